@@ -6,6 +6,7 @@
 #include "alfe/cga.h"
 #include "alfe/knob.h"
 #include "alfe/image_filter.h"
+#include "alfe/sha256.h"
 #include <commdlg.h>
 
 class MatcherTable
@@ -20,6 +21,9 @@ public:
             _table[i]._count = 0;
             _table[i]._pattern = 1;
         }
+        _mapping = FileMapping();
+        _entryData = &_table[0];
+        _patternData = &_patterns[0];
     }
 
     void add(Word pattern, int position)
@@ -46,16 +50,73 @@ public:
                 ++p;
             }
         }
+        _patternCount = p;
     }
-    int get(int position, Word** p)
+    int get(int position, const Word** p)
     {
-        Entry* e = &_table[position];
-        *p = &_patterns[e->_pattern];
+        const Entry* e = &_entryData[position];
+        *p = &_patternData[e->_pattern];
         if (e->_count == 0 && e->_pattern != 1)
             return 0x10000;
         return e->_count;
     }
+
+    // Appends the finalized table to data in the form that load() expects:
+    // the number of patterns, the entries and then the patterns (padded to
+    // keep the next table aligned).
+    void save(AppendableArray<Byte>* data)
+    {
+        DWord patternCount = _patternCount;
+        data->append(reinterpret_cast<const Byte*>(&patternCount),
+            sizeof(DWord));
+        data->append(reinterpret_cast<const Byte*>(&_table[0]),
+            _entries*sizeof(Entry));
+        data->append(reinterpret_cast<const Byte*>(&_patterns[0]),
+            paddedPatterns(_patternCount)*sizeof(Word));
+    }
+    // Uses a table written by save() in place in the mapped file rather than
+    // building it. On success, *offset is moved past the table.
+    bool load(const FileMapping& mapping, UInt64* offset, int entries)
+    {
+        UInt64 o = *offset;
+        if (o + sizeof(DWord) > mapping.size())
+            return false;
+        const Byte* data = mapping.data() + o;
+        DWord patternCount = *reinterpret_cast<const DWord*>(data);
+        if (patternCount > 0x10000)
+            return false;
+        UInt64 patternsOffset = o + sizeof(DWord) + entries*sizeof(Entry);
+        UInt64 end = patternsOffset +
+            paddedPatterns(patternCount)*sizeof(Word);
+        if (end > mapping.size())
+            return false;
+        // Check that every entry's patterns are within the table, so that a
+        // damaged file can't make get() read past the end of the mapping.
+        const Entry* entryData =
+            reinterpret_cast<const Entry*>(data + sizeof(DWord));
+        for (int i = 0; i < entries; ++i) {
+            const Entry* e = &entryData[i];
+            int c = e->_count;
+            if (c == 0 && e->_pattern != 1)
+                c = 0x10000;
+            if (c != 0 && e->_pattern + c > static_cast<int>(patternCount))
+                return false;
+        }
+        _mapping = mapping;
+        _entries = entries;
+        _patternCount = patternCount;
+        _entryData = entryData;
+        _patternData =
+            reinterpret_cast<const Word*>(mapping.data() + patternsOffset);
+        *offset = end;
+        return true;
+    }
 private:
+    static int paddedPatterns(int patternCount)
+    {
+        return (patternCount + 1) & ~1;
+    }
+
     struct Entry
     {
         Word _pattern;
@@ -65,6 +126,52 @@ private:
     Array<Word> _next;
     Array<Word> _patterns;
     int _entries;
+    int _patternCount;
+    // The table in use - either _table and _patterns or a cached table
+    // in _mapping.
+    const Entry* _entryData;
+    const Word* _patternData;
+    FileMapping _mapping;
+};
+
+// Writes gamut tables to the cache on a thread of its own, so that the
+// matcher can start matching without waiting for the disk. If another table
+// is written before the previous one has been, only the newer one is kept.
+class GamutCacheWriter : public ThreadTask
+{
+public:
+    void write(const File& file, const AppendableArray<Byte>& data)
+    {
+        {
+            Lock lock(&_mutex);
+            _file = file;
+            _data = data;
+        }
+        restart();
+    }
+    void run()
+    {
+        File file;
+        AppendableArray<Byte> data;
+        {
+            Lock lock(&_mutex);
+            file = _file;
+            data = _data;
+            _data = AppendableArray<Byte>();
+        }
+        if (data.count() == 0)
+            return;
+        // The cache is optional, so if it can't be written we just don't.
+        // A partially written file is rejected by the size checks in
+        // MatcherTable::load().
+        FileStream stream = file.tryOpenWrite();
+        if (stream.valid())
+            stream.write(data);
+    }
+private:
+    Mutex _mutex;
+    File _file;
+    AppendableArray<Byte> _data;
 };
 
 template<class T> class CGAMatcherT : public ThreadTask
@@ -116,6 +223,7 @@ public:
     void setProgram(Program* program) { _program = program; }
     void setSequencer(CGASequencer* sequencer) { _sequencer = sequencer; }
     void setData(CGAData* data) { _data = data; }
+    void setGamutCache(const Directory& directory) { _gamutCache = directory; }
     void run()
     {
         int scanlinesPerRow;
@@ -596,18 +704,73 @@ public:
                 _rgbiPalette[i] = levels[palette[i]];
         }
 
+        // The gamut tables are expensive to populate but only depend on the
+        // settings hashed here, so they are cached on disk keyed by the hash.
+        SHA256Hash::Hasher hasher;
+        auto hash = [&](const void* data, int length)
+        {
+            hasher.update(static_cast<const Byte*>(data), length);
+        };
+        hash(&boxCount, sizeof(int));
+        hash(&entries, sizeof(int));
+        hash(&srgbScale, sizeof(srgbScale));
+        hash(&gamma, sizeof(double));
+        hash(&_modeThread, sizeof(int));
+        hash(&_palette2, sizeof(int));
+        hash(&_blockHeight, sizeof(int));
+        hash(&_patternCount, sizeof(int));
+        hash(&_combineShift, sizeof(int));
+        hash(&_combineVertical, sizeof(bool));
+        hash(&_isComposite, sizeof(bool));
+        hash(&_rgbiFromBits[0], 4);
+        hash(&_skip[0], 0x100*sizeof(bool));
+        if (!_graphics)
+            hash(_sequencer->romData(), 0x100*8);
+        if (_isComposite) {
+            hash(&connector, sizeof(int));
+            hash(&hue, sizeof(double));
+            hash(&saturation, sizeof(double));
+            hash(&contrast, sizeof(double));
+            hash(&brightness, sizeof(double));
+            hash(&chromaBandwidth, sizeof(double));
+            hash(&lumaBandwidth, sizeof(double));
+            hash(&rollOff, sizeof(double));
+            hash(&lobes, sizeof(double));
+            hash(&gamutLeftPadding, sizeof(int));
+            hash(&gamutWidth, sizeof(int));
+            hash(&gamutOutputWidth, sizeof(int));
+        }
+        else
+            hash(&_rgbiPalette[0], 3*0x11);
+        for (int boxIndex = 0; boxIndex < boxCount; ++boxIndex) {
+            Box* box = &_boxes[boxIndex];
+            hash(&box->_positionForPixel[0], 35);
+            hash(&box->_lBlockToLChange, sizeof(int));
+            hash(&box->_lChangeToRChange, sizeof(int));
+        }
+        SHA256Hash gamutKey(hasher);
+        File gamutFile;
+        bool gamutCached = false;
+        if (_gamutCache.valid()) {
+            gamutFile = _gamutCache.file(gamutKey.toString() + ".gamut");
+            gamutCached =
+                loadGamutTables(gamutFile, gamutKey, boxCount, entries);
+        }
+
         // Populate gamut tables
         for (int boxIndex = 0; boxIndex < boxCount; ++boxIndex) {
             Box* box = &_boxes[boxIndex];
             int lChangeToRChange = box->_lChangeToRChange;
             _srgb.ensure(lChangeToRChange);
             _srgb.ensure(box->_lCompareToRCompare);
-            box->_table.setSize(entries);
             if (_isComposite)
                 _base.ensure(box->_lCompareToRCompare*_blockHeight);
             box->_blockArea = static_cast<float>(lChangeToRChange);
             if (_combineVertical)
                 box->_blockArea *= _blockHeight;
+            if (gamutCached)
+                continue;
+            box->_table.setSize(entries);
             int skipSolidColour = 0xf00;
             for (int pattern = 0; pattern < _patternCount; ++pattern) {
                 if (!_graphics && !oneBpp) {
@@ -681,6 +844,8 @@ public:
             }
             box->_table.finalize();
         }
+        if (!gamutCached && _gamutCache.valid())
+            saveGamutTables(gamutFile, gamutKey, boxCount, entries);
 
         // Set up data structures for matching
         int rowDataStride = 2*_horizontalDisplayed + 1;
@@ -847,7 +1012,7 @@ public:
                     for (int r = rMin; r <= rMax; ++r) {
                         for (int g = gMin; g <= gMax; ++g) {
                             for (int b = bMin; b <= bMax; ++b) {
-                                Word* patterns;
+                                const Word* patterns;
                                 int n = box->_table.get(r +
                                     srgbDiv.x*(g + srgbDiv.y*b), &patterns);
                                 for (int i = 0; i < n; ++i) {
@@ -1216,6 +1381,51 @@ public:
             _data->getDataByte(CGAData::registerScanlinesRepeat);
     }
 private:
+    // Bump gamutCacheVersion when the way the gamut tables are populated
+    // changes, so that stale cache files are ignored.
+    static const DWord gamutCacheMagic = 0x54414743;  // "CGAT"
+    static const DWord gamutCacheVersion = 1;
+    static const int gamutCacheHeaderLength = 4*sizeof(DWord) + 32;
+
+    // The cache files are only meant to be read on the machine that wrote
+    // them, so they use its byte order.
+    bool loadGamutTables(const File& file, SHA256Hash key, int boxCount,
+        int entries)
+    {
+        FileMapping mapping;
+        BEGIN_CHECKED {
+            mapping = FileMapping(file, FileMapping::random);
+        } END_CHECKED(Exception&) {
+            // Not cached yet (or unreadable) - the tables will be built.
+            return false;
+        }
+        if (mapping.size() < gamutCacheHeaderLength)
+            return false;
+        const DWord* header = reinterpret_cast<const DWord*>(mapping.data());
+        if (header[0] != gamutCacheMagic || header[1] != gamutCacheVersion ||
+            header[2] != static_cast<DWord>(boxCount) ||
+            header[3] != static_cast<DWord>(entries) ||
+            memcmp(&header[4], key.data(), 32) != 0)
+            return false;
+        UInt64 offset = gamutCacheHeaderLength;
+        for (int i = 0; i < boxCount; ++i)
+            if (!_boxes[i]._table.load(mapping, &offset, entries))
+                return false;
+        return offset == mapping.size();
+    }
+    void saveGamutTables(const File& file, SHA256Hash key, int boxCount,
+        int entries)
+    {
+        AppendableArray<Byte> data;
+        DWord header[4] = {gamutCacheMagic, gamutCacheVersion,
+            static_cast<DWord>(boxCount), static_cast<DWord>(entries)};
+        data.append(reinterpret_cast<const Byte*>(header), sizeof(header));
+        data.append(key.data(), 32);
+        for (int i = 0; i < boxCount; ++i)
+            _boxes[i]._table.save(&data);
+        _gamutCacheWriter.write(file, data);
+    }
+
     void fixEndianness(Byte* data, int bytes, bool oneBpp)
     {
         for (int i = 0; i < bytes; ++i) {
@@ -1621,6 +1831,8 @@ private:
     int _patternCount;
 
     MatchingNTSCDecoder _gamutDecoder;
+    Directory _gamutCache;
+    GamutCacheWriter _gamutCacheWriter;
 };
 
 typedef CGAMatcherT<void> CGAMatcher;
@@ -3121,6 +3333,7 @@ public:
         configFile.addDefaultOption("interactive", true);
         configFile.addDefaultOption("combFilter", 0);
         configFile.addDefaultOption("fftWisdom", String("wisdom"));
+        configFile.addDefaultOption("gamutCache", String("gamut"));
         configFile.addDefaultOption("activeSize", Vector(640, 200));
 
         configFile.addFunco(BitmapIsRGBIFunction(bitmapType));
@@ -3164,6 +3377,12 @@ public:
         matcher.setProgram(this);
         matcher.setData(&_data);
         matcher.setSequencer(&_sequencer);
+        _gamutCacheDirectory = configFile.get<String>("gamutCache");
+        Directory gamutCache(_gamutCacheDirectory, _configFile.parent());
+        // Fails harmlessly if the directory already exists. If it can't be
+        // created, the gamut tables just won't be cached.
+        CreateDirectory(NullTerminatedWideString(gamutCache.path()), NULL);
+        matcher.setGamutCache(gamutCache);
         _window.setConfig(&configFile);
         _window.setMatcher(_matcher);
         _window.setOutput(&output);
@@ -3342,6 +3561,7 @@ public:
         s += "maskSize = " + format("%6f", _output->getMaskSize()) + ";\n";
         s += "interactive = " + String::Boolean(_interactive) + ";\n";
         s += "fftWisdom = " + enquote(_fftWisdomFile) + ";\n";
+        s += "gamutCache = " + enquote(_gamutCacheDirectory) + ";\n";
         return s;
     }
     void saveConfig(File file) { file.save(configContents()); }
@@ -3439,6 +3659,7 @@ private:
     double _overscan;
     bool _interactive;
     String _fftWisdomFile;
+    String _gamutCacheDirectory;
     CGAData _data;
     CGAMatcher* _matcher;
     CGASequencer _sequencer;
@@ -7,7 +7,7 @@
 #include "alfe\gcd.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
-//#include "alfe\convolution_pipe.h"
+#include "alfe\convolution_pipe.h"
 #include "alfe\main.h"
 
 typedef signed short Sample;
@@ -668,14 +668,25 @@ public:
         FileSource<Byte> source(file);
         MOSSID sid;
         //NearestNeighborInterpolator<Sample> interpolator(985248, 44100);
-        LinearInterpolator<Sample> interpolator(985248, 44100);
+        //LinearInterpolator<Sample> interpolator(985248, 44100);
+        // Resample with a windowed sinc filter, which removes everything the
+        // output rate can't represent instead of letting it alias. The
+        // convolution is done with floats since the coefficients are less
+        // than 1. The kernel is measured in output samples, so it is scaled
+        // down by the resampling factor to give a gain of 1.
+        CastPipe<float, Sample> toFloat;
+        LCMConvolutionPipe<float> resampler(44100, 985248,
+            SincFilter()*RectangleWindow(16)*ConstantKernel(44100.0/985248));
+        CastPipe<Sample, float> toSample;
         //XAudio2Sink<Sample> sink;
         //DirectSoundSink<Sample> sink(NULL, 44100, 1024, 1);
         //WaveOutSink<Sample> sink;
         WaveFileSink<Sample> sink(File(String("sanxion.wav")));
         source.connect(sid.sink());
-        sid.source()->connect(interpolator.sink());
-        interpolator.source()->connect(&sink);
+        sid.source()->connect(toFloat.sink());
+        toFloat.source()->connect(resampler.sink());
+        resampler.source()->connect(toSample.sink());
+        toSample.source()->connect(&sink);
         sink.play();
         //sink.wait();
     }
@@ -18,9 +18,14 @@ public:
         if (_lastOffset >= _byteCount)
             return bytes;  // We don't have the complete instruction yet
         _byteCount = 0;
+        _text.clear();
+        _text += bytes;
         for (int i = 0; i <= _lastOffset; ++i)
-            bytes += hex(_code[i], 2, false);
-        return bytes.alignLeft(12) + " " + instruction;
+            _text += hex(_code[i], 2, false);
+        _text.padTo(12);
+        _text += " ";
+        _text += instruction;
+        return _text.string();
     }
 private:
     String disassembleInstruction()
@@ -319,6 +324,7 @@ private:
     bool _doubleWord;
     int _offset;
     int _lastOffset;
+    StringBuilder _text;
 };
 
 class SnifferDecoder
@@ -355,27 +361,47 @@ public:
         static const char qsc[] = ".IES";
         static const char sc[] = "ARWHCrwp";
         static const char dmasc[] = " h:H";
-        String line;
-        if (_cpuDataFloating)
-            line = String(hex(_cpu_ad >> 8, 3, false)) + "??";
+        // This is called every cycle when logging, so the line is built in
+        // place in a buffer that is reused from one line to the next.
+        StringBuilder& line = _line;
+        line.clear();
+        if (_cpuDataFloating) {
+            line += hex(_cpu_ad >> 8, 3, false);
+            line += "??";
+        }
         else
-            line = String(hex(_cpu_ad, 5, false));
-        line += " " +
-            codePoint(qsc[_cpu_qs]) + codePoint(sc[_cpu_s]) +
-            (_cpu_rqgt0 ? "G" : ".") + (_cpu_ready ? "." : "z") +
-            (_cpu_test ? "T" : ".") + (_cpu_lock ? "L" : ".") +
-            "  " + hex(_bus_address, 5, false) + " ";
+            line += hex(_cpu_ad, 5, false);
+        line += " ";
+        line += codePoint(qsc[_cpu_qs]);
+        line += codePoint(sc[_cpu_s]);
+        line += _cpu_rqgt0 ? "G" : ".";
+        line += _cpu_ready ? "." : "z";
+        line += _cpu_test ? "T" : ".";
+        line += _cpu_lock ? "L" : ".";
+        line += "  ";
+        line += hex(_bus_address, 5, false);
+        line += " ";
         if (_isaDataFloating)
             line += "??";
         else
             line += hex(_bus_data, 2, false);
-        line += " " + hex(_bus_dma, 2, false) + codePoint(dmasc[_dmas]) +
-            " " + hex(_bus_irq, 2, false) + (_int ? "I" : " ") + " " +
-            hex(_bus_pit, 1, false) + hex(_cga, 1, false) + " " + (_bus_ior ? "R" : ".") +
-            (_bus_iow ? "W" : ".") + (_bus_memr ? "r" : ".") +
-            (_bus_memw ? "w" : ".") + (_bus_iochrdy ? "." : "z") +
-            (_bus_aen ? "D" : ".") +
-            (_bus_tc ? "T" : ".");
+        line += " ";
+        line += hex(_bus_dma, 2, false);
+        line += codePoint(dmasc[_dmas]);
+        line += " ";
+        line += hex(_bus_irq, 2, false);
+        line += _int ? "I" : " ";
+        line += " ";
+        line += hex(_bus_pit, 1, false);
+        line += hex(_cga, 1, false);
+        line += " ";
+        line += _bus_ior ? "R" : ".";
+        line += _bus_iow ? "W" : ".";
+        line += _bus_memr ? "r" : ".";
+        line += _bus_memw ? "w" : ".";
+        line += _bus_iochrdy ? "." : "z";
+        line += _bus_aen ? "D" : ".";
+        line += _bus_tc ? "T" : ".";
         line += "  ";
         if (_cpu_s != 7 && _cpu_s != 3)
             switch (_tNext) {
@@ -471,16 +497,17 @@ public:
         if (_tNext == 4 || _d == 4) {
             if (_tNext == 4 && _d == 4)
                 line += "!e";
-            String seg;
+            const char* seg = "";
             switch (_cpu_ad & 0x30000) {
                 case 0x00000: seg = "ES "; break;
                 case 0x10000: seg = "SS "; break;
                 case 0x20000: seg = "CS "; break;
                 case 0x30000: seg = "DS "; break;
             }
-            String type = "-";
+            const char* type = "-";
+            line += hex(_bus_data, 2, false);
             if (_lastS == 0)
-                line += hex(_bus_data, 2, false) + " <-i           ";
+                line += " <-i           ";
             else {
                 if (_lastS == 4) {
                     type = "f";
@@ -490,15 +517,26 @@ public:
                     type = "d";
                     seg = "   ";
                 }
-                line += hex(_bus_data, 2, false) + " ";
-                if (_bus_ior || _bus_memr)
-                    line += "<-" + type + " ";
-                else
-                    line += type + "-> ";
-                if (_bus_memr || _bus_memw)
-                    line += "[" + seg + hex(_bus_address, 5, false) + "]";
-                else
-                    line += "port[" + hex(_bus_address, 4, false) + "]";
+                line += " ";
+                if (_bus_ior || _bus_memr) {
+                    line += "<-";
+                    line += type;
+                    line += " ";
+                }
+                else {
+                    line += type;
+                    line += "-> ";
+                }
+                if (_bus_memr || _bus_memw) {
+                    line += "[";
+                    line += seg;
+                    line += hex(_bus_address, 5, false);
+                }
+                else {
+                    line += "port[";
+                    line += hex(_bus_address, 4, false);
+                }
+                line += "]";
                 if (_lastS == 4 && _d != 4) {
                     if (_queueLength >= 4)
                         line += "!f";
@@ -516,7 +554,9 @@ public:
             line += codePoint(qsc[_cpu_qs]);
         else
             line += " ";
-        line += " " + instruction + "\n";
+        line += " ";
+        line += instruction;
+        line += "\n";
         _lastS = _cpu_s;
         _t = _tNext;
         if (_t == 4 || _d == 4) {
@@ -527,7 +567,7 @@ public:
         }
         _cpu_qs = _cpu_next_qs;
         _cpu_next_qs = 0;
-        return line;
+        return line.string();
     }
     void queueOperation(int qs) { _cpu_next_qs = qs; }
     void setStatus(int s) { _cpu_s = s; }
@@ -592,6 +632,7 @@ public:
     void setCGA(UInt8 cga) { _cga = cga; }
 private:
     Disassembler _disassembler;
+    StringBuilder _line;
 
     // Internal variables that we use to keep track of what's going on in order
     // to be able to print useful logs.
@@ -2092,7 +2133,7 @@ public:
     }
     void setInitialIP(int ip) { _ip = ip; }
     int cycle() const { return _cycle; }
-    String log() const { return _log; }
+    String log() const { return _log.string(); }
     void reset()
     {
         _bus.reset();
@@ -2121,7 +2162,7 @@ public:
         _delayedPrefetchedRemove = false;
         _prefetching = true;
         _transferStarting = false;
-        _log = "";
+        _log.clear();
         _ip = 0;
         _nmiRequested = false;
         _queueReadPosition = 0;
@@ -4589,7 +4630,7 @@ private:
         tSecondIdle
     };
 
-    String _log;
+    StringBuilder _log;
     BusEmulator _bus;
 
     int _stopIP;
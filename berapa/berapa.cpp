@@ -11,9 +11,14 @@
 #include "alfe/pipes.h"
 #include "alfe/sdl2.h"
 #include "alfe/reference.h"
+#include "alfe/lock_free_circular_buffer.h"
+#include "alfe/bound_signal.h"
 
 #include <stdlib.h>
 #include <limits.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 typedef UInt8 BGRI;
 
@@ -250,6 +255,8 @@ public:
         connect(other);
     }
     virtual void connect(Connector* other) { }
+    // Called after all connections have been made.
+    virtual void bind() { }
     Simulator* simulator() const { return _component->simulator(); }
 
 private:
@@ -355,6 +362,12 @@ public:
     }
     virtual void runTo(Tick tick) { _tick = tick; }
     virtual void maintain(Tick ticks) { _tick -= ticks; }
+    // Called on the simulator thread once the simulation has finished,
+    // before any component is destroyed. Components that run threads of
+    // their own stop them here.
+    virtual void stop() { }
+    // Write out any trace or coverage data collected so far.
+    virtual void dumpTrace() { }
     String name() const { return _name; }
     void set(Identifier name, Value value, Span span)
     {
@@ -509,6 +522,16 @@ public:
             ++*n;
         }
     }
+    virtual void bindConnections()
+    {
+        for (auto i : _config) {
+            Member m = i.value();
+            if (typename ConnectorT<T>::Type(m.type()).valid())
+                static_cast<ConnectorT<T>*>(m._p)->bind();
+        }
+        if (_defaultConnector != 0)
+            _defaultConnector->bind();
+    }
     SimulatorT<T>* simulator() const { return _simulator; }
     bool loopCheck()
     {
@@ -883,19 +906,28 @@ public:
     };
 };
 
+// Data is sent with send() (from BoundSignal) rather than
+// _other->setData(), so that the binding made by bind() is used.
 template<class T> class BidirectionalConnector
-  : public TransportConnectorBase<BidirectionalConnector<T>, T>
+  : public TransportConnectorBase<BidirectionalConnector<T>, T>,
+    public BoundSignal<T, Tick>
 {
 public:
     static String tycoName() { return "BidirectionalConnector"; }
     BidirectionalConnector(Component* c)
-      : TransportConnectorBase<BidirectionalConnector<T>, T>(c), _other(0) { }
-    virtual void setData(Tick t, T v) = 0;
+      : TransportConnectorBase<BidirectionalConnector<T>, T>(c), _other(0)
+    { }
+    // Called once the machine is fully connected. Works out where our data
+    // ultimately ends up and how to deliver it there, so that for the fixed
+    // topologies of the stock machines most signals are a single direct call
+    // rather than a chain of virtual calls through glue components.
+    void bind() { BoundSignal<T, Tick>::bind(_other); }
     void connect(::Connector* other, ProtocolDirection pd, Span span)
     {
         auto o = static_cast<BidirectionalConnector<T>*>(other);
         if (_other == 0) {
             _other = o;
+            BoundSignal<T, Tick>::bind(o);
             _otherComponent = _other->component();
             return;
         }
@@ -929,7 +961,7 @@ public:
     }
     OutputConnector(Component* c) : TransportConnectorBase<OutputConnector<T>,
         T, BidirectionalConnector<T>>(c) { }
-    void set(Tick t, T v) { this->_other->setData(t, v); }
+    void set(Tick t, T v) { this->send(t, v); }
     void setData(Tick t, T v) { }
 };
 
@@ -941,7 +973,7 @@ public:
     {
         if (v != _v) {
             _v = v;
-            this->_other->setData(t, v);
+            this->send(t, v);
         }
     }
     void init(T v) { _v = v; }
@@ -982,6 +1014,20 @@ public:
     }
 };
 
+// A connector that knows its own concrete type C, so that a connector bound to
+// it can call C::setData() directly (where it can be inlined) instead of going
+// through the vtable.
+template<class C, class T, class B = InputConnector<T>> class DirectConnector
+  : public B
+{
+public:
+    DirectConnector(Component* c) : B(c) { }
+    typename BoundSignal<T, Tick>::Sender sender(bool inverted)
+    {
+        return BoundSignal<T, Tick>::template directSender<C>(inverted);
+    }
+};
+
 template<class C, class T> class TransportComponentBase
   : public ComponentBase<C>
 {
@@ -1010,9 +1056,9 @@ public:
     virtual void update0(Tick t, T v) = 0;
     virtual void update1(Tick t, T v) = 0;
 private:
-    class InputConnector : public ::InputConnector<T>
+    template<class I> class InputConnector : public DirectConnector<I, T>
     {
-        using Base = ::InputConnector<T>;
+        using Base = DirectConnector<I, T>;
     public:
         InputConnector(BooleanComponent *c) : Base(c) { }
         T _v;
@@ -1021,20 +1067,22 @@ private:
             return static_cast<BooleanComponent*>(Base::component());
         }
     };
-    class InputConnector0 : public InputConnector
+    class InputConnector0 : public InputConnector<InputConnector0>
     {
     public:
-        InputConnector0(BooleanComponent *c) : InputConnector(c) { }
+        InputConnector0(BooleanComponent *c)
+          : InputConnector<InputConnector0>(c) { }
         void setData(Tick t, T v)
         {
             component()->update0(t, v);
             this->_v = v;
         }
     };
-    class InputConnector1 : public InputConnector
+    class InputConnector1 : public InputConnector<InputConnector1>
     {
     public:
-        InputConnector1(BooleanComponent *c) : InputConnector(c) { }
+        InputConnector1(BooleanComponent *c)
+          : InputConnector<InputConnector1>(c) { }
         void setData(Tick t, T v)
         {
             component()->update1(t, v);
@@ -1047,22 +1095,6 @@ protected:
     OptimizedOutputConnector<T> _output;
 };
 
-template<class T> class BinaryTraits
-{
-public:
-    static T zero() { return 0; }
-    static T invert(const T& other) { return ~other; }
-    static T one() { return invert(zero()); }
-};
-
-template<> class BinaryTraits<bool>
-{
-public:
-    static bool zero() { return false; }
-    static bool invert(const bool& other) { return !other; }
-    static bool one() { return true; }
-};
-
 template<class T> class AndComponent
   : public BooleanComponent<AndComponent<T>, T>
 {
@@ -1164,10 +1196,7 @@ public:
         _input._otherComponent->runTo(tick);
         Component::runTo(tick);
     }
-    void update(Tick t, T v)
-    {
-        _output._other->setData(t, BinaryTraits<T>::invert(v));
-    }
+    void update(Tick t, T v) { _output.set(t, BinaryTraits<T>::invert(v)); }
 private:
     class InputConnector : public ::InputConnector<T>
     {
@@ -1177,6 +1206,11 @@ private:
         {
             static_cast<NotComponent*>(component())->update(t, v);
         }
+        ::BidirectionalConnector<T>* forward(bool* inverted)
+        {
+            *inverted = true;
+            return static_cast<NotComponent*>(component())->_output._other;
+        }
     };
 protected:
     InputConnector _input;
@@ -1193,10 +1227,10 @@ public:
     {
         this->connector("", &_connector);
     }
-    class Connector : public InputConnector<T>
+    class Connector : public DirectConnector<Connector, T>
     {
     public:
-        Connector(BucketComponent* c) : InputConnector<T>(c) { }
+        Connector(BucketComponent* c) : DirectConnector<Connector, T>(c) { }
         void setData(Tick tick, T t) { }
     };
     Connector _connector;
@@ -1245,6 +1279,14 @@ public:
                 this->simulator()->connect(&_input, c, span);
             }
     }
+    void bindConnections()
+    {
+        Component::bindConnections();
+        for (auto& i : _output)
+            const_cast<OutputConnector<T>&>(i).bind();
+        for (auto& i : _bidirectional)
+            const_cast<BidirectionalConnector&>(i).bind();
+    }
     bool subLoopCheck()
     {
         for (auto i : _output)
@@ -1291,11 +1333,11 @@ private:
             v &= i._v;
         }
         for (auto i : _output)
-            i._other->setData(t, v);
+            i.send(t, v);
         for (auto i : _bidirectional) {
             if (&i == c)
                 continue;
-            i._other->setData(t, v);
+            i.send(t, v);
         }
     }
     InputConnector _input;
@@ -1393,10 +1435,11 @@ public:
     }
 
 private:
-    class SetConnector : public InputConnector<bool>
+    class SetConnector : public DirectConnector<SetConnector, bool>
     {
     public:
-        SetConnector(SRLatch* latch) : InputConnector(latch) { }
+        SetConnector(SRLatch* latch)
+          : DirectConnector<SetConnector, bool>(latch) { }
         void setData(Tick t, bool v)
         {
             static_cast<SRLatch*>(component())->doSet(t, v);
@@ -1404,10 +1447,11 @@ private:
         }
         bool _v;
     };
-    class ResetConnector : public InputConnector<bool>
+    class ResetConnector : public DirectConnector<ResetConnector, bool>
     {
     public:
-        ResetConnector(SRLatch* latch) : InputConnector(latch) { }
+        ResetConnector(SRLatch* latch)
+          : DirectConnector<ResetConnector, bool>(latch) { }
         void setData(Tick t, bool v)
         {
             static_cast<SRLatch*>(component())->doReset(t, v);
@@ -1570,6 +1614,8 @@ public:
             for (auto i : _components)
                 i->maintain(delta);
         } while (!_halted);
+        for (auto i : _components)
+            i->stop();
     }
     String save() const
     {
@@ -1591,6 +1637,11 @@ public:
     }
 
     void halt() { _halted = true; }
+    void dumpTraces()
+    {
+        for (auto i : _components)
+            i->dumpTrace();
+    }
     void addComponent(Reference<Component> c)
     {
         _topLevelComponents.add(c);
@@ -1618,6 +1669,8 @@ public:
                 throw Exception(s);
             }
         }
+        for (auto i : _components)
+            i->bindConnections();
         for (auto component : _components) {
             auto c = dynamic_cast<ClockedComponent*>(component);
             if (c == 0)
@@ -1843,6 +1896,7 @@ private:
 #include "rom.h"
 #include "i8088cpu.h"
 #include "cga.h"
+#include "threaded_sink.h"
 #include "rgbi_monitor.h"
 #include "one_bit_speaker.h"
 
@@ -1939,6 +1993,25 @@ protected:
             String _stopSaveState;
         };
         Saver saver(&simulator, stopSaveState);
+
+        // Trace data is written out at exit (however we exit), while all the
+        // components are still alive for the disassembler to look at.
+        class TraceDumper
+        {
+        public:
+            TraceDumper(Simulator* simulator) : _simulator(simulator) { }
+            ~TraceDumper()
+            {
+                try {
+                    _simulator->dumpTraces();
+                }
+                catch (...) {
+                }
+            }
+        private:
+            Simulator* _simulator;
+        };
+        TraceDumper traceDumper(&simulator);
         simulator.simulate();
     }
 };
@@ -5,9 +5,24 @@ public:
     void setCPU(Intel8088CPU* cpu) { _cpu = cpu; }
     String disassemble(UInt16 address)
     {
-        _bytes = "";
+        _segment = -1;
+        _bytes.clear();
         String i = disassembleInstruction(address);
-        return _bytes.alignLeft(10) + " " + i;
+        _bytes.padTo(10);
+        _bytes += " ";
+        _bytes += i;
+        return _bytes.string();
+    }
+    // Disassemble at segment:address rather than at CS:address.
+    String disassemble(UInt16 segment, UInt16 address)
+    {
+        _segment = segment;
+        _bytes.clear();
+        String i = disassembleInstruction(address);
+        _bytes.padTo(10);
+        _bytes += " ";
+        _bytes += i;
+        return _bytes.string();
     }
 private:
     String disassembleInstruction(UInt16 address)
@@ -204,7 +219,9 @@ private:
     }
     UInt8 getByte()
     {
-        UInt8 v = _bus->debugReadMemory(_cpu->codeAddress(_address));
+        UInt32 a = _segment == -1 ? _cpu->codeAddress(_address) :
+            ((_segment << 4) + _address) & 0xfffff;
+        UInt8 v = _bus->debugReadMemory(a);
         ++_address;
         _bytes += hex(v, 2, false);
         return v;
@@ -299,16 +316,146 @@ private:
 
     ISA8BitBus* _bus;
     Intel8088CPUT<T>* _cpu;
+    int _segment;
     UInt16 _address;
     UInt8 _opcode;
     UInt8 _modRM;
     bool _wordSize;
     bool _doubleWord;
-    String _bytes;
+    StringBuilder _bytes;
 };
 
 typedef DisassemblerT<void> Disassembler;
 
+// An Intel8088Trace is told about each instruction that the CPU starts. The
+// CPU keeps a (usually empty) chain of them, so when tracing is disabled the
+// only cost is checking for a null pointer once per instruction.
+template<class T> class Intel8088TraceT
+{
+public:
+    Intel8088TraceT() : _next(0) { }
+    virtual ~Intel8088TraceT() { }
+    virtual void instruction(int cycle, UInt16 cs, UInt16 ip) = 0;
+    // Write out what has been collected so far. Called at exit and on demand.
+    virtual void dump() { }
+    Intel8088TraceT* _next;
+};
+
+typedef Intel8088TraceT<void> Intel8088Trace;
+
+// Records which addresses instructions have been started at, using one bit per
+// byte of address space. The dump is a disassembly of each instruction, in the
+// order in which they were first executed, along with the cycle on which that
+// happened. The instructions are disassembled from memory as it is when the
+// dump is made rather than when they were executed, which only matters for
+// self-modifying code.
+template<class T> class Intel8088CoverageTraceT : public Intel8088TraceT<T>
+{
+public:
+    Intel8088CoverageTraceT(DisassemblerT<T>* disassembler, File file)
+      : _disassembler(disassembler), _file(file)
+    {
+        _visited.allocate(0x100000 >> 5);
+        for (int i = 0; i < (0x100000 >> 5); ++i)
+            _visited[i] = 0;
+    }
+    void instruction(int cycle, UInt16 cs, UInt16 ip)
+    {
+        UInt32 a = ((cs << 4) + ip) & 0xfffff;
+        UInt32& w = _visited[a >> 5];
+        UInt32 bit = 1 << (a & 31);
+        if ((w & bit) != 0)
+            return;
+        w |= bit;
+        _firstVisits.append(Visit(cycle, cs, ip));
+    }
+    void dump()
+    {
+        StringBuilder s(_firstVisits.count()*48);
+        for (auto v : _firstVisits) {
+            int start = s.length();
+            s += decimal(v._cycle);
+            s.alignRight(start, 5);
+            s += " ";
+            s += hex(v._cs, 4, false);
+            s += ":";
+            s += hex(v._ip, 4, false);
+            s += " ";
+            s += _disassembler->disassemble(v._cs, v._ip);
+            s += "\n";
+        }
+        _file.save(s.string());
+    }
+    bool visited(UInt32 address) const
+    {
+        return (_visited[address >> 5] & (1 << (address & 31))) != 0;
+    }
+private:
+    struct Visit
+    {
+        Visit() { }
+        Visit(int cycle, UInt16 cs, UInt16 ip)
+          : _cycle(cycle), _cs(cs), _ip(ip) { }
+        int _cycle;
+        UInt16 _cs;
+        UInt16 _ip;
+    };
+
+    DisassemblerT<T>* _disassembler;
+    File _file;
+    Array<UInt32> _visited;
+    AppendableArray<Visit> _firstVisits;
+};
+
+typedef Intel8088CoverageTraceT<void> Intel8088CoverageTrace;
+
+// Writes an 8-byte little-endian record for every instruction executed: the
+// cycle (4 bytes), then CS and IP (2 bytes each). Records are buffered and
+// written out in large blocks.
+template<class T> class Intel8088BinaryTraceT : public Intel8088TraceT<T>
+{
+    static const int bufferSize = 0x10000;
+public:
+    Intel8088BinaryTraceT(File file) : _stream(file.openWrite()), _used(0)
+    {
+        _buffer.allocate(bufferSize);
+    }
+    ~Intel8088BinaryTraceT()
+    {
+        try {
+            dump();
+        }
+        catch (...) {
+        }
+    }
+    void instruction(int cycle, UInt16 cs, UInt16 ip)
+    {
+        if (_used == bufferSize)
+            dump();
+        Byte* p = &_buffer[_used];
+        p[0] = cycle & 0xff;
+        p[1] = (cycle >> 8) & 0xff;
+        p[2] = (cycle >> 16) & 0xff;
+        p[3] = (cycle >> 24) & 0xff;
+        p[4] = cs & 0xff;
+        p[5] = cs >> 8;
+        p[6] = ip & 0xff;
+        p[7] = ip >> 8;
+        _used += 8;
+    }
+    void dump()
+    {
+        _stream.write(&_buffer[0], _used);
+        _used = 0;
+    }
+private:
+    FileStream _stream;
+    Array<Byte> _buffer;
+    int _used;
+};
+
+typedef Intel8088BinaryTraceT<void> Intel8088BinaryTrace;
+
 template<class T> class Intel8088CPUT
   : public ClockedComponentBase<Intel8088CPU>
 {
@@ -316,11 +463,13 @@ public:
     static String typeName() { return "Intel8088CPU"; }
     Intel8088CPUT(Component::Type type)
       : ClockedComponentBase(type), _connector(this), _irqConnector(this),
-        _nmiConnector(this)
+        _nmiConnector(this), _trace(0)
     {
         connector("", &_connector);
         connector("nmi", &_nmiConnector);
         connector("irq", &_irqConnector);
+        config("coverageFile", &_coverageFile);
+        config("traceFile", &_traceFile);
 
         static String b[8] = {"AL", "CL", "DL", "BL", "AH", "CH", "DH", "BH"};
         static String w[8] = {"AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI"};
@@ -571,16 +720,32 @@ public:
         persist("interruptRequested", &_interruptRequested);
         persist("cycle", &_cycle);
         persist("ready", &_ready, true);
-
-        _visited.allocate(0x100000);
-        for (int i = 0; i < 0x100000; ++i)
-            _visited[i] = false;
     }
     void load(const Value& v)
     {
         ClockedComponent::load(v);
         _disassembler.setBus(_bus);
         _pic = _bus->getPIC();
+        Directory directory = simulator()->directory();
+        if (!_coverageFile.empty()) {
+            addTrace(Reference<Intel8088Trace>::create<Intel8088CoverageTrace>(
+                &_disassembler, File(_coverageFile, directory)));
+        }
+        if (!_traceFile.empty()) {
+            addTrace(Reference<Intel8088Trace>::create<Intel8088BinaryTrace>(
+                File(_traceFile, directory)));
+        }
+    }
+    void addTrace(Reference<Intel8088Trace> trace)
+    {
+        _traces.add(trace);
+        trace->_next = _trace;
+        _trace = &*trace;
+    }
+    void dumpTrace()
+    {
+        for (auto t = _trace; t != 0; t = t->_next)
+            t->dump();
     }
     void setStopAtCycle(int stopAtCycle) { _stopAtCycle = stopAtCycle; }
     UInt32 codeAddress(UInt16 offset) { return physicalAddress(1, offset); }
@@ -588,6 +753,20 @@ public:
     {
         while (_tick < tick) {
             _tick += _ticksPerCycle;
+            if (_wait > 0 && busIdle()) {
+                // The execution unit is just counting down and the bus unit
+                // has nothing to do, so nothing observable can happen until
+                // the count runs out. Skip the state machines entirely.
+                _abandonFetch = false;
+                do {
+                    --_wait;
+                    endCycle();
+                    if (_wait == 0 || _tick >= tick)
+                        break;
+                    _tick += _ticksPerCycle;
+                } while (true);
+                continue;
+            }
             simulateCycle();
         }
     }
@@ -600,57 +779,15 @@ public:
     void simulateCycle()
     {
         simulateCycleAction();
-        if (_cycle >= 000000) {
-        //    String line = String(decimal(_cycle)).alignRight(5) + " ";
-        //    switch (_busState) {
-        //        case t1:
-        //            line += "T1 " + hex(_busAddress, 5, false) + " ";
-        //            break;
-        //        case t2:
-        //            line += "T2 ";
-        //            if (_ioInProgress == ioWrite)
-        //                line += "M<-" + hex(_busData, 2, false) + " ";
-        //            else
-        //                line += "      ";
-        //            break;
-        //        case t3: line += "T3       "; break;
-        //        case tWait: line += "Tw       "; break;
-        //        case t4:
-        //            line += "T4 ";
-        //            if (_ioInProgress == ioWrite)
-        //                line += "      ";
-        //            else
-        //                if (_abandonFetch)
-        //                    line += "----- ";
-        //                else
-        //                    line += "M->" + hex(_busData, 2, false) + " ";
-        //            break;
-        //        case tIdle: line += "         "; break;
-        //    }
-            if (_newInstruction) {
-                UInt32 a = codeAddress(_newIP);
-                if (!_visited[a]) {
-                    console.write(String(decimal(_cycle)).alignRight(5) + " " +
-                        hex(csQuiet(), 4, false) + ":" +
-                        hex(_newIP, 4, false) + " " +
-                        _disassembler.disassemble(_newIP) + "\n");
-                }
-                _visited[a] = true;
-        //        line += hex(csQuiet(), 4, false) + ":" + hex(_newIP, 4, false)
-        //            + " " + _disassembler.disassemble(_newIP);
-            }
-        //    line = line.alignLeft(50);
-        //    for (int i = 0; i < 8; ++i) {
-        //        line += _byteRegisters[i].text();
-        //        line += _wordRegisters[i].text();
-        //        line += _segmentRegisters[i].text();
-        //    }
-        //    line += _flags.text();
-        //    //if(_newInstruction)
-        //        console.write(line + "\n");
+        if (_newInstruction) {
+            if (_trace != 0)
+                traceInstruction();
             _newInstruction = false;
         }
-
+        endCycle();
+    }
+    void endCycle()
+    {
         ++_cycle;
         //if (_cycle == 4793344)
         //    console.write("!");
@@ -659,6 +796,15 @@ public:
         //if (_cycle == 4900000)
         //    throw Exception("Finished");
     }
+    // True if the bus unit will sit in its idle state until the execution unit
+    // asks it for something: no transfer in progress or requested and the
+    // prefetch queue full.
+    bool busIdle() const
+    {
+        return _busState == tIdle && _ioInProgress == ioNone &&
+            _ioRequested == ioNone && _prefetched == 4 &&
+            _byte != ioWordSecond;
+    }
     void simulateCycleAction()
     {
         bool busDone;
@@ -1887,24 +2033,28 @@ stateLoadD,        stateLoadD,        stateMisc,         stateMisc};
                 static_cast<ISA8BitBus*>(other->component());
         }
     };
-    class NMIConnector : public InputConnector<bool>
+    class NMIConnector : public DirectConnector<NMIConnector, bool>
     {
     public:
-        NMIConnector(Intel8088CPU* cpu) : InputConnector(cpu) { }
+        NMIConnector(Intel8088CPU* cpu)
+          : DirectConnector<NMIConnector, bool>(cpu) { }
         void setData(Tick t, bool v)
         {
             if (v)
-                static_cast<Intel8088CPU*>(component())->_nmiRequested = true;
+                static_cast<Intel8088CPU*>(this->component())->
+                    _nmiRequested = true;
         }
     };
-    class IRQConnector : public InputConnector<bool>
+    class IRQConnector : public DirectConnector<IRQConnector, bool>
     {
     public:
-        IRQConnector(Intel8088CPU* cpu) : InputConnector(cpu) { }
+        IRQConnector(Intel8088CPU* cpu)
+          : DirectConnector<IRQConnector, bool>(cpu) { }
         void setData(Tick t, bool v)
         {
             if (v)
-                static_cast<Intel8088CPU*>(component())->_interruptRequested = true;
+                static_cast<Intel8088CPU*>(this->component())->
+                    _interruptRequested = true;
         }
     };
 
@@ -2323,6 +2473,11 @@ private:
     Register<UInt8>& ah() { return _byteRegisters[4]; }
     Register<UInt16>& cs() { return _segmentRegisters[1]; }
     UInt16& csQuiet() { return _segmentRegisterData[1]; }
+    void traceInstruction()
+    {
+        for (auto t = _trace; t != 0; t = t->_next)
+            t->instruction(_cycle, csQuiet(), _newIP);
+    }
     bool cf() { return (_flags & 1) != 0; }
     void setCF(bool cf) { _flags = (_flags & ~1) | (cf ? 1 : 0); }
     bool pf() { return (_flags & 4) != 0; }
@@ -2510,9 +2665,12 @@ private:
     bool _ready;
     Tick _interruptTick;
     Tick _readyChangeTick;
-    Array<bool> _visited;
 
     Disassembler _disassembler;
+    String _coverageFile;
+    String _traceFile;
+    Intel8088Trace* _trace;
+    List<Reference<Intel8088Trace>> _traces;
 
     Connector _connector;
     IRQConnector _irqConnector;
@@ -436,13 +436,13 @@ private:
             _dReqData = v;
             _dmac->checkForDMA();
         }
-        class Connector : public InputConnector<bool>
+        class Connector : public DirectConnector<Connector, bool>
         {
         public:
-            Connector(Channel* c) : InputConnector<bool>(c) { }
+            Connector(Channel* c) : DirectConnector<Connector, bool>(c) { }
             void setData(Tick tick, bool v)
             {
-                static_cast<Channel*>(component())->setDReq(tick, v);
+                static_cast<Channel*>(this->component())->setDReq(tick, v);
             }
         };
 
@@ -486,13 +486,16 @@ private:
     State _state;
     Clock _clock;
 
-    class EOPConnector : public BidirectionalConnector<bool>
+    class EOPConnector : public DirectConnector<EOPConnector, bool,
+        BidirectionalConnector<bool>>
     {
+        using Base =
+            DirectConnector<EOPConnector, bool, BidirectionalConnector<bool>>;
     public:
-        EOPConnector(Intel8237DMAC* c) : BidirectionalConnector<bool>(c) { }
+        EOPConnector(Intel8237DMAC* c) : Base(c) { }
         void setData(Tick tick, bool v)
         {
-            static_cast<Intel8237DMAC*>(component())->setEOP(tick, v);
+            static_cast<Intel8237DMAC*>(this->component())->setEOP(tick, v);
         }
     };
 
@@ -500,13 +503,14 @@ private:
 
     OutputConnector<bool> _hrq;
 
-    class HLDAConnector : public InputConnector<bool>
+    class HLDAConnector : public DirectConnector<HLDAConnector, bool>
     {
     public:
-        HLDAConnector(Intel8237DMAC* c) : InputConnector<bool>(c) { }
+        HLDAConnector(Intel8237DMAC* c)
+          : DirectConnector<HLDAConnector, bool>(c) { }
         void setData(Tick tick, bool v)
         {
-            static_cast<Intel8237DMAC*>(component())->setHLDA(tick, v);
+            static_cast<Intel8237DMAC*>(this->component())->setHLDA(tick, v);
         }
     };
 
@@ -388,10 +388,10 @@ private:
             _value -= (0x1000 - 0x999);
         }
 
-        class Connector : public InputConnector<bool>
+        class Connector : public DirectConnector<Connector, bool>
         {
         public:
-            Connector(Timer* c) : InputConnector<bool>(c) { }
+            Connector(Timer* c) : DirectConnector<Connector, bool>(c) { }
             void setData(Tick tick, bool v)
             {
                 static_cast<Timer*>(component())->setGate(tick, v);
@@ -141,24 +141,27 @@ public:
         incoming(n, (_incoming[n] & ~b) | (v ? b : 0));
     }
 private:
-    template<class U> class Connector : public BidirectionalConnector<U>
+    template<class U> class Connector
+      : public DirectConnector<Connector<U>, U, BidirectionalConnector<U>>
     {
+        using Base =
+            DirectConnector<Connector<U>, U, BidirectionalConnector<U>>;
     public:
-        Connector(Intel8255PPI* c) : BidirectionalConnector<U>(c) { }
+        Connector(Intel8255PPI* c) : Base(c) { }
         void setData(Tick tick, U v)
         {
-            static_cast<Intel8255PPI*>(component())->setData(_i, v);
+            static_cast<Intel8255PPI*>(this->component())->setData(_i, v);
         }
         int _i;
     };
     void outgoing(int i, UInt8 v)
     {
         if (v != _outgoing[i]) {
-            _bytes[i]._other->setData(this->_tick, v);
+            _bytes[i].send(this->_tick, v);
             for (int b = 0; b < 8; ++b)
                 if (((v ^ _outgoing[i]) & (1 << b)) != 0) {
-                    _bits[(i<<3) | b]._other->
-                        setData(this->_tick, (v & (1 << b)) != 0);
+                    _bits[(i<<3) | b].send(this->_tick,
+                        (v & (1 << b)) != 0);
                 }
             _outgoing[i] = v;
         }
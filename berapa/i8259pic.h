@@ -27,14 +27,15 @@ public:
         }
         this->connector("int", &_intConnector);
     }
-    class Connector : public InputConnector<bool>
+    class Connector : public DirectConnector<Connector, bool>
     {
     public:
-        Connector(Intel8259PIC* pic) : InputConnector(pic) { }
+        Connector(Intel8259PIC* pic)
+          : DirectConnector<Connector, bool>(pic) { }
         void init(int i) { _i = i; }
         void setData(Tick t, bool v)
         {
-            static_cast<Intel8259PIC*>(component())->setIRQ(t, _i, v);
+            static_cast<Intel8259PIC*>(this->component())->setIRQ(t, _i, v);
         }
         int _i;
     };
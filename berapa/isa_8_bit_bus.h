@@ -43,6 +43,9 @@ public:
     virtual void writeMemory(Tick tick, UInt8 data) { }
     virtual UInt8 readIO(Tick tick) { return 0xff; }
     virtual void writeIO(Tick tick, UInt8 data) { }
+    // Refresh count consecutive DRAM rows starting at the row selected by
+    // address. Components without DRAM ignore this.
+    virtual void refreshMemory(Tick tick, UInt32 address, int count) { }
     virtual bool wait() { return false; }
     virtual void setBus(ISA8BitBus* bus) { _bus = bus; }
     virtual UInt8 debugReadMemory(UInt32 address) { return 0xff; }
@@ -249,6 +252,13 @@ public:
     {
         return _readMemory.debugReadMemory(address);
     }
+    // A DMA refresh sweep of count rows starting at address, done in one call
+    // rather than one memory read per row.
+    void refreshMemory(Tick tick, UInt32 address, int count)
+    {
+        _readMemory.getComponent(address)->refreshMemory(tick, address,
+            count);
+    }
     void load(const Value& v)
     {
         Component::load(v);
@@ -599,13 +609,16 @@ private:
     friend class ISA8BitComponentT<T>;
     friend class Choice;
 
-    class TerminalCountConnector : public InputConnector<bool>
+    class TerminalCountConnector
+      : public DirectConnector<TerminalCountConnector, bool>
     {
     public:
-        TerminalCountConnector(ISA8BitBus* c) : InputConnector<bool>(c) { }
+        TerminalCountConnector(ISA8BitBus* c)
+          : DirectConnector<TerminalCountConnector, bool>(c) { }
         void setData(Tick tick, bool v)
         {
-            static_cast<ISA8BitBus*>(component())->setTerminalCount(tick, v);
+            static_cast<ISA8BitBus*>(this->component())->
+                setTerminalCount(tick, v);
         }
     };
 
@@ -30,6 +30,10 @@ public:
     {
         _ram.write(tick, _address, data);
     }
+    void refreshMemory(Tick tick, UInt32 address, int count)
+    {
+        _ram.refresh(tick, address, count);
+    }
     UInt8 debugReadMemory(UInt32 address) { return _ram.debugRead(address); }
 private:
     int _address;
@@ -10,10 +10,10 @@ public:
     {
         // TODO
     }
-    class Connector : public InputConnector<bool>
+    class Connector : public DirectConnector<Connector, bool>
     {
     public:
-        Connector(OneBitSpeaker* c) : InputConnector(c) { }
+        Connector(OneBitSpeaker* c) : DirectConnector<Connector, bool>(c) { }
         static String typeName() { return "OneBitSpeaker.Connector"; }
         void setData(Tick tick, bool v)
         {
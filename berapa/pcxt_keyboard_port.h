@@ -54,22 +54,24 @@ public:
                 static_cast<PCXTKeyboard*>(other->component());
         }
     };
-    class ClearConnector : public InputConnector<bool>
+    class ClearConnector : public DirectConnector<ClearConnector, bool>
     {
     public:
-        ClearConnector(PCXTKeyboardPort* p) : InputConnector<bool>(p) { }
+        ClearConnector(PCXTKeyboardPort* p)
+          : DirectConnector<ClearConnector, bool>(p) { }
         void setData(Tick t, bool v)
         {
-            static_cast<PCXTKeyboardPort*>(component())->setClear(t, v);
+            static_cast<PCXTKeyboardPort*>(this->component())->setClear(t, v);
         }
     };
-    class ClockConnector : public InputConnector<bool>
+    class ClockConnector : public DirectConnector<ClockConnector, bool>
     {
     public:
-        ClockConnector(PCXTKeyboardPort* p) : InputConnector<bool>(p) { }
+        ClockConnector(PCXTKeyboardPort* p)
+          : DirectConnector<ClockConnector, bool>(p) { }
         void setData(Tick t, bool v)
         {
-            static_cast<PCXTKeyboardPort*>(component())->setClock(t, v);
+            static_cast<PCXTKeyboardPort*>(this->component())->setClock(t, v);
         }
     };
 
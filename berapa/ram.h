@@ -12,11 +12,17 @@ public:
         config("decayValue", &_decayValue);
         persist("data", this, PersistDataType());
         persist("decay", &_decayTimes, ArrayType(Tick::Type(), 0));
+        persist("decayEpoch", &_epoch);
+    }
+    bool decayed(Tick tick, int address)
+    {
+        return tick + _epoch >= decay(address);
     }
-    bool decayed(Tick tick, int address) { return (tick >= decay(address)); }
     UInt8 read(Tick tick, int address)
     {
-        if (decayed(tick, address)) {
+        Tick& d = decay(address);
+        Tick t = tick + _epoch;
+        if (t >= d) {
             // RAM has decayed! On a real machine this would not always signal
             // an NMI but we'll make the NMI happen every time to make DRAM
             // decay problems easier to find.
@@ -26,32 +32,53 @@ public:
             // emulator.
             return _decayValue;
         }
-        decay(address) = tick + _decayTicks;
+        d = t + _decayTicks;
         if (address >= _ramSize)
             return _decayValue;
         return _data[address];
     }
     void write(Tick tick, int address, UInt8 data)
     {
-        decay(address) = tick + _decayTicks;
+        decay(address) = tick + _epoch + _decayTicks;
         if (address < _ramSize)
             _data[address] = data;
     }
+    // Refresh count rows starting at row (wrapping around at the end of the
+    // row space), as a DMA refresh sweep or a RAS-only refresh burst would.
+    void refresh(Tick tick, int row, int count)
+    {
+        Tick d = tick + _epoch + _decayTicks;
+        int rows = _rowMask + 1;
+        if (count >= rows) {
+            row = 0;
+            count = rows;
+        }
+        row &= _rowMask;
+        int n = min(count, rows - row);
+        Tick* p = &_decayTimes[0];
+        for (int i = 0; i < n; ++i)
+            p[row + i] = d;
+        for (int i = 0; i < count - n; ++i)
+            p[i] = d;
+    }
     UInt8 debugRead(int address)
     {
         return address < _ramSize ? _data[address] : 0xff;
     }
     void maintain(Tick ticks)
     {
-        for (auto& r : _decayTimes) {
-            if (r > 0)
-                r -= ticks;
-        }
+        // Decay times are stored relative to _epoch, so moving the scheduler's
+        // origin forwards is just an addition. Only when the epoch gets large
+        // enough to risk overflow do we need to touch every row.
+        _epoch += ticks;
+        if (_epoch > Tick(0x40000000))
+            rebase();
     }
     void load(const Value& value)
     {
         _data.allocate(_ramSize);
         _decayTimes.allocate(1 << _rowBits);
+        _epoch = 0;
         Component::load(value);
         _rowMask = (1 << _rowBits) - 1;
         if (_decayTime == 0) {
@@ -156,10 +183,21 @@ private:
     };
 
     Tick& decay(int address) { return _decayTimes[address & _rowMask]; }
+    void rebase()
+    {
+        for (auto& r : _decayTimes) {
+            if (r > _epoch)
+                r -= _epoch;
+            else
+                r = 0;
+        }
+        _epoch = 0;
+    }
 
     Array<UInt8> _data;
     Array<Tick> _decayTimes;
     Tick _decayTicks;
+    Tick _epoch;
     int _rowMask;
     OutputConnector<bool> _parityError;
     Rational _decayTime;
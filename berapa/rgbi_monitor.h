@@ -23,9 +23,14 @@ private:
 
 class RGBIMonitor : public ComponentBase<RGBIMonitor>
 {
+    static const int frameWidth = 912;
+    static const int frameHeight = 262;
+    static const int frameSamples = frameWidth*frameHeight + 1;
 public:
     static String typeName() { return "RGBIMonitor"; }
-    RGBIMonitor(Component::Type type) : ComponentBase(type), _connector(this)
+    RGBIMonitor(Component::Type type)
+      : ComponentBase(type), _connector(this), _front(0), _back(1),
+        _ready(2), _sink(this)
     {
         _palette.allocate(64);
         _palette[0x0] = 0xff000000;
@@ -55,6 +60,11 @@ public:
             _palette[i + 32] = 0xff220022 + rgb; // vsync
             _palette[i + 48] = 0xff222222 + rgb; // hsync+vsync
         }
+        for (int i = 0; i < 3; ++i) {
+            _frames[i].allocate(frameWidth*frameHeight);
+            for (int j = 0; j < frameWidth*frameHeight; ++j)
+                _frames[i][j] = 0xff000000;
+        }
         connector("", &_connector);
     }
     void load(const Value& v)
@@ -63,6 +73,22 @@ public:
         // Defer creating the window until load time to avoid creating windows
         // during type building.
         _window = Reference<Window>::template create<Window>();
+        _sink.start();
+    }
+    // SDL wants rendering and events to be handled on the thread that
+    // created the window, so decoded frames are presented from here (once per
+    // scheduler quantum) rather than from the decoding thread.
+    void maintain(Tick ticks)
+    {
+        Component::maintain(ticks);
+        _sink.check();
+        present();
+        handleEvents();
+    }
+    void stop()
+    {
+        Component::stop();
+        _sink.stop();
     }
 
     class Connector : public ConnectorBase<Connector>
@@ -71,7 +97,11 @@ public:
         Connector(RGBIMonitor* monitor) : ConnectorBase(monitor) { }
         void connect(::Connector* other)
         {
-            // TODO
+            auto cga = dynamic_cast<IBMCGA*>(other->component());
+            if (cga != 0) {
+                cga->bgriSource()->connect(
+                    &static_cast<RGBIMonitor*>(component())->_sink);
+            }
         }
         static String typeName() { return "RGBIMonitor.Connector"; }
         static auto protocolDirection()
@@ -80,30 +110,31 @@ public:
         }
     };
 
-    class BGRISink : public Sink<BGRI>
+    // The BGRI samples are decoded on a thread of their own. The buffer
+    // between the CGA and the decoder holds two frames so that the CGA can
+    // carry on generating the next frame while the previous one is decoded.
+    class BGRISink : public ThreadedSink<BGRI>
     {
     public:
-        BGRISink(RGBIMonitor* monitor) : _monitor(monitor) { }
+        BGRISink(RGBIMonitor* monitor)
+          : ThreadedSink<BGRI>(2*frameSamples), _monitor(monitor) { }
+        ~BGRISink() { noFailStop(); }
+    protected:
         // We ignore the suggested number of samples and just read a whole
         // frame's worth once there is enough for a frame.
-        void consume(int nSuggested)
+        int process(Accessor<BGRI> reader, int count)
         {
-            // Since the pumping is currently done by Simulator::simulate(),
-            // don't try to pull more data from the CGA than we have.
-            if (remaining() < 912*262 + 1)
-                return;
-
-            // We have enough data for a frame - update the screen.
-            read(_monitor->consume(Sink::reader(912*262 + 1)));
+            if (count < frameSamples)
+                return 0;
+            return _monitor->decode(reader);
         }
-
     private:
         RGBIMonitor* _monitor;
     };
 
-    int consume(Accessor<BGRI> reader)
+    // Called on the decoding thread.
+    int decode(Accessor<BGRI> reader)
     {
-        SDLTextureLock _lock(&_window->_texture);
         int y = 0;
         int x = 0;
         bool hSync = false;
@@ -111,20 +142,19 @@ public:
         bool oldHSync = false;
         bool oldVSync = false;
         int n = 0;
-        UInt8* row = reinterpret_cast<UInt8*>(_lock._pixels);
-        int pitch = _lock._pitch;
-        UInt32* output = reinterpret_cast<UInt32*>(row);
+        UInt32* row = &_frames[_back][0];
+        UInt32* output = row;
         do {
             BGRI p = reader.item();
             hSync = ((p & 0x10) != 0);
             vSync = ((p & 0x20) != 0);
-            if (x == 912 || (oldHSync && !hSync)) {
+            if (x == frameWidth || (oldHSync && !hSync)) {
                 x = 0;
                 ++y;
-                row += pitch;
-                output = reinterpret_cast<UInt32*>(row);
+                row += frameWidth;
+                output = row;
             }
-            if (y == 262 || (oldVSync && !vSync))
+            if (y == frameHeight || (oldVSync && !vSync))
                 break;
             oldHSync = hSync;
             oldVSync = vSync;
@@ -134,10 +164,48 @@ public:
             ++x;
             reader.advance(1);
         } while (true);
-        _window->_renderer.renderTexture(&_window->_texture);
+        // Publish the frame. If the previous one hasn't been presented yet it
+        // is dropped: the simulation shouldn't have to wait for the display.
+        _back = _ready.exchange(_back | freshFrame) & ~freshFrame;
         return n;
     }
 private:
+    static const int freshFrame = 4;
+
+    // Called on the simulator thread.
+    void present()
+    {
+        if ((_ready.load(std::memory_order_relaxed) & freshFrame) == 0)
+            return;
+        _front = _ready.exchange(_front) & ~freshFrame;
+        SDLTextureLock lock(&_window->_texture);
+        UInt8* row = reinterpret_cast<UInt8*>(lock._pixels);
+        const UInt32* frame = &_frames[_front][0];
+        for (int y = 0; y < frameHeight; ++y) {
+            memcpy(row, frame, frameWidth*sizeof(UInt32));
+            row += lock._pitch;
+            frame += frameWidth;
+        }
+        _window->_renderer.renderTexture(&_window->_texture);
+    }
+
+    void handleEvents()
+    {
+        SDL_Event event;
+        while (SDL_PollEvent(&event) != 0) {
+            switch (event.type) {
+                case SDL_QUIT:
+                    simulator()->halt();
+                    break;
+                case SDL_KEYDOWN:
+                    // F12 writes out the CPU's coverage and trace files.
+                    if (event.key.keysym.sym == SDLK_F12)
+                        simulator()->dumpTraces();
+                    break;
+            }
+        }
+    }
+
     class Window
     {
     public:
@@ -150,5 +218,16 @@ private:
     Array<UInt32> _palette;
 
     Connector _connector;
+
+    // Triple buffer: the decoder writes to _back, the simulator thread
+    // presents _front and completed frames are exchanged through _ready.
+    Array<UInt32> _frames[3];
+    int _front;
+    int _back;
+    std::atomic<int> _ready;
+
+    // Declared last so that the decoding thread is stopped before anything it
+    // uses is destroyed.
+    BGRISink _sink;
 };
 
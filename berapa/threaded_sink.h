@@ -0,0 +1,140 @@
+// A Sink which hands its data over to a worker thread. The component that owns
+// it stays on the simulator's (timing-critical) thread and receives samples
+// through consume() as usual, while process() runs on the worker. The two
+// threads are connected by a fixed-size lock-free buffer, so if the worker
+// falls behind the simulator waits for it rather than letting the buffer grow
+// without bound. The buffer needs to be at least as large as the largest
+// amount of data that process() needs to see at once.
+//
+// The worker calls process(), which is implemented by a derived class, so the
+// worker has to be stopped before the derived part is destroyed: the owner
+// calls stop() when it is done, and the most-derived class's destructor calls
+// noFailStop() in case that didn't happen (e.g. because of an exception).
+template<class T> class ThreadedSink : public Sink<T>
+{
+public:
+    ThreadedSink(int bufferSize, int n = defaultSampleCount)
+      : Sink<T>(n), _bufferSize(bufferSize), _stopping(false), _error(false)
+    { }
+    void start()
+    {
+        _buffer.allocate(_bufferSize);
+        _stopping = false;
+        _thread = std::thread([this] { threadProc(); });
+    }
+    // Stops the worker and rethrows on this thread any exception that
+    // process() threw.
+    void stop()
+    {
+        noFailStop();
+        check();
+    }
+    // Rethrows an exception thrown by process(), if there was one. Once that
+    // happens the worker has stopped and further data is discarded, so the
+    // owner should check for it periodically.
+    void check()
+    {
+        if (_error.load(std::memory_order_acquire)) {
+            _error = false;
+            throw _exception;
+        }
+    }
+    void consume(int n)
+    {
+        Accessor<T> reader = this->reader(n);
+        BufferWriter writer(this);
+        Backoff backoff;
+        int done = 0;
+        while (done < n) {
+            int w = min(_buffer.writable(), n - done);
+            if (w == 0) {
+                if (!_thread.joinable() || _stopping)
+                    break;
+                backoff.wait();
+                continue;
+            }
+            backoff.reset();
+            reader.items(writer, w);
+            done += w;
+        }
+        this->read(n);
+    }
+protected:
+    void noFailStop()
+    {
+        if (!_thread.joinable())
+            return;
+        _stopping = true;
+        _thread.join();
+    }
+    // Called on the worker thread with count samples available from reader.
+    // Returns the number of samples consumed, or 0 to wait for more data.
+    virtual int process(Accessor<T> reader, int count) = 0;
+private:
+    // Spin briefly (a frame's worth of data usually arrives in well under a
+    // millisecond when the simulation is keeping up) before going to sleep.
+    class Backoff
+    {
+    public:
+        Backoff() : _spins(0) { }
+        void wait()
+        {
+            if (_spins < 64) {
+                ++_spins;
+                std::this_thread::yield();
+            }
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        void reset() { _spins = 0; }
+    private:
+        int _spins;
+    };
+    class BufferWriter
+    {
+    public:
+        BufferWriter(ThreadedSink* sink) : _sink(sink) { }
+        void operator()(T* source, int n)
+        {
+            if (n == 0)
+                return;
+            _sink->_buffer.copyIn(source, n);
+            _sink->_buffer.added(n);
+        }
+    private:
+        ThreadedSink* _sink;
+    };
+    void threadProc()
+    {
+        Backoff backoff;
+        try {
+            while (!_stopping.load(std::memory_order_relaxed)) {
+                int n = _buffer.readable();
+                if (n != 0) {
+                    n = process(Accessor<T>(_buffer.lowPointer(),
+                        _buffer.readOffset(), _buffer.mask()), n);
+                }
+                if (n == 0) {
+                    backoff.wait();
+                    continue;
+                }
+                backoff.reset();
+                _buffer.remove(n);
+            }
+        }
+        catch (Exception& e) {
+            _exception = e;
+            _error.store(true, std::memory_order_release);
+            // Stop the simulator thread waiting for us. Anything it sends
+            // from now on is discarded.
+            _stopping = true;
+        }
+    }
+
+    LockFreeCircularBuffer<T> _buffer;
+    int _bufferSize;
+    std::thread _thread;
+    std::atomic<bool> _stopping;
+    std::atomic<bool> _error;
+    Exception _exception;
+};
@@ -0,0 +1,303 @@
+#include "alfe/main.h"
+#include "alfe/cga.h"
+#include "alfe/config_file.h"
+
+// Renders CGA frames without a window, writing them to stdout as raw 24-bit
+// RGB or as YUV4MPEG2 (which ffmpeg and most other video tools can read).
+// Timings for each stage of the pipeline are reported on stderr, so this
+// also serves as a benchmark.
+
+class VideoOutput : public CGAOutput
+{
+public:
+    VideoOutput(CGAData* data, CGASequencer* sequencer)
+      : CGAOutput(data, sequencer), _writing(false), _writeTime(0) { }
+    // Frames rendered before this is called (e.g. by requiredSize()) are
+    // discarded.
+    void startWriting(Stream stream, bool y4m)
+    {
+        _stream = stream;
+        _y4m = y4m;
+        _headerWritten = false;
+        _writing = true;
+    }
+    Bitmap<Pixel> outputFrame(Bitmap<Pixel> bitmap)
+    {
+        if (!_writing)
+            return bitmap;
+        Timer timer;
+        Vector size = bitmap.size();
+        int pixels = size.x*size.y;
+        if (_y4m) {
+            if (!_headerWritten) {
+                // The hdot clock is 157.5/11 MHz.
+                _stream.write("YUV4MPEG2 W" + decimal(size.x) + " H" +
+                    decimal(size.y) + " F157500000:" +
+                    decimal(11*_total) + " Ip A1:1 C444\n");
+                _headerWritten = true;
+            }
+            _stream.write("FRAME\n");
+            // Studio-range BT.601, one plane each for Y, Cb and Cr.
+            _buffer.ensure(pixels*3);
+            Byte* yp = &_buffer[0];
+            Byte* bp = yp + pixels;
+            Byte* rp = bp + pixels;
+            const Byte* row = bitmap.data();
+            for (int y = 0; y < size.y; ++y) {
+                const Pixel* p = reinterpret_cast<const Pixel*>(row);
+                for (int x = 0; x < size.x; ++x) {
+                    int r = (p[x] >> 16) & 0xff;
+                    int g = (p[x] >> 8) & 0xff;
+                    int b = p[x] & 0xff;
+                    *yp = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+                    *bp = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+                    *rp = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+                    ++yp;
+                    ++bp;
+                    ++rp;
+                }
+                row += bitmap.stride();
+            }
+        }
+        else {
+            _buffer.ensure(pixels*3);
+            Byte* o = &_buffer[0];
+            const Byte* row = bitmap.data();
+            for (int y = 0; y < size.y; ++y) {
+                const Pixel* p = reinterpret_cast<const Pixel*>(row);
+                for (int x = 0; x < size.x; ++x) {
+                    o[0] = (p[x] >> 16) & 0xff;
+                    o[1] = (p[x] >> 8) & 0xff;
+                    o[2] = p[x] & 0xff;
+                    o += 3;
+                }
+                row += bitmap.stride();
+            }
+        }
+        _stream.write(&_buffer[0], pixels*3);
+        _writeTime += timer.elapsed();
+        // The frame has been written out, so its bitmap can be reused.
+        return bitmap;
+    }
+    void setTotal(int total) { _total = total; }
+    double takeWriteTime()
+    {
+        double t = _writeTime;
+        _writeTime = 0;
+        return t;
+    }
+private:
+    Stream _stream;
+    bool _y4m;
+    bool _headerWritten;
+    bool _writing;
+    int _total;
+    double _writeTime;
+    Array<Byte> _buffer;
+};
+
+class Program : public ProgramBase
+{
+public:
+    void run()
+    {
+        ConfigFile configFile;
+        configFile.addDefaultOption("cgaROM", String("5788005.u33"));
+        configFile.addDefaultOption("mode", 0x1a);
+        configFile.addDefaultOption("palette", 0x0f);
+        configFile.addDefaultOption("connector", 1);
+        configFile.addDefaultOption("phase", 1);
+        configFile.addDefaultOption("contrast", 100.0);
+        configFile.addDefaultOption("brightness", 0.0);
+        configFile.addDefaultOption("saturation", 100.0);
+        configFile.addDefaultOption("hue", 0.0);
+        configFile.addDefaultOption("showClipping", false);
+        configFile.addDefaultOption("chromaBandwidth", 1.0);
+        configFile.addDefaultOption("lumaBandwidth", 1.0);
+        configFile.addDefaultOption("rollOff", 0.0);
+        configFile.addDefaultOption("lobes", 4.0);
+        configFile.addDefaultOption("combFilter", 0);
+        configFile.addDefaultOption("aspectRatio", 5.0/6.0);
+        configFile.addDefaultOption("scanlineWidth", 0.5);
+        configFile.addDefaultOption("scanlineProfile", 0);
+        configFile.addDefaultOption("horizontalProfile", 0);
+        configFile.addDefaultOption("scanlineBleeding", 2);
+        configFile.addDefaultOption("horizontalBleeding", 2);
+        configFile.addDefaultOption("zoom", 2.0);
+        configFile.addDefaultOption("horizontalRollOff", 0.0);
+        configFile.addDefaultOption("verticalRollOff", 0.0);
+        configFile.addDefaultOption("horizontalLobes", 4.0);
+        configFile.addDefaultOption("verticalLobes", 4.0);
+        configFile.addDefaultOption("subPixelSeparation", 1.0);
+        configFile.addDefaultOption("phosphor", 0);
+        configFile.addDefaultOption("mask", 0);
+        configFile.addDefaultOption("maskSize", 0.0);
+        configFile.addDefaultOption("overscan", 0.1);
+        configFile.addDefaultOption("y4m", true);
+        configFile.addDefaultOption("repeat", 1);
+        configFile.addDefaultOption("fullFrames", false);
+        configFile.addDefaultOption("fftWisdom", String("wisdom"));
+
+        if (_arguments.count() < 2) {
+            console.write("Syntax: " + _arguments[0] +
+                " [<config file name>.config] <input file name>(.dat|.cgad)"
+                "...\n");
+            return;
+        }
+        String configPath = "default.config";
+        int firstInput = 1;
+        if (_arguments[1].endsInIgnoreCase(".config")) {
+            configPath = _arguments[1];
+            firstInput = 2;
+        }
+        File config(configPath, true);
+        configFile.load(config);
+
+        FFTWWisdom<float> wisdom(
+            File(configFile.get<String>("fftWisdom"), config.parent()));
+
+        _sequencer.setROM(
+            File(configFile.get<String>("cgaROM"), config.parent()));
+        _mode = configFile.get<int>("mode");
+        _palette = configFile.get<int>("palette");
+
+        VideoOutput output(&_data, &_sequencer);
+        output.setConnector(configFile.get<int>("connector"));
+        output.setPhase(configFile.get<int>("phase"));
+        output.setContrast(configFile.get<double>("contrast"));
+        output.setBrightness(configFile.get<double>("brightness"));
+        output.setSaturation(configFile.get<double>("saturation"));
+        output.setHue(configFile.get<double>("hue"));
+        output.setShowClipping(configFile.get<bool>("showClipping"));
+        output.setChromaBandwidth(configFile.get<double>("chromaBandwidth"));
+        output.setLumaBandwidth(configFile.get<double>("lumaBandwidth"));
+        output.setRollOff(configFile.get<double>("rollOff"));
+        output.setLobes(configFile.get<double>("lobes"));
+        output.setCombFilter(configFile.get<int>("combFilter"));
+        output.setAspectRatio(configFile.get<double>("aspectRatio"));
+        output.setScanlineWidth(configFile.get<double>("scanlineWidth"));
+        output.setScanlineProfile(configFile.get<int>("scanlineProfile"));
+        output.setHorizontalProfile(configFile.get<int>("horizontalProfile"));
+        output.setScanlineBleeding(configFile.get<int>("scanlineBleeding"));
+        output.setHorizontalBleeding(
+            configFile.get<int>("horizontalBleeding"));
+        output.setZoom(configFile.get<double>("zoom"));
+        output.setHorizontalRollOff(
+            configFile.get<double>("horizontalRollOff"));
+        output.setVerticalRollOff(configFile.get<double>("verticalRollOff"));
+        output.setHorizontalLobes(configFile.get<double>("horizontalLobes"));
+        output.setVerticalLobes(configFile.get<double>("verticalLobes"));
+        output.setSubPixelSeparation(
+            configFile.get<double>("subPixelSeparation"));
+        output.setPhosphor(configFile.get<int>("phosphor"));
+        output.setMask(configFile.get<int>("mask"));
+        output.setMaskSize(configFile.get<double>("maskSize"));
+        output.setOverscan(configFile.get<double>("overscan"));
+        output.setKeepAllFrames(true);
+        int repeat = configFile.get<int>("repeat");
+        bool fullFrames = configFile.get<bool>("fullFrames");
+
+        if (firstInput >= _arguments.count())
+            throw Exception("No input files given.");
+        load(File(_arguments[firstInput], true));
+        Vector size = output.requiredSize();
+        output.flush();
+        output.takeTimings();
+        output.setTotal(_data.getTotal());
+        output.startWriting(console, configFile.get<bool>("y4m"));
+
+        // Each frame is loaded while the one before it is still being
+        // scaled, so the two stages overlap.
+        Timer timer;
+        for (int i = firstInput; i < _arguments.count(); ++i) {
+            if (i != firstInput)
+                load(File(_arguments[i], true));
+            for (int j = 0; j < repeat; ++j) {
+                if (fullFrames)
+                    output.refresh();
+                else
+                    output.restart();
+                output.join();
+            }
+        }
+        output.flush();
+        double elapsed = timer.elapsed();
+
+#ifdef _WIN32
+        Stream errors(GetStdHandle(STD_ERROR_HANDLE), Console(), false);
+#else
+        Stream errors(STDERR_FILENO, Console(), false);
+#endif
+        CGAOutput::Timings timings = output.takeTimings();
+        int frames = max(timings._frames, 1);
+        errors.write(decimal(timings._frames) + " frames of " +
+            decimal(size.x) + "x" + decimal(size.y) + " in " +
+            format("%.3f", elapsed) + " seconds (" +
+            format("%.2f", timings._frames/elapsed) + " fps)\n");
+        errors.write("Milliseconds per frame:\n");
+        reportStage(errors, "RGBI", timings._rgbi, frames);
+        reportStage(errors, "Decode", timings._decode, frames);
+        reportStage(errors, "Linearize", timings._linearize, frames);
+        reportStage(errors, "Scale", timings._scale, frames);
+        reportStage(errors, "Delinearize", timings._delinearize, frames);
+        reportStage(errors, "Write", output.takeWriteTime(), frames);
+    }
+private:
+    // Loads a frame from a CGAData file, or from a VRAM dump using the mode
+    // and palette from the config file.
+    void load(File file)
+    {
+        if (file.path().endsInIgnoreCase(".cgad")) {
+            _data.load(file);
+            return;
+        }
+        _data.loadVRAM(file);
+        static const int regs = -CGAData::registerLogCharactersPerBank;
+        Byte cgaRegistersData[regs] = { 0 };
+        Byte* cgaRegisters = &cgaRegistersData[regs];
+        cgaRegisters[CGAData::registerLogCharactersPerBank] = 12;
+        cgaRegisters[CGAData::registerScanlinesRepeat] = 1;
+        cgaRegisters[CGAData::registerMode] = _mode;
+        cgaRegisters[CGAData::registerPalette] = _palette;
+        if ((_mode & 1) != 0) {
+            cgaRegisters[CGAData::registerHorizontalTotal] = 114 - 1;
+            cgaRegisters[CGAData::registerHorizontalDisplayed] = 80;
+            cgaRegisters[CGAData::registerHorizontalSyncPosition] = 90;
+        }
+        else {
+            cgaRegisters[CGAData::registerHorizontalTotal] = 57 - 1;
+            cgaRegisters[CGAData::registerHorizontalDisplayed] = 40;
+            cgaRegisters[CGAData::registerHorizontalSyncPosition] = 45;
+        }
+        cgaRegisters[CGAData::registerHorizontalSyncWidth] = 10;
+        if ((_mode & 2) != 0) {
+            cgaRegisters[CGAData::registerVerticalTotal] = 128 - 1;
+            cgaRegisters[CGAData::registerVerticalTotalAdjust] = 6;
+            cgaRegisters[CGAData::registerVerticalDisplayed] = 100;
+            cgaRegisters[CGAData::registerVerticalSyncPosition] = 112;
+            cgaRegisters[CGAData::registerMaximumScanline] = 1;
+        }
+        else {
+            cgaRegisters[CGAData::registerVerticalTotal] = 32 - 1;
+            cgaRegisters[CGAData::registerVerticalTotalAdjust] = 6;
+            cgaRegisters[CGAData::registerVerticalDisplayed] = 25;
+            cgaRegisters[CGAData::registerVerticalSyncPosition] = 28;
+            cgaRegisters[CGAData::registerMaximumScanline] = 7;
+        }
+        cgaRegisters[CGAData::registerInterlaceMode] = 2;
+        cgaRegisters[CGAData::registerCursorStart] = 6;
+        cgaRegisters[CGAData::registerCursorEnd] = 7;
+        _data.change(0, -regs, regs, &cgaRegistersData[0]);
+        _data.setTotals(912*262, 910, static_cast<int>(910*262.5));
+    }
+    void reportStage(Stream errors, String name, double seconds, int frames)
+    {
+        errors.write(name + ": " + format("%.3f", seconds*1000/frames) +
+            "\n");
+    }
+
+    CGAData _data;
+    CGASequencer _sequencer;
+    int _mode;
+    int _palette;
+};
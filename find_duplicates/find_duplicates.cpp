@@ -106,16 +106,41 @@ class FindDuplicates : Uncopyable
         {
             update((*_map)(directory), directory.name());
         }
+        // Each entry is hashed with its name. The entries are all hashed
+        // together by hash(), since SHA256Hash::hashMany() can do several at
+        // once.
         void update(ObjectData d, String name)
         {
-            SHA256Hash::Hasher hasher;
-            hasher.update(d._hash.data(), 32);
-            hasher.update(&name[0], name.length());
-            _set.insert(SHA256Hash(hasher));
+            _entries += String(reinterpret_cast<const char*>(d._hash.data()),
+                32);
+            _entries += name;
+            _ends.append(_entries.length());
             _size += d._size;
         }
+        SHA256Hash hash()
+        {
+            HashSet set;
+            int n = _ends.count();
+            if (n == 0)
+                return set.hash();
+            String entries = _entries.string();
+            Array<const Byte*> data(n);
+            Array<int> lengths(n);
+            int start = 0;
+            for (int i = 0; i < n; ++i) {
+                data[i] = entries.data() + start;
+                lengths[i] = _ends[i] - start;
+                start = _ends[i];
+            }
+            Array<SHA256Hash> hashes(n);
+            SHA256Hash::hashMany(&data[0], &lengths[0], n, &hashes[0]);
+            for (int i = 0; i < n; ++i)
+                set.insert(hashes[i]);
+            return set.hash();
+        }
         FindDuplicates* _map;
-        HashSet _set;
+        StringBuilder _entries;
+        AppendableArray<int> _ends;
         Int64 _size;
     };
 
@@ -324,8 +349,7 @@ public:
         catch (...) {
 
         }
-        SHA256Hash hash(p._set.hash());
-        ObjectData data(SHA256Hash(p._set.hash()), p._size);
+        ObjectData data(p.hash(), p._size);
         insert(data, directory);
         //console.write(data._hash.toString() + " " + directory.path() + "\n");
         return data;
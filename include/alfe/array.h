@@ -630,6 +630,8 @@ public:
     const T& operator[](int i) const { return (*body())[i]; }
     int count() const { return body() == 0 ? 0 : body()->size(); }
     int allocated() const { return body() == 0 ? 0 : body()->_allocated; }
+    // True if no other array or String is using this array's storage.
+    bool unique() const { return Handle::unique(); }
     AppendableArray copy() const
     {
         AppendableArray r(count());
@@ -642,25 +644,25 @@ public:
     {
         if (body() != 0)
             return body()->begin();
-        return Body::Iterator();
+        return typename Body::Iterator();
     }
     Iterator end() const
     {
         if (body() != 0)
             return body()->end();
-        return Body::Iterator();
+        return typename Body::Iterator();
     }
     Iterator begin()
     {
         if (body() != 0)
             return body()->begin();
-        return Body::Iterator();
+        return typename Body::Iterator();
     }
     Iterator end()
     {
         if (body() != 0)
             return body()->end();
-        return Body::Iterator();
+        return typename Body::Iterator();
     }
 
 private:
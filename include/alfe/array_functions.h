@@ -33,6 +33,7 @@ public:
             }
             return *x;
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorIndex(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -40,7 +40,7 @@ template<class T> class RawFileFormatTemplate : public BitmapFileFormat<T>
 {
 public:
     RawFileFormatTemplate(Vector size)
-      : BitmapFileFormat(this->create<Body>(size)) { }
+      : BitmapFileFormat<T>(Handle::create<Body>(size)) { }
 private:
     class Body : public BitmapFileFormat<T>::Body
     {
@@ -62,11 +62,11 @@ private:
         virtual Bitmap<T> load(const File& file) const
         {
             FileStream stream = file.openRead();
-            Bitmap<SRGB> bitmap(_size);
+            Bitmap<T> bitmap(_size);
             Byte* data = bitmap.data();
             int stride = bitmap.stride();
             for (int y = 0; y < _size.y; ++y) {
-                stream.read(static_cast<void*>(data), _size.x*sizeof(T));
+                stream.read(data, _size.x*sizeof(T));
                 data += stride;
             }
             return bitmap;
@@ -192,7 +192,8 @@ public:
 
 private:
     Bitmap(Array<Pixel> array, Byte* topLeft, Vector size, int stride)
-      : Array(array), _topLeft(topLeft), _size(size), _stride(stride) { }
+      : Array<Pixel>(array), _topLeft(topLeft), _size(size), _stride(stride)
+    { }
 
     Vector _size;
     Byte* _topLeft;
@@ -4,22 +4,36 @@
 #define INCLUDED_BITMAP_PNG_H
 
 #include <png.h>
+#include <zlib.h>
 #include "alfe/bitmap.h"
 
 // Currently T needs to be DWORD (0x00RRGGBB) or SRGB (0xRR, 0xGG, 0xBB).
+//
+// Images are saved by our own encoder rather than by libpng. The rows are
+// split into horizontal stripes, which are filtered and deflated in
+// parallel. Each stripe is an independent run of deflate blocks ending on a
+// byte boundary, so they can be concatenated into a single zlib stream, and
+// the Adler-32 checksums of the stripes are combined for the trailer. Each
+// stripe goes in its own IDAT chunk, and stripes are written as each batch
+// of them is finished. fast gives up some compression for speed, for bulk
+// frame dumps. If no pool is given, a shared one is used.
 template<class T> class PNGFileFormat : public BitmapFileFormat<T>
 {
 public:
-    PNGFileFormat() : BitmapFileFormat<T>(Handle::create<Body>()) { }
+    PNGFileFormat(bool fast = false, ThreadPool* pool = 0)
+      : BitmapFileFormat<T>(Handle::create<Body>(fast, pool)) { }
 private:
     class Body : public BitmapFileFormat<T>::Body
     {
     public:
+        Body(bool fast, ThreadPool* pool) : _fast(fast), _pool(pool) { }
         virtual void save(Bitmap<T>& bitmap, const File& file) const
         {
             FileStream stream = file.openWrite();
-            PNGWrite write(&stream);
-            write.write(bitmap);
+            ThreadPool* pool = _pool;
+            if (pool == 0)
+                pool = ThreadPool::shared();
+            PNGEncoder(&stream, _fast, pool).write(bitmap);
         }
         virtual Bitmap<T> load(const File& file) const
         {
@@ -38,14 +52,6 @@ private:
                 static_cast<FileStream*>(png_get_io_ptr(png_ptr));
             stream->read(static_cast<Byte*>(data), static_cast<int>(length));
         }
-        static void userWriteData(png_structp png_ptr, png_bytep data,
-            png_size_t length)
-        {
-            FileStream* stream =
-                static_cast<FileStream*>(png_get_io_ptr(png_ptr));
-            stream->write(static_cast<void*>(data), static_cast<int>(length));
-        }
-        static void userFlushData(png_structp png_ptr) { }
         static void userErrorFunction(png_structp png_ptr,
             png_const_charp error_msg)
         {
@@ -88,7 +94,7 @@ private:
                 Vector size(png_get_image_width(_png_ptr, _info_ptr),
                     png_get_image_height(_png_ptr, _info_ptr));
                 Bitmap<T> bitmap(size);
-                doCopy<T>(bitmap, png_get_channels(_png_ptr, _info_ptr));
+                doCopy(bitmap, png_get_channels(_png_ptr, _info_ptr));
                 return bitmap;
             }
             ~PNGRead()
@@ -100,7 +106,7 @@ private:
             {
                 throw Exception();
             }
-            template<> void doCopy<SRGB>(Bitmap<SRGB> bitmap, int channels)
+            void doCopy(Bitmap<SRGB> bitmap, int channels)
             {
                 Byte* data = bitmap.data();
                 int stride = bitmap.stride();
@@ -151,7 +157,7 @@ private:
                         break;
                 }
             }
-            template<> void doCopy<DWORD>(Bitmap<DWORD> bitmap, int channels)
+            void doCopy(Bitmap<DWORD> bitmap, int channels)
             {
                 Byte* data = bitmap.data();
                 int stride = bitmap.stride();
@@ -216,64 +222,251 @@ private:
             FileStream* _stream;
         };
 
-        class PNGWrite
+        class PNGEncoder
         {
         public:
-            PNGWrite(FileStream* stream) : _stream(stream)
+            PNGEncoder(FileStream* stream, bool fast, ThreadPool* pool)
+              : _stream(stream), _fast(fast), _pool(pool) { }
+            void write(Bitmap<T>& bitmap)
             {
-                _png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-                    static_cast<png_voidp>(stream), userErrorFunction,
-                    userWarningFunction);
-                if (_png_ptr == 0)
-                    throw Exception("Error creating PNG write structure");
+                static const Byte signature[8] =
+                    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+                _stream->write(signature, 8);
+                _size = bitmap.size();
+                Byte header[13];
+                writeBigEndian(header, _size.x);
+                writeBigEndian(header + 4, _size.y);
+                header[8] = 8;   // Bit depth
+                header[9] = 2;   // Colour type: RGB
+                header[10] = 0;  // Compression method: deflate
+                header[11] = 0;  // Filter method: adaptive
+                header[12] = 0;  // Interlace method: none
+                writeChunk("IHDR", header, 13);
+
+                _bitmap = bitmap;
+                _rowBytes = _size.x*3;
+                _stripeRows = max(1, stripeBytes/(_rowBytes + 1));
+                int stripes = (_size.y + _stripeRows - 1)/_stripeRows;
+                // Batches are big enough to keep every thread busy.
+                int batch = 2*(_pool->threads() + 1);
+                Array<Stripe> encoded(min(batch, stripes));
+                UInt32 adler = adler32(0, 0, 0);
+                for (int first = 0; first < stripes; first += batch) {
+                    int n = min(batch, stripes - first);
+                    _pool->parallelFor(0, n, [&](int i)
+                    {
+                        encode(first + i, stripes, &encoded[i]);
+                    });
+                    for (int i = 0; i < n; ++i) {
+                        Stripe* stripe = &encoded[i];
+                        adler = adler32_combine(adler, stripe->_adler,
+                            stripe->_rawLength);
+                        if (first + i == stripes - 1) {
+                            writeBigEndian(&stripe->_data[stripe->_length],
+                                adler);
+                            stripe->_length += 4;
+                        }
+                        writeChunk("IDAT", &stripe->_data[0],
+                            stripe->_length);
+                    }
+                }
+                writeChunk("IEND", 0, 0);
             }
-            void write(Bitmap<T>& bitmap)
+        private:
+            // Rows are grouped into stripes of about this many bytes once
+            // filtered. Smaller stripes spread the work better but compress
+            // slightly less well, since each stripe's compressor starts with
+            // an empty window.
+            static const int stripeBytes = 0x40000;
+
+            class Stripe
             {
-                _info_ptr = png_create_info_struct(_png_ptr);
-                if (_info_ptr == 0)
-                    throw Exception("Error creating PNG info structure");
-                png_set_write_fn(_png_ptr, static_cast<png_voidp>(_stream),
-                    userWriteData, userFlushData);
-                Vector size = bitmap.size();
-                png_set_IHDR(_png_ptr, _info_ptr, size.x, size.y, 8,
-                    PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-                    PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-                Array<Byte*> rows(size.y);
-                Byte* data = bitmap.data();
-                int stride = bitmap.stride();
-                for (int y = 0; y < size.y; ++y) {
-                    rows[y] = data;
-                    data += stride;
+            public:
+                Array<Byte> _data;
+                int _length;
+                UInt32 _adler;
+                int _rawLength;
+            };
+
+            static void writeBigEndian(Byte* p, UInt32 v)
+            {
+                p[0] = static_cast<Byte>(v >> 24);
+                p[1] = static_cast<Byte>(v >> 16);
+                p[2] = static_cast<Byte>(v >> 8);
+                p[3] = static_cast<Byte>(v);
+            }
+            void writeChunk(const char* type, const Byte* data, int length)
+            {
+                Byte b[4];
+                writeBigEndian(b, length);
+                _stream->write(b, 4);
+                _stream->write(type, 4);
+                _stream->write(data, length);
+                UInt32 crc = crc32(0, reinterpret_cast<const Byte*>(type), 4);
+                if (length != 0)
+                    crc = crc32(crc, data, length);
+                writeBigEndian(b, crc);
+                _stream->write(b, 4);
+            }
+
+            static void convert(const SRGB* input, Byte* output, int n)
+            {
+                memcpy(output, input, n*3);
+            }
+            static void convert(const DWORD* input, Byte* output, int n)
+            {
+                for (int x = 0; x < n; ++x) {
+                    DWORD p = input[x];
+                    output[0] = static_cast<Byte>(p >> 16);
+                    output[1] = static_cast<Byte>(p >> 8);
+                    output[2] = static_cast<Byte>(p);
+                    output += 3;
                 }
-                png_set_rows(_png_ptr, _info_ptr,
-                    static_cast<png_bytepp>(&rows[0]));
-                doWrite<T>();
             }
-            ~PNGWrite()
+            void convertRow(int y, Byte* output)
             {
-                png_destroy_write_struct(&_png_ptr, &_info_ptr);
+                convert(reinterpret_cast<const T*>(_bitmap.data() +
+                    y*_bitmap.stride()), output, _size.x);
             }
-        private:
-            template<class T2> void doWrite()
+
+            static int paeth(int a, int b, int c)
             {
-                throw Exception();
+                int p = a + b - c;
+                int pa = abs(p - a);
+                int pb = abs(p - b);
+                int pc = abs(p - c);
+                if (pa <= pb && pa <= pc)
+                    return a;
+                return pb <= pc ? b : c;
             }
-            template<> void doWrite<SRGB>()
+            // Applies filter type to row (whose predecessor is prior) and
+            // returns the sum of the absolute values of the filtered bytes
+            // taken as signed, which is the usual cheap estimate of how well
+            // the row will compress.
+            int filter(int type, const Byte* row, const Byte* prior,
+                Byte* output)
             {
-                png_write_png(_png_ptr, _info_ptr, PNG_TRANSFORM_IDENTITY,
-                    NULL);
+                int n = _rowBytes;
+                switch (type) {
+                    case 0:
+                        memcpy(output, row, n);
+                        break;
+                    case 1:
+                        for (int i = 0; i < 3; ++i)
+                            output[i] = row[i];
+                        for (int i = 3; i < n; ++i)
+                            output[i] = row[i] - row[i - 3];
+                        break;
+                    case 2:
+                        for (int i = 0; i < n; ++i)
+                            output[i] = row[i] - prior[i];
+                        break;
+                    case 3:
+                        for (int i = 0; i < 3; ++i)
+                            output[i] = row[i] - (prior[i] >> 1);
+                        for (int i = 3; i < n; ++i) {
+                            output[i] =
+                                row[i] - ((row[i - 3] + prior[i]) >> 1);
+                        }
+                        break;
+                    case 4:
+                        for (int i = 0; i < 3; ++i)
+                            output[i] = row[i] - prior[i];
+                        for (int i = 3; i < n; ++i) {
+                            output[i] = row[i] -
+                                paeth(row[i - 3], prior[i], prior[i - 3]);
+                        }
+                        break;
+                }
+                int total = 0;
+                for (int i = 0; i < n; ++i) {
+                    SInt8 f = static_cast<SInt8>(output[i]);
+                    total += f < 0 ? -f : f;
+                }
+                return total;
             }
-            template<> void doWrite<DWORD>()
+            void encode(int index, int stripes, Stripe* stripe)
             {
-                png_write_png(_png_ptr, _info_ptr,
-                    PNG_TRANSFORM_BGR | PNG_TRANSFORM_STRIP_FILLER_AFTER,
-                    NULL);
+                int y0 = index*_stripeRows;
+                int y1 = min(y0 + _stripeRows, _size.y);
+                Array<Byte> rows(2*_rowBytes);
+                Byte* row = &rows[0];
+                Byte* prior = &rows[_rowBytes];
+                if (y0 == 0)
+                    memset(prior, 0, _rowBytes);
+                else
+                    convertRow(y0 - 1, prior);
+                Array<Byte> trial(_rowBytes);
+                int rawLength = (y1 - y0)*(_rowBytes + 1);
+                Array<Byte> raw(rawLength);
+                Byte* r = &raw[0];
+                for (int y = y0; y < y1; ++y) {
+                    convertRow(y, row);
+                    // The fast preset only tries Sub and Up, which are
+                    // the ones that usually win on synthetic images.
+                    int best = _fast ? 1 : 0;
+                    int bestTotal = filter(best, row, prior, r + 1);
+                    for (int type = best + 1; type <= (_fast ? 2 : 4);
+                        ++type) {
+                        int total = filter(type, row, prior, &trial[0]);
+                        if (total < bestTotal) {
+                            best = type;
+                            bestTotal = total;
+                            memcpy(r + 1, &trial[0], _rowBytes);
+                        }
+                    }
+                    r[0] = best;
+                    r += _rowBytes + 1;
+                    swap(row, prior);
+                }
+                stripe->_adler = adler32(adler32(0, 0, 0), &raw[0],
+                    rawLength);
+                stripe->_rawLength = rawLength;
+
+                z_stream z;
+                z.zalloc = 0;
+                z.zfree = 0;
+                z.opaque = 0;
+                if (deflateInit2(&z, _fast ? 1 : 6, Z_DEFLATED, -15, 8,
+                    _fast ? Z_RLE : Z_FILTERED) != Z_OK)
+                    throw Exception("Error initializing deflate");
+                // Room for the zlib header and the Adler-32 trailer.
+                int capacity =
+                    static_cast<int>(deflateBound(&z, rawLength)) + 16;
+                stripe->_data.ensure(capacity);
+                int start = 0;
+                if (index == 0) {
+                    // Window size 32K, and a compression level hint.
+                    stripe->_data[0] = 0x78;
+                    stripe->_data[1] = _fast ? 0x01 : 0x9c;
+                    start = 2;
+                }
+                z.next_in = &raw[0];
+                z.avail_in = rawLength;
+                z.next_out = &stripe->_data[start];
+                z.avail_out = capacity - (start + 4);
+                // Every stripe but the last ends with a sync flush, which
+                // leaves the output on a byte boundary without marking the
+                // last block as final.
+                int e = deflate(&z, index == stripes - 1 ? Z_FINISH :
+                    Z_SYNC_FLUSH);
+                stripe->_length = capacity - 4 - z.avail_out;
+                deflateEnd(&z);
+                if (e != Z_STREAM_END && (e != Z_OK || z.avail_in != 0))
+                    throw Exception("Error compressing PNG data");
             }
-            png_structp _png_ptr;
-            png_infop _info_ptr;
-            png_bytep* _row_pointers;
+
             FileStream* _stream;
+            bool _fast;
+            ThreadPool* _pool;
+            Bitmap<T> _bitmap;
+            Vector _size;
+            int _rowBytes;
+            int _stripeRows;
         };
+
+        bool _fast;
+        ThreadPool* _pool;
     };
 };
 
@@ -15,6 +15,7 @@ public:
         {
             return Value(!arguments.begin()->value<bool>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorNot(); }
         FunctionType type() const
         {
@@ -0,0 +1,99 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_BOUND_SIGNAL_H
+#define INCLUDED_BOUND_SIGNAL_H
+
+template<class T> class BinaryTraits
+{
+public:
+    static T zero() { return 0; }
+    static T invert(const T& other) { return ~other; }
+    static T one() { return invert(zero()); }
+};
+
+template<> class BinaryTraits<bool>
+{
+public:
+    static bool zero() { return false; }
+    static bool invert(const bool& other) { return !other; }
+    static bool one() { return true; }
+};
+
+// One end of a connection that carries values of type T, each at a time of
+// type Tick. Data arrives through setData(). Data is sent with send(), which
+// calls whatever bind() found to be the cheapest way of getting the data to
+// its ultimate destination: ends that just pass their data on (possibly
+// inverted) are skipped, and an end whose concrete type is known can have its
+// setData() called directly (see directSender()) rather than through the
+// vtable.
+template<class T, class Tick> class BoundSignal
+{
+public:
+    typedef void (*Sender)(BoundSignal* target, Tick t, T v);
+
+    BoundSignal() : _target(0), _sender(&receive) { }
+    virtual void setData(Tick t, T v) = 0;
+    void send(Tick t, T v) { _sender(_target, t, v); }
+    // Returns the function that delivers data to this end (inverted first,
+    // if inverted is true). The default goes through the vtable.
+    virtual Sender sender(bool inverted)
+    {
+        if (inverted)
+            return &receiveInverted;
+        return &receive;
+    }
+    // If this end does nothing but pass its data on to another end, returns
+    // that end (setting *inverted if the data is inverted on the way) so that
+    // senders can bypass this one.
+    virtual BoundSignal* forward(bool* inverted) { return 0; }
+    // Makes send() deliver data to other, or to wherever other forwards it.
+    void bind(BoundSignal* other)
+    {
+        BoundSignal* target = other;
+        if (target == 0)
+            return;
+        bool inverted = false;
+        do {
+            bool i = false;
+            BoundSignal* next = target->forward(&i);
+            if (next == 0)
+                break;
+            inverted = (inverted != i);
+            target = next;
+        } while (true);
+        _target = target;
+        _sender = target->sender(inverted);
+    }
+    // A sender() for an end of concrete type C, which calls C::setData()
+    // directly so that it can be inlined.
+    template<class C> static Sender directSender(bool inverted)
+    {
+        if (inverted)
+            return &receiveDirectInverted<C>;
+        return &receiveDirect<C>;
+    }
+private:
+    static void receive(BoundSignal* target, Tick t, T v)
+    {
+        target->setData(t, v);
+    }
+    static void receiveInverted(BoundSignal* target, Tick t, T v)
+    {
+        target->setData(t, BinaryTraits<T>::invert(v));
+    }
+    template<class C> static void receiveDirect(BoundSignal* target, Tick t,
+        T v)
+    {
+        static_cast<C*>(target)->C::setData(t, v);
+    }
+    template<class C> static void receiveDirectInverted(BoundSignal* target,
+        Tick t, T v)
+    {
+        static_cast<C*>(target)->C::setData(t, BinaryTraits<T>::invert(v));
+    }
+
+    BoundSignal* _target;
+    Sender _sender;
+};
+
+#endif // INCLUDED_BOUND_SIGNAL_H
@@ -3,13 +3,24 @@
 #ifndef INCLUDED_CGA_H
 #define INCLUDED_CGA_H
 
+#ifdef _WIN32
 #include "alfe/user.h"
+#else
+class BitmapWindow;
+#endif
 #include "alfe/ntsc_decode.h"
 #include "alfe/scanlines.h"
 #include "alfe/wrap.h"
 #include "alfe/timer.h"
 #include "alfe/bitmap_png.h"
 #include "alfe/thread.h"
+#include "alfe/cpu_features.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALFE_CGA_SSE2
+#endif
 
 #ifdef COLOURS_3BIT
 static const SRGB rgbiPalette[16] = {
@@ -42,6 +53,42 @@ public:
             0, 2, 4, 6, 0, 10, 12, 14, 0, 3, 5, 7, 0, 11, 13, 15,
             0, 3, 4, 7, 0, 11, 12, 15, 0, 3, 4, 7, 0, 11, 12, 15};
         memcpy(_palettes, palettes, 32);
+        for (int b = 0; b < 256; ++b) {
+            _bytes[b] = 0;
+            _nibbles[b] = 0;
+            _evenNibbles[b] = 0;
+            for (int x = 0; x < 8; ++x) {
+                if ((b & (0x80 >> x)) != 0) {
+                    _bytes[b] |= static_cast<UInt64>(0xff) << (x*8);
+                    _nibbles[b] |= static_cast<UInt32>(0xf) << (x*4);
+                }
+            }
+            for (int x = 0; x < 4; ++x) {
+                if ((b & (0x40 >> (x*2))) != 0)
+                    _evenNibbles[b] |= 0xf << (x*4);
+            }
+        }
+        // These are built up front rather than on first use, because one
+        // sequencer can be used from more than one thread.
+        _table2bpp.allocate(128*512);
+        for (int key = 0; key < 128; ++key) {
+            UInt32* t = &_table2bpp[key*512];
+            Byte pal[4];
+            memcpy(pal, &_palettes[((key & 0x30) >> 2) + ((key & 0x40) >> 2)],
+                4);
+            pal[0] = key & 0xf;
+            for (int b = 0; b < 256; ++b) {
+                UInt32 wide = 0;
+                UInt32 narrow = 0;
+                for (int x = 0; x < 4; ++x) {
+                    int c = pal[(b >> (6 - x*2)) & 3];
+                    wide |= static_cast<UInt32>(c*0x11) << (x*8);
+                    narrow |= c << (x*4);
+                }
+                t[b] = wide;
+                t[b + 256] = narrow;
+            }
+        }
     }
     void setROM(File rom) { _cgaROM = rom.contents(); }
     const Byte* romData() { return &_cgaROM[0x300*8]; }
@@ -50,13 +97,14 @@ public:
 //    +HRES +GRPH gives abcb efgf ij in other   phase 1 even  <- use this one for compatibility with -HRES modes
 //    with 1bpp +HRES, odd bits are ignored (76543210 = -0-1-2-3)
 
-// Can we do all the graphics modes with tables?
-// 1bpp: 16 pixel positions * 2 colours * 16 palettes = 512 UInt64 elements (4kB)
-// 2bpp: 8 pixel positions * 4 colours * 128 palettes = 4096 UInt64 element (32kB)
-//   Pixel positions * colour is same for 1bpp and 2bpp so we could use 2bpp code for 1bpp as well (excluding table initialization)
-// Would need to do some profiling to see if it's actually faster or if it uses too much cache
-//   Usually we'd only care about one palette row = 256 bytes
-//   Or do it bytewise?
+// All the modes are done with tables indexed by a byte of input:
+//   _bytes, _nibbles and _evenNibbles expand the bits of a byte to masks of
+//   8 bytes, 8 nibbles or (for +HRES 1bpp, which ignores the odd bits) 4
+//   nibbles. Text modes use them to select between the foreground and
+//   background colours, and 1bpp graphics modes to mask the palette colour.
+//   2bpp modes have a table for each of the 128 combinations of palette
+//   register and mode bit 2, built by the constructor, that gives the 4
+//   pixels of a byte both as bytes and (for +HRES) as nibbles.
 
 
     // renders a 1 character by 1 scanline region of CGA VRAM data into RGBI
@@ -74,153 +122,96 @@ public:
         if ((mode & 8) == 0)
             return 0;
         Character c;
-        UInt64 r = 0;
-        int x;
-        Byte* pal;
-        UInt64 fg;
-        UInt64 bg;
+        const UInt32* t;
+        UInt64 p;
+        int b0 = input & 0xff;
+        int b1 = (input >> 8) & 0xff;
+        int b3 = input >> 24;
 
         switch (mode & 0x53) {
             case 0x00:
             case 0x40:
                 // 40-column text mode
                 c = getCharacter(input, mode, scanline, cursor, cursorBlink);
-                fg = (c.attribute & 0x0f) * 0x11;
-                bg = (c.attribute >> 4) * 0x11;
-                for (x = 0; x < 8; ++x)
-                    r += ((c.bits & (0x80 >> x)) != 0 ? fg : bg) << (x*8);
-                break;
+                return select(_bytes[c.bits], c.attribute, 16);
             case 0x01:
             case 0x41:
                 // 80-column text mode
                 c = getCharacter(input, mode, scanline, cursor, cursorBlink);
-                fg = c.attribute & 0x0f;
-                bg = c.attribute >> 4;
-                for (x = 0; x < 8; ++x)
-                    r += ((c.bits & (0x80 >> x)) != 0 ? fg : bg) << (x*4);
-                break;
+                return select(_nibbles[c.bits], c.attribute, 8);
             case 0x02:
             case 0x42:
                 // 2bpp graphics mode
-                pal = &_palettes[((palette & 0x30) >> 2) + ((mode & 4) << 2)];
-                *pal = palette & 0xf;
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (6 - x*2)) & 3] * 0x11) << (x*8);
-                }
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (14 - x*2)) & 3] * 0x11) << (32 + x*8);
-                }
-                break;
+                t = table2bpp(mode, palette);
+                return t[b0] | (static_cast<UInt64>(t[b1]) << 32);
             case 0x03:
                 // Improper: +HRES 2bpp graphics mode
-                pal = &_palettes[((palette & 0x30) >> 2) + ((mode & 4) << 2)];
-                *pal = palette & 0xf;
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (6 - x*2)) & 3]) << (x*4);
-                }
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (14 - x*2)) & 3]) << (16 + x*4);
-                }
-                break;
+                t = table2bpp(mode, palette) + 256;
+                return t[b0] | (t[b1] << 16);
             case 0x43:
                 // Improper: +HRES 2bpp graphics mode
-                pal = &_palettes[((palette & 0x30) >> 2) + ((mode & 4) << 2)];
-                *pal = palette & 0xf;
                 // The attribute byte is not latched for odd hchars, so the
                 // second column uses the previously latched value.
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (6 - x*2)) & 3]) << (x*4);
-                }
-                for (int x = 0; x < 4; ++x) {
-                    r += static_cast<UInt64>(
-                        pal[(input >> (30 - x*2)) & 3]) << (16 + x*4);
-                }
-                break;
+                t = table2bpp(mode, palette) + 256;
+                return t[b0] | (t[b3] << 16);
             case 0x10:
             case 0x50:
                 // Improper: 40-column text mode with 1bpp graphics overlay
                 c = getCharacter(input, mode, scanline, cursor, cursorBlink);
-                fg = (c.attribute & 0x0f) * 0x11;
-                bg = (c.attribute >> 4) * 0x11;
-                for (x = 0; x < 8; ++x)
-                    r += ((c.bits & (128 >> x)) != 0 ? fg : bg) << (x*8);
                 // Shift register loaded from attribute latch before attribute
                 // latch loaded from VRAM, so the second column uses the
                 // previously latched value.
-                for (int x = 0; x < 8; ++x) {
-                    if ((input & (0x80 >> x)) == 0)
-                        r &= ~(static_cast<UInt64>(0x0f) << (x*4));
-                }
-                for (int x = 0; x < 8; ++x) {
-                    if ((input & (0x80000000 >> x)) == 0)
-                        r &= ~(static_cast<UInt64>(0x0f) << (32 + x*4));
-                }
-                break;
+                return select(_bytes[c.bits], c.attribute, 16) &
+                    (_nibbles[b0] | (static_cast<UInt64>(_nibbles[b3]) << 32));
             case 0x11:
             case 0x51:
                 // Improper: 80-column text mode with +HRES 1bpp graphics mode
                 c = getCharacter(input, mode, scanline, cursor, cursorBlink);
-                fg = c.attribute & 0x0f;
-                bg = c.attribute >> 4;
-                for (x = 0; x < 8; ++x)
-                    r += ((c.bits & (128 >> x)) != 0 ? fg : bg) << (x*4);
                 // Shift register loaded from attribute latch before attribute
                 // latch loaded from VRAM, so the second column uses the
                 // previously latched value on both odd and even hchars.
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x40 >> (x*2))) == 0)
-                        r &= ~(static_cast<UInt64>(0x0f) << (x*4));
-                }
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x40000000 >> (x*2))) == 0)
-                        r &= ~(static_cast<UInt64>(0x0f) << (16 + x*4));
-                }
-                break;
+                return select(_nibbles[c.bits], c.attribute, 8) &
+                    (_evenNibbles[b0] | (_evenNibbles[b3] << 16));
             case 0x12:
             case 0x52:
                 // 1bpp graphics mode
-                for (int x = 0; x < 8; ++x) {
-                    if ((input & (0x80 >> x)) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (x*4);
-                }
-                for (int x = 0; x < 8; ++x) {
-                    if ((input & (0x8000 >> x)) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (32 + x*4);
-                }
-                break;
+                p = (palette & 0x0f)*nibbles(16);
+                return p & (_nibbles[b0] |
+                    (static_cast<UInt64>(_nibbles[b1]) << 32));
             case 0x13:
                 // Improper: +HRES 1bpp graphics mode
                 // Only the even bits have an effect.
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x40 >> (x*2))) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (x*4);
-                }
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x4000 >> (x*2))) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (16 + x*4);
-                }
-                break;
+                p = (palette & 0x0f)*nibbles(8);
+                return p & (_evenNibbles[b0] | (_evenNibbles[b1] << 16));
             case 0x53:
                 // Improper: +HRES 1bpp graphics mode
                 // Only the even bits have an effect.
                 // The attribute byte is not latched for odd hchars, so the
                 // second column uses the previously latched value.
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x40 >> (x*2))) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (x*4);
-                }
-                for (int x = 0; x < 4; ++x) {
-                    if ((input & (0x40000000 >> (x*2))) != 0)
-                        r += static_cast<UInt64>(palette & 0x0f) << (16 + x*4);
-                }
-                break;
+                p = (palette & 0x0f)*nibbles(8);
+                return p & (_evenNibbles[b0] | (_evenNibbles[b3] << 16));
+        }
+        return 0;
+    }
+    // Expands the first count nibbles of the output of process() to one byte
+    // per hdot.
+    static void unpack(UInt64 r, Byte* rgbi, int count)
+    {
+#ifdef ALFE_CGA_SSE2
+        if (count == 16 || count == 8) {
+            __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&r));
+            __m128i m = _mm_set1_epi8(0x0f);
+            v = _mm_unpacklo_epi8(_mm_and_si128(v, m),
+                _mm_and_si128(_mm_srli_epi16(v, 4), m));
+            if (count == 16)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(rgbi), v);
+            else
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(rgbi), v);
+            return;
         }
-        return r;
+#endif
+        for (int x = 0; x < count; ++x)
+            rgbi[x] = (r >> (x*4)) & 0x0f;
     }
 private:
     struct Character
@@ -229,6 +220,26 @@ private:
         int attribute;
     };
 
+    // Returns a value with 1 in each of the first count nibbles.
+    static UInt64 nibbles(int count)
+    {
+        return 0x1111111111111111 >> (64 - count*4);
+    }
+    // Returns the foreground colour of attribute in the nibbles where mask is
+    // set and the background colour in the rest of the first count nibbles.
+    static UInt64 select(UInt64 mask, int attribute, int count)
+    {
+        UInt64 fg = (attribute & 0x0f)*nibbles(count);
+        UInt64 bg = ((attribute >> 4) & 0x0f)*nibbles(count);
+        return bg ^ (mask & (fg ^ bg));
+    }
+    // Returns the 2bpp table for the given palette and mode: 256 entries with
+    // the 4 pixels of a byte as 4 bytes, then 256 with them as 4 nibbles.
+    const UInt32* table2bpp(UInt8 mode, UInt8 palette)
+    {
+        return &_table2bpp[((palette & 0x3f) + ((mode & 4) << 4))*512];
+    }
+
     Character getCharacter(UInt16 input, UInt8 mode, int scanline, bool cursor,
         int cursorBlink)
     {
@@ -249,14 +260,23 @@ private:
 
     String _cgaROM;
     Byte _palettes[32];
+    UInt64 _bytes[256];
+    UInt32 _nibbles[256];
+    UInt32 _evenNibbles[256];
+    Array<UInt32> _table2bpp;
 };
 
 class CGAComposite
 {
 public:
-    CGAComposite() : _newCGA(false), _bw(false) { }
+    CGAComposite() : _newCGA(false), _bw(false), _tables(&_cache[0]) { }
+    // The tables for each combination of setNewCGA() and setBW() are only
+    // computed once, so this is cheap to call when nothing has changed.
     void initChroma()
     {
+        _tables = &_cache[(_newCGA ? 2 : 0) + (_bw ? 1 : 0)];
+        if (_tables->_valid)
+            return;
         double maxV = 0;
         for (int x = 0; x < 1024; ++x)
             maxV = max(maxV, tableValue(x));
@@ -287,10 +307,17 @@ public:
         double c = 255.0/(n*maxV + m);
         double a = n*c;
         double b = m*c;
+        Byte* table = _tables->_table;
         for (int x = 0; x < 1024; ++x)
-            _table[x] = byteClamp(tableValue(x)*a + b);
-        _black = vBlack*a + b;
-        _white = vWhite*a + b;
+            table[x] = byteClamp(tableValue(x)*a + b);
+        for (int x = 0; x < 256; ++x) {
+            UInt32 phases = 0;
+            for (int p = 0; p < 4; ++p)
+                phases |= static_cast<UInt32>(table[(x << 2) + p]) << (p*8);
+            _tables->_phases[x] = phases;
+        }
+        _tables->_black = vBlack*a + b;
+        _tables->_white = vWhite*a + b;
 
         // v                 p
         //
@@ -320,34 +347,49 @@ public:
                     q = tableValue(x & 3)*a + b;
                 }
             }
-            _syncTable[x] = byteClamp(q);
+            _tables->_syncTable[x] = byteClamp(q);
         }
+        _tables->_valid = true;
     }
     Byte simulateCGA(int left, int right, int phase)
     {
-        if ((left | right) < 16)
-            return _table[((left & 15) << 6) + ((right & 15) << 2) + phase];
-        return _syncTable[(left << 2) + phase];
+        if ((left | right) < 16) {
+            return _tables->_table[
+                ((left & 15) << 6) + ((right & 15) << 2) + phase];
+        }
+        return _tables->_syncTable[(left << 2) + phase];
     }
     Byte simulateHalfCGA(int left, Byte right, int phase)
     {
-        int b = _table[((left & 15) << 6) + phase];
-        int w = _table[((left & 15) << 6) + 0x3c + phase];
-        int bb = _table[phase];
-        int ww = _table[0x3fc + phase];
+        int b = _tables->_table[((left & 15) << 6) + phase];
+        int w = _tables->_table[((left & 15) << 6) + 0x3c + phase];
+        int bb = _tables->_table[phase];
+        int ww = _tables->_table[0x3fc + phase];
         return (right - bb)*(w - b)/(ww - bb) + b;
     }
     Byte simulateRightHalfCGA(Byte left, int right, int phase)
     {
-        int b = _table[((right & 15) << 2) + phase];
-        int w = _table[0x3c0 + ((right & 15) << 2) + phase];
-        int bb = _table[phase];
-        int ww = _table[0x3fc + phase];
+        int b = _tables->_table[((right & 15) << 2) + phase];
+        int w = _tables->_table[0x3c0 + ((right & 15) << 2) + phase];
+        int bb = _tables->_table[phase];
+        int ww = _tables->_table[0x3fc + phase];
         return (left - bb)*(w - b)/(ww - bb) + b;
     }
+    // Converts length samples of RGBI to composite. rgbi[length] is also
+    // read, as the right neighbour of the last sample. The first sample has
+    // phase (phase + 1) & 3.
     void simulateLine(const Byte* rgbi, Byte* ntsc, int length, int phase)
     {
-        for (int x = 0; x < length; ++x) {
+        int done = 0;
+#ifdef ALFE_X86
+        static const bool avx2 = CPUFeatures::hasAVX2();
+        if (avx2)
+            done = simulateLineAVX2(rgbi, ntsc, length, (phase + 1) & 3);
+#endif
+        rgbi += done;
+        ntsc += done;
+        phase += done;
+        for (int x = done; x < length; ++x) {
             phase = (phase + 1) & 3;
             int left = *rgbi;
             ++rgbi;
@@ -391,9 +433,61 @@ public:
     // levels here so that emulated output devices can make sensible defaults
     // (setting black and white levels to sRGB (0, 0, 0) and (255, 255, 255)
     // respectively).
-    double black() { return _black; }
-    double white() { return _white; }
+    double black() { return _tables->_black; }
+    double white() { return _tables->_white; }
 private:
+#ifdef ALFE_X86
+    // Does the first multiple of 32 samples of simulateLine() and returns how
+    // many were done. Runs of 32 active (non-blanking) samples, which is
+    // most of them, are looked up 8 at a time by gathering from _phases,
+    // since each lane's phase is fixed.
+    ALFE_TARGET("avx2") int simulateLineAVX2(const Byte* rgbi, Byte* ntsc,
+        int length, int phase)
+    {
+        const int* phases = reinterpret_cast<const int*>(_tables->_phases);
+        __m256i shifts = _mm256_setr_epi32(0, 8, 16, 24, 0, 8, 16, 24);
+        shifts = _mm256_permutevar8x32_epi32(shifts,
+            _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+            _mm256_set1_epi32(phase)));
+        __m256i blanking = _mm256_set1_epi8(static_cast<char>(0xf0));
+        __m256i low = _mm256_set1_epi32(0xff);
+        __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        int x;
+        for (x = 0; x + 32 <= length; x += 32) {
+            __m256i left =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgbi + x));
+            __m256i right = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(rgbi + x + 1));
+            if (!_mm256_testz_si256(_mm256_or_si256(left, right), blanking)) {
+                for (int i = x; i < x + 32; ++i) {
+                    ntsc[i] =
+                        simulateCGA(rgbi[i], rgbi[i + 1], (phase + i) & 3);
+                }
+                continue;
+            }
+            // Since left < 16, this doesn't carry into the next byte.
+            __m256i pairs = _mm256_or_si256(_mm256_slli_epi16(left, 4), right);
+            __m256i samples[4];
+            for (int q = 0; q < 4; ++q) {
+                __m128i p = q < 2 ? _mm256_castsi256_si128(pairs) :
+                    _mm256_extracti128_si256(pairs, 1);
+                if ((q & 1) != 0)
+                    p = _mm_srli_si128(p, 8);
+                __m256i g = _mm256_i32gather_epi32(phases,
+                    _mm256_cvtepu8_epi32(p), 4);
+                samples[q] =
+                    _mm256_and_si256(_mm256_srlv_epi32(g, shifts), low);
+            }
+            __m256i s = _mm256_packus_epi16(
+                _mm256_packus_epi32(samples[0], samples[1]),
+                _mm256_packus_epi32(samples[2], samples[3]));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(ntsc + x),
+                _mm256_permutevar8x32_epi32(s, order));
+        }
+        return x;
+    }
+#endif
+
     double tableValue(int x)
     {
         static unsigned char chromaData[256] = {
@@ -436,12 +530,24 @@ private:
             (b/0.28)*0.07;
     }
 
+    struct Tables
+    {
+        Tables() : _valid(false) { }
+        bool _valid;
+        Byte _table[1024];
+        Byte _syncTable[0x77*4];
+        // _table with the 4 phases of each left/right pair packed together:
+        // byte p of _phases[(left << 4) + right] is
+        // _table[(left << 6) + (right << 2) + p].
+        UInt32 _phases[256];
+        double _black;
+        double _white;
+    };
+
     bool _newCGA;
     bool _bw;
-    Byte _table[1024];
-    Byte _syncTable[0x77*4];
-    double _black;
-    double _white;
+    Tables _cache[4];
+    Tables* _tables;
 };
 
 // The CGAData structure encapsulates the state of the (extended) CGA's VRAM
@@ -453,11 +559,25 @@ private:
 class CGAData : Uncopyable
 {
 public:
-    CGAData() : _total(1) { reset(); }
+    CGAData() : _total(1), _dirty(false) { reset(); }
     void reset()
     {
         _root.reset();
         _endAddress = 0;
+        invalidate(0);
+    }
+    // Returns true if anything has changed since the last call, and if so
+    // sets *start to the first hdot whose output may be different. Since the
+    // CRTC state at any point depends on everything before it in the frame, a
+    // change at time t can affect the output anywhere from t onwards.
+    bool takeDirty(int* start)
+    {
+        Lock lock(&_mutex);
+        if (!_dirty)
+            return false;
+        *start = _dirtyStart;
+        _dirty = false;
+        return true;
     }
     // Output RGBI values:
     //   0-15: normal active data
@@ -540,6 +660,7 @@ public:
     {
         Lock lock(&_mutex);
         _root.remove(t, address, count, 0, _total);
+        invalidate(t);
     }
     void setTotals(int total, int pllWidth, int pllHeight)
     {
@@ -549,6 +670,7 @@ public:
         _total = total;
         _pllWidth = pllWidth;
         _pllHeight = pllHeight;
+        invalidate(0);
     }
     int getTotal()
     {
@@ -577,6 +699,7 @@ public:
     {
         Lock lock(&_mutex);
         _root.reset();
+        invalidate(0);
         Array<Byte> data;
         file.readIntoArray(&data);
         if (deserialize(&data, 0) != *reinterpret_cast<const DWord*>("CGAD"))
@@ -635,6 +758,14 @@ private:
             _endAddress = address + count;
             _root.ensureAddresses(registerLogCharactersPerBank, _endAddress);
         }
+        invalidate(t);
+    }
+    void invalidate(int t)
+    {
+        t = max(t, 0);
+        if (!_dirty || t < _dirtyStart)
+            _dirtyStart = t;
+        _dirty = true;
     }
     int deserialize(Array<Byte>* data, int offset)
     {
@@ -705,6 +836,7 @@ private:
             _character = 0;
             _hdot = 0;
             _state = 0;
+            _latch = 0;
             latch();
         }
         void runTo(int t)
@@ -716,10 +848,9 @@ private:
                 if (_state == 0) {
                     UInt64 r = _sequencer->process(_latch, mode | _phase,
                         dat(registerPalette), _rowAddress, false, 0);
-                    for (; _hdot < c; ++_hdot) {
-                        *_rgbi = (r >> (_hdot * 4)) & 0x0f;
-                        ++_rgbi;
-                    }
+                    CGASequencer::unpack(r >> (_hdot*4), _rgbi, c - _hdot);
+                    _rgbi += c - _hdot;
+                    _hdot = c;
                 }
                 else {
                     int v = 0;
@@ -1201,18 +1332,54 @@ private:
     int _pllWidth;
     int _pllHeight;
     int _endAddress;
+    bool _dirty;
+    int _dirtyStart;
     Mutex _mutex;
 };
 
+// Renders the output of a CGAData to a BitmapWindow. With no window (as on
+// platforms other than Windows) the frames are passed to outputFrame()
+// instead, which a derived class can override.
 class CGAOutput : public ThreadTask
 {
 public:
-    CGAOutput(CGAData* data, CGASequencer* sequencer, BitmapWindow* window)
-      : _data(data), _sequencer(sequencer), _window(window), _zoom(0),
-        _aspectRatio(1), _inputTL(0, 0), _outputSize(0, 0), _active(false)
+#ifdef _WIN32
+    typedef DWORD Pixel;
+#else
+    typedef DWord Pixel;
+#endif
+
+    // Total seconds spent in each part of the pipeline, for benchmarking.
+    struct Timings
+    {
+        Timings()
+          : _frames(0), _rgbi(0), _decode(0), _linearize(0), _scale(0),
+            _delinearize(0) { }
+        int _frames;
+        double _rgbi;         // CGAData to RGBI
+        double _decode;       // Finding syncs and RGBI to sRGB
+        double _linearize;
+        double _scale;        // ScanlineRenderer
+        double _delinearize;
+    };
+
+    CGAOutput(CGAData* data, CGASequencer* sequencer,
+        BitmapWindow* window = 0)
+      : _data(data), _sequencer(sequencer), _zoom(0), _aspectRatio(1),
+        _outputSize(0, 0), _inputTL(0, 0), _active(false), _stale(stageAll),
+        _mode(0), _total(0), _pllWidth(0), _pllHeight(0),
+        _decoderBackend(NTSCDecoder::automaticBackend),
+        _reportDecodeTime(false), _keepAllFrames(false), _window(window),
+        _firstQueued(0), _queuedCount(0), _scaleStage(this)
     { }
+    ~CGAOutput() { flush(); }
+    // The first stage of the pipeline: generates the RGBI data, finds the
+    // syncs and decodes to sRGB, then hands the frame over to _scaleStage
+    // (which runs present()) so that the next frame can be decoded while
+    // this one is being scaled.
     void run()
     {
+        Timer timer;
         int connector;
         Vector outputSize;
         int combFilter;
@@ -1223,17 +1390,40 @@ public:
         float overscan;
         double zoom;
         double aspectRatio;
-        static const int decoderPadding = 32;
+        NTSCDecoder::Backend decoderBackend;
+        bool reportDecodeTime;
+        bool keepAllFrames;
         Vector2<float> zoomVector;
         bool bw;
+        int stale;
+        bool dirty;
+        int dirtyStart;
         {
             Lock lock(&_mutex);
             if (!_active)
                 return;
 
+            stale = _stale;
+            _stale = stageNone;
             int total = _data->getTotal();
-            _rgbi.ensure(total);
-            _data->output(0, total, &_rgbi[0], _sequencer, _phase);
+            if (total != _total || _data->getPLLWidth() != _pllWidth ||
+                _data->getPLLHeight() != _pllHeight) {
+                _total = total;
+                _pllWidth = _data->getPLLWidth();
+                _pllHeight = _data->getPLLHeight();
+                stale = stageAll;
+            }
+            dirty = _data->takeDirty(&dirtyStart);
+            if (stale == stageAll || dirty) {
+                if (stale != stageAll) {
+                    // Keep the last frame's RGBI data so that we can find out
+                    // which part of it actually changed.
+                    _lastRGBI.ensure(total);
+                    memcpy(&_lastRGBI[0], &_rgbi[0], total);
+                }
+                _rgbi.ensure(total);
+                _data->output(0, total, &_rgbi[0], _sequencer, _phase);
+            }
 
             connector = _connector;
             combFilter = _combFilter;
@@ -1244,6 +1434,11 @@ public:
             zoom = _zoom;
             aspectRatio = _aspectRatio;
             Byte mode = _data->getDataByte(CGAData::registerMode);
+            if (mode != _mode) {
+                // The decoder settings depend on the mode.
+                _mode = mode;
+                stale = max(stale, static_cast<int>(stageDecode));
+            }
             bw = (mode & 4) != 0;
             _composite.setBW(false);
             bool newCGA = connector == 2;
@@ -1267,170 +1462,48 @@ public:
             _decoder.setLumaBandwidth(_lumaBandwidth);
             _decoder.setRollOff(_rollOff);
             _decoder.setLobes(_lobes);
-            _scaler.setProfile(_scanlineProfile);
-            _scaler.setHorizontalProfile(_horizontalProfile);
-            _scaler.setWidth(static_cast<float>(_scanlineWidth));
-            _scaler.setBleeding(_scanlineBleeding);
-            _scaler.setHorizontalBleeding(_horizontalBleeding);
-            _scaler.setHorizontalRollOff(
-                static_cast<float>(_horizontalRollOff));
-            _scaler.setVerticalRollOff(static_cast<float>(_verticalRollOff));
-            _scaler.setHorizontalLobes(static_cast<float>(_horizontalLobes));
-            _scaler.setVerticalLobes(static_cast<float>(_verticalLobes));
-            _scaler.setSubPixelSeparation(
-                static_cast<float>(_subPixelSeparation));
-            _scaler.setPhosphor(_phosphor);
-            _scaler.setMask(_mask);
-            _scaler.setMaskSize(static_cast<float>(_maskSize));
+            decoderBackend = _decoderBackend;
+            reportDecodeTime = _reportDecodeTime;
+            keepAllFrames = _keepAllFrames;
             zoomVector = scale();
-            _scaler.setZoom(zoomVector);
         }
+        double rgbiTime = timer.elapsed();
 
-        int srgbSize = _data->getTotal();
+        int srgbSize = _total;
         _srgb.ensure(srgbSize*3);
-        int pllWidth = _data->getPLLWidth();
-        int pllHeight = _data->getPLLHeight();
-        static const int driftHorizontal = 8;
-        static const int driftVertical = 14*pllWidth;
-        _scanlines.clear();
-        _fields.clear();
-        _fieldOffsets.clear();
-
-        Byte hSync = 0x41;
-        Byte vSync = 0x42;
-        if (connector != 0) {
-            hSync = 0x44;
-            vSync = 0x44;
-        }
-        int lastScanline = 0;
-        int i;
-        Vector2<float> activeSize(0, 0);
-        do {
-            int offset = (lastScanline + pllWidth - driftHorizontal) %
-                srgbSize;
-            Byte* p = &_rgbi[offset];
-            int n = driftHorizontal*2;
-            if (offset + n <= srgbSize) {
-                for (i = 0; i < n; ++i) {
-                    if ((p[i] & hSync) == hSync)
-                        break;
-                }
-            }
-            else {
-                for (i = 0; i < n; ++i) {
-                    if ((_rgbi[(offset + i) % srgbSize] & hSync) == hSync)
-                        break;
+        int pllWidth = _pllWidth;
+
+        // Find the range of hdots whose RGBI values are actually different
+        // from last time. If only active data changed then the scanlines and
+        // fields are where they were, and only the part of the frame around
+        // the changed range needs to be decoded again.
+        int changedStart = srgbSize;
+        int changedEnd = 0;
+        bool syncChanged = false;
+        if (dirty && stale != stageAll) {
+            for (int t = dirtyStart; t < srgbSize; ++t) {
+                Byte b = _rgbi[t];
+                Byte l = _lastRGBI[t];
+                if (b != l) {
+                    changedStart = min(changedStart, t);
+                    changedEnd = t + 1;
+                    if (b >= 0x10 || l >= 0x10)
+                        syncChanged = true;
                 }
             }
-            i = (i + offset) % srgbSize;
-            activeSize.x = max(activeSize.x,
-                static_cast<float>(wrap(i - lastScanline, srgbSize)));
-            if ((_rgbi[i] & 0x80) != 0)
-                break;
-            _rgbi[i] |= 0x80;
-            _scanlines.append(i);
-            lastScanline = i;
-        } while (true);
-        int firstScanline = _scanlines.count() - 1;
-        for (; firstScanline > 0; --firstScanline) {
-            if (_scanlines[firstScanline] == i)
-                break;
         }
+        if (syncChanged)
+            stale = stageAll;
+        bool fullDecode = stale >= stageDecode;
+        if (!fullDecode && changedStart >= changedEnd && stale == stageNone &&
+            !outputSize.zeroArea() && !keepAllFrames)
+            return;  // Nothing visible has changed.
+        if (stale == stageAll)
+            findSyncs(connector);
+        int firstScanline = _firstScanline;
         int scanlines = _scanlines.count() - firstScanline;
-
-        for (auto& s : _scanlines)
-            _rgbi[s] &= ~0x80;
-        int lastField = 0;
-        do {
-            int offset = (lastField + pllHeight - driftVertical) %
-                srgbSize;
-            Byte* p = &_rgbi[offset];
-            int n = driftVertical*2;
-            int j;
-            int s = 0;
-            if (offset + n <= srgbSize) {
-                for (j = 0; j < n; j += 57) {
-                    if ((p[j] & vSync) == vSync) {
-                        ++s;
-                        if (s == 3)
-                            break;
-                    }
-                    else
-                        s = 0;
-                }
-            }
-            else {
-                for (j = 0; j < n; j += 57) {
-                    if ((_rgbi[(offset + j) % srgbSize] & vSync) == vSync) {
-                        ++s;
-                        if (s == 3)
-                            break;
-                    }
-                    else
-                        s = 0;
-                }
-            }
-            j = (j + offset) % srgbSize;
-            lastField = j;
-            int s0;
-            int s1;
-            float fieldOffset;
-            for (i = 0; i < scanlines; ++i) {
-                s0 = _scanlines[
-                    (firstScanline + scanlines + i - 1) % scanlines];
-                if (s0 < 0)
-                    s0 = -1 - s0;
-                s1 = _scanlines[firstScanline + i];
-                if (s1 < 0)
-                    s1 = -1 - s1;
-                if (s0 < s1) {
-                    if (j >= s0 && j < s1) {
-                        fieldOffset = static_cast<float>(j - s0) / (s1 - s0);
-                        break;
-                    }
-                }
-                else {
-                    if (j >= s0) {
-                        fieldOffset =
-                            static_cast<float>(j - s0) / (s1 + srgbSize - s0);
-                        break;
-                    }
-                    else {
-                        if (j < s1) {
-                            fieldOffset = static_cast<float>(j + srgbSize - s0)
-                                / (s1 + srgbSize - s0);
-                            break;
-                        }
-                    }
-                }
-            }
-            int fo = static_cast<int>(fieldOffset * 8 + 0.5);
-            if (fo == 8) {
-                fo = 0;
-                i = (i + 1) % scanlines;
-            }
-            float f = fo/8.0f;
-            int c = _fields.count() - 1;
-            if (c >= 0) {
-                int iLast = _fields[c];
-                float fLast = _fieldOffsets[c];
-                int lines = (i - iLast + scanlines - 1) % scanlines + 1;
-                activeSize.y = max(activeSize.y,
-                    static_cast<float>(lines) + f - fLast);
-            }
-            if (_scanlines[firstScanline + i] < 0)
-                break;
-            _fields.append(i);
-            _fieldOffsets.append(f);
-            _scanlines[firstScanline + i] = -1 - _scanlines[firstScanline + i];
-        } while (true);
-        int firstField = _fields.count() - 1;
-        for (; firstField > 0; --firstField) {
-            if (_fields[firstField] == i)
-                break;
-        }
-        for (auto& f : _fields)
-            _scanlines[firstScanline + f] = -1 - _scanlines[firstScanline + f];
+        int firstField = _firstField;
+        Vector2<float> activeSize = _activeSize;
 
         // Assume standard overscan/blank/sync areas
         activeSize -= Vector2<float>(272, 62);
@@ -1447,24 +1520,13 @@ public:
             _inputTL = inputTL;
             _outputSize = outputSize;
         }
-        Vector2<float> offset(0, 0);
-        if (connector != 0) {
-            offset = Vector2<float>(-decoderPadding - 0.5f, 0);
-            if (combFilter == 2)
-                offset += Vector2<float>(2, -1);
+        // The range of _srgb that is different from last time.
+        int srgbStart = 0;
+        int srgbEnd = srgbSize;
+        if (!fullDecode) {
+            srgbStart = changedStart;
+            srgbEnd = changedEnd;
         }
-        _scaler.setOffset(inputTL + offset +
-            Vector2<float>(0.5f, 0.5f)/zoomVector);
-        _scaler.setOutputSize(outputSize);
-
-        _bitmap.ensure(outputSize);
-        _scaler.init();
-        _unscaled = _scaler.input();
-        _scaled = _scaler.output();
-        Vector tl = _scaler.inputTL();
-        Vector br = _scaler.inputBR();
-        _unscaledSize = br - tl;
-
         if (connector == 0) {
             // Convert from RGBI to 9.7 fixed-point sRGB
             Byte levels[4];
@@ -1508,9 +1570,9 @@ public:
             Byte srgbPalette[3*0x77];
             for (int i = 0; i < 3*0x77; ++i)
                 srgbPalette[i] = levels[palette[i]];
-            const Byte* rgbi = &_rgbi[0];
-            Byte* srgb = &_srgb[0];
-            for (int x = 0; x < srgbSize; ++x) {
+            const Byte* rgbi = &_rgbi[0] + srgbStart;
+            Byte* srgb = &_srgb[0] + 3*srgbStart;
+            for (int x = srgbStart; x < srgbEnd; ++x) {
                 Byte* p = &srgbPalette[3 * *rgbi];
                 ++rgbi;
                 srgb[0] = p[0];
@@ -1527,6 +1589,7 @@ public:
             _decoder.setLength(decoderOutputLength);
 #else
             _decoder.setPadding(decoderPadding);
+            _decoder.setBackend(decoderBackend);
 #endif
             Byte burst[4];
             for (int i = 0; i < 4; ++i)
@@ -1557,22 +1620,55 @@ public:
             }
             memcpy(&_rgbi[srgbSize], &_rgbi[0], rgbiSize - srgbSize);
 
-            // Convert from RGBI to composite
-            const Byte* rgbi = &_rgbi[0];
-            Byte* ntsc = &_ntsc[0];
-            for (int x = 0; x < ntscSize; ++x) {
-                *ntsc = _composite.simulateCGA(*rgbi, rgbi[1], x & 3);
-                ++rgbi;
-                ++ntsc;
+            // Convert from RGBI to composite. Each composite sample depends
+            // on two RGBI samples, and the start of the RGBI data is repeated
+            // at the end, so a changed RGBI range affects two composite
+            // ranges.
+            int ntscStart[2] = {0, ntscSize};
+            int ntscEnd[2] = {ntscSize, ntscSize};
+            if (!fullDecode) {
+                for (int r = 0; r < 2; ++r) {
+                    ntscStart[r] =
+                        clamp(0, changedStart - 1 + r*srgbSize, ntscSize);
+                    ntscEnd[r] = clamp(0, changedEnd + r*srgbSize, ntscSize);
+                }
+            }
+            for (int r = 0; r < 2; ++r) {
+                if (ntscStart[r] < ntscEnd[r]) {
+                    _composite.simulateLine(&_rgbi[ntscStart[r]],
+                        &_ntsc[ntscStart[r]], ntscEnd[r] - ntscStart[r],
+                        (ntscStart[r] - 1) & 3);
+                }
             }
             // Apply comb filter and decode to sRGB.
-            ntsc = &_ntsc[0];
             Byte* srgb = &_srgb[0];
             static const int fftLength = 512;
             int stride = fftLength - 2*decoderPadding;
             Byte* ntscBlock = &_ntsc[0];
             Timer decodeTimer;
 
+            // Only the blocks whose input includes changed composite samples
+            // need to be decoded again. The block starting at j reads
+            // fftLength samples from each of the lines it combs. The last
+            // block overlaps the previous one, so it also needs to be decoded
+            // if the previous one was.
+            int blockInput = fftLength + combTL.y*pllWidth;
+            srgbStart = srgbSize;
+            srgbEnd = 0;
+            auto needsDecoding = [&](int j)
+            {
+                bool changed = j < srgbEnd;
+                for (int r = 0; r < 2; ++r) {
+                    if (j < ntscEnd[r] && j + blockInput > ntscStart[r])
+                        changed = true;
+                }
+                if (!changed)
+                    return false;
+                srgbStart = min(srgbStart, j);
+                srgbEnd = max(srgbEnd, j + stride);
+                return true;
+            };
+
 #if FIR_DECODING
             stride = decoderOutputLength;
             switch (combFilter) {
@@ -1583,9 +1679,11 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
                         Byte* ip = ntscBlock + decoderPadding + inputLeft;
 
 #if FIR_FP
@@ -1607,8 +1705,6 @@ public:
 #endif
                         _decoder.execute();
                         _decoder.outputToSRGB(reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
                 case 1:
@@ -1622,9 +1718,11 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
 
                         Byte* ip0 = ntscBlock + decoderPadding + inputLeft;
                         Byte* ip1 = ip0 + pllWidth;
@@ -1650,8 +1748,6 @@ public:
 
                         _decoder.execute();
                         _decoder.outputToSRGB(reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
                 case 2:
@@ -1661,9 +1757,11 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
 
                         Byte* ip0 = ntscBlock + decoderPadding + inputLeft;
                         Byte* ip1 = ip0 + pllWidth;
@@ -1691,8 +1789,6 @@ public:
 #endif
                         _decoder.execute();
                         _decoder.outputToSRGB(reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
             }
@@ -1705,13 +1801,13 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
                         _decoder.decodeNTSC(ntscBlock,
                             reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
                 case 1:
@@ -1725,9 +1821,11 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
                         Byte* n0 = ntscBlock;
                         Byte* n1 = n0 + pllWidth;
                         float* y = _decoder.yData();
@@ -1749,8 +1847,6 @@ public:
                             q += 2;
                         }
                         _decoder.decodeBlock(reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
                 case 2:
@@ -1760,9 +1856,11 @@ public:
                             // The last block is a small one, so we'll decode
                             // it by overlapping the previous one.
                             j = srgbSize - stride;
-                            ntscBlock = &_ntsc[j];
-                            srgb = &_srgb[3*j];
                         }
+                        if (!needsDecoding(j))
+                            continue;
+                        ntscBlock = &_ntsc[j];
+                        srgb = &_srgb[3*j];
                         Byte* n0 = ntscBlock;
                         Byte* n1 = n0 + pllWidth;
                         Byte* n2 = n1 + pllWidth;
@@ -1786,24 +1884,168 @@ public:
                             q += 2;
                         }
                         _decoder.decodeBlock(reinterpret_cast<SRGB*>(srgb));
-                        srgb += stride*3;
-                        ntscBlock += stride;
                     }
                     break;
             }
 #endif
-            //decodeTimer.output("Decoder: ");
+#if !FIR_DECODING
+            if (reportDecodeTime) {
+                decodeTimer.output(_decoder.usingFIR() ? "FIR decoder" :
+                    "FFT decoder");
+            }
+#endif
+        }
+        // Hand the frame over to the scale stage. Normally if it hasn't taken
+        // the last one yet, that one is superseded by this one, so the
+        // changes are accumulated. If every frame is wanted, this one is
+        // queued behind it instead, and we only wait if the queue is full.
+        double decodeTime = timer.elapsed() - rgbiTime;
+        if (keepAllFrames) {
+            do {
+                {
+                    Lock lock(&_frameMutex);
+                    if (_queuedCount < maxQueuedFrames)
+                        break;
+                }
+                _frameTaken.wait();
+            } while (true);
+        }
+        {
+            Lock lock(&_frameMutex);
+            _timings._rgbi += rgbiTime;
+            _timings._decode += decodeTime;
+            if (_queuedCount == 0 || keepAllFrames)
+                ++_queuedCount;
+            Frame* f = &_queuedFrames[
+                (_firstQueued + _queuedCount - 1)%maxQueuedFrames];
+            f->change(srgbStart, srgbEnd);
+            // A frame that is being superseded may have a different changed
+            // range, and the parts of its buffer outside that range are from
+            // whichever frame last used it, so the whole merged range is
+            // copied.
+            f->_srgb.ensure(srgbSize*3);
+            if (f->_start < f->_end) {
+                memcpy(&f->_srgb[3*f->_start], &_srgb[3*f->_start],
+                    3*(f->_end - f->_start));
+            }
+            if (stale == stageAll) {
+                int n = _scanlines.count();
+                f->_scanlines.ensure(n);
+                memcpy(&f->_scanlines[0], &_scanlines[0], n*sizeof(int));
+                n = _fields.count();
+                f->_fields.ensure(n);
+                memcpy(&f->_fields[0], &_fields[0], n*sizeof(int));
+                f->_scanlineCount = scanlines;
+                f->_firstScanline = firstScanline;
+                f->_firstField = firstField;
+            }
+            f->_stale = max(f->_stale, stale);
+            f->_size = srgbSize;
+            f->_connector = connector;
+            f->_combFilter = combFilter;
+            f->_showClipping = showClipping;
+            f->_inputTL = inputTL;
+            f->_outputSize = outputSize;
+            f->_zoom = zoomVector;
+            f->_keep = keepAllFrames;
+        }
+        _scaleStage.restart();
+    }
+
+    // The second stage of the pipeline, run by _scaleStage: takes the frames
+    // that run() has queued, oldest first, and presents each of them.
+    void present()
+    {
+        do {
+            {
+                Lock lock(&_frameMutex);
+                if (_queuedCount == 0)
+                    return;
+                _frame.take(&_queuedFrames[_firstQueued]);
+                _firstQueued = (_firstQueued + 1)%maxQueuedFrames;
+                --_queuedCount;
+            }
+            _frameTaken.signal();
+            presentFrame();
+        } while (true);
+    }
+
+    // Linearizes _frame, scales it and shows it.
+    void presentFrame()
+    {
+        Timer timer;
+        {
+            Lock lock(&_mutex);
+            _scaler.setProfile(_scanlineProfile);
+            _scaler.setHorizontalProfile(_horizontalProfile);
+            _scaler.setWidth(static_cast<float>(_scanlineWidth));
+            _scaler.setBleeding(_scanlineBleeding);
+            _scaler.setHorizontalBleeding(_horizontalBleeding);
+            _scaler.setHorizontalRollOff(
+                static_cast<float>(_horizontalRollOff));
+            _scaler.setVerticalRollOff(static_cast<float>(_verticalRollOff));
+            _scaler.setHorizontalLobes(static_cast<float>(_horizontalLobes));
+            _scaler.setVerticalLobes(static_cast<float>(_verticalLobes));
+            _scaler.setSubPixelSeparation(
+                static_cast<float>(_subPixelSeparation));
+            _scaler.setPhosphor(_phosphor);
+            _scaler.setMask(_mask);
+            _scaler.setMaskSize(static_cast<float>(_maskSize));
         }
+        int connector = _frame._connector;
+        int combFilter = _frame._combFilter;
+        bool showClipping = _frame._showClipping;
+        Vector2<float> inputTL = _frame._inputTL;
+        Vector outputSize = _frame._outputSize;
+        Vector2<float> zoomVector = _frame._zoom;
+        int stale = _frame._stale;
+        int srgbSize = _frame._size;
+        int srgbStart = _frame._start;
+        int srgbEnd = _frame._end;
+        int scanlines = _frame._scanlineCount;
+        int firstScanline = _frame._firstScanline;
+        int firstField = _frame._firstField;
+        const Array<int>& scanlineStarts = _frame._scanlines;
+        const Array<Byte>& srgbFrame = _frame._srgb;
+        _scaler.setZoom(zoomVector);
+
+        Vector2<float> offset(0, 0);
+        if (connector != 0) {
+            offset = Vector2<float>(-decoderPadding - 0.5f, 0);
+            if (combFilter == 2)
+                offset += Vector2<float>(2, -1);
+        }
+        _scaler.setOffset(inputTL + offset +
+            Vector2<float>(0.5f, 0.5f)/zoomVector);
+        _scaler.setOutputSize(outputSize);
+
+        _bitmap.ensure(outputSize);
+        bool rescaled = _scaler.init();
+        _unscaled = _scaler.input();
+        _scaled = _scaler.output();
+        Vector tl = _scaler.inputTL();
+        Vector br = _scaler.inputBR();
+        _unscaledSize = br - tl;
+
         // Shift, clip, show clipping and linearization
-        _linearizer.setShowClipping(showClipping && _connector != 0);
-        tl.y = wrap(tl.y + _fields[firstField], scanlines);
-        Byte* unscaledRow = _unscaled.data();
+        _linearizer.setShowClipping(showClipping && connector != 0);
+        tl.y = wrap(tl.y + _frame._fields[firstField], scanlines);
+        Byte* unscaledRow = _unscaled.data() - _unscaled.stride();
         int scanlineChannels = _unscaledSize.x*3;
+        int rowsChanged = 0;
         for (int y = 0; y < _unscaledSize.y; ++y) {
+            unscaledRow += _unscaled.stride();
             int offsetTL = wrap(
-                tl.x + _scanlines[(tl.y + y)%scanlines + firstScanline],
+                tl.x + scanlineStarts[(tl.y + y)%scanlines + firstScanline],
                 srgbSize);
-            const Byte* srgbRow = &_srgb[offsetTL*3];
+            // If the scaler's input buffer is the same as last time, rows
+            // whose sRGB data hasn't changed are still there.
+            int offsetBR = offsetTL + _unscaledSize.x;
+            if (!rescaled && (offsetTL >= srgbEnd || offsetBR <= srgbStart) &&
+                offsetBR - srgbSize <= srgbStart)
+                continue;
+            ++rowsChanged;
+            const Byte* srgbRow = &srgbFrame[offsetTL*3];
             float* unscaled = reinterpret_cast<float*>(unscaledRow);
             const Byte* srgb = srgbRow;
             if (offsetTL + _unscaledSize.x > srgbSize) {
@@ -1811,24 +2053,30 @@ public:
                 for (int x = 0; x < endChannels; ++x)
                     unscaled[x] = _linearizer.linear(srgb[x]);
                 for (int x = 0; x < scanlineChannels - endChannels; ++x)
-                    unscaled[x + endChannels] = _linearizer.linear(_srgb[x]);
+                    unscaled[x + endChannels] =
+                        _linearizer.linear(srgbFrame[x]);
             }
             else {
                 for (int x = 0; x < scanlineChannels; ++x)
                     unscaled[x] = _linearizer.linear(srgb[x]);
             }
-            unscaledRow += _unscaled.stride();
         }
+        if (rowsChanged == 0 && stale < stageScale && !_frame._keep)
+            return;  // The changes were all outside the visible area.
+        double linearizeTime = timer.elapsed();
 
-        // Scale to desired size and apply scanline filter
+        // Scale to desired size and apply scanline filter. The scanline
+        // bleeding carries down the whole frame, so all of this needs to be
+        // done even if only a few rows changed.
         _scaler.render();
+        double scaleTime = timer.elapsed();
 
         // Delinearization and float-to-byte conversion
         const Byte* scaledRow = _scaled.data();
         Byte* outputRow = _bitmap.data();
         for (int y = 0; y < outputSize.y; ++y) {
             const float* scaled = reinterpret_cast<const float*>(scaledRow);
-            DWORD* output = reinterpret_cast<DWORD*>(outputRow);
+            Pixel* output = reinterpret_cast<Pixel*>(outputRow);
             for (int x = 0; x < outputSize.x; ++x) {
                 SRGB srgb =
                     _linearizer.srgb(Colour(scaled[0], scaled[1], scaled[2]));
@@ -1839,15 +2087,33 @@ public:
             scaledRow += _scaled.stride();
             outputRow += _bitmap.stride();
         }
+        {
+            Lock lock(&_frameMutex);
+            ++_timings._frames;
+            _timings._linearize += linearizeTime;
+            _timings._scale += scaleTime - linearizeTime;
+            _timings._delinearize += timer.elapsed() - scaleTime;
+        }
         _lastBitmap = _bitmap;
-        _bitmap = _window->setNextBitmap(_bitmap);
+        _bitmap = outputFrame(_bitmap);
+    }
+
+    // Called by the scale stage with each frame that is rendered. Returns
+    // the bitmap to render the next frame into.
+    virtual Bitmap<Pixel> outputFrame(Bitmap<Pixel> bitmap)
+    {
+#ifdef _WIN32
+        if (_window != 0)
+            return _window->setNextBitmap(bitmap);
+#endif
+        return bitmap;
     }
 
     void save(String outputFileName)
     {
         setOutputSize(Vector(0, 0));
-        join();
-        _lastBitmap.save(PNGFileFormat<DWORD>(),
+        flush();
+        _lastBitmap.save(PNGFileFormat<Pixel>(),
             File(outputFileName + ".png", true));
 
         if (_connector != 0) {
@@ -1861,6 +2127,7 @@ public:
         {
             Lock lock(&_mutex);
             _connector = connector;
+            invalidate(stageAll);
         }
         restart();
     }
@@ -1870,6 +2137,7 @@ public:
         {
             Lock lock(&_mutex);
             _scanlineProfile = profile;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1879,6 +2147,7 @@ public:
         {
             Lock lock(&_mutex);
             _horizontalProfile = profile;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1888,6 +2157,7 @@ public:
         {
             Lock lock(&_mutex);
             _scanlineWidth = width;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1897,6 +2167,7 @@ public:
         {
             Lock lock(&_mutex);
             _scanlineBleeding = bleeding;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1906,6 +2177,7 @@ public:
         {
             Lock lock(&_mutex);
             _horizontalBleeding = bleeding;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1916,7 +2188,9 @@ public:
             zoom = 1.0;
         {
             Lock lock(&_mutex);
-            if (_window->hWnd() != 0) {
+#ifdef _WIN32
+            // Keep the point under the mouse (or the centre) where it is.
+            if (_window != 0 && _window->hWnd() != 0) {
                 Vector mousePosition = _window->mousePosition();
                 Vector size = _outputSize;
                 Vector2<float> position = Vector2Cast<float>(size)/2.0f;
@@ -1928,7 +2202,9 @@ public:
                     Vector2<float>(static_cast<float>(_aspectRatio)/2.0f, 1.0f)
                     *static_cast<float>(_zoom*zoom));
             }
+#endif
             _zoom = zoom;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1938,6 +2214,7 @@ public:
         {
             Lock lock(&_mutex);
             _horizontalRollOff = rollOff;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1947,6 +2224,7 @@ public:
         {
             Lock lock(&_mutex);
             _horizontalLobes = lobes;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1956,6 +2234,7 @@ public:
         {
             Lock lock(&_mutex);
             _verticalRollOff = rollOff;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1965,6 +2244,7 @@ public:
         {
             Lock lock(&_mutex);
             _verticalLobes = lobes;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1974,6 +2254,7 @@ public:
         {
             Lock lock(&_mutex);
             _subPixelSeparation = separation;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1983,6 +2264,7 @@ public:
         {
             Lock lock(&_mutex);
             _phosphor = phosphor;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -1992,6 +2274,7 @@ public:
         {
             Lock lock(&_mutex);
             _mask = mask;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -2001,6 +2284,7 @@ public:
         {
             Lock lock(&_mutex);
             _maskSize = size;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -2011,7 +2295,9 @@ public:
             ratio = 1.0;
         {
             Lock lock(&_mutex);
-            if (_window->hWnd() != 0) {
+#ifdef _WIN32
+            // Keep the point under the mouse (or the centre) where it is.
+            if (_window != 0 && _window->hWnd() != 0) {
                 Vector mousePosition = _window->mousePosition();
                 Vector size = _outputSize;
                 Vector2<float> position = Vector2Cast<float>(size)/2.0f;
@@ -2022,7 +2308,9 @@ public:
                 _inputTL.x += position.x*2.0f*static_cast<float>(
                     (ratio - _aspectRatio)/(_zoom*ratio*_aspectRatio));
             }
+#endif
             _aspectRatio = ratio;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -2032,6 +2320,7 @@ public:
         {
             Lock lock(&_mutex);
             _overscan = overscan;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -2041,6 +2330,7 @@ public:
             Lock lock(&_mutex);
             _outputSize = outputSize;
             _active = true;
+            invalidate(stageScale);
         }
         restart();
     }
@@ -2049,6 +2339,7 @@ public:
         {
             Lock lock(&_mutex);
             _combFilter = combFilter;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2059,6 +2350,7 @@ public:
         {
             Lock lock(&_mutex);
             _hue = hue;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2068,6 +2360,7 @@ public:
         {
             Lock lock(&_mutex);
             _saturation = saturation;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2077,6 +2370,7 @@ public:
         {
             Lock lock(&_mutex);
             _contrast = contrast;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2086,6 +2380,7 @@ public:
         {
             Lock lock(&_mutex);
             _brightness = brightness;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2095,6 +2390,7 @@ public:
         {
             Lock lock(&_mutex);
             _showClipping = showClipping;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2104,6 +2400,7 @@ public:
         {
             Lock lock(&_mutex);
             _chromaBandwidth = chromaBandwidth;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2113,6 +2410,7 @@ public:
         {
             Lock lock(&_mutex);
             _lumaBandwidth = lumaBandwidth;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2122,6 +2420,7 @@ public:
         {
             Lock lock(&_mutex);
             _rollOff = rollOff;
+            invalidate(stageDecode);
         }
         restart();
     }
@@ -2131,15 +2430,71 @@ public:
         {
             Lock lock(&_mutex);
             _lobes = lobes;
+            invalidate(stageDecode);
         }
         restart();
     }
     double getLobes() { return _lobes; }
+    // The decoder normally picks FFT or FIR filtering by kernel length, but
+    // either can be forced (to compare them, for example).
+    void setDecoderBackend(NTSCDecoder::Backend backend)
+    {
+        {
+            Lock lock(&_mutex);
+            _decoderBackend = backend;
+            invalidate(stageDecode);
+        }
+        restart();
+    }
+    NTSCDecoder::Backend getDecoderBackend() { return _decoderBackend; }
+    // Normally a frame that the scale stage hasn't got to yet is replaced by
+    // a newer one, which is what an interactive display wants. With
+    // keepAllFrames set (for exporting), up to maxQueuedFrames frames are
+    // queued for the scale stage, run() only waits when the queue is full,
+    // and every run() produces exactly one call to outputFrame(), even if
+    // nothing has changed.
+    void setKeepAllFrames(bool keepAllFrames)
+    {
+        Lock lock(&_mutex);
+        _keepAllFrames = keepAllFrames;
+    }
+    // Returns the timings since the last call.
+    Timings takeTimings()
+    {
+        Lock lock(&_frameMutex);
+        Timings timings = _timings;
+        _timings = Timings();
+        return timings;
+    }
+    // Redoes every stage for the next frame, even if nothing has changed.
+    void refresh()
+    {
+        {
+            Lock lock(&_mutex);
+            invalidate(stageAll);
+        }
+        restart();
+    }
+    // Waits until both stages have finished with all the frames they have
+    // been given.
+    void flush()
+    {
+        // run() hands frames to _scaleStage, so has to finish first.
+        join();
+        _scaleStage.join();
+    }
+    // Writes the time taken to decode each frame to the console.
+    void setReportDecodeTime(bool reportDecodeTime)
+    {
+        Lock lock(&_mutex);
+        _reportDecodeTime = reportDecodeTime;
+    }
     void setPhase(int phase)
     {
         {
             Lock lock(&_mutex);
             _phase = phase;
+            invalidate(stageAll);
         }
         restart();
     }
@@ -2170,6 +2525,10 @@ public:
             }
             _inputTL =
                 _dragStartInputPosition - Vector2Cast<float>(position)/scale();
+            {
+                Lock lock(&_mutex);
+                invalidate(stageScale);
+            }
             restart();
         }
         _dragging = button;
@@ -2181,6 +2540,268 @@ public:
     }
 
 private:
+    // The stages of run() and present() that a setting can affect. Each
+    // setter raises _stale to the earliest stage that it affects, and that
+    // stage and everything after it are redone. Changes to the CGAData are
+    // found with CGAData::takeDirty() instead, since those usually only
+    // affect part of the frame.
+    enum Stage
+    {
+        stageNone,    // Nothing to redo
+        stageScale,   // Linearization and scaling
+        stageDecode,  // RGBI to sRGB conversion
+        stageAll      // Everything, including finding the syncs
+    };
+    void invalidate(Stage stage)
+    {
+        _stale = max(_stale, static_cast<int>(stage));
+    }
+
+    // hdots of NTSC decoded either side of each block
+    static const int decoderPadding = 32;
+
+    // A decoded frame on its way from run() to present(). run() writes to
+    // the ones in _queuedFrames (with _frameMutex held) and present() takes
+    // them in order into _frame, which it owns. Only the parts that changed
+    // are copied, so the buffers are reused from frame to frame.
+    struct Frame
+    {
+        Frame() : _size(0), _start(0), _end(0), _stale(stageNone) { }
+        // Adds [start, end) to the range of _srgb that changed.
+        void change(int start, int end)
+        {
+            if (start >= end)
+                return;
+            if (_start < _end) {
+                start = min(start, _start);
+                end = max(end, _end);
+            }
+            _start = start;
+            _end = end;
+        }
+        // Brings this frame up to date with pending, which is then left with
+        // no changes (ready to be queued again).
+        void take(Frame* pending)
+        {
+            _srgb.ensure(pending->_size*3);
+            if (pending->_start < pending->_end) {
+                memcpy(&_srgb[3*pending->_start],
+                    &pending->_srgb[3*pending->_start],
+                    3*(pending->_end - pending->_start));
+            }
+            if (pending->_stale == stageAll) {
+                int n = pending->_scanlines.count();
+                _scanlines.ensure(n);
+                memcpy(&_scanlines[0], &pending->_scanlines[0],
+                    n*sizeof(int));
+                n = pending->_fields.count();
+                _fields.ensure(n);
+                memcpy(&_fields[0], &pending->_fields[0], n*sizeof(int));
+                _scanlineCount = pending->_scanlineCount;
+                _firstScanline = pending->_firstScanline;
+                _firstField = pending->_firstField;
+            }
+            _size = pending->_size;
+            _start = pending->_start;
+            _end = pending->_end;
+            _stale = pending->_stale;
+            _connector = pending->_connector;
+            _combFilter = pending->_combFilter;
+            _showClipping = pending->_showClipping;
+            _inputTL = pending->_inputTL;
+            _outputSize = pending->_outputSize;
+            _zoom = pending->_zoom;
+            _keep = pending->_keep;
+            pending->_start = 0;
+            pending->_end = 0;
+            pending->_stale = stageNone;
+        }
+
+        Array<Byte> _srgb;
+        Array<int> _scanlines;  // Only updated when the syncs are found
+        Array<int> _fields;
+        int _scanlineCount;
+        int _firstScanline;
+        int _firstField;
+        int _size;
+        int _start;             // Range of _srgb that changed
+        int _end;
+        int _stale;
+        int _connector;
+        int _combFilter;
+        bool _showClipping;
+        Vector2<float> _inputTL;
+        Vector _outputSize;
+        Vector2<float> _zoom;
+        bool _keep;             // Render even if nothing has changed
+    };
+
+    class ScaleStage : public ThreadTask
+    {
+    public:
+        ScaleStage(CGAOutput* output) : _output(output) { }
+        void run() { _output->present(); }
+    private:
+        CGAOutput* _output;
+    };
+
+    // Finds the scanlines and fields in _rgbi from the sync pulses.
+    void findSyncs(int connector)
+    {
+        int srgbSize = _total;
+        int pllWidth = _pllWidth;
+        int pllHeight = _pllHeight;
+        static const int driftHorizontal = 8;
+        int driftVertical = 14*pllWidth;
+        _scanlines.clear();
+        _fields.clear();
+        _fieldOffsets.clear();
+
+        Byte hSync = 0x41;
+        Byte vSync = 0x42;
+        if (connector != 0) {
+            hSync = 0x44;
+            vSync = 0x44;
+        }
+        int lastScanline = 0;
+        int i;
+        Vector2<float> activeSize(0, 0);
+        do {
+            int offset = (lastScanline + pllWidth - driftHorizontal) %
+                srgbSize;
+            Byte* p = &_rgbi[offset];
+            int n = driftHorizontal*2;
+            if (offset + n <= srgbSize) {
+                for (i = 0; i < n; ++i) {
+                    if ((p[i] & hSync) == hSync)
+                        break;
+                }
+            }
+            else {
+                for (i = 0; i < n; ++i) {
+                    if ((_rgbi[(offset + i) % srgbSize] & hSync) == hSync)
+                        break;
+                }
+            }
+            i = (i + offset) % srgbSize;
+            activeSize.x = max(activeSize.x,
+                static_cast<float>(wrap(i - lastScanline, srgbSize)));
+            if ((_rgbi[i] & 0x80) != 0)
+                break;
+            _rgbi[i] |= 0x80;
+            _scanlines.append(i);
+            lastScanline = i;
+        } while (true);
+        int firstScanline = _scanlines.count() - 1;
+        for (; firstScanline > 0; --firstScanline) {
+            if (_scanlines[firstScanline] == i)
+                break;
+        }
+        int scanlines = _scanlines.count() - firstScanline;
+        _firstScanline = firstScanline;
+
+        for (auto& s : _scanlines)
+            _rgbi[s] &= ~0x80;
+        int lastField = 0;
+        do {
+            int offset = (lastField + pllHeight - driftVertical) %
+                srgbSize;
+            Byte* p = &_rgbi[offset];
+            int n = driftVertical*2;
+            int j;
+            int s = 0;
+            if (offset + n <= srgbSize) {
+                for (j = 0; j < n; j += 57) {
+                    if ((p[j] & vSync) == vSync) {
+                        ++s;
+                        if (s == 3)
+                            break;
+                    }
+                    else
+                        s = 0;
+                }
+            }
+            else {
+                for (j = 0; j < n; j += 57) {
+                    if ((_rgbi[(offset + j) % srgbSize] & vSync) == vSync) {
+                        ++s;
+                        if (s == 3)
+                            break;
+                    }
+                    else
+                        s = 0;
+                }
+            }
+            j = (j + offset) % srgbSize;
+            lastField = j;
+            int s0;
+            int s1;
+            float fieldOffset = 0;
+            for (i = 0; i < scanlines; ++i) {
+                s0 = _scanlines[
+                    (firstScanline + scanlines + i - 1) % scanlines];
+                if (s0 < 0)
+                    s0 = -1 - s0;
+                s1 = _scanlines[firstScanline + i];
+                if (s1 < 0)
+                    s1 = -1 - s1;
+                if (s0 < s1) {
+                    if (j >= s0 && j < s1) {
+                        fieldOffset = static_cast<float>(j - s0) / (s1 - s0);
+                        break;
+                    }
+                }
+                else {
+                    if (j >= s0) {
+                        fieldOffset =
+                            static_cast<float>(j - s0) / (s1 + srgbSize - s0);
+                        break;
+                    }
+                    else {
+                        if (j < s1) {
+                            fieldOffset = static_cast<float>(j + srgbSize - s0)
+                                / (s1 + srgbSize - s0);
+                            break;
+                        }
+                    }
+                }
+            }
+            // The scanlines go all the way round, so one of them should
+            // contain the vertical sync. If none does, start the field at
+            // the first one.
+            if (i == scanlines)
+                i = 0;
+            int fo = static_cast<int>(fieldOffset * 8 + 0.5);
+            if (fo == 8) {
+                fo = 0;
+                i = (i + 1) % scanlines;
+            }
+            float f = fo/8.0f;
+            int c = _fields.count() - 1;
+            if (c >= 0) {
+                int iLast = _fields[c];
+                float fLast = _fieldOffsets[c];
+                int lines = (i - iLast + scanlines - 1) % scanlines + 1;
+                activeSize.y = max(activeSize.y,
+                    static_cast<float>(lines) + f - fLast);
+            }
+            if (_scanlines[firstScanline + i] < 0)
+                break;
+            _fields.append(i);
+            _fieldOffsets.append(f);
+            _scanlines[firstScanline + i] = -1 - _scanlines[firstScanline + i];
+        } while (true);
+        int firstField = _fields.count() - 1;
+        for (; firstField > 0; --firstField) {
+            if (_fields[firstField] == i)
+                break;
+        }
+        for (auto& f : _fields)
+            _scanlines[firstScanline + f] = -1 - _scanlines[firstScanline + f];
+        _firstField = firstField;
+        _activeSize = activeSize;
+    }
+
     // Output pixels per input pixel
     Vector2<float> scale()
     {
@@ -2193,6 +2814,9 @@ private:
     AppendableArray<int> _scanlines;    // hdot positions of scanline starts
     AppendableArray<int> _fields;       // scanline numbers of field starts
     AppendableArray<float> _fieldOffsets; // fractional scanline numbers
+    int _firstScanline;
+    int _firstField;
+    Vector2<float> _activeSize;
 
     int _connector;
     int _phase;
@@ -2225,9 +2849,17 @@ private:
     int _combFilter;
     bool _showClipping;
     bool _active;
+    int _stale;
+    Byte _mode;
+    int _total;
+    int _pllWidth;
+    int _pllHeight;
+    NTSCDecoder::Backend _decoderBackend;
+    bool _reportDecodeTime;
+    bool _keepAllFrames;
 
-    Bitmap<DWORD> _bitmap;
-    Bitmap<DWORD> _lastBitmap;
+    Bitmap<Pixel> _bitmap;
+    Bitmap<Pixel> _lastBitmap;
     CGAComposite _composite;
 #if FIR_DECODING
     MatchingNTSCDecoder _decoder;
@@ -2241,12 +2873,26 @@ private:
     ScanlineRenderer _scaler;
     Vector _combedSize;
     Array<Byte> _rgbi;
+    Array<Byte> _lastRGBI;
     Array<Byte> _ntsc;
     Array<Byte> _srgb;
     Vector _unscaledSize;
     AlignedBuffer _unscaled;
     AlignedBuffer _scaled;
 
+    // Frames in flight between the two stages when keepAllFrames is set.
+    // An interactive display only ever has one queued.
+    static const int maxQueuedFrames = 4;
+
+    Mutex _frameMutex;
+    Frame _queuedFrames[maxQueuedFrames];  // A ring, oldest at _firstQueued
+    int _firstQueued;
+    int _queuedCount;
+    Frame _frame;
+    Event _frameTaken;
+    Timings _timings;
+    ScaleStage _scaleStage;
+
     bool _dragging;
     Vector _dragStart;
     Vector2<float> _dragStartInputPosition;
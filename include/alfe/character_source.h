@@ -108,6 +108,9 @@ public:
     CharacterSourceT(const String& string) : _string(string) { }
     CharacterSourceT(const String& string, const File& file)
       : _string(string), _location(file) { }
+    // Parses the contents of a mapped file in place.
+    CharacterSourceT(const FileMapping& mapping, const File& file)
+      : _string(mapping.string()), _mapping(mapping), _location(file) { }
     int get(Span* span = 0)
     {
         Location start = _location;
@@ -317,6 +320,8 @@ private:
     }
 
     String _string;
+    // Keeps _string's memory alive if it refers to a mapped file.
+    FileMapping _mapping;
     Location _location;
 };
 
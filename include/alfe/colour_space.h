@@ -151,11 +151,11 @@ template<class T> class LUVColourSpaceBodyT : public ColourSpaceBody
 public:
     Colour fromSrgb(const Colour& srgb)
     {
-        return fromRgb(ColourSpace::rgb().fromSrgb(srgb));
+        return fromRgb(ColourSpaceT<T>::rgb().fromSrgb(srgb));
     }
     Colour toSrgb(const Colour& luv)
     {
-        return ColourSpace::rgb().toSrgb(toRgb(luv));
+        return ColourSpaceT<T>::rgb().toSrgb(toRgb(luv));
     }
     Colour fromRgb(const Colour& rgb) { return luvFromRgb(rgb); }
     Colour toRgb(const Colour& luv)
@@ -177,7 +177,7 @@ public:
             return SRGB(0, 0, 0);
         float x = y*(9.0f*uu)/(4.0f*vv);
         float z = y*(12.0f - 3.0f*uu - 20.0f*vv)/(4.0f*vv);
-        return ColourSpace::xyz().toRgb(Colour(x, y, z));
+        return ColourSpaceT<T>::xyz().toRgb(Colour(x, y, z));
     }
 private:
     LUVColourSpaceBodyT() { }
@@ -192,17 +192,17 @@ template<class T> class LABColourSpaceBodyT : public ColourSpaceBody
 public:
     Colour fromSrgb(const Colour& srgb)
     {
-        return fromRgb(ColourSpace::rgb().fromSrgb(srgb));
+        return fromRgb(ColourSpaceT<T>::rgb().fromSrgb(srgb));
     }
     Colour toSrgb(const Colour& lab)
     {
-        return ColourSpace::rgb().toSrgb(toRgb(lab));
+        return ColourSpaceT<T>::rgb().toSrgb(toRgb(lab));
     }
     Colour fromRgb(const Colour& rgb) { return labFromRgb(rgb); }
     Colour toRgb(const Colour& lab)
     {
         float y = (lab.x + 16.0f)/116.0f;
-        return ColourSpace::xyz().toRgb(Colour(
+        return ColourSpaceT<T>::xyz().toRgb(Colour(
             xyzFromLabHelper(y + lab.y/500.0f),
             xyzFromLabHelper(y),
             xyzFromLabHelper(y - lab.z/200.0f)));
@@ -227,11 +227,11 @@ public:
     Colour toSrgb(const Colour& srgb) { return srgb; }
     Colour fromRgb(const Colour& rgb)
     {
-        return ColourSpace::rgb().toSrgb(rgb);
+        return ColourSpaceT<T>::rgb().toSrgb(rgb);
     }
     Colour toRgb(const Colour& srgb)
     {
-        return ColourSpace::rgb().fromSrgb(srgb);
+        return ColourSpaceT<T>::rgb().fromSrgb(srgb);
     }
 private:
     SRGBColourSpaceBodyT() { }
@@ -280,11 +280,11 @@ template<class T> class XYZColourSpaceBodyT : public ColourSpaceBody
 public:
     Colour fromSrgb(const Colour& srgb)
     {
-        return fromRgb(ColourSpace::rgb().fromSrgb(srgb));
+        return fromRgb(ColourSpaceT<T>::rgb().fromSrgb(srgb));
     }
     Colour toSrgb(const Colour& xyz)
     {
-        return ColourSpace::rgb().toSrgb(toRgb(xyz));
+        return ColourSpaceT<T>::rgb().toSrgb(toRgb(xyz));
     }
     Colour fromRgb(const Colour& rgb)
     {
@@ -347,11 +347,11 @@ private:
     static XYZColourSpaceBody _xyz;
 };
 
-LUVColourSpaceBody ColourSpace::_luv;
-LABColourSpaceBody ColourSpace::_lab;
-SRGBColourSpaceBody ColourSpace::_srgb;
-RGBColourSpaceBody ColourSpace::_rgb;
-XYZColourSpaceBody ColourSpace::_xyz;
+template<class T> LUVColourSpaceBody ColourSpaceT<T>::_luv;
+template<class T> LABColourSpaceBody ColourSpaceT<T>::_lab;
+template<class T> SRGBColourSpaceBody ColourSpaceT<T>::_srgb;
+template<class T> RGBColourSpaceBody ColourSpaceT<T>::_rgb;
+template<class T> XYZColourSpaceBody ColourSpaceT<T>::_xyz;
 
 class Linearizer
 {
@@ -0,0 +1,277 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_COMPILED_EXPRESSION_H
+#define INCLUDED_COMPILED_EXPRESSION_H
+
+#include "alfe/function.h"
+
+template<class T> class ExpressionCompilerT;
+typedef ExpressionCompilerT<void> ExpressionCompiler;
+
+template<class T> class CompiledExpressionT;
+typedef CompiledExpressionT<void> CompiledExpression;
+
+// A CompiledExpression is a resolved Expression lowered to a flat list of
+// instructions for a small stack machine, for expressions that are evaluated
+// more than once. Compared with Expression::evaluate():
+//   Literals, and calls to pure funcos whose arguments are all constant, are
+//   evaluated once at compile time. So are conditions that turn out to be
+//   constant, and only the branch that would be taken is compiled.
+//   Each distinct identifier gets a slot, and is looked up in the context the
+//   first time it is needed in each evaluation instead of at every use.
+//   Calls go straight to the funco that resolve() picked.
+// Expressions that have no compiled form of their own (member access,
+// constructor calls, calls that couldn't be resolved statically etc.) are
+// compiled to an instruction that walks their subtree, so any resolved
+// Expression can be compiled. The result is always an rvalue.
+template<class T> class CompiledExpressionT : private ConstHandle
+{
+public:
+    CompiledExpressionT() { }
+    CompiledExpressionT(const Expression& expression)
+      : CompiledExpressionT(compile(expression)) { }
+    bool valid() const { return ConstHandle::valid(); }
+    // Returns true if the whole expression was folded to a constant, in which
+    // case evaluate() doesn't need a context.
+    bool constant() const
+    {
+        return body()->_code.count() == 1 &&
+            body()->_code[0]._opcode == pushConstant;
+    }
+    ValueT<T> evaluate(Structure* context) const
+    {
+        const Body* b = body();
+        int slots = b->_identifiers.count();
+        Array<ValueT<T>> stack(slots + b->_stackSize);
+        int sp = slots;
+        int n = b->_code.count();
+        for (int pc = 0; pc < n; ++pc) {
+            const Instruction& i = b->_code[pc];
+            switch (i._opcode) {
+                case pushConstant:
+                    stack[sp] = b->_constants[i._operand];
+                    ++sp;
+                    break;
+                case load:
+                    {
+                        ValueT<T>& v = stack[i._operand];
+                        if (!v.valid())
+                            v = context->getValue(b->_identifiers[i._operand]);
+                        // Like LValue::rValue(), the value gets the span of
+                        // the identifier rather than that of its definition.
+                        stack[sp] = ValueT<T>(v.type(), v.value(),
+                            b->_spans[i._span]);
+                        ++sp;
+                    }
+                    break;
+                case call:
+                    {
+                        int arity = b->_arities[i._operand];
+                        List<ValueT<T>> arguments;
+                        for (int a = sp - arity; a < sp; ++a)
+                            arguments.add(stack[a]);
+                        sp -= arity;
+                        stack[sp] = b->_funcos[i._operand].evaluate(arguments,
+                            b->_spans[i._span]).simplify();
+                        ++sp;
+                    }
+                    break;
+                case evaluateTree:
+                    stack[sp] =
+                        b->_trees[i._operand].evaluate(context).rValue();
+                    ++sp;
+                    break;
+                case checkBoolean:
+                    if (stack[sp - 1].type() != BooleanTypeT<T>()) {
+                        b->_spans[i._span].throwError(
+                            b->_messages[i._operand]);
+                    }
+                    break;
+                case branchUnless:
+                    --sp;
+                    if (!stack[sp].template value<bool>())
+                        pc = i._operand - 1;
+                    break;
+                case jump:
+                    pc = i._operand - 1;
+                    break;
+            }
+        }
+        return stack[sp - 1];
+    }
+private:
+    enum Opcode
+    {
+        pushConstant,  // Push _constants[_operand]
+        load,          // Push the value of _identifiers[_operand]
+        call,          // Pop arguments, push result of _funcos[_operand]
+        evaluateTree,  // Push the value of _trees[_operand]
+        checkBoolean,  // Throw _messages[_operand] unless top is a Boolean
+        branchUnless,  // Pop, and go to _operand if it was false
+        jump           // Go to _operand
+    };
+    struct Instruction
+    {
+        Instruction() { }
+        Instruction(Opcode opcode, int operand, int span)
+          : _opcode(opcode), _operand(operand), _span(span) { }
+        Opcode _opcode;
+        int _operand;
+        int _span;
+    };
+    class Body : public ConstHandle::Body
+    {
+    public:
+        AppendableArray<Instruction> _code;
+        AppendableArray<ValueT<T>> _constants;
+        AppendableArray<Identifier> _identifiers;
+        AppendableArray<FuncoT<T>> _funcos;
+        AppendableArray<int> _arities;
+        AppendableArray<Expression> _trees;
+        AppendableArray<Span> _spans;
+        AppendableArray<String> _messages;
+        int _stackSize;
+    };
+    CompiledExpressionT(const ConstHandle& other) : ConstHandle(other) { }
+    static CompiledExpressionT compile(const Expression& expression)
+    {
+        ExpressionCompilerT<T> compiler;
+        expression.compile(&compiler);
+        return compiler.compiled();
+    }
+    const Body* body() const { return as<Body>(); }
+
+    friend class ExpressionCompilerT<T>;
+};
+
+// The code generator that Expression::Body::compile() implementations use.
+// Code is only ever appended, except that constants at the end can be
+// removed again when they get folded into something else.
+template<class T> class ExpressionCompilerT : Uncopyable
+{
+    typedef CompiledExpressionT<T> Compiled;
+    typedef typename Compiled::Instruction Instruction;
+public:
+    ExpressionCompilerT()
+      : _compiled(ConstHandle::create<typename Compiled::Body>()),
+        _body(const_cast<typename Compiled::Body*>(_compiled.body())),
+        _depth(0), _maxDepth(0)
+    { }
+    int position() const { return _body->_code.count(); }
+    void constant(const ValueT<T>& value)
+    {
+        emit(Compiled::pushConstant, _body->_constants.count(), 1);
+        _body->_constants.append(value);
+    }
+    void load(const Identifier& identifier, const Span& span)
+    {
+        int slot = 0;
+        for (auto i : _body->_identifiers) {
+            if (i == identifier)
+                break;
+            ++slot;
+        }
+        if (slot == _body->_identifiers.count())
+            _body->_identifiers.append(identifier);
+        emit(Compiled::load, slot, 1, span);
+    }
+    // Emits a call to funco with the top arguments values on the stack,
+    // whose code starts at start. The call is folded if possible.
+    void call(const FuncoT<T>& funco, int arguments, int start,
+        const Span& span)
+    {
+        if (funco.pure() && constantsSince(start, arguments)) {
+            List<ValueT<T>> values;
+            for (int i = start; i < position(); ++i)
+                values.add(_body->_constants[_body->_code[i]._operand]);
+            try {
+                ValueT<T> v = funco.evaluate(values, span).simplify();
+                rewind(start);
+                constant(v);
+                return;
+            }
+            catch (...) {
+                // Leave the error for run time, since this code might
+                // never be reached.
+            }
+        }
+        emit(Compiled::call, _body->_funcos.count(), 1 - arguments, span);
+        _body->_funcos.append(funco);
+        _body->_arities.append(arguments);
+    }
+    void tree(const Expression& expression)
+    {
+        emit(Compiled::evaluateTree, _body->_trees.count(), 1);
+        _body->_trees.append(expression);
+    }
+    void checkBoolean(const Span& span, const String& message)
+    {
+        emit(Compiled::checkBoolean, _body->_messages.count(), 0, span);
+        _body->_messages.append(message);
+    }
+    // branchUnless() and jump() return the instruction to pass to target()
+    // once the destination is known. The code after a jump() is the other
+    // side of a branch, so it starts with one less value on the stack.
+    int branchUnless() { return emit(Compiled::branchUnless, 0, -1); }
+    int jump() { return emit(Compiled::jump, 0, -1); }
+    void target(int instruction)
+    {
+        _body->_code[instruction]._operand = position();
+    }
+    // If everything emitted since start is a single constant, returns true
+    // and sets *value to it.
+    bool constantSince(int start, ValueT<T>* value) const
+    {
+        if (!constantsSince(start, 1))
+            return false;
+        *value = _body->_constants[_body->_code[start]._operand];
+        return true;
+    }
+    // Removes the constants emitted since start.
+    void rewind(int start)
+    {
+        int n = position() - start;
+        assert(constantsSince(start, n));
+        _body->_code.unappend(n);
+        _depth -= n;
+    }
+    Compiled compiled()
+    {
+        _body->_stackSize = _maxDepth;
+        return _compiled;
+    }
+private:
+    // Every value's code is at least one instruction long, so n values
+    // compiled since start are all constants if there are exactly n
+    // instructions since start and they are all pushConstant.
+    bool constantsSince(int start, int n) const
+    {
+        if (position() != start + n)
+            return false;
+        for (int i = start; i < position(); ++i)
+            if (_body->_code[i]._opcode != Compiled::pushConstant)
+                return false;
+        return true;
+    }
+    int emit(typename Compiled::Opcode opcode, int operand, int push,
+        const Span& span = Span())
+    {
+        int s = 0;
+        if (opcode == Compiled::load || opcode == Compiled::call ||
+            opcode == Compiled::checkBoolean) {
+            s = _body->_spans.count();
+            _body->_spans.append(span);
+        }
+        _body->_code.append(Instruction(opcode, operand, s));
+        _depth += push;
+        _maxDepth = max(_maxDepth, _depth);
+        return position() - 1;
+    }
+
+    Compiled _compiled;
+    typename Compiled::Body* _body;
+    int _depth;
+    int _maxDepth;
+};
+
+#endif // INCLUDED_COMPILED_EXPRESSION_H
@@ -187,7 +187,7 @@ template<class T> class ConcreteTypeTemplate : public Type
         typedef Array<int>::Body<BaseBody> Body;
     public:
         String toString() const { return "Concrete"; }
-        bool equals(const ConstHandle::Body* other) const
+        bool equals(const ::ConstHandle::Body* other) const
         {
             auto b = other->to<Body>();
             if (b == 0)
@@ -19,6 +19,7 @@ public:
             ++i;
             return Value(l + i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -55,6 +56,7 @@ public:
             ++i;
             return Value(l - i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -91,6 +93,7 @@ public:
             ++i;
             return Value(l * i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -127,6 +130,7 @@ public:
             ++i;
             return l * i->convertTo(RationalType()).value<Rational>();
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -163,6 +167,7 @@ public:
             ++i;
             return Value(l * i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -197,6 +202,7 @@ public:
             ++i;
             return Value(l / i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -232,6 +238,7 @@ public:
             ++i;
             return l / i->convertTo(RationalType()).value<Rational>();
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -267,6 +274,7 @@ public:
             ++i;
             return Value(l / i->value<Concrete>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -305,6 +313,7 @@ public:
                 return l*Rational(1, 1 << -r);
             return l*Rational(1 << r, 1);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftLeft(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
@@ -343,6 +352,7 @@ public:
                 return l*Rational(1 << -r, 1);
             return l*Rational(1, 1 << r);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftRight(); }
         bool argumentsMatch(List<Type> argumentTypes) const
         {
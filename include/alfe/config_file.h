@@ -10,6 +10,7 @@
 #include "alfe/set.h"
 #include "alfe/expression.h"
 #include "alfe/function.h"
+#include "alfe/compiled_expression.h"
 #include "alfe/integer_functions.h"
 #include "alfe/string_functions.h"
 #include "alfe/rational_functions.h"
@@ -165,9 +166,7 @@ public:
             s = source;
             Span span;
             if (Space::parseKeyword(&s, "include", &span)) {
-                Expression e = Expression::parse(&s);
-                e.resolve(&_scope);
-                Value v = e.evaluate(this).convertTo(StringType());
+                Value v = evaluate(&s).convertTo(StringType());
                 Space::assertCharacter(&s, ';', &span);
                 load(File(v.value<String>(), _file.parent()));
                 source = s;
@@ -187,11 +186,8 @@ public:
                         " already exists");
                 }
                 Value value = StructuredType::empty();
-                if (Space::parseCharacter(&s, '=', &span)) {
-                    Expression e = Expression::parse(&s);
-                    e.resolve(&_scope);
-                    value = e.evaluate(this);
-                }
+                if (Space::parseCharacter(&s, '=', &span))
+                    value = evaluate(&s);
                 Space::assertCharacter(&s, ';', &span);
                 source = s;
                 value = value.rValue().convertTo(type);
@@ -225,12 +221,8 @@ public:
             le.resolve(&_scope);
             Value left = le.evaluate(this);
             Space::assertCharacter(&source, '=', &span);
-            Expression e = Expression::parse(&source);
-            if (!e.valid())
-                source.location().throwError("Expected expression.");
+            Value loadedExpression = evaluate(&source);
             Space::assertCharacter(&source, ';', &span);
-            e.resolve(&_scope);
-            Value loadedExpression = e.evaluate(this);
             LValueType lValueType(left.type());
             if (!lValueType.valid())
                 left.span().throwError("LValue required");
@@ -277,16 +269,28 @@ public:
 
     File file() const { return _file; }
 
-    template<class U> U evaluate(String text, const U& def)
+    // Parses and resolves an expression in the scope of this file.
+    Expression parse(String text)
     {
         CharacterSource s(text);
+        Expression e = Expression::parse(&s);
+        if (!e.valid())
+            s.location().throwError("Expected expression.");
+        e.resolve(&_scope);
+        return e;
+    }
+    // Parses, resolves and compiles an expression in the scope of this file,
+    // for callers that will evaluate it many times.
+    CompiledExpression compile(String text)
+    {
+        return CompiledExpression(parse(text));
+    }
+
+    template<class U> U evaluate(String text, const U& def)
+    {
         Value c;
         try {
-            Expression e = Expression::parse(&s);
-            if (!e.valid())
-                return def;
-            e.resolve(&_scope);
-            Value v = e.evaluate(this);
+            Value v = compile(text).evaluate(this);
             if (!v.valid())
                 return def;
             c = v.convertTo(typeFromCompileTimeType<U>());
@@ -299,6 +303,28 @@ public:
         return c.template value<U>();
     }
 private:
+    // Parses and evaluates the expression on the right of a statement. All
+    // expressions are evaluated through CompiledExpression, so that there is
+    // only one evaluator to keep correct and constant folding applies to
+    // config files too. The result is an rvalue.
+    //
+    // The parse tree is thrown away as soon as the value is known, so its
+    // nodes come from an arena and are freed all at once. The evaluation
+    // itself can create objects (like components) that last as long as the
+    // values in the file do, so it doesn't use the arena. Names that are kept
+    // (those of new objects and of assigned members) are parsed outside it.
+    Value evaluate(CharacterSource* source)
+    {
+        SmallObjectArena arena;
+        Expression e = Expression::parse(source);
+        if (!e.valid())
+            source->location().throwError("Expected expression.");
+        e.resolve(&_scope);
+        CompiledExpression compiled(e);
+        SmallObjectArena::Pause pause;
+        return compiled.evaluate(this);
+    }
+
     File _file;
     StructureOwner _structureOwner;
     Scope _scope;
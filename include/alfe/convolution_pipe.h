@@ -10,7 +10,14 @@
 #include "alfe/gcd.h"
 #include "float.h"
 
-class ProductKernel;
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ALFE_CONVOLUTION_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALFE_CONVOLUTION_SSE2
+#endif
 
 // A convolution kernel is indexed in such a way that the input samples
 // correspond to integer input values.
@@ -25,38 +32,30 @@ public:
         virtual double rightExtent() const { return DBL_MAX; }
     };
 
-    ConvolutionKernel(Body* body) : Handle(body) { }
-    double operator()(double x) const { return (body()->operator())(x); }
-    double leftExtent() const { return _body->leftExtent(); }
-    double rightExtent() const { return _body->rightExtent(); }
-    ConvolutionKernel& operator*=(const ConvolutionKernel& right)
-    {
-        _body = new ProductKernel(*this, right);
-    }
-    ConvolutionKernel& operator+=(const ConvolutionKernel& right)
-    {
-        _body = new SumKernel(*this, right);
-    }
-    ConvolutionKernel& operator-=(const ConvolutionKernel& right)
-    {
-        _body = new SumKernel(*this, -right);
-    }
-    ConvolutionKernel operator-() const
-    {
-        return ProductKernel(*this, ConstantKernel());
-    }
-    ConvolutionKernel operator*(const ConvolutionKernel& right)
+    ConvolutionKernel(const Handle& other) : Handle(other) { }
+    double operator()(double x) const { return (*body())(x); }
+    double leftExtent() const { return body()->leftExtent(); }
+    double rightExtent() const { return body()->rightExtent(); }
+    ConvolutionKernel& operator*=(const ConvolutionKernel& right);
+    ConvolutionKernel& operator+=(const ConvolutionKernel& right);
+    ConvolutionKernel& operator-=(const ConvolutionKernel& right);
+    ConvolutionKernel operator-() const;
+    ConvolutionKernel operator*(const ConvolutionKernel& right) const
     {
         ConvolutionKernel k = *this; k *= right; return k;
     }
-    ConvolutionKernel operator+(const ConvolutionKernel& right)
+    ConvolutionKernel operator+(const ConvolutionKernel& right) const
     {
         ConvolutionKernel k = *this; k += right; return k;
     }
-    ConvolutionKernel operator-(const ConvolutionKernel& right)
+    ConvolutionKernel operator-(const ConvolutionKernel& right) const
     {
         ConvolutionKernel k = *this; k -= right; return k;
     }
+protected:
+    using Handle::create;
+private:
+    const Body* body() const { return as<Body>(); }
 };
 
 // Sinc filter corresponds to perfect band-limited interpolation - it removes
@@ -64,11 +63,13 @@ public:
 class SincFilter : public ConvolutionKernel
 {
 public:
-    SincFilter() : ConvolutionKernel(new Body) { }
+    SincFilter() : ConvolutionKernel(create<Body>()) { }
     class Body : public ConvolutionKernel::Body
     {
         virtual double operator()(double x) const
         {
+            if (x == 0)
+                return 1;
             return sin(M_PI*x)/(M_PI*x);
         }
     };
@@ -78,7 +79,7 @@ class RectangleWindow : public ConvolutionKernel
 {
 public:
     RectangleWindow(double semiWidth)
-      : ConvolutionKernel(new Body(semiWidth)) { }
+      : ConvolutionKernel(create<Body>(semiWidth)) { }
     class Body : public ConvolutionKernel::Body
     {
     public:
@@ -95,7 +96,7 @@ class ScaledFilter : public ConvolutionKernel
 {
 public:
     ScaledFilter(ConvolutionKernel kernel, double scale)
-      : ConvolutionKernel(new Body(kernel, scale)) { }
+      : ConvolutionKernel(create<Body>(kernel, scale)) { }
     class Body : public ConvolutionKernel::Body
     {
     public:
@@ -123,7 +124,7 @@ class ProductKernel : public ConvolutionKernel
 {
 public:
     ProductKernel(ConvolutionKernel a, ConvolutionKernel b)
-      : ConvolutionKernel(new Body(a, b)) { }
+      : ConvolutionKernel(create<Body>(a, b)) { }
     class Body : public ConvolutionKernel::Body
     {
     public:
@@ -148,7 +149,7 @@ class SumKernel : public ConvolutionKernel
 {
 public:
     SumKernel(ConvolutionKernel a, ConvolutionKernel b)
-      : ConvolutionKernel(new Body(a, b)) { }
+      : ConvolutionKernel(create<Body>(a, b)) { }
     class Body : public ConvolutionKernel::Body
     {
     public:
@@ -172,137 +173,442 @@ public:
 class ConstantKernel : public ConvolutionKernel
 {
 public:
-    ConstantKernel(double c) : ConvolutionKernel(new Body(c)) { }
+    ConstantKernel(double c) : ConvolutionKernel(create<Body>(c)) { }
     class Body : public ConvolutionKernel::Body
     {
     public:
         Body(double c) : _c(c) { }
-        virtual double operator()(double) const { return c; }
+        virtual double operator()(double) const { return _c; }
     private:
         double _c;
     };
 };
 
+inline ConvolutionKernel& ConvolutionKernel::operator*=(
+    const ConvolutionKernel& right)
+{
+    *this = ProductKernel(*this, right);
+    return *this;
+}
+
+inline ConvolutionKernel& ConvolutionKernel::operator+=(
+    const ConvolutionKernel& right)
+{
+    *this = SumKernel(*this, right);
+    return *this;
+}
+
+inline ConvolutionKernel& ConvolutionKernel::operator-=(
+    const ConvolutionKernel& right)
+{
+    *this = SumKernel(*this, -right);
+    return *this;
+}
+
+inline ConvolutionKernel ConvolutionKernel::operator-() const
+{
+    return ProductKernel(*this, ConstantKernel(-1));
+}
+
+
+// Multiply-accumulate of n input samples with n coefficients. This is the
+// inner loop of all the convolution pipes, so there are vectorized versions
+// for float and double samples. The coefficient tables are padded to a
+// multiple of convolutionTapAlignment taps so that these don't usually need a
+// scalar tail.
+static const int convolutionTapAlignment = 8;
+
+template<class T> T dotProduct(const T* input, const T* coefficients, int n)
+{
+    T sample = 0;
+    for (int i = 0; i < n; ++i)
+        sample += input[i]*coefficients[i];
+    return sample;
+}
+
+#ifdef ALFE_CONVOLUTION_SSE2
+inline float dotProduct(const float* input, const float* coefficients, int n)
+{
+    int i = 0;
+#ifdef __AVX__
+    __m256 a0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(input + i),
+            _mm256_loadu_ps(coefficients + i)));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_loadu_ps(input + i + 8),
+            _mm256_loadu_ps(coefficients + i + 8)));
+    }
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_loadu_ps(input + i),
+            _mm256_loadu_ps(coefficients + i)));
+    }
+    a0 = _mm256_add_ps(a0, a1);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a0),
+        _mm256_extractf128_ps(a0, 1));
+#else
+    __m128 s = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(input + i),
+            _mm_loadu_ps(coefficients + i)));
+    }
+#endif
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    float sample = _mm_cvtss_f32(s);
+    for (; i < n; ++i)
+        sample += input[i]*coefficients[i];
+    return sample;
+}
+
+inline double dotProduct(const double* input, const double* coefficients,
+    int n)
+{
+    int i = 0;
+#ifdef __AVX__
+    __m256d a0 = _mm256_setzero_pd();
+    __m256d a1 = _mm256_setzero_pd();
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_pd(a0, _mm256_mul_pd(_mm256_loadu_pd(input + i),
+            _mm256_loadu_pd(coefficients + i)));
+        a1 = _mm256_add_pd(a1, _mm256_mul_pd(_mm256_loadu_pd(input + i + 4),
+            _mm256_loadu_pd(coefficients + i + 4)));
+    }
+    a0 = _mm256_add_pd(a0, a1);
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a0),
+        _mm256_extractf128_pd(a0, 1));
+#else
+    __m128d s = _mm_setzero_pd();
+    for (; i + 2 <= n; i += 2) {
+        s = _mm_add_pd(s, _mm_mul_pd(_mm_loadu_pd(input + i),
+            _mm_loadu_pd(coefficients + i)));
+    }
+#endif
+    s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+    double sample = _mm_cvtsd_f64(s);
+    for (; i < n; ++i)
+        sample += input[i]*coefficients[i];
+    return sample;
+}
+#endif
+
+
+// A table of kernel coefficients in polyphase form. Row r holds the
+// coefficients for an output sample r/phases of the way from one input sample
+// to the next, in the order that the input samples are read, so that each
+// output sample is a single dot product over contiguous memory. "scale" is
+// the number of output samples per input sample (the kernel is measured in
+// output samples). The first tap of each row is firstTap() input samples
+// from the output sample's position. The pipes using the table start reading
+// at the first tap, so their output sample i is centred on input sample
+// i*consumerRate/producerRate - firstTap().
+template<class T> class PolyphaseKernel
+{
+public:
+    PolyphaseKernel() : _firstTap(0), _taps(0) { }
+    PolyphaseKernel(ConvolutionKernel kernel, double scale, int phases,
+        int rows)
+    {
+        double le = kernel.leftExtent();
+        double re = kernel.rightExtent();
+        if (le == -DBL_MAX || re == DBL_MAX) {
+            throw Exception("Convolution kernel must have a finite extent - "
+                "multiply it by a window.");
+        }
+        _firstTap = static_cast<int>(floor(le/scale));
+        int taps = static_cast<int>(floor(re/scale)) - _firstTap + 2;
+        _taps = (taps + convolutionTapAlignment - 1) &
+            -convolutionTapAlignment;
+        _coefficients.allocate(rows*_taps);
+        for (int r = 0; r < rows; ++r) {
+            double f = static_cast<double>(r)/phases;
+            T* row = &_coefficients[r*_taps];
+            for (int k = 0; k < _taps; ++k) {
+                double x = (_firstTap + k - f)*scale;
+                row[k] = 0;
+                if (k < taps && x >= le && x <= re)
+                    row[k] = static_cast<T>(kernel(x));
+            }
+        }
+    }
+    const T* row(int r) const { return &_coefficients[r*_taps]; }
+    int taps() const { return _taps; }
+    int firstTap() const { return _firstTap; }
+private:
+    Array<T> _coefficients;
+    int _firstTap;
+    int _taps;
+};
+
+
+// Base class for the convolution pipes. It copies the input samples needed
+// for a block of output samples out of the (circular) Sink buffer into a
+// linear window, so that the dot products don't need to deal with
+// wrap-around. The n passed to produce() is the number of samples to output.
+// "scale" is the number of output samples per input sample.
+template<class T, class P> class ConvolutionPipeBase : public Pipe<T, T, P>
+{
+public:
+    ConvolutionPipeBase(P* p, double scale, int n)
+      : Pipe<T, T, P>(p, n), _scale(scale) { }
+protected:
+    const T* window(int n)
+    {
+        _window.ensure(n);
+        CopyTo<T> copy(&_window[0]);
+        this->_sink.reader(n).items(copy, n);
+        return &_window[0];
+    }
+    // Called when n samples have been produced using up to taps input
+    // samples each. Once the input is known to be finite, this also tells
+    // the consumer how many more samples there will be - one for each output
+    // sample that still has all its input to come, so that the pipe is never
+    // asked for one that would need input past the end.
+    void written(int n, int taps)
+    {
+        this->_source.written(n);
+        if (this->_sink.finite()) {
+            this->_source.remaining(max(0, static_cast<int>(
+                (this->_sink.remaining() - taps - 1)*_scale)));
+        }
+    }
+private:
+    Array<T> _window;
+    double _scale;
+};
+
+
 // A convolution pipe which computes kernel coefficients as they are needed,
-// which is likely to be very slow. The kernel is measured in output samples
+// which is likely to be very slow but works for any resampling factor
+// (including one that changes). The kernel is measured in output samples
 // which is the appropriate default for downsampling. For upsampling, scale
-// the
+// the kernel (with ScaledFilter) so that it is measured in input samples.
 template<class T, class Rate = int> class SmallConvolutionPipe
-  : public Pipe<T, T, SmallConvolutionPipe<T, Rate> >
+  : public ConvolutionPipeBase<T, SmallConvolutionPipe<T, Rate>>
 {
+    typedef ConvolutionPipeBase<T, SmallConvolutionPipe<T, Rate>> Base;
 public:
+    // For every "consumerRate" samples consumed we will produce "producerRate"
+    // samples.
     SmallConvolutionPipe(Rate producerRate, Rate consumerRate,
         ConvolutionKernel kernel, int n = defaultSampleCount)
-      : Pipe(this, n),
+      : Base(this, static_cast<double>(producerRate)/consumerRate, n),
         _kernel(kernel),
         _t(0),
-        _r(static_cast<double>(producerRate)/consumerRate),
+        _scale(static_cast<double>(producerRate)/consumerRate),
         _le(kernel.leftExtent()),
-        _re(kernel.rightExtent()),
-        _maxRead((n + (_re - _le))/_r)
-    { }
+        _re(kernel.rightExtent())
+    {
+        // The taps needed for one output sample are the same as for one row
+        // of a PolyphaseKernel, so use an empty one to work out how many.
+        PolyphaseKernel<T> shape(kernel, _scale, 1, 0);
+        _firstTap = shape.firstTap();
+        _row.allocate(shape.taps());
+    }
     void produce(int n)
     {
-        Accessor<T> reader = _sink.reader(_maxRead);
-        Accessor<T> writer = _source.writer(n);
+        int taps = _row.count();
+        // The extra sample allows for _t accumulating rounding errors.
+        const T* input = this->window(
+            static_cast<int>(_t + (n - 1)/_scale) + 1 + taps);
+        Accessor<T> writer = this->_source.writer(n);
         int read = 0;
+        T* row = &_row[0];
         for (int i = 0; i < n; ++i) {
-            T sample = 0;
-            int j = read;
-            for (double k = _t + _le; k < _re; k += _r) {
-                sample += reader.item(j)*_kernel(k);
-                ++j;
+            for (int k = 0; k < taps; ++k) {
+                double x = (_firstTap + k - _t)*_scale;
+                row[k] = 0;
+                if (x >= _le && x <= _re)
+                    row[k] = static_cast<T>(_kernel(x));
             }
-            writer.item() = sample;
-
-            int r = static_cast<int>((_r + 1.0 - _t)/_r);
-            _t += r*_r;
+            writer.item() = dotProduct(input + read, row, taps);
+            _t += 1/_scale;
+            int r = static_cast<int>(_t);
+            _t -= r;
             read += r;
         }
-        _sink.read(read);
-        _source.written(n);
+        this->_sink.read(read);
+        this->written(n, taps);
     }
 private:
     ConvolutionKernel _kernel;
     double _t;
-    double _r;
-    int _maxRead;  // Maximum number of samples that are read at once
+    double _scale;
     double _le;
     double _re;
+    int _firstTap;
+    Array<T> _row;
 };
 
+
 // A convolution pipe that stores the kernel coefficients it requires. This
 // may use a lot of memory if the producing and consuming rates have a high
 // lowest common multiple, and it can't be used if the resampling factor
 // changes.
 template<class T, class Rate = int> class LCMConvolutionPipe
-  : public Pipe<T, T, LCMConvolutionPipe<T, Rate> >
+  : public ConvolutionPipeBase<T, LCMConvolutionPipe<T, Rate>>
 {
+    typedef ConvolutionPipeBase<T, LCMConvolutionPipe<T, Rate>> Base;
 public:
     // For every "consumerRate" samples consumed we will produce "producerRate"
     // samples.
     LCMConvolutionPipe(Rate producerRate, Rate consumerRate,
         ConvolutionKernel kernel, int n = defaultSampleCount)
-      : Pipe(this, n),
-        _t(0)
+      : Base(this, static_cast<double>(producerRate)/consumerRate, n),
+        _phase(0)
     {
-        Rate l = lcm(producerRate, consumerRate);  // 275625000
-        int c = l/producerRate;  // 6250
-        _delta = l/consumerRate;  // 231
-        double le = kernel.leftExtent();
-        double re = kernel.rightExtent();
-        double extent = re-le;  // 10
-        _maxRead = (n + extent)/_r;
-        _kernelSize = extent*c;
-        // TODO: rearrange kernel coefficients so that they are adjacent in
-        // memory for better cache performance
-        _kernel.allocate(_kernelSize);
-        for (int i = 0; i < _kernelSize; ++i)
-            _kernel[i] = kernel(static_cast<double>(i)/c + le);
+        Rate g = gcd(producerRate, consumerRate);
+        _phases = static_cast<int>(producerRate/g);
+        Rate c = consumerRate/g;
+        // Output sample i is at input position i*c/_phases. Each output
+        // advances the phase by c, which is _step whole input samples and
+        // _delta phases.
+        _step = static_cast<int>(c/_phases);
+        _delta = static_cast<int>(c%_phases);
+        _kernel = PolyphaseKernel<T>(kernel,
+            static_cast<double>(producerRate)/consumerRate, _phases,
+            _phases);
     }
     void produce(int n)
     {
-        Accessor<T> reader = _sink.reader(_maxRead);
-        Accessor<T> writer = _source.writer(n);
+        int taps = _kernel.taps();
+        const T* input = this->window(static_cast<int>((n - 1)*_step +
+            (_phase + static_cast<SInt64>(n - 1)*_delta)/_phases) + taps);
+        Accessor<T> writer = this->_source.writer(n);
         int read = 0;
         for (int i = 0; i < n; ++i) {
-            T sample = 0;
-            int j = read;
-            for (int k = _t; k < _kernelSize; k += _delta) {
-                sample += reader.item(j)*_kernel[k];
-                ++j;
+            writer.item() =
+                dotProduct(input + read, _kernel.row(_phase), taps);
+            read += _step;
+            _phase += _delta;
+            if (_phase >= _phases) {
+                _phase -= _phases;
+                ++read;
             }
-            writer.item() = sample;
-            int r = static_cast<int>((c + _delta - _t)/_delta);
-            _t += r*_delta;
-            read += r;
         }
-        _sink.read(read);
-        _source.written(n);
+        this->_sink.read(read);
+        this->written(n, taps);
     }
 private:
-    // _kernel is indexed in units of 1/c of an output sample and offset by le
-    // output samples
-    Array<T> _kernel;
-    int _kernelSize;
-    int _t;
+    PolyphaseKernel<T> _kernel;
+    int _phases;
+    int _phase;
+    int _step;
     int _delta;
-    int _t;
 };
 
+
+// Base class for convolution pipes that use a fixed number of phases
+// regardless of the resampling factor. The position between input samples is
+// kept in 32.32 fixed point so that the output doesn't depend on rounding
+// errors accumulating in a double.
+template<class T, class Rate, class P> class FixedPhaseConvolutionPipe
+  : public ConvolutionPipeBase<T, P>
+{
+public:
+    FixedPhaseConvolutionPipe(P* p, Rate producerRate, Rate consumerRate,
+        ConvolutionKernel kernel, int phases, int n)
+      : ConvolutionPipeBase<T, P>(p,
+            static_cast<double>(producerRate)/consumerRate, n),
+        _kernel(kernel, static_cast<double>(producerRate)/consumerRate,
+            phases, phases + 1),
+        _phases(phases),
+        _position(0),
+        _step((static_cast<UInt64>(consumerRate) << 32)/producerRate)
+    { }
+protected:
+    // Returns the input samples needed for the next n output samples.
+    const T* outputWindow(int n)
+    {
+        return this->window(static_cast<int>(
+            (_position + (n - 1)*_step) >> 32) + _kernel.taps());
+    }
+    void advance(int n)
+    {
+        _position += n*_step;
+        this->_sink.read(static_cast<int>(_position >> 32));
+        _position &= 0xffffffff;
+    }
+
+    PolyphaseKernel<T> _kernel;
+    int _phases;
+    UInt64 _position;
+    UInt64 _step;
+};
+
+
 // A convolution pipe that computes a fixed number of kernel coefficients, and
 // uses the closest one to the one required.
 template<class T, class Rate = int> class NearestNeighborConvolutionPipe
-  : public Pipe<T, T, NearestNeighborConvolutionPipe<T, Rate> >
+  : public FixedPhaseConvolutionPipe<T, Rate,
+        NearestNeighborConvolutionPipe<T, Rate>>
 {
-    // TODO
+    typedef FixedPhaseConvolutionPipe<T, Rate,
+        NearestNeighborConvolutionPipe<T, Rate>> Base;
+public:
+    // For every "consumerRate" samples consumed we will produce "producerRate"
+    // samples.
+    NearestNeighborConvolutionPipe(Rate producerRate, Rate consumerRate,
+        ConvolutionKernel kernel, int phases = 256,
+        int n = defaultSampleCount)
+      : Base(this, producerRate, consumerRate, kernel, phases, n)
+    { }
+    void produce(int n)
+    {
+        int taps = this->_kernel.taps();
+        const T* input = this->outputWindow(n);
+        Accessor<T> writer = this->_source.writer(n);
+        UInt64 position = this->_position;
+        for (int i = 0; i < n; ++i) {
+            int phase = static_cast<int>(((position & 0xffffffff)*
+                this->_phases + 0x80000000) >> 32);
+            writer.item() = dotProduct(input + (position >> 32),
+                this->_kernel.row(phase), taps);
+            position += this->_step;
+        }
+        this->advance(n);
+        this->written(n, taps);
+    }
 };
 
+
 // A convolution pipe that computes a fixed number of kernel coefficients, and
-// uses linear interpolation to find the others.
+// uses linear interpolation to find the others. Since convolution is linear,
+// interpolating between the outputs of the two nearest rows is the same as
+// interpolating the coefficients and then convolving.
 template<class T, class Rate = int> class LinearConvolutionPipe
-  : public Pipe<T, T, LinearConvolutionPipe<T, Rate> >
+  : public FixedPhaseConvolutionPipe<T, Rate, LinearConvolutionPipe<T, Rate>>
 {
+    typedef FixedPhaseConvolutionPipe<T, Rate,
+        LinearConvolutionPipe<T, Rate>> Base;
+public:
+    // For every "consumerRate" samples consumed we will produce "producerRate"
+    // samples.
+    LinearConvolutionPipe(Rate producerRate, Rate consumerRate,
+        ConvolutionKernel kernel, int phases = 256,
+        int n = defaultSampleCount)
+      : Base(this, producerRate, consumerRate, kernel, phases, n)
+    { }
+    void produce(int n)
+    {
+        int taps = this->_kernel.taps();
+        const T* input = this->outputWindow(n);
+        Accessor<T> writer = this->_source.writer(n);
+        UInt64 position = this->_position;
+        for (int i = 0; i < n; ++i) {
+            UInt64 p = (position & 0xffffffff)*this->_phases;
+            int phase = static_cast<int>(p >> 32);
+            T a = static_cast<T>(static_cast<double>(p & 0xffffffff)/
+                4294967296.0);
+            const T* x = input + (position >> 32);
+            T s0 = dotProduct(x, this->_kernel.row(phase), taps);
+            T s1 = dotProduct(x, this->_kernel.row(phase + 1), taps);
+            writer.item() = s0 + a*(s1 - s0);
+            position += this->_step;
+        }
+        this->advance(n);
+        this->written(n, taps);
+    }
 };
 
 
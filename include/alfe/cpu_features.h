@@ -0,0 +1,100 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_CPU_FEATURES_H
+#define INCLUDED_CPU_FEATURES_H
+
+#include "alfe/integer_types.h"
+
+// Run-time detection of x86 instruction set extensions, for code that has
+// optimized paths that the compiler wouldn't otherwise be allowed to use.
+// Such functions are marked with ALFE_TARGET("<features>") so that GCC and
+// Clang will generate those instructions in them (MSVC always will), and must
+// only be called if the corresponding has...() function returns true.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+    defined(__i386__)
+#define ALFE_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ALFE_TARGET(features)
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define ALFE_TARGET(features) __attribute__((target(features)))
+#endif
+
+template<class T> class CPUFeaturesT
+{
+public:
+    static bool hasSSE2() { return features()._sse2; }
+    static bool hasSSSE3() { return features()._ssse3; }
+    static bool hasSHA() { return features()._sha; }
+    static bool hasAVX2() { return features()._avx2; }
+    // AVX-512 Foundation plus the byte/word instructions.
+    static bool hasAVX512BW() { return features()._avx512bw; }
+private:
+    CPUFeaturesT()
+    {
+        int r[4];
+        cpuid(0, r);
+        int maxLeaf = r[0];
+        cpuid(1, r);
+        int ecx1 = r[2];
+        int edx1 = r[3];
+        int ebx7 = 0;
+        if (maxLeaf >= 7) {
+            cpuid(7, r);
+            ebx7 = r[1];
+        }
+        // The OS has to save the YMM (and for AVX-512 the ZMM and opmask)
+        // registers as well as the CPU having the instructions.
+        UInt64 xcr0 = 0;
+        if ((ecx1 & (1 << 27)) != 0)
+            xcr0 = xgetbv();
+        bool ymm = (ecx1 & (1 << 28)) != 0 && (xcr0 & 6) == 6;
+        bool zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+
+        _sse2 = (edx1 & (1 << 26)) != 0;
+        _ssse3 = (ecx1 & (1 << 9)) != 0;
+        // The SHA instructions are only useful with SSSE3 and SSE4.1.
+        _sha = _ssse3 && (ecx1 & (1 << 19)) != 0 && (ebx7 & (1 << 29)) != 0;
+        _avx2 = ymm && (ebx7 & (1 << 5)) != 0;
+        _avx512bw = zmm && (ebx7 & (1 << 16)) != 0 && (ebx7 & (1 << 30)) != 0;
+    }
+    static const CPUFeaturesT& features()
+    {
+        static CPUFeaturesT f;
+        return f;
+    }
+    static void cpuid(int leaf, int* r)
+    {
+#ifdef _MSC_VER
+        __cpuidex(r, leaf, 0);
+#else
+        __cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+#endif
+    }
+    static UInt64 xgetbv()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        UInt32 low;
+        UInt32 high;
+        __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        return (static_cast<UInt64>(high) << 32) | low;
+#endif
+    }
+
+    bool _sse2;
+    bool _ssse3;
+    bool _sha;
+    bool _avx2;
+    bool _avx512bw;
+};
+
+typedef CPUFeaturesT<void> CPUFeatures;
+
+#endif // ALFE_X86
+
+#endif // INCLUDED_CPU_FEATURES_H
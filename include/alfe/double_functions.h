@@ -19,6 +19,7 @@ public:
             ++i;
             return Value(l + i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -40,6 +41,7 @@ public:
             ++i;
             return Value(l + i->value<Rational>().value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -61,6 +63,7 @@ public:
             ++i;
             return Value(l.value<double>() + i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -82,6 +85,7 @@ public:
             ++i;
             return Value(l - i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -103,6 +107,7 @@ public:
             ++i;
             return Value(l - i->value<Rational>().value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -124,6 +129,7 @@ public:
             ++i;
             return Value(l.value<double>() - i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -145,6 +151,7 @@ public:
             ++i;
             return Value(l * i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -166,6 +173,7 @@ public:
             ++i;
             return Value(l * i->value<Rational>().value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -187,6 +195,7 @@ public:
             ++i;
             return Value(l.value<double>() * i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -208,6 +217,7 @@ public:
             ++i;
             return Value(l / i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -229,6 +239,7 @@ public:
             ++i;
             return Value(l / i->value<Rational>().value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -250,6 +261,7 @@ public:
             ++i;
             return Value(l.value<double>() / i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -271,6 +283,7 @@ public:
             ++i;
             return l*pow(2.0, i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftLeft(); }
         FunctionType type() const
         {
@@ -293,6 +306,7 @@ public:
             ++i;
             return l/pow(2.0, i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftRight(); }
         FunctionType type() const
         {
@@ -314,6 +328,7 @@ public:
             ++i;
             return pow(l, i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPower(); }
         FunctionType type() const
         {
@@ -335,6 +350,7 @@ public:
             ++i;
             return pow(l, i->value<Rational>().value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPower(); }
         FunctionType type() const
         {
@@ -356,6 +372,7 @@ public:
             ++i;
             return pow(l.value<double>(), i->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPower(); }
         FunctionType type() const
         {
@@ -374,6 +391,7 @@ public:
         {
             return Value( - arguments.begin()->value<double>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -69,6 +69,8 @@ typedef BooleanTypeT<void> BooleanType;
 
 class ArrayType;
 
+template<class T> class ExpressionCompilerT;
+
 int parseHexadecimalCharacter(CharacterSource* source, Span* span)
 {
     CharacterSource s = *source;
@@ -111,6 +113,12 @@ public:
         virtual TypeT<T> type() const = 0;
         virtual void resolve(Scope* scope) = 0;
         virtual bool mightHaveSideEffect() const = 0;
+        // Expressions that have no compiled form of their own are evaluated
+        // by walking the tree.
+        virtual void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            compiler->tree(expression());
+        }
     };
 
     ExpressionT(const String& string, const Span& span)
@@ -193,6 +201,10 @@ public:
     }
     TypeT<T> type() const { return body()->type(); }
     bool mightHaveSideEffect() const { return body()->mightHaveSideEffect(); }
+    void compile(ExpressionCompilerT<T>* compiler) const
+    {
+        body()->compile(compiler);
+    }
 
 protected:
     const Body* body() const { return as<Body>(); }
@@ -516,6 +528,10 @@ private:
         TypeT<T> type() const { return BooleanTypeT<T>(); }
         void resolve(Scope* scope) { }
         bool mightHaveSideEffect() const { return false; }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            compiler->constant(this->expression().evaluate(0));
+        }
     };
     class TrueBody : public BooleanBody
     {
@@ -563,6 +579,10 @@ private:
         TypeT<T> type() const { return StringTypeT<T>(); }
         void resolve(Scope* scope) { }
         bool mightHaveSideEffect() const { return false; }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            compiler->constant(this->expression().evaluate(0));
+        }
     private:
         String _string;
     };
@@ -682,7 +702,7 @@ private:
         TypeT<T> type() const
         {
             TypeT<T> lType = _left.type();
-            StructuredType s = lType;
+            StructuredTypeT<T> s = lType;
             if (!s.valid())
                 _left.span().throwError("Expression has no members");
             return s.member(_right);
@@ -694,7 +714,7 @@ private:
         void resolve(Scope* scope)
         {
             _left.resolve(scope);
-            StructuredType t = _left.type().rValue();
+            StructuredTypeT<T> t = _left.type().rValue();
             if (!t.valid())
                 _left.span().throwError("Expression has no members");
             _right.resolve(t.scope());
@@ -735,6 +755,10 @@ public:
         }
         void resolve(Scope* scope) { }
         bool mightHaveSideEffect() const { return false; }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            compiler->constant(this->expression().evaluate(0));
+        }
     private:
         Rational _n;
     };
@@ -962,7 +986,7 @@ public:
             ValueT<T> l;
             if (!_resolvedFunco.valid())
                 l = _function.evaluate(context).rValue();
-            List<Value> arguments;
+            List<ValueT<T>> arguments;
             for (auto p : this->_arguments)
                 arguments.add(p.evaluate(context).rValue());
             if (_resolvedFunco.valid())
@@ -989,11 +1013,11 @@ public:
                     LValue(p, i), this->span());
             }
             List<Value> convertedArguments;
-            Function f = l.template value<Function>();
-            List<Tyco> parameterTycos = f.parameterTycos();
+            auto f = l.template value<Function>();
+            auto parameterTycos = f.parameterTycos();
             auto ii = parameterTycos.begin();
             for (auto a : arguments) {
-                Type type = *ii;
+                TypeT<T> type = *ii;
                 if (!type.valid()) {
                     a.span().throwError("Function parameter's type "
                         "constructor is not a type.");
@@ -1011,7 +1035,7 @@ public:
         void resolve(ScopeT<T>* scope)
         {
             Body::resolve(scope);
-            Identifier i = _function;
+            IdentifierT<T> i = _function;
             if (!i.valid()) {
                 _function.resolve(scope);
                 return;
@@ -1020,9 +1044,21 @@ public:
         }
         // TODO: check if it's a pure function
         bool mightHaveSideEffect() const { return true; }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            if (!_resolvedFunco.valid()) {
+                compiler->tree(this->expression());
+                return;
+            }
+            int start = compiler->position();
+            for (auto e : this->_arguments)
+                e.compile(compiler);
+            compiler->call(_resolvedFunco, this->_arguments.count(), start,
+                this->span());
+        }
     private:
         Expression _function;
-        Funco _resolvedFunco;
+        FuncoT<T> _resolvedFunco;
     };
 
     class ConstructorCallBody : public Body
@@ -1064,7 +1100,7 @@ public:
         bool mightHaveSideEffect() const { return true; }
     private:
         TycoSpecifier _tycoSpecifier;
-        Type _type;
+        TypeT<T> _type;
     };
 private:
     static Expression parseRemainder(Expression e, CharacterSource* source)
@@ -1103,7 +1139,7 @@ public:
         TycoSpecifier t = TycoSpecifier::parse(&s);
         if (!t.valid())
             return VariableDefinitionT();
-        Identifier i = Identifier::parse(&s);
+        IdentifierT<T> i = IdentifierT<T>::parse(&s);
         if (!i.valid())
             return VariableDefinitionT();
         *source = s;
@@ -1119,11 +1155,11 @@ public:
         return create<Body>(t, i, e, span);
     }
     VariableDefinitionT() { }
-    VariableDefinitionT(TycoSpecifier tycoSpecifier, Identifier identifier)
+    VariableDefinitionT(TycoSpecifier tycoSpecifier, IdentifierT<T> identifier)
       : Expression(create<Body>(tycoSpecifier, identifier, Expression(),
           Span()))
     { }
-    VariableDefinitionT(TypeT<T> type, Identifier identifier)
+    VariableDefinitionT(TypeT<T> type, IdentifierT<T> identifier)
       : Expression(create<Body>(type, identifier, Expression(), Span()))
     { }
     IdentifierT<T> identifier() const { return body()->identifier(); }
@@ -1133,12 +1169,12 @@ private:
     class Body : public Expression::Body
     {
     public:
-        Body(TycoSpecifier tycoSpecifier, Identifier identifier,
+        Body(TycoSpecifier tycoSpecifier, IdentifierT<T> identifier,
             Expression initializer, Span span)
           : Expression::Body(span), _tycoSpecifier(tycoSpecifier),
             _identifier(identifier), _initializer(initializer)
         { }
-        Body(TypeT<T> type, Identifier identifier, Expression initializer,
+        Body(TypeT<T> type, IdentifierT<T> identifier, Expression initializer,
             Span span)
           : Expression::Body(span), _type(type), _identifier(identifier),
             _initializer(initializer)
@@ -1170,9 +1206,9 @@ private:
     private:
         TycoSpecifier _tycoSpecifier;
         TypeT<T> _type;
-        Identifier _identifier;
+        IdentifierT<T> _identifier;
         Expression _initializer;
-        Scope _scope;
+        ScopeT<T> _scope;
     };
 
     const Body* body() const { return as<Body>(); }
@@ -1190,11 +1226,6 @@ protected:
             _left(left), _right(right), _operatorSpan(operatorSpan) { }
         Expression left() const { return _left; }
         Expression right() const { return _right; }
-        void resolve(const Scope* scope)
-        {
-            _left.resolve(scope);
-            _right.resolve(scope);
-        }
         TypeT<T> type() const { return BooleanTypeT<T>(); }
         bool mightHaveSideEffect() const
         {
@@ -1205,6 +1236,20 @@ protected:
             _left.resolve(scope);
             _right.resolve(scope);
         }
+    protected:
+        // Compiles the right operand followed by a check that it is a
+        // Boolean, unless it is known to be one already so that a constant
+        // stays foldable.
+        void compileRight(ExpressionCompilerT<T>* compiler,
+            const String& message) const
+        {
+            int start = compiler->position();
+            _right.compile(compiler);
+            ValueT<T> v;
+            if (!compiler->constantSince(start, &v) ||
+                v.type() != BooleanTypeT<T>())
+                compiler->checkBoolean(_right.span(), message);
+        }
     private:
         Expression _left;
         Expression _right;
@@ -1246,14 +1291,14 @@ private:
           : BinaryExpression::Body(left, operatorSpan, right) { }
         ValueT<T> evaluate(Structure* context) const
         {
-            ValueT<T> v = left().evaluate(context);
+            ValueT<T> v = left().evaluate(context).rValue();
             if (v.type() != BooleanTypeT<T>()) {
                 left().span().throwError("Logical operator requires operand "
                     "of type Boolean.");
             }
             if (!v.template value<bool>())
                 return false;
-            v = right().evaluate(context);
+            v = right().evaluate(context).rValue();
             if (v.type() != BooleanTypeT<T>()) {
                 right().span().throwError("Logical operator requires operand "
                     "of type Boolean.");
@@ -1269,6 +1314,31 @@ private:
             return ConditionalExpressionT<T>(left(), right().stringify(),
                 Expression("false", Span()));
         }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            static const String message =
+                "Logical operator requires operand of type Boolean.";
+            int start = compiler->position();
+            left().compile(compiler);
+            ValueT<T> v;
+            if (compiler->constantSince(start, &v) &&
+                v.type() == BooleanTypeT<T>()) {
+                compiler->rewind(start);
+                if (!v.template value<bool>()) {
+                    compiler->constant(false);
+                    return;
+                }
+                compileRight(compiler, message);
+                return;
+            }
+            compiler->checkBoolean(left().span(), message);
+            int otherwise = compiler->branchUnless();
+            compileRight(compiler, message);
+            int end = compiler->jump();
+            compiler->target(otherwise);
+            compiler->constant(false);
+            compiler->target(end);
+        }
     };
 };
 
@@ -1301,14 +1371,14 @@ private:
           : BinaryExpression::Body(left, operatorSpan, right) { }
         ValueT<T> evaluate(Structure* context) const
         {
-            ValueT<T> v = left().evaluate(context);
+            ValueT<T> v = left().evaluate(context).rValue();
             if (v.type() != BooleanTypeT<T>()) {
                 left().span().throwError("Logical operator requires operand "
                     "of type Boolean.");
             }
-            if (!v.template value<bool>())
-                return false;
-            v = right().evaluate(context);
+            if (v.template value<bool>())
+                return true;
+            v = right().evaluate(context).rValue();
             if (v.type() != BooleanTypeT<T>()) {
                 right().span().throwError("Logical operator requires operand "
                     "of type Boolean.");
@@ -1317,13 +1387,38 @@ private:
         }
         String toString() const
         {
-            return "(" + left().toString() + " && " + right().toString() + ")";
+            return "(" + left().toString() + " || " + right().toString() + ")";
         }
         Expression stringify() const
         {
             return ConditionalExpressionT<T>(left(),
                 Expression("true", Span()), right().stringify());
         }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            static const String message =
+                "Logical operator requires operand of type Boolean.";
+            int start = compiler->position();
+            left().compile(compiler);
+            ValueT<T> v;
+            if (compiler->constantSince(start, &v) &&
+                v.type() == BooleanTypeT<T>()) {
+                compiler->rewind(start);
+                if (v.template value<bool>()) {
+                    compiler->constant(true);
+                    return;
+                }
+                compileRight(compiler, message);
+                return;
+            }
+            compiler->checkBoolean(left().span(), message);
+            int otherwise = compiler->branchUnless();
+            compiler->constant(true);
+            int end = compiler->jump();
+            compiler->target(otherwise);
+            compileRight(compiler, message);
+            compiler->target(end);
+        }
     };
 };
 
@@ -1405,6 +1500,29 @@ private:
             _trueExpression.resolve(scope);
             _falseExpression.resolve(scope);
         }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            int start = compiler->position();
+            _condition.compile(compiler);
+            ValueT<T> v;
+            if (compiler->constantSince(start, &v) &&
+                v.type() == BooleanTypeT<T>()) {
+                compiler->rewind(start);
+                if (v.template value<bool>())
+                    _trueExpression.compile(compiler);
+                else
+                    _falseExpression.compile(compiler);
+                return;
+            }
+            compiler->checkBoolean(_condition.span(), "Conditional operator "
+                "requires operand of type Boolean.");
+            int otherwise = compiler->branchUnless();
+            _trueExpression.compile(compiler);
+            int end = compiler->jump();
+            compiler->target(otherwise);
+            _falseExpression.compile(compiler);
+            compiler->target(end);
+        }
     private:
         Expression _condition;
         Span _s1;
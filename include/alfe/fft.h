@@ -75,8 +75,8 @@ template<class T> class FFTWRealArray : public FFTWArray<T>
 public:
     FFTWRealArray() { }
     FFTWRealArray(int n)
-      : FFTWArray<T>(FFTWArray<T>::create<FFTWArray<T>::Body>(
-          FFTW<T>::alloc_real(n), n))
+      : FFTWArray<T>(FFTWArray<T>::template create<
+            typename FFTWArray<T>::Body>(FFTW<T>::alloc_real(n), n))
     { }
     T& operator[](int i) { return data()[i]; }
     const T& operator[](int i) const { return data()[i]; }
@@ -90,13 +90,13 @@ template<class T> class FFTWComplexArray : public FFTWArray<T>
 public:
     FFTWComplexArray() { }
     FFTWComplexArray(int n)
-      : FFTWArray<T>(FFTWArray<T>::create<FFTWArray<T>::Body>(
-          FFTW<T>::alloc_complex(n), n)) { }
-    typename Complex<T>& operator[](int i)
+      : FFTWArray<T>(FFTWArray<T>::template create<
+            typename FFTWArray<T>::Body>(FFTW<T>::alloc_complex(n), n)) { }
+    Complex<T>& operator[](int i)
     {
         return reinterpret_cast<Complex<T>*>(data())[i];
     }
-    const typename Complex<T>& operator[](int i) const
+    const Complex<T>& operator[](int i) const
     {
         return reinterpret_cast<Complex<T>*>(data())[i];
     }
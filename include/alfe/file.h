@@ -397,7 +397,8 @@ private:
             char* p = reinterpret_cast<char*>(buffer.data());
             if (getcwd(p, size) != 0) {
                 String path = buffer.subString(0, strlen(p));
-                return FileSystemObject::parse(path, RootDirectory(), false);
+                return FileSystemObject::parse(path, RootDirectoryT<T>(),
+                    false);
             }
             if (errno != ERANGE)
                 throw Exception::systemError("Obtaining current directory");
@@ -554,6 +555,8 @@ private:
 template<class T> class FileStreamT;
 typedef FileStreamT<void> FileStream;
 
+template<class T> class FileMappingT;
+
 template<class T> class FileT : public FileSystemObject
 {
 public:
@@ -589,6 +592,9 @@ public:
         array->allocate(n);
         f.read(&(*array)[0], n*sizeof(U));
     }
+    // Maps the file into memory instead of reading it, for sequential
+    // access. Construct a FileMapping directly to give a different hint.
+    FileMappingT<T> map() const { return FileMappingT<T>(*this); }
 
     template<class U> void save(const U& contents) const
     {
@@ -893,8 +899,7 @@ template<class T, class V = Void> void applyToWildcard(T& functor,
 }
 
 template<class T> void applyToWildcard(T& functor, const String& wildcard,
-    int recurseIntoDirectories = true,
-    const Directory& relativeTo = CurrentDirectory())
+    int recurseIntoDirectories, const Directory& relativeTo)
 {
     CharacterSource s(wildcard);
 #ifdef _WIN32
@@ -906,6 +911,15 @@ template<class T> void applyToWildcard(T& functor, const String& wildcard,
     applyToWildcard(functor, s, recurseIntoDirectories, dir);
 }
 
+// The defaults are supplied by an overload because the function above is
+// first declared as a friend, which can't have default arguments.
+template<class T> void applyToWildcard(T& functor, const String& wildcard,
+    int recurseIntoDirectories = true)
+{
+    applyToWildcard(functor, wildcard, recurseIntoDirectories,
+        CurrentDirectory());
+}
+
 class Console : public File
 {
 public:
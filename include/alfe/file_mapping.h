@@ -0,0 +1,101 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_FILE_MAPPING_H
+#define INCLUDED_FILE_MAPPING_H
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// A read-only view of an entire file, mapped into memory. Compared with
+// reading the file into an Array or String, nothing is copied: pages are
+// loaded on demand as they are touched, and the OS can drop them again under
+// memory pressure. The view remains valid while any FileMapping referring to
+// it exists. The access hint is passed to madvise() on POSIX systems; on
+// Windows the view is always mapped the same way.
+template<class T> class FileMappingT : private ConstHandle
+{
+public:
+    enum Access { sequential, random, willNeed };
+
+    FileMappingT() { }
+    explicit FileMappingT(const File& file, Access access = sequential)
+    {
+#ifdef _WIN32
+        FileStream f = file.openRead();
+        UInt64 size = f.size();
+        if (size == 0)
+            return;
+        HANDLE h = CreateFileMapping(f, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (h == NULL)
+            throw Exception::systemError("Mapping file " + file.path());
+        WindowsHandle mapping(h);
+        void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == NULL)
+            throw Exception::systemError("Mapping file " + file.path());
+#else
+        NullTerminatedString path(file.path());
+        int fd = ::open(path, O_RDONLY);
+        if (fd == -1)
+            throw Exception::systemError("Opening file " + file.path());
+        struct stat s;
+        if (fstat(fd, &s) != 0) {
+            { PreserveSystemError p; ::close(fd); }
+            throw Exception::systemError("Obtaining length of file " +
+                file.path());
+        }
+        UInt64 size = s.st_size;
+        if (size == 0) {
+            ::close(fd);
+            return;
+        }
+        void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        {
+            PreserveSystemError p;
+            ::close(fd);  // The mapping keeps the file open.
+        }
+        if (data == MAP_FAILED)
+            throw Exception::systemError("Mapping file " + file.path());
+        static const int advice[] =
+            { MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED };
+        madvise(data, size, advice[access]);  // Just a hint, so no check.
+#endif
+        ConstHandle::operator=(create<Body>(data, size));
+    }
+    const Byte* data() const { return valid() ? body()->_data : 0; }
+    UInt64 size() const { return valid() ? body()->_size : 0; }
+    // Returns a String referring to the view instead of a copy of it. The
+    // String doesn't keep the view alive, so the caller must keep the
+    // FileMapping around for as long as it uses the String (CharacterSource
+    // does this).
+    String string() const
+    {
+        if (size() >= 0x80000000)
+            throw Exception("2Gb or more in mapped file");
+        return String(reinterpret_cast<const char*>(data()),
+            static_cast<int>(size()));
+    }
+private:
+    class Body : public ConstHandle::Body
+    {
+    public:
+        Body(void* data, UInt64 size)
+          : _data(static_cast<const Byte*>(data)), _size(size) { }
+        ~Body()
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(_data);
+#else
+            munmap(const_cast<Byte*>(_data), _size);
+#endif
+        }
+        const Byte* _data;
+        UInt64 _size;
+    };
+    const Body* body() const { return as<Body>(); }
+};
+
+typedef FileMappingT<void> FileMapping;
+
+#endif // INCLUDED_FILE_MAPPING_H
@@ -63,6 +63,10 @@ protected:
         }
         virtual List<Tyco> parameterTycos() const = 0;
         virtual String toString() const { return type().toString(); }
+        // A pure funco's result depends only on its arguments and calling it
+        // has no other effect, so a call with constant arguments can be
+        // evaluated when the expression is compiled.
+        virtual bool pure() const { return false; }
     };
     const Body* body() const { return as<Body>(); }
 public:
@@ -81,6 +85,7 @@ public:
     String toString() const { return body()->toString(); }
     FunctionType type() const { return body()->type(); }
     List<Tyco> parameterTycos() const { return body()->parameterTycos(); }
+    bool pure() const { return body()->pure(); }
 };
 
 class Function : public Funco
@@ -25,6 +25,8 @@ public:
         return *this;
     }
     bool valid() const { return _body != 0; }
+    // True if this is the only handle to its body.
+    bool unique() const { return _body != 0 && _body->_count == 1; }
     UInt32 hash() const { return _body != 0 ? _body->hash() : 0; }
     bool operator==(const ConstHandle& other) const
     {
@@ -121,6 +123,7 @@ public:
         return *this;
     }
     bool valid() const { return ConstHandle::valid(); }
+    bool unique() const { return ConstHandle::unique(); }
     UInt32 hash() const { return ConstHandle::hash(); }
     bool operator==(const Handle& other) const
     {
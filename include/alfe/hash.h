@@ -5,30 +5,59 @@
 
 #include <typeinfo>
 
+// Hashes data a (64-bit) word at a time: each mixin() folds its whole argument
+// into the state with one multiply, however wide it is, so long keys such as
+// strings cost one multiply per 8 bytes instead of one per byte. The final
+// avalanche happens when the result is taken, so that all output bits depend
+// on all input bits even when only a few values have been mixed in.
 class Hash
 {
 public:
-    // FNV-1a hash
-    Hash(const std::type_info& t) : _h(0x811c9dc5)
+    Hash(const std::type_info& t) : _h(0x243f6a8885a308d3)
     {
-        mixin(static_cast<UInt32>(t.hash_code()));
+        mixin(static_cast<UInt64>(t.hash_code()));
     }
-    Hash& mixin(UInt8 v) { _h = (_h ^ v) * 0x01000193; return *this; }
-    Hash& mixin(UInt16 v) { return mixin(static_cast<UInt8>(v)).mixin(static_cast<UInt8>(v >> 8)); }
-    Hash& mixin(UInt32 v) { return mixin(static_cast<UInt16>(v)).mixin(static_cast<UInt16>(v >> 16)); }
+    Hash& mixin(UInt64 v)
+    {
+        _h = ((_h << 27 | _h >> 37) ^ v)*0x9e3779b97f4a7c15;
+        return *this;
+    }
+    Hash& mixin(UInt8 v) { return mixin(static_cast<UInt64>(v)); }
+    Hash& mixin(UInt16 v) { return mixin(static_cast<UInt64>(v)); }
+    Hash& mixin(UInt32 v) { return mixin(static_cast<UInt64>(v)); }
     Hash& mixin(int v) { return mixin(static_cast<UInt32>(v)); }
-    operator UInt32() const { return _h; }
+    // Mixes in the bytes at data. The length goes in too, so that runs of
+    // zero bytes of different lengths hash differently.
+    Hash& mixin(const void* data, int length)
+    {
+        auto p = static_cast<const UInt8*>(data);
+        int n = length;
+        for (; n >= 8; n -= 8) {
+            UInt64 w;
+            memcpy(&w, p, 8);
+            mixin(w);
+            p += 8;
+        }
+        UInt64 w = 0;
+        if (n > 0)
+            memcpy(&w, p, n);
+        return mixin(w).mixin(static_cast<UInt64>(length));
+    }
+    operator UInt32() const
+    {
+        // MurmurHash3's 64-bit finalizer.
+        UInt64 h = _h;
+        h = (h ^ (h >> 33))*0xff51afd7ed558ccd;
+        h = (h ^ (h >> 33))*0xc4ceb9fe1a85ec53;
+        return static_cast<UInt32>(h ^ (h >> 33));
+    }
 private:
-    UInt32 _h;
+    UInt64 _h;
 };
 
 template<class T> UInt32 hash(const T& t) { return t.hash(); }
 UInt32 hash(int t) { return Hash(typeid(int)).mixin(t); }
 UInt32 hash(DWord t) { return Hash(typeid(int)).mixin(t); }
-UInt32 hash(UInt64 t)
-{
-    return Hash(typeid(UInt64)).mixin(static_cast<UInt32>(t)).
-        mixin(static_cast<UInt32>(t >> 32));
-}
+UInt32 hash(UInt64 t) { return Hash(typeid(UInt64)).mixin(t); }
 
 #endif // INCLUDED_HASH_H
@@ -5,11 +5,30 @@
 
 #include "alfe/tuple.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ALFE_HASH_TABLE_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 // HashTable is not quite a value type, since changing an element in one table
 // will affect copies of the same table. Adding an element may cause it to
 // become a deep copy, if more storage space was needed.
 //
-// Note that the default-constructed Key should not be used for real entries.
+// The slots are grouped into chunks of chunkSlots. Each chunk starts with a
+// 16-byte header holding a tag byte per slot (0 for an empty slot, otherwise
+// 0x80 plus 7 bits of the remixed hash) and is followed directly by the
+// entries of those slots, so a lookup that finds its key usually only touches
+// the cache lines of one chunk. The header is scanned with one SSE2 compare
+// and only the keys of slots whose tags match are compared. Entries go in the
+// first chunk with room, starting from the chunk their hash picks, and each
+// chunk counts the entries that went past it because it was full. A lookup
+// stops at the first chunk whose count is 0, so erase() just empties the slot
+// and decrements the counts along the way: there are no tombstones and nothing
+// else moves. Erasing only invalidates references to the erased entry.
 
 template<class Key, class Value> class HashTableEntry
 {
@@ -26,109 +45,80 @@ private:
     Value _value;
 };
 
-template<class Key, class Value> class HashTableBody
-  : public Array<HashTableEntry<Key, Value>>::AppendableBaseBody
-{
-public:
-    virtual void justSetSize(int size) const = 0;
-    void preDestroy() const { justSetSize(this->_allocated); }
-
-    //HashTableBody() : _misses(0) { }
-
-    //mutable uint64_t _misses;
-};
-
-template<class Key, class Value> class HashTable
-  : private AppendableArray<HashTableEntry<Key, Value>,
-    HashTableBody<Key, Value>>
+template<class Key, class Value> class HashTable : private Handle
 {
     typedef HashTableEntry<Key, Value> Entry;
 public:
-    bool hasKey(const Key& key) const
-    {
-        auto e = lookup(key);
-        if (e != 0)
-            return e->key() == key;
-        return false;
-    }
+    HashTable() { }
+    bool hasKey(const Key& key) const { return find(key, ::hash(key)) >= 0; }
     Value& operator[](const Key& key)
     {
-        auto e = lookup(key);
-        if (e != 0 && e->key() == key)
-            return e->value();
-        if (count() >= this->allocated()/2) {
-            //dumpStats(File("tempHash.dat"));
-
-            int n = this->allocated()*2;
-            if (n == 0)
-                n = 1;
-            HashTable other;
-            other.allocate(n);
-            n = other.allocated();
-            other.expand(n);
-            other.body()->_size = 0;
-            for (auto i : *this)
-                other[i.key()] = i.value();
-            *this = other;
-            e = lookup(key);
-        }
-        ++this->body()->_size;
-        e->key() = key;
-        return e->value();
+        UInt32 h = ::hash(key);
+        int slot = find(key, h);
+        if (slot >= 0)
+            return data(slot)->value();
+        if (count() >= maximumLoad(chunks()))
+            rehash(count() + 1);
+        slot = place(h);
+        data(slot)->key() = key;
+        return data(slot)->value();
     }
     Value operator[](const Key& key) const
     {
-        auto e = lookup(key);
-        if (e != 0)
-            return e->value();
+        int slot = find(key, ::hash(key));
+        if (slot >= 0)
+            return data(slot)->value();
         return Value();
     }
     void add(const Key& key, const Value& value) { (*this)[key] = value; }
-    int count() const { return this->body() == 0 ? 0 : this->body()->_size; }
+    void erase(const Key& key)
+    {
+        UInt32 h = ::hash(key);
+        int slot = find(key, h);
+        if (slot < 0)
+            return;
+        int mask = chunks() - 1;
+        for (int c = home(h); c != (slot >> 4); c = (c + 1) & mask) {
+            Chunk* k = chunk(c);
+            if (k->_overflow != overflowSaturated)
+                --k->_overflow;
+        }
+        Chunk* k = chunk(slot >> 4);
+        k->_tags[slot & 15] = 0;
+        k->_entries[slot & 15] = Entry();
+        --body()->_count;
+    }
+    // Makes room for n entries so that adding them won't need to reallocate.
+    void reserve(int n)
+    {
+        if (n > maximumLoad(chunks()))
+            rehash(n);
+    }
+    int count() const { return valid() ? body()->_count : 0; }
     class Iterator
     {
     public:
-        const Entry& operator*() const { return *_entry; }
-        const Entry* operator->() const { return _entry; }
+        const Entry& operator*() const { return *_table.data(_slot); }
+        const Entry* operator->() const { return _table.data(_slot); }
         bool operator==(const Iterator& other) const
         {
-            return _entry == other._entry;
+            return _slot == other._slot;
         }
         bool operator!=(const Iterator& other) const
         {
             return !operator==(other);
         }
-        void operator++()
-        {
-            do {
-                ++_entry;
-                if ((*this) == _table.end())
-                    return;
-            } while (_entry->key() == Key());
-        }
+        void operator++() { _slot = _table.nextFull(_slot + 1); }
     private:
-        Iterator(const Entry* entry, const HashTable& table)
-          : _entry(entry), _table(table) { }
-        const Entry* _entry;
+        Iterator(int slot, const HashTable& table)
+          : _slot(slot), _table(table) { }
+        int _slot;
         const HashTable _table;
 
         friend class HashTable;
     };
-    Iterator begin() const
-    {
-        if (this->allocated() == 0)
-            return Iterator(0, *this);
-        Iterator i(data(0), *this);
-        if (i->key() == Key())
-            ++i;
-        return i;
-    }
-    Iterator end() const
-    {
-        if (this->allocated() == 0)
-            return Iterator(0, *this);
-        return Iterator(data(this->allocated()), *this);
-    }
+    Iterator begin() const { return Iterator(nextFull(0), *this); }
+    Iterator end() const { return Iterator(capacity(), *this); }
     template<class V1> bool operator==(HashTable<Key, V1> other) const
     {
         if (count() != other.count())
@@ -164,61 +154,185 @@ public:
     }
     void dumpStats(File file)
     {
-        //if (this->body() == 0)
-        //    return;
-        //console.write("Misses: " + decimal(static_cast<int>(this->body()->_misses)) + "," + decimal(static_cast<int>(this->body()->_misses >> 32)) + "\n");
         //console.write("Entries: " + decimal(count()) + "\n");
-        //int n = this->allocated();
+        //int n = capacity();
         //console.write("Size: " + decimal(n) + "\n");
         //auto o = file.openWrite();
         //for (int i = 0; i < n; ++i) {
-        //    UInt8 present = !(data(i)->key() == Key()) ? 255 : 0;
+        //    UInt8 present = (i & 15) < chunkSlots &&
+        //        chunk(i >> 4)->_tags[i & 15] != 0 ? 255 : 0;
         //    o.write(present);
         //}
     }
 private:
-    int row(const Key& key) const { return ::hash(key) % this->allocated(); }
-    Entry* lookup(const Key& key)
+    // A slot number is the chunk number times 16 plus the index in the
+    // chunk, so the last 16 - chunkSlots numbers of each chunk are unused.
+    static const int chunkSlots = 14;
+    static const int overflowSaturated = 255;
+    static const int cacheLine = 64;
+
+    class Chunk
     {
-        int n = this->allocated();
-        if (n == 0)
-            return 0;
-        int r = row(key);
-        for (int i = 0; i < n; ++i) {
-            Entry* e = data(r);
-            if (e->key() == key || e->key() == Key())
-                return e;
-            // We have a decent hash function so linear probing should work
-            // fine.
-            r = (r + 1)%n;
-            //++this->body()->_misses;
+    public:
+        Chunk() : _overflow(0), _unused(0) { memset(_tags, 0, chunkSlots); }
+        UInt8 _tags[chunkSlots];
+        UInt8 _overflow;
+        UInt8 _unused;
+        Entry _entries[chunkSlots];
+    };
+
+    // The chunks are aligned to a cache line, so that a chunk with small
+    // entries spans as few lines as possible.
+    class Body : public Handle::Body
+    {
+    public:
+        Body(int chunks) : _chunks(chunks), _count(0)
+        {
+            _memory = operator new(chunks*sizeof(Chunk) + cacheLine - 1);
+            _chunk = reinterpret_cast<Chunk*>(
+                (reinterpret_cast<uintptr_t>(_memory) + cacheLine - 1) &
+                ~static_cast<uintptr_t>(cacheLine - 1));
+            for (int i = 0; i < chunks; ++i)
+                new(&_chunk[i]) Chunk();
+        }
+        ~Body()
+        {
+            for (int i = 0; i < _chunks; ++i)
+                _chunk[i].~Chunk();
+            operator delete(_memory);
         }
-        return 0;
+        void* _memory;
+        Chunk* _chunk;
+        int _chunks;
+        int _count;
+    };
+
+    explicit HashTable(int chunks) : Handle(create<Body>(chunks)) { }
+    Body* body() const { return const_cast<Body*>(as<Body>()); }
+    int chunks() const { return valid() ? body()->_chunks : 0; }
+    int capacity() const { return chunks() << 4; }
+    // Keep the load factor below 6/7 so that chunks with a free slot are
+    // never far away.
+    static int maximumLoad(int chunks) { return chunks*12; }
+    Chunk* chunk(int c) const { return &body()->_chunk[c]; }
+    Entry* data(int slot) const
+    {
+        return &chunk(slot >> 4)->_entries[slot & 15];
     }
-    const Entry* lookup(const Key& key) const
+    // Spread the hash with a multiply so that hash() implementations that
+    // don't use Hash still work well enough. The chunk comes from the middle
+    // bits of the product and the tag from the top bits.
+    static UInt64 remix(UInt32 h)
     {
-        int n = this->allocated();
+        return static_cast<UInt64>(h)*0x9e3779b97f4a7c15;
+    }
+    int home(UInt32 h) const
+    {
+        return static_cast<int>(remix(h) >> 32) & (chunks() - 1);
+    }
+    static UInt8 tag(UInt32 h)
+    {
+        return static_cast<UInt8>(0x80 | (remix(h) >> 57));
+    }
+    // Returns a mask of the slots in the chunk whose tags are equal to t.
+    static int match(const Chunk* k, UInt8 t)
+    {
+#ifdef ALFE_HASH_TABLE_SSE2
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(k));
+        return _mm_movemask_epi8(
+            _mm_cmpeq_epi8(g, _mm_set1_epi8(static_cast<char>(t)))) &
+            ((1 << chunkSlots) - 1);
+#else
+        int m = 0;
+        for (int i = 0; i < chunkSlots; ++i)
+            if (k->_tags[i] == t)
+                m |= 1 << i;
+        return m;
+#endif
+    }
+    static int lowestSetBit(int m)
+    {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, m);
+        return static_cast<int>(i);
+#else
+        return __builtin_ctz(m);
+#endif
+    }
+    int find(const Key& key, UInt32 h) const
+    {
+        int n = chunks();
         if (n == 0)
-            return 0;
-        int r = row(key);
-        for (int i = 0; i < n; ++i) {
-            const Entry* e = data(r);
-            if (e->key() == key || e->key() == Key())
-                return e;
-            r = (r + 1)%n;
-            //++this->body()->_misses;
-        }
-        return 0;
+            return -1;
+        UInt8 t = tag(h);
+        int c = home(h);
+        do {
+            const Chunk* k = chunk(c);
+#ifdef ALFE_HASH_TABLE_SSE2
+            // The entry we want is likely to be on the chunk's next cache
+            // line, so start fetching it while the header is being read.
+            if (sizeof(Chunk) > cacheLine) {
+                _mm_prefetch(reinterpret_cast<const char*>(k) + cacheLine,
+                    _MM_HINT_T0);
+            }
+#endif
+            for (int m = match(k, t); m != 0; m &= m - 1) {
+                int i = lowestSetBit(m);
+                if (k->_entries[i].key() == key)
+                    return (c << 4) + i;
+            }
+            if (k->_overflow == 0)
+                return -1;
+            c = (c + 1) & (n - 1);
+        } while (true);
+    }
+    // Claims the first free slot on the probe sequence for hash h. The
+    // caller fills in the entry.
+    int place(UInt32 h)
+    {
+        int mask = chunks() - 1;
+        int c = home(h);
+        do {
+            Chunk* k = chunk(c);
+            int empty = match(k, 0);
+            if (empty != 0) {
+                int i = lowestSetBit(empty);
+                k->_tags[i] = tag(h);
+                ++body()->_count;
+                return (c << 4) + i;
+            }
+            if (k->_overflow != overflowSaturated)
+                ++k->_overflow;
+            c = (c + 1) & mask;
+        } while (true);
     }
-    Entry* data(int row)
+    int nextFull(int slot) const
     {
-        return &static_cast<AppendableArray<Entry,
-            HashTableBody<Key, Value>>&>(*this)[row];
+        int n = capacity();
+        for (; slot < n; ++slot) {
+            if ((slot & 15) >= chunkSlots)
+                continue;
+            if (chunk(slot >> 4)->_tags[slot & 15] != 0)
+                break;
+        }
+        return slot;
     }
-    const Entry* data(int row) const
+    // The entries are copied rather than moved, since copies of this table
+    // share the old body and still need them.
+    void rehash(int n)
     {
-        return &static_cast<const AppendableArray<Entry,
-            HashTableBody<Key, Value>>&>(*this)[row];
+        int c = 1;
+        while (maximumLoad(c) < n)
+            c <<= 1;
+        HashTable other(c);
+        int oldCapacity = capacity();
+        for (int slot = nextFull(0); slot < oldCapacity;
+            slot = nextFull(slot + 1)) {
+            const Entry* e = data(slot);
+            *other.data(other.place(::hash(e->key()))) = *e;
+        }
+        *this = other;
     }
 };
 
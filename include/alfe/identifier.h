@@ -17,7 +17,10 @@ template<class T> class IdentifierT : public ExpressionT<T>
     {
     public:
         Body(const Span& span) : Expression::Body(span) { }
-        Identifier identifier() const { return this->handle<Handle>(); }
+        IdentifierT<T> identifier() const
+        {
+            return this->template handle<Handle>();
+        }
         ValueT<T> evaluate(Structure* context) const
         {
             return _path.evaluate(context, identifier());
@@ -29,9 +32,13 @@ template<class T> class IdentifierT : public ExpressionT<T>
         }
         TypeT<T> type() const { return _definition.type(); }
         bool mightHaveSideEffect() const { return false; }
+        void compile(ExpressionCompilerT<T>* compiler) const
+        {
+            compiler->load(identifier(), this->span());
+        }
     private:
-        VariableDefinition _definition;
-        ResolutionPath _path;
+        VariableDefinitionT<T> _definition;
+        ResolutionPathT<T> _path;
     };
     class NameBody : public Body
     {
@@ -5,8 +5,9 @@
 
 #include <memory>
 #include <functional>
-#include <intrin.h>
 #include "alfe/tuple.h"
+#include "alfe/cpu_features.h"
+#include "alfe/thread.h"
 #include <cmath>
 
 float sinint(float x)
@@ -48,18 +49,70 @@ float sinint(float x)
     return (static_cast<float>(tau)/4.0f - (cos(x)/x)*cr - (sin(x)/x)*sr) * mr;
 }
 
-bool useSSE2()
+bool detectSSE2()
 {
     //return false;
 
-    int cpuInfo[4];
-    __cpuid(cpuInfo, 0);
-    if (cpuInfo[0] < 1)
-        return false;
-    __cpuid(cpuInfo, 1);
-    return (cpuInfo[3] & (1 << 26)) != 0;
+    return CPUFeatures::hasSSE2();
+}
+
+// CPUID is slow (especially in a virtual machine) and the filters ask for
+// every group of rows, so only do it once.
+bool useSSE2()
+{
+    static bool sse2 = detectSSE2();
+    return sse2;
+}
+
+// Calls f(top, bottom) for bands of rows that together cover rows 0 to
+// height - 1. If there are enough multiply-adds (work) for it to be worth it,
+// the bands are done in parallel. Bands start on a multiple of 4 rows so that
+// the kernels that do several rows at a time get whole groups.
+template<class F> void forEachBand(int height, int work, F f)
+{
+    static const int bandWork = 1 << 16;
+    int bands = min(height/4, work/bandWork);
+    if (bands <= 1) {
+        f(0, height);
+        return;
+    }
+    ThreadPool::shared()->parallelFor(0, bands, [&](int b)
+    {
+        int bottom = b == bands - 1 ? height : ((b + 1)*height/bands) & ~3;
+        f((b*height/bands) & ~3, bottom);
+    });
 }
 
+// Unaligned loads and aligned stores of 128-bit units.
+__m128i load128i(const Byte* p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+void store128i(Byte* p, __m128i x)
+{
+    _mm_store_si128(reinterpret_cast<__m128i*>(p), x);
+}
+__m128 load128(const Byte* p)
+{
+    return _mm_loadu_ps(reinterpret_cast<const float*>(p));
+}
+void store128(Byte* p, __m128 x)
+{
+    _mm_store_ps(reinterpret_cast<float*>(p), x);
+}
+#ifdef ALFE_X86
+// Returns t + a*b. GCC allows itself to fuse a multiply and an add into an
+// FMA when FMA instructions are available (as they are with AVX-512), which
+// would round differently from the SSE2 code. Using the explicit rounding
+// forms of the intrinsics prevents that.
+ALFE_TARGET("avx512f") __m512 multiplyAdd(__m512 t, __m512 a, __m512 b)
+{
+    return _mm512_add_round_ps(t,
+        _mm512_mul_round_ps(a, b, _MM_FROUND_CUR_DIRECTION),
+        _MM_FROUND_CUR_DIRECTION);
+}
+#endif
+
 class AlignedBuffer
 {
 public:
@@ -92,58 +145,8 @@ public:
     ImageFilter16() : _shift(6) { }
     void execute()
     {
-        Byte* inputRow = _input.data() + _inputOffset;
-        Byte* outputRow = _output.data();
-        int* kernelSizes = &_kernelSizes[0];
-        if (useSSE2()) {
-            for (int y = 0; y < _height; ++y) {
-                __m128i* kernel =
-                    reinterpret_cast<__m128i*>(_kernelBuffer.data());
-                __m128i* output = reinterpret_cast<__m128i*>(outputRow);
-                int* offsets = &_offsets[0];
-                for (int x = 0; x < _width; ++x) {
-                    __m128i total = _mm_set1_epi16(0);
-                    int kernelSize = kernelSizes[x];
-                    for (int k = 0; k < kernelSize; ++k) {
-                        // We need to use an unaligned load here because we
-                        // need it to be possible for any input position to
-                        // affect any output position. We could do this by
-                        // duplicating each input position eight times, but
-                        // this would probably be slower than the unaligned
-                        // loads.
-                        total = _mm_add_epi16(total, _mm_mullo_epi16(*kernel,
-                            _mm_castps_si128(_mm_loadu_ps(
-                            reinterpret_cast<float*>(inputRow + *offsets)))));
-                        ++kernel;
-                        ++offsets;
-                    }
-                    output[x] = total;
-                }
-                inputRow += _input.stride();
-                outputRow += _output.stride();
-            }
-        }
-        else {
-            for (int y = 0; y < _height; ++y) {
-                UInt16* kernel =
-                    reinterpret_cast<UInt16*>(_kernelBuffer.data());
-                UInt16* output = reinterpret_cast<UInt16*>(outputRow);
-                int* offsets = &_offsets[0];
-                for (int x = 0; x < _width; ++x) {
-                    UInt16 total = 0;
-                    int kernelSize = kernelSizes[x];
-                    for (int k = 0; k < kernelSize; ++k) {
-                        total += *kernel *
-                            *reinterpret_cast<UInt16*>(inputRow + *offsets);
-                        ++kernel;
-                        ++offsets;
-                    }
-                    output[x] = total;
-                }
-                inputRow += _input.stride();
-                outputRow += _output.stride();
-            }
-        }
+        forEachBand(_height, _work,
+            [&](int top, int bottom) { executeRows(top, bottom); });
     }
     // outputSize.x is measured in output pixels
     // inputChannels is number of channels in input data
@@ -211,6 +214,7 @@ public:
 
         int left = std::numeric_limits<int>::max();
         int right = std::numeric_limits<int>::min();
+        int work = 0;
         for (int x = 0; x < _width; ++x) {
             int o = x*channelsPerUnit;
             int kernelSize = 0;
@@ -300,7 +304,9 @@ public:
                 }
             }
             sizes[x] = kernelSize;
+            work += kernelSize;
         }
+        _work = work*_height;
         if (left < 0)
             *inputLeft = (left - (inputChannels - 1))/inputChannels;
         else
@@ -323,6 +329,152 @@ public:
     int shift() const { return _shift; }
 
 private:
+    void executeRows(int top, int bottom)
+    {
+        int y = top;
+        if (useSSE2()) {
+#ifdef ALFE_X86
+            if (CPUFeatures::hasAVX512BW())
+                y = executeAVX512(y, bottom);
+            else if (CPUFeatures::hasAVX2())
+                y = executeAVX2(y, bottom);
+#endif
+            executeSSE2(y, bottom);
+            return;
+        }
+        Byte* inputRow = _input.data() + _inputOffset + y*_input.stride();
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y < bottom; ++y) {
+            UInt16* kernel = reinterpret_cast<UInt16*>(_kernelBuffer.data());
+            UInt16* output = reinterpret_cast<UInt16*>(outputRow);
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                UInt16 total = 0;
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    total += *kernel *
+                        *reinterpret_cast<UInt16*>(inputRow + *offsets);
+                    ++kernel;
+                    ++offsets;
+                }
+                output[x] = total;
+            }
+            inputRow += _input.stride();
+            outputRow += _output.stride();
+        }
+    }
+    void executeSSE2(int y, int bottom)
+    {
+        Byte* inputRow = _input.data() + _inputOffset + y*_input.stride();
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y < bottom; ++y) {
+            __m128i* kernel = reinterpret_cast<__m128i*>(_kernelBuffer.data());
+            __m128i* output = reinterpret_cast<__m128i*>(outputRow);
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m128i total = _mm_set1_epi16(0);
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    // We need to use an unaligned load here because we need
+                    // it to be possible for any input position to affect any
+                    // output position. We could do this by duplicating each
+                    // input position eight times, but this would probably be
+                    // slower than the unaligned loads.
+                    total = _mm_add_epi16(total, _mm_mullo_epi16(*kernel,
+                        _mm_castps_si128(_mm_loadu_ps(
+                        reinterpret_cast<float*>(inputRow + *offsets)))));
+                    ++kernel;
+                    ++offsets;
+                }
+                output[x] = total;
+            }
+            inputRow += _input.stride();
+            outputRow += _output.stride();
+        }
+    }
+#ifdef ALFE_X86
+    // Every row uses the same kernel, so the wider versions do the same
+    // 8-channel unit of 2 (AVX2) or 4 (AVX-512) rows at once, with each row
+    // in its own 128-bit lane. Each lane does exactly what the SSE2 code
+    // does, so the results are the same. They return the first row that
+    // they didn't do.
+    ALFE_TARGET("avx2") int executeAVX2(int y, int bottom)
+    {
+        int stride = _input.stride();
+        Byte* inputRow = _input.data() + _inputOffset + y*stride;
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y + 2 <= bottom; y += 2) {
+            const __m128i* kernel =
+                reinterpret_cast<const __m128i*>(_kernelBuffer.data());
+            __m128i* output0 = reinterpret_cast<__m128i*>(outputRow);
+            __m128i* output1 =
+                reinterpret_cast<__m128i*>(outputRow + _output.stride());
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m256i total = _mm256_setzero_si256();
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    const Byte* input = inputRow + *offsets;
+                    __m256i i = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(load128i(input)),
+                        load128i(input + stride), 1);
+                    total = _mm256_add_epi16(total, _mm256_mullo_epi16(
+                        _mm256_broadcastsi128_si256(*kernel), i));
+                    ++kernel;
+                    ++offsets;
+                }
+                output0[x] = _mm256_castsi256_si128(total);
+                output1[x] = _mm256_extracti128_si256(total, 1);
+            }
+            inputRow += 2*stride;
+            outputRow += 2*_output.stride();
+        }
+        return y;
+    }
+    ALFE_TARGET("avx512f,avx512bw") int executeAVX512(int y, int bottom)
+    {
+        int stride = _input.stride();
+        int outputStride = _output.stride();
+        Byte* inputRow = _input.data() + _inputOffset + y*stride;
+        Byte* outputRow = _output.data() + y*outputStride;
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y + 4 <= bottom; y += 4) {
+            const __m128i* kernel =
+                reinterpret_cast<const __m128i*>(_kernelBuffer.data());
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m512i total = _mm512_setzero_si512();
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    const Byte* input = inputRow + *offsets;
+                    __m512i i = _mm512_castsi128_si512(load128i(input));
+                    i = _mm512_inserti32x4(i, load128i(input + stride), 1);
+                    i = _mm512_inserti32x4(i, load128i(input + 2*stride), 2);
+                    i = _mm512_inserti32x4(i, load128i(input + 3*stride), 3);
+                    total = _mm512_add_epi16(total, _mm512_mullo_epi16(
+                        _mm512_broadcast_i32x4(*kernel), i));
+                    ++kernel;
+                    ++offsets;
+                }
+                Byte* output = outputRow + x*sizeof(__m128i);
+                store128i(output, _mm512_castsi512_si128(total));
+                store128i(output + outputStride,
+                    _mm512_extracti32x4_epi32(total, 1));
+                store128i(output + 2*outputStride,
+                    _mm512_extracti32x4_epi32(total, 2));
+                store128i(output + 3*outputStride,
+                    _mm512_extracti32x4_epi32(total, 3));
+            }
+            inputRow += 4*stride;
+            outputRow += 4*outputStride;
+        }
+        return y;
+    }
+#endif
+
     // Buffers
     AlignedBuffer _kernelBuffer;
     Array<int> _offsets;
@@ -339,6 +491,7 @@ private:
     int _outputStride;
     int _inputOffset;
     int _shift;
+    int _work;  // Multiply-adds of units per execute()
 
     int _outputLeft;
     int _outputRight;
@@ -351,56 +504,22 @@ class ImageFilterHorizontal
 public:
     void execute()
     {
-        Byte* inputRow = _input.data() + _inputOffset;
-        Byte* outputRow = _output.data();
-        int* kernelSizes = &_kernelSizes[0];
-        if (useSSE2()) {
-            for (int y = 0; y < _height; ++y) {
-                __m128* kernel =
-                    reinterpret_cast<__m128*>(_kernelBuffer.data());
-                __m128* output = reinterpret_cast<__m128*>(outputRow);
-                int* offsets = &_offsets[0];
-                for (int x = 0; x < _width; ++x) {
-                    __m128 total = _mm_set1_ps(0.0f);
-                    int kernelSize = kernelSizes[x];
-                    for (int k = 0; k < kernelSize; ++k) {
-                        // We need to use an unaligned load here because we
-                        // need it to be possible for any input position to
-                        // affect any output position. We could do this by
-                        // duplicating each input position four times, but this
-                        // would probably be slower than the unaligned loads.
-                        total = _mm_add_ps(total, _mm_mul_ps(*kernel,
-                            _mm_loadu_ps(reinterpret_cast<float*>(inputRow +
-                                *offsets))));
-                        ++kernel;
-                        ++offsets;
-                    }
-                    output[x] = total;
-                }
-                inputRow += _input.stride();
-                outputRow += _output.stride();
-            }
-        }
-        else {
-            for (int y = 0; y < _height; ++y) {
-                float* kernel = reinterpret_cast<float*>(_kernelBuffer.data());
-                float* output = reinterpret_cast<float*>(outputRow);
-                int* offsets = &_offsets[0];
-                for (int x = 0; x < _width; ++x) {
-                    float total = 0;
-                    int kernelSize = kernelSizes[x];
-                    for (int k = 0; k < kernelSize; ++k) {
-                        total += *kernel *
-                            *reinterpret_cast<float*>(inputRow + *offsets);
-                        ++kernel;
-                        ++offsets;
-                    }
-                    output[x] = total;
-                }
-                inputRow += _input.stride();
-                outputRow += _output.stride();
+        forEachBand(_height, _work,
+            [&](int top, int bottom) { executeRows(top, bottom); });
+    }
+    // Like execute(), but calls after(top, bottom) on each group of up to 4
+    // output rows as soon as they have been filtered, while they are still in
+    // the cache. Groups in different bands may be done in parallel.
+    template<class F> void execute(F after)
+    {
+        forEachBand(_height, _work, [&](int top, int bottom)
+        {
+            for (int y = top; y < bottom; y += 4) {
+                int b = min(y + 4, bottom);
+                executeRows(y, b);
+                after(y, b);
             }
-        }
+        });
     }
     // outputSize.x is measured in output pixels
     // inputChannels is number of channels in input data
@@ -464,6 +583,7 @@ public:
 
         int left = std::numeric_limits<int>::max();
         int right = std::numeric_limits<int>::min();
+        int work = 0;
         for (int x = 0; x < _width; ++x) {
             int o = x*channelsPerUnit;
             int kernelSize = 0;
@@ -552,7 +672,9 @@ public:
                 ++offsetsStart;
             }
             sizes[x] = kernelSize;
+            work += kernelSize;
         }
+        _work = work*_height;
         if (left < 0)
             *inputLeft = (left - (inputChannels - 1))/inputChannels;
         else
@@ -573,6 +695,149 @@ public:
     int outputRight() const { return _outputRight; }
 
 private:
+    void executeRows(int top, int bottom)
+    {
+        int y = top;
+        if (useSSE2()) {
+#ifdef ALFE_X86
+            if (CPUFeatures::hasAVX512BW())
+                y = executeAVX512(y, bottom);
+            else if (CPUFeatures::hasAVX2())
+                y = executeAVX2(y, bottom);
+#endif
+            executeSSE2(y, bottom);
+            return;
+        }
+        Byte* inputRow = _input.data() + _inputOffset + y*_input.stride();
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y < bottom; ++y) {
+            float* kernel = reinterpret_cast<float*>(_kernelBuffer.data());
+            float* output = reinterpret_cast<float*>(outputRow);
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                float total = 0;
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    total += *kernel *
+                        *reinterpret_cast<float*>(inputRow + *offsets);
+                    ++kernel;
+                    ++offsets;
+                }
+                output[x] = total;
+            }
+            inputRow += _input.stride();
+            outputRow += _output.stride();
+        }
+    }
+    void executeSSE2(int y, int bottom)
+    {
+        Byte* inputRow = _input.data() + _inputOffset + y*_input.stride();
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y < bottom; ++y) {
+            __m128* kernel = reinterpret_cast<__m128*>(_kernelBuffer.data());
+            __m128* output = reinterpret_cast<__m128*>(outputRow);
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m128 total = _mm_set1_ps(0.0f);
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    // We need to use an unaligned load here because we need
+                    // it to be possible for any input position to affect any
+                    // output position. We could do this by duplicating each
+                    // input position four times, but this would probably be
+                    // slower than the unaligned loads.
+                    total = _mm_add_ps(total, _mm_mul_ps(*kernel,
+                        _mm_loadu_ps(reinterpret_cast<float*>(inputRow +
+                            *offsets))));
+                    ++kernel;
+                    ++offsets;
+                }
+                output[x] = total;
+            }
+            inputRow += _input.stride();
+            outputRow += _output.stride();
+        }
+    }
+#ifdef ALFE_X86
+    // As in ImageFilter16, these do a unit of 2 or 4 rows at once with one
+    // row per 128-bit lane, and return the first row they didn't do.
+    ALFE_TARGET("avx2") int executeAVX2(int y, int bottom)
+    {
+        int stride = _input.stride();
+        Byte* inputRow = _input.data() + _inputOffset + y*stride;
+        Byte* outputRow = _output.data() + y*_output.stride();
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y + 2 <= bottom; y += 2) {
+            const __m128* kernel =
+                reinterpret_cast<const __m128*>(_kernelBuffer.data());
+            __m128* output0 = reinterpret_cast<__m128*>(outputRow);
+            __m128* output1 =
+                reinterpret_cast<__m128*>(outputRow + _output.stride());
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m256 total = _mm256_setzero_ps();
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    const Byte* input = inputRow + *offsets;
+                    __m256 i = _mm256_insertf128_ps(
+                        _mm256_castps128_ps256(load128(input)),
+                        load128(input + stride), 1);
+                    total = _mm256_add_ps(total,
+                        _mm256_mul_ps(_mm256_broadcast_ps(kernel), i));
+                    ++kernel;
+                    ++offsets;
+                }
+                output0[x] = _mm256_castps256_ps128(total);
+                output1[x] = _mm256_extractf128_ps(total, 1);
+            }
+            inputRow += 2*stride;
+            outputRow += 2*_output.stride();
+        }
+        return y;
+    }
+    ALFE_TARGET("avx512f,avx512bw") int executeAVX512(int y, int bottom)
+    {
+        int stride = _input.stride();
+        int outputStride = _output.stride();
+        Byte* inputRow = _input.data() + _inputOffset + y*stride;
+        Byte* outputRow = _output.data() + y*outputStride;
+        int* kernelSizes = &_kernelSizes[0];
+        for (; y + 4 <= bottom; y += 4) {
+            const float* kernel =
+                reinterpret_cast<const float*>(_kernelBuffer.data());
+            int* offsets = &_offsets[0];
+            for (int x = 0; x < _width; ++x) {
+                __m512 total = _mm512_setzero_ps();
+                int kernelSize = kernelSizes[x];
+                for (int k = 0; k < kernelSize; ++k) {
+                    const Byte* input = inputRow + *offsets;
+                    __m512 i = _mm512_castps128_ps512(load128(input));
+                    i = _mm512_insertf32x4(i, load128(input + stride), 1);
+                    i = _mm512_insertf32x4(i, load128(input + 2*stride), 2);
+                    i = _mm512_insertf32x4(i, load128(input + 3*stride), 3);
+                    total = multiplyAdd(total,
+                        _mm512_broadcast_f32x4(_mm_load_ps(kernel)), i);
+                    kernel += 4;
+                    ++offsets;
+                }
+                Byte* output = outputRow + x*sizeof(__m128);
+                store128(output, _mm512_castps512_ps128(total));
+                store128(output + outputStride,
+                    _mm512_extractf32x4_ps(total, 1));
+                store128(output + 2*outputStride,
+                    _mm512_extractf32x4_ps(total, 2));
+                store128(output + 3*outputStride,
+                    _mm512_extractf32x4_ps(total, 3));
+            }
+            inputRow += 4*stride;
+            outputRow += 4*outputStride;
+        }
+        return y;
+    }
+#endif
+
     // Buffers
     AlignedBuffer _kernelBuffer;
     Array<int> _offsets;
@@ -587,6 +852,7 @@ private:
     int _inputStride;
     int _outputStride;
     int _inputOffset;
+    int _work;  // Multiply-adds of units per execute()
 
     int _outputLeft;
     int _outputRight;
@@ -599,52 +865,20 @@ class ImageFilterVertical
 public:
     void execute()
     {
-        Byte* inputStart = _input.data() + _inputOffset;
-        Byte* outputRow = _output.data();
-        Byte* kernel = _kernelBuffer.data();
-        int* offsets = &_offsets[0];
-        int* kernelSizes = &_kernelSizes[0];
-        if (useSSE2()) {
-            for (int y = 0; y < _height; ++y) {
-                int kernelSize = kernelSizes[y];
-                int offset = offsets[y];
-                Byte* inputColumn = inputStart;
-                for (int x = 0; x < _width; ++x) {
-                    Byte* input = inputColumn + offset;
-                    __m128 total = _mm_set1_ps(0.0f);
-                    for (int k = 0; k < kernelSize; ++k) {
-                        total = _mm_add_ps(total, _mm_mul_ps(
-                            reinterpret_cast<__m128*>(kernel)[k],
-                            *reinterpret_cast<__m128*>(input)));
-                        input += _input.stride();
-                    }
-                    inputColumn += sizeof(__m128);
-                    reinterpret_cast<__m128*>(outputRow)[x] = total;
-                }
-                outputRow += _output.stride();
-                kernel += kernelSize*sizeof(__m128);
-            }
-        }
-        else {
-            for (int y = 0; y < _height; ++y) {
-                int kernelSize = kernelSizes[y];
-                int offset = offsets[y];
-                Byte* inputColumn = inputStart;
-                for (int x = 0; x < _width; ++x) {
-                    Byte* input = inputColumn + offset;
-                    float total = 0;
-                    for (int k = 0; k < kernelSize; ++k) {
-                        total += reinterpret_cast<float*>(kernel)[k] *
-                            *reinterpret_cast<float*>(input);
-                        input += _input.stride();
-                    }
-                    inputColumn += sizeof(float);
-                    reinterpret_cast<float*>(outputRow)[x] = total;
-                }
-                outputRow += _output.stride();
-                kernel += kernelSize*sizeof(float);
+        forEachBand(_height, _work,
+            [&](int top, int bottom) { executeRows(top, bottom); });
+    }
+    // As ImageFilterHorizontal::execute(after).
+    template<class F> void execute(F after)
+    {
+        forEachBand(_height, _work, [&](int top, int bottom)
+        {
+            for (int y = top; y < bottom; y += 4) {
+                int b = min(y + 4, bottom);
+                executeRows(y, b);
+                after(y, b);
             }
-        }
+        });
     }
     // outputSize.x is measured in output channels and should be a multiple of
     // channelsPerUnit
@@ -700,6 +934,8 @@ public:
 
         int top = std::numeric_limits<int>::max();
         int bottom = std::numeric_limits<int>::min();
+        _kernelStarts.ensure(_height);
+        int work = 0;
         for (int y = 0; y < _height; ++y) {
             // Compute topmost and bottommost possible input positions
             float tp = offset - kernelRadius + 1 + static_cast<float>(y)/zoom;
@@ -752,11 +988,14 @@ public:
             }
             sizes[y] = 1 + realBottom - realTop;
             offsets[y] = realTop;
+            _kernelStarts[y] = work*channelsPerUnit;
+            work += sizes[y];
             top = min(top, realTop);
             bottom = max(bottom, realBottom);
         }
         *inputTop = top;
         *inputBottom = bottom + 1;
+        _work = work*_width;
 
         _inputOffsetCount = -top;
     }
@@ -770,11 +1009,162 @@ public:
     }
 
 private:
+    void executeRows(int top, int bottom)
+    {
+        Byte* inputStart = _input.data() + _inputOffset;
+        Byte* outputRow = _output.data() + top*_output.stride();
+        float* kernels = reinterpret_cast<float*>(_kernelBuffer.data());
+        int* offsets = &_offsets[0];
+        int* kernelSizes = &_kernelSizes[0];
+        if (useSSE2()) {
+            for (int y = top; y < bottom; ++y) {
+                int kernelSize = kernelSizes[y];
+                int offset = offsets[y];
+                float* kernel = kernels + _kernelStarts[y];
+                int x = 0;
+#ifdef ALFE_X86
+                if (CPUFeatures::hasAVX512BW()) {
+                    x = rowAVX512(inputStart + offset, outputRow, kernel,
+                        kernelSize);
+                }
+                else if (CPUFeatures::hasAVX2()) {
+                    x = rowAVX2(inputStart + offset, outputRow, kernel,
+                        kernelSize);
+                }
+#endif
+                Byte* inputColumn = inputStart + x*sizeof(__m128);
+                for (; x < _width; ++x) {
+                    Byte* input = inputColumn + offset;
+                    __m128 total = _mm_set1_ps(0.0f);
+                    for (int k = 0; k < kernelSize; ++k) {
+                        total = _mm_add_ps(total, _mm_mul_ps(
+                            reinterpret_cast<__m128*>(kernel)[k],
+                            *reinterpret_cast<__m128*>(input)));
+                        input += _input.stride();
+                    }
+                    inputColumn += sizeof(__m128);
+                    reinterpret_cast<__m128*>(outputRow)[x] = total;
+                }
+                outputRow += _output.stride();
+            }
+        }
+        else {
+            for (int y = top; y < bottom; ++y) {
+                int kernelSize = kernelSizes[y];
+                int offset = offsets[y];
+                float* kernel = kernels + _kernelStarts[y];
+                Byte* inputColumn = inputStart;
+                for (int x = 0; x < _width; ++x) {
+                    Byte* input = inputColumn + offset;
+                    float total = 0;
+                    for (int k = 0; k < kernelSize; ++k) {
+                        total += kernel[k] * *reinterpret_cast<float*>(input);
+                        input += _input.stride();
+                    }
+                    inputColumn += sizeof(float);
+                    reinterpret_cast<float*>(outputRow)[x] = total;
+                }
+                outputRow += _output.stride();
+            }
+        }
+    }
+#ifdef ALFE_X86
+    // Adjacent units of a row use the same coefficients, so the wider
+    // versions just do 2 (AVX2) or 4 (AVX-512) units per register, and
+    // several registers at once so that the additions for different columns
+    // can overlap. Each channel is still summed in the same order as in the
+    // SSE2 code. They return the first unit they didn't do.
+    ALFE_TARGET("avx2") int rowAVX2(const Byte* inputColumn, Byte* outputRow,
+        const float* kernel, int kernelSize)
+    {
+        int stride = _input.stride();
+        float* output = reinterpret_cast<float*>(outputRow);
+        int x = 0;
+        for (; x + 8 <= _width; x += 8) {
+            const float* input =
+                reinterpret_cast<const float*>(inputColumn) + x*4;
+            __m256 t0 = _mm256_setzero_ps();
+            __m256 t1 = _mm256_setzero_ps();
+            __m256 t2 = _mm256_setzero_ps();
+            __m256 t3 = _mm256_setzero_ps();
+            for (int k = 0; k < kernelSize; ++k) {
+                __m256 c = _mm256_broadcast_ss(kernel + k*4);
+                t0 = _mm256_add_ps(t0, _mm256_mul_ps(c,
+                    _mm256_loadu_ps(input)));
+                t1 = _mm256_add_ps(t1, _mm256_mul_ps(c,
+                    _mm256_loadu_ps(input + 8)));
+                t2 = _mm256_add_ps(t2, _mm256_mul_ps(c,
+                    _mm256_loadu_ps(input + 16)));
+                t3 = _mm256_add_ps(t3, _mm256_mul_ps(c,
+                    _mm256_loadu_ps(input + 24)));
+                input += stride/sizeof(float);
+            }
+            _mm256_storeu_ps(output + x*4, t0);
+            _mm256_storeu_ps(output + x*4 + 8, t1);
+            _mm256_storeu_ps(output + x*4 + 16, t2);
+            _mm256_storeu_ps(output + x*4 + 24, t3);
+        }
+        for (; x + 2 <= _width; x += 2) {
+            const float* input =
+                reinterpret_cast<const float*>(inputColumn) + x*4;
+            __m256 t = _mm256_setzero_ps();
+            for (int k = 0; k < kernelSize; ++k) {
+                t = _mm256_add_ps(t, _mm256_mul_ps(
+                    _mm256_broadcast_ss(kernel + k*4),
+                    _mm256_loadu_ps(input)));
+                input += stride/sizeof(float);
+            }
+            _mm256_storeu_ps(output + x*4, t);
+        }
+        return x;
+    }
+    ALFE_TARGET("avx512f,avx512bw") int rowAVX512(const Byte* inputColumn,
+        Byte* outputRow, const float* kernel, int kernelSize)
+    {
+        int stride = _input.stride();
+        float* output = reinterpret_cast<float*>(outputRow);
+        int x = 0;
+        for (; x + 16 <= _width; x += 16) {
+            const float* input =
+                reinterpret_cast<const float*>(inputColumn) + x*4;
+            __m512 t0 = _mm512_setzero_ps();
+            __m512 t1 = _mm512_setzero_ps();
+            __m512 t2 = _mm512_setzero_ps();
+            __m512 t3 = _mm512_setzero_ps();
+            for (int k = 0; k < kernelSize; ++k) {
+                __m512 c = _mm512_set1_ps(kernel[k*4]);
+                t0 = multiplyAdd(t0, c, _mm512_loadu_ps(input));
+                t1 = multiplyAdd(t1, c, _mm512_loadu_ps(input + 16));
+                t2 = multiplyAdd(t2, c, _mm512_loadu_ps(input + 32));
+                t3 = multiplyAdd(t3, c, _mm512_loadu_ps(input + 48));
+                input += stride/sizeof(float);
+            }
+            _mm512_storeu_ps(output + x*4, t0);
+            _mm512_storeu_ps(output + x*4 + 16, t1);
+            _mm512_storeu_ps(output + x*4 + 32, t2);
+            _mm512_storeu_ps(output + x*4 + 48, t3);
+        }
+        for (; x + 4 <= _width; x += 4) {
+            const float* input =
+                reinterpret_cast<const float*>(inputColumn) + x*4;
+            __m512 t = _mm512_setzero_ps();
+            for (int k = 0; k < kernelSize; ++k) {
+                t = multiplyAdd(t, _mm512_set1_ps(kernel[k*4]),
+                    _mm512_loadu_ps(input));
+                input += stride/sizeof(float);
+            }
+            _mm512_storeu_ps(output + x*4, t);
+        }
+        return x;
+    }
+#endif
+
     // Buffers
     AlignedBuffer _kernelBuffer;
     Array<int> _offsetCounts;
     Array<int> _offsets;
     Array<int> _kernelSizes;
+    Array<int> _kernelStarts;
     AlignedBuffer _input;
     AlignedBuffer _output;
 
@@ -785,6 +1175,7 @@ private:
     int _outputStride;
     int _inputOffsetCount;
     int _inputOffset;
+    int _work;  // Multiply-adds of units per execute()
 };
 
 #endif // INCLUDED_IMAGE_FILTER_H
@@ -18,6 +18,7 @@ public:
             ++i;
             return Value(l + i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -39,6 +40,7 @@ public:
             ++i;
             return Value(l - i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -60,6 +62,7 @@ public:
             ++i;
             return Value(l * i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -85,6 +88,7 @@ public:
                 return Rational(l, 1 << -r);
             return l << r;
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftLeft(); }
         FunctionType type() const
         {
@@ -110,6 +114,7 @@ public:
                 return l << -r;
             return Rational(l, 1 << r);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftRight(); }
         FunctionType type() const
         {
@@ -131,6 +136,7 @@ public:
             ++i;
             return Value(l < i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorLessThan(); }
         FunctionType type() const
         {
@@ -153,6 +159,7 @@ public:
             ++i;
             return Value(l > i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorGreaterThan(); }
         FunctionType type() const
         {
@@ -175,6 +182,7 @@ public:
             ++i;
             return Value(l <= i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorLessThanOrEqualTo(); }
         FunctionType type() const
         {
@@ -197,6 +205,7 @@ public:
             ++i;
             return Value(l >= i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const
         {
             return OperatorGreaterThanOrEqualTo();
@@ -218,6 +227,7 @@ public:
         {
             return Value( - arguments.begin()->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -28,6 +28,12 @@ typedef UInt16             Word;
 typedef UInt32             DWord;
 typedef UInt64             QWord;
 
+#ifndef _WIN32
+// The Windows name is used for 0x00RRGGBB pixels in code that isn't
+// Windows-specific.
+typedef UInt32             DWORD;
+#endif
+
 typedef void               Void;
 
 typedef SInt32             PSInt;
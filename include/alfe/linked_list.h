@@ -11,10 +11,13 @@ template<class T> class LinkedListMember : Uncopyable
 public:
     LinkedListMember() : _next(this), _prev(this) { }
 
+    // Safe to call even if we're not in a list.
     void remove()
     {
         _next->_prev = _prev;
         _prev->_next = _next;
+        _next = this;
+        _prev = this;
     }
 
     void moveFrom(LinkedListMember<T>* oldLocation)
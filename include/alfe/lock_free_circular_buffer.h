@@ -0,0 +1,138 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_LOCK_FREE_CIRCULAR_BUFFER_H
+#define INCLUDED_LOCK_FREE_CIRCULAR_BUFFER_H
+
+#include <atomic>
+
+// A fixed-size circular buffer which can be written by one thread and read by
+// another without locking. Unlike CircularBuffer it never grows: a producer
+// that finds the buffer full has to wait for the consumer (that's the
+// backpressure). The size is always a power of two.
+//
+// The read and write positions are free-running counters that are only masked
+// when used to index the buffer, so a full buffer and an empty one are
+// distinguishable. Each position lives on its own cache line along with the
+// other side's position as last seen, so that in the common case neither
+// thread has to touch a cache line that the other thread is writing.
+template<class T> class LockFreeCircularBuffer : Uncopyable
+{
+public:
+    LockFreeCircularBuffer(int size = 0)
+      : _buffer(0), _mask(0), _size(0), _readPosition(0),
+        _cachedWritePosition(0), _writePosition(0), _cachedReadPosition(0)
+    {
+        if (size != 0)
+            allocate(size);
+    }
+    ~LockFreeCircularBuffer() { if (_buffer != 0) delete[] _buffer; }
+    // Not thread-safe: call this before the producer and consumer start.
+    void allocate(int size)
+    {
+        int newSize = 1;
+        while (newSize < size)
+            newSize <<= 1;
+        if (_buffer != 0)
+            delete[] _buffer;
+        _buffer = new T[newSize];
+        _size = newSize;
+        _mask = newSize - 1;
+        _readPosition.store(0, std::memory_order_relaxed);
+        _writePosition.store(0, std::memory_order_relaxed);
+        _cachedReadPosition = 0;
+        _cachedWritePosition = 0;
+    }
+    int size() const { return _size; }
+    int mask() const { return _mask; }
+    T* lowPointer() const { return _buffer; }
+
+    // Producer side.
+
+    // Returns the number of items that can be written without waiting.
+    int writable()
+    {
+        UInt32 w = _writePosition.load(std::memory_order_relaxed);
+        if (w - _cachedReadPosition == static_cast<UInt32>(_size))
+            _cachedReadPosition = _readPosition.load(std::memory_order_acquire);
+        return _size - static_cast<int>(w - _cachedReadPosition);
+    }
+    int writeOffset() const
+    {
+        return _writePosition.load(std::memory_order_relaxed) & _mask;
+    }
+    void copyIn(const T* source, int n)
+    {
+        int start = writeOffset();
+        int n1 = min(n, _size - start);
+        memcpy(_buffer + start, source, n1*sizeof(T));
+        memcpy(_buffer, source + n1, (n - n1)*sizeof(T));
+    }
+    // Makes n items written since the last call visible to the consumer.
+    void added(int n)
+    {
+        _writePosition.store(
+            _writePosition.load(std::memory_order_relaxed) + n,
+            std::memory_order_release);
+    }
+
+    // Consumer side.
+
+    // Returns the number of items that can be read without waiting.
+    int readable()
+    {
+        UInt32 r = _readPosition.load(std::memory_order_relaxed);
+        if (r == _cachedWritePosition) {
+            _cachedWritePosition =
+                _writePosition.load(std::memory_order_acquire);
+        }
+        return static_cast<int>(_cachedWritePosition - r);
+    }
+    // Like readable(), but always looks at the producer's position.
+    int readableNow()
+    {
+        _cachedWritePosition = _writePosition.load(std::memory_order_acquire);
+        return static_cast<int>(_cachedWritePosition -
+            _readPosition.load(std::memory_order_relaxed));
+    }
+    int readOffset() const
+    {
+        return _readPosition.load(std::memory_order_relaxed) & _mask;
+    }
+    const T& read(int n = 0) const
+    {
+        return _buffer[(readOffset() + n) & _mask];
+    }
+    void copyOut(T* destination, int n) const
+    {
+        int start = readOffset();
+        int n1 = min(n, _size - start);
+        memcpy(destination, _buffer + start, n1*sizeof(T));
+        memcpy(destination + n1, _buffer, (n - n1)*sizeof(T));
+    }
+    // Hands the space occupied by n items back to the producer.
+    void remove(int n)
+    {
+        _readPosition.store(
+            _readPosition.load(std::memory_order_relaxed) + n,
+            std::memory_order_release);
+    }
+private:
+    static const int cacheLineSize = 64;
+
+    T* _buffer;
+    int _mask;
+    int _size;
+
+    // Written by the consumer.
+    alignas(cacheLineSize) std::atomic<UInt32> _readPosition;
+    UInt32 _cachedWritePosition;
+
+    // Written by the producer.
+    alignas(cacheLineSize) std::atomic<UInt32> _writePosition;
+    UInt32 _cachedReadPosition;
+
+    char _padding[cacheLineSize - sizeof(std::atomic<UInt32>) -
+        sizeof(UInt32)];
+};
+
+#endif // INCLUDED_LOCK_FREE_CIRCULAR_BUFFER_H
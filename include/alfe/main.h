@@ -44,6 +44,7 @@ bool alerting = false;
 #include "alfe/windows_handle.h"
 #include "alfe/stream.h"
 #include "alfe/file_stream.h"
+#include "alfe/file_mapping.h"
 #include "alfe/character_source.h"
 #if defined(_WIN32) && defined(_WINDOWS)
 #include "alfe/vectors.h"
@@ -106,7 +107,9 @@ protected:
     virtual void run() = 0;
     Array<String> _arguments;
     int _returnValue;
+#ifdef _WIN32
     HINSTANCE _hInst;
+#endif
 private:
 #ifdef _WIN32
 #ifdef _WINDOWS
@@ -7,6 +7,9 @@
 #include "alfe/fft.h"
 #include "alfe/image_filter.h"
 #include "alfe/colour_space.h"
+#include "alfe/cpu_features.h"
+#include "alfe/thread.h"
+#include "alfe/wrap.h"
 #include <cmath>
 
 float sinc(float z)
@@ -49,6 +52,7 @@ public:
         _yScale = 1;
         _doDecode = true;
         _chromaSamples = 8;
+        _pool = 0;
 
         for (int i = 8; i < 40; ++i)
             _burstWeights[i] = 1;
@@ -77,6 +81,9 @@ public:
     void setYScale(int yscale) { _yScale = yscale; }
     void setDoDecode(bool doDecode) { _doDecode = doDecode; }
     void setChromaSamples(float samples) { _chromaSamples = samples; }
+    // The lines are decoded on this pool's threads. By default a pool shared
+    // by all decoders is used.
+    void setThreadPool(ThreadPool* pool) { _pool = pool; }
 
     void decode()
     {
@@ -169,9 +176,9 @@ public:
         float deltaSamplesPerLine = samplesPerLine - nominalSamplesPerLine;
 
 
-        // Pass 2 - render
-
-        Byte* outputRow = _output.data();
+        // Pass 2 - work out the position, length and colour adjustments of
+        // each line. These are smoothed from one line to the next, so this
+        // has to be done in order, but it's cheap.
 
         float q = syncPositions[1] - samplesPerLine;
         syncPositions[0] = q;
@@ -180,9 +187,9 @@ public:
         for (int i = 0; i < 8; ++i)
             rotorTable[i] = rotor(static_cast<float>(i)/8).x;
         Complex<float> expectedBurst = burst;
-        int oldActualSamplesPerLine = nominalSamplesPerLine;
         float contrast1 = _contrast;
         float saturation1 = _saturation*100;
+        Line lineParameters[lines];
         for (int line = 0; line < lines; ++line) {
             // Determine the phase, amplitude and DC offset of the color signal
             // from the color burst, which starts shortly after the horizontal
@@ -194,17 +201,44 @@ public:
             //burst = actualBurst;
 
             float phaseDifference = (actualBurst*(expectedBurst.conjugate())).argument()/tau;
-            float adjust = -phaseDifference/_outputPixelsPerLine;
+            Line* l = &lineParameters[line];
+            l->_adjust = -phaseDifference/_outputPixelsPerLine;
 
             float bm2 = burst.modulus2();
-            Complex<float> chromaAdjust;
             // TODO: Implement proper colour-killer logic (100 scanlines hysterisis?)
             if (bm2 < 50)
-                chromaAdjust = 0;
+                l->_chromaAdjust = 0;
             else
-                chromaAdjust = burst.conjugate()*contrast1*saturation1 / bm2;
+                l->_chromaAdjust = burst.conjugate()*contrast1*saturation1 / bm2;
             burstDCAverage = (2*burstDCAverage + burstDCs[line])/3;
-            float brightness1 = _brightness + 65 - burstDCAverage;
+            l->_brightness = _brightness + 65 - burstDCAverage;
+            l->_q = q;
+            l->_samplesPerLine = samplesPerLine;
+
+            int p = syncPositions[line + 1];
+            int actualSamplesPerLine = p - syncPositions[line];
+            samplesPerLine = (2*samplesPerLine + actualSamplesPerLine + fracSyncPositions[line] - fracSyncPositions[line + 1])/3;
+            q += samplesPerLine;
+            q = (10*q + p)/11;
+
+            expectedBurst = actualBurst;
+        }
+
+        // Pass 3 - render. Each line only depends on its own parameters, so
+        // the lines are resampled and decoded in parallel. Lines before
+        // firstScanline would be overwritten by the first one that is kept,
+        // so they aren't rendered at all.
+
+        ThreadPool* pool = _pool;
+        if (pool == 0)
+            pool = ThreadPool::shared();
+        pool->parallelFor(firstScanline, lines, [&](int line)
+        {
+            const Line* l = &lineParameters[line];
+            float samplesPerLine = l->_samplesPerLine;
+            float q = l->_q;
+            Byte* outputRow = _output.data() +
+                (line - firstScanline)*_yScale*_output.stride();
 
             // Resample the image data
 
@@ -263,8 +297,8 @@ public:
                     t += s;
                 }
 
-                y = y*contrast1/t + brightness1;
-                c = c*chromaAdjust*rotor((x - burstCenter*_outputPixelsPerLine/samplesPerLine)*adjust);
+                y = y*contrast1/t + l->_brightness;
+                c = c*l->_chromaAdjust*rotor((x - burstCenter*_outputPixelsPerLine/samplesPerLine)*l->_adjust);
 
                 setOutput(output, SRGB(
                     checkClamp(y + 0.9563*c.x + 0.6210*c.y),
@@ -273,31 +307,30 @@ public:
                 ++output;
             }
 
-            int p = syncPositions[line + 1];
-            int actualSamplesPerLine = p - syncPositions[line];
-            samplesPerLine = (2*samplesPerLine + actualSamplesPerLine + fracSyncPositions[line] - fracSyncPositions[line + 1])/3;
-            q += samplesPerLine;
-            q = (10*q + p)/11;
-
-            expectedBurst = actualBurst;
-
-            if (line >= firstScanline) {
-                Byte* outputRow2 = outputRow + _output.stride();
-                for (int yy = 1; yy < _yScale; ++yy) {
-                    T* output = reinterpret_cast<T*>(outputRow2);
-                    T* input = reinterpret_cast<T*>(outputRow);
-                    for (int x = 0; x < _output.size().x; ++x) {
-                        *output = *input;
-                        ++output;
-                        ++input;
-                    }
-                    outputRow2 += _output.stride();
+            Byte* outputRow2 = outputRow + _output.stride();
+            for (int yy = 1; yy < _yScale; ++yy) {
+                T* output = reinterpret_cast<T*>(outputRow2);
+                T* input = reinterpret_cast<T*>(outputRow);
+                for (int x = 0; x < _output.size().x; ++x) {
+                    *output = *input;
+                    ++output;
+                    ++input;
                 }
-                outputRow = outputRow2;
+                outputRow2 += _output.stride();
             }
-        }
+        });
     }
 private:
+    // What pass 2 of decode() works out for each line.
+    struct Line
+    {
+        float _q;
+        float _samplesPerLine;
+        float _adjust;
+        Complex<float> _chromaAdjust;
+        float _brightness;
+    };
+
     void outputRaw()
     {
         Byte* outputRow = _output.data();
@@ -325,10 +358,13 @@ private:
     {
         *output = (x.x << 16) | (x.y << 8) | x.z;
     }
+#ifdef _WIN32
+    // DWORD is only a distinct type from UInt32 on Windows.
     void setOutput(DWORD* output, SRGB x)
     {
         *output = (x.x << 16) | (x.y << 8) | x.z;
     }
+#endif
 
     int _outputPixelsPerLine;
     float _contrast;
@@ -341,15 +377,21 @@ private:
     bool _doDecode;
     float _chromaSamples;
     float _burstWeights[48];
+    ThreadPool* _pool;
 };
 
 // A non-resampling decoder optimized to decode a large chunk of samples at
-// once, using FFTs.
+// once. The filtering is done either with FFTs or, when the kernels are short
+// enough for that to be faster, by convolving directly with FIR filters.
+// Both give the same results (up to rounding): the FIR filters wrap around
+// the ends of the block just like the FFTs do.
 class NTSCDecoder
 {
 public:
+    enum Backend { automaticBackend, fftBackend, firBackend };
+
     NTSCDecoder(int length = 512, int outputLength = 448)
-      : _rigor(FFTW_EXHAUSTIVE)
+      : _rigor(FFTW_EXHAUSTIVE), _backend(automaticBackend), _fir(false)
     {
         setLength(length, outputLength);
     }
@@ -395,6 +437,16 @@ public:
         if (chromaCutoff == 0)
             chromaScale = 0;
 
+        // The FIR filters can only reproduce the FFT ones if the kernels
+        // don't overlap themselves when wrapped around the block.
+        int radius = static_cast<int>(width);
+        _fir = radius < _length/2 && (_backend == firBackend ||
+            (_backend == automaticBackend &&
+            2*radius + 1 <= maximumFIRTaps()));
+        _radius = radius;
+        _lumaKernel.ensure(fLength);
+        _chromaKernel.ensure(fLength);
+
         float lumaTotal = 0;
         for (int t = 0; t < fLength; ++t) {
             float d = static_cast<float>(t);
@@ -404,12 +456,22 @@ public:
             _yTime[t] = r;
             if (t > 0)
                 _yTime[_length - t] = r;
+            _lumaKernel[t] = r;
             lumaTotal += r * (t == 0 ? 1 : 2);
         }
         float scale = 1 / lumaTotal;
         _lumaForward.execute(_yTime, _frequency);
         for (int f = 0; f < fLength; ++f)
             _yResponse[f] = _frequency[f].x * contrast * scale;
+        if (_fir) {
+            // The inverse FFT doesn't normalize, so the luma response has a
+            // gain of _length that contrast cancels.
+            _lumaTaps.ensure(2*radius + 1);
+            for (int t = -radius; t <= radius; ++t) {
+                _lumaTaps[t + radius] =
+                    _lumaKernel[abs(t)] * contrast * _length * scale;
+            }
+        }
 
         float chromaTotal = 0;
         for (int t = 0; t < fLength; ++t) {
@@ -420,6 +482,7 @@ public:
             _yTime[t] = r;
             if (t > 0)
                 _yTime[_length - t] = r;
+            _chromaKernel[t] = r;
             chromaTotal += r * (t == 0 ? 1 : 2);
         }
         scale = 1 / chromaTotal;
@@ -429,7 +492,30 @@ public:
             _iResponse[f] = s * unit(-f / 512.0f);
             _qResponse[f] = s;
         }
+        if (_fir) {
+            // The chroma samples are at half rate, so each full-rate output
+            // sample only sees every other tap. Split the kernel into its
+            // even and odd taps so that we don't multiply by the zeros.
+            int evenRadius = radius/2;
+            int oddRadius = (radius + 1)/2;
+            _evenTaps.ensure(2*evenRadius + 1);
+            for (int t = -evenRadius; t <= evenRadius; ++t) {
+                _evenTaps[t + evenRadius] =
+                    _chromaKernel[abs(2*t)] * _length * scale;
+            }
+            _oddTaps.ensure(2*oddRadius);
+            for (int t = -oddRadius; t < oddRadius; ++t) {
+                _oddTaps[t + oddRadius] =
+                    _chromaKernel[abs(2*t + 1)] * _length * scale;
+            }
+        }
     }
+    // Choose between FFT and FIR filtering. With automaticBackend (the
+    // default) init() picks whichever is faster for the current kernels.
+    void setBackend(Backend backend) { _backend = backend; }
+    Backend getBackend() { return _backend; }
+    // Returns true if init() chose FIR filtering.
+    bool usingFIR() { return _fir; }
     void calculateBurst(const Byte* burst)
     {
         Complex<float> iq;
@@ -448,6 +534,10 @@ public:
 
     void decodeBlock(SRGB* srgb)
     {
+        if (_fir) {
+            decodeBlockFIR(srgb);
+            return;
+        }
         int fLength = _length/2 + 1;
 
         // Filter I
@@ -552,6 +642,165 @@ public:
         decodeBlock(srgb);
     }
 private:
+    // The longest kernel for which direct convolution beats the FFTs. The
+    // five FFTs per block cost the same whatever the kernel length, whereas
+    // convolution costs about 2*taps multiply-adds per sample (the luma
+    // kernel, plus the even and odd halves of the chroma kernel for each of
+    // I and Q at half rate). With AVX2 the two break even at around 100
+    // taps for 512-sample blocks.
+    static int maximumFIRTaps()
+    {
+#ifdef ALFE_X86
+        if (CPUFeatures::hasAVX2())
+            return 81;
+#endif
+        return 25;
+    }
+
+    void decodeBlockFIR(SRGB* srgb)
+    {
+        int n = _length;
+        int h = n/2;
+        int radius = _radius;
+        int evenRadius = radius/2;
+        int oddRadius = (radius + 1)/2;
+
+        // Extend the half-rate chroma at both ends, wrapping around.
+        int chromaPadding = oddRadius + 1;
+        int chromaPadded = h + 2*chromaPadding;
+        int lumaPadded = _outputLength + 2*radius;
+        _firBuffer.ensure(2*chromaPadded + 4*(h + 1) + lumaPadded +
+            _outputLength);
+        float* iPadded = &_firBuffer[0];
+        float* qPadded = iPadded + chromaPadded;
+        float* iEven = qPadded + chromaPadded;
+        float* iOdd = iEven + h + 1;
+        float* qEven = iOdd + h + 1;
+        float* qOdd = qEven + h + 1;
+        float* yPadded = qOdd + h + 1;
+        float* yFiltered = yPadded + lumaPadded;
+        copyWrapped(&_iTime[0], h, -chromaPadding, iPadded, chromaPadded);
+        copyWrapped(&_qTime[0], h, -chromaPadding, qPadded, chromaPadded);
+
+        // Filter I and Q. I is delayed by one full-rate sample relative to Q,
+        // so the I sample at 2*m comes from the odd taps and the one at
+        // 2*m + 1 from the even taps, and vice versa for Q.
+        const float* even = &_evenTaps[0];
+        const float* odd = &_oddTaps[0];
+        int evenTaps = 2*evenRadius + 1;
+        int oddTaps = 2*oddRadius;
+        convolve(iPadded + chromaPadding - evenRadius, iEven, h + 1, even,
+            evenTaps);
+        convolve(iPadded + chromaPadding - oddRadius, iOdd, h + 1, odd,
+            oddTaps);
+        convolve(qPadded + chromaPadding - evenRadius, qEven, h + 1, even,
+            evenTaps);
+        convolve(qPadded + chromaPadding - oddRadius, qOdd, h + 1, odd,
+            oddTaps);
+        for (int m = 0; m < h; ++m) {
+            _iTime[2*m] = iOdd[m];
+            _iTime[2*m + 1] = iEven[m];
+            _qTime[2*m] = qEven[m];
+            _qTime[2*m + 1] = qOdd[m + 1];
+        }
+
+        // Remove remodulated IQ from Y
+        for (int t = 0; t < n; t += 4) {
+            _yTime[t] -= _qTime[t]*_chromaScale;
+            _yTime[t + 1] += _iTime[t + 1]*_chromaScale;
+            _yTime[t + 2] += _qTime[t + 2]*_chromaScale;
+            _yTime[t + 3] -= _iTime[t + 3]*_chromaScale;
+        }
+        copyWrapped(&_yTime[0], n, _padding - radius, yPadded, lumaPadded);
+
+        // Filter Y
+        convolve(yPadded, yFiltered, _outputLength, &_lumaTaps[0],
+            2*radius + 1);
+
+        for (int x = 0; x < _outputLength; ++x) {
+            int t = _padding + x;
+            float y = yFiltered[x] + _brightness2;
+            Complex<float> iq(_iTime[t], _qTime[t]);
+            *srgb = SRGB(byteClamp(y + _ri*iq.x + _rq*iq.y),
+                byteClamp(y + _gi*iq.x + _gq*iq.y),
+                byteClamp(y + _bi*iq.x + _bq*iq.y));
+            ++srgb;
+        }
+    }
+    // Copies count samples, starting at start (which can be outside the
+    // block), from a block of length samples that repeats periodically.
+    static void copyWrapped(const float* input, int length, int start,
+        float* output, int count)
+    {
+        start = wrap(start, length);
+        while (count > 0) {
+            int n = min(count, length - start);
+            memcpy(output, input + start, n*sizeof(float));
+            output += n;
+            count -= n;
+            start = 0;
+        }
+    }
+    // output[x] = sum over k of taps[k]*input[x + k], for 0 <= x < n.
+    static void convolve(const float* input, float* output, int n,
+        const float* taps, int nTaps)
+    {
+        int x = 0;
+#ifdef ALFE_X86
+        if (CPUFeatures::hasAVX2())
+            x = convolveAVX2(input, output, n, taps, nTaps);
+#endif
+        for (; x < n; ++x) {
+            float s = 0;
+            for (int k = 0; k < nTaps; ++k)
+                s += taps[k]*input[x + k];
+            output[x] = s;
+        }
+    }
+#ifdef ALFE_X86
+    // Does 32 outputs at a time with each tap broadcast across four
+    // accumulators, and returns how many outputs were done. The sums are
+    // accumulated in the same order as the scalar loop, so the results are
+    // the same.
+    ALFE_TARGET("avx2") static int convolveAVX2(const float* input,
+        float* output, int n, const float* taps, int nTaps)
+    {
+        int x = 0;
+        for (; x + 32 <= n; x += 32) {
+            const float* in = input + x;
+            __m256 s0 = _mm256_setzero_ps();
+            __m256 s1 = _mm256_setzero_ps();
+            __m256 s2 = _mm256_setzero_ps();
+            __m256 s3 = _mm256_setzero_ps();
+            for (int k = 0; k < nTaps; ++k) {
+                __m256 t = _mm256_broadcast_ss(taps + k);
+                s0 = _mm256_add_ps(s0,
+                    _mm256_mul_ps(t, _mm256_loadu_ps(in + k)));
+                s1 = _mm256_add_ps(s1,
+                    _mm256_mul_ps(t, _mm256_loadu_ps(in + k + 8)));
+                s2 = _mm256_add_ps(s2,
+                    _mm256_mul_ps(t, _mm256_loadu_ps(in + k + 16)));
+                s3 = _mm256_add_ps(s3,
+                    _mm256_mul_ps(t, _mm256_loadu_ps(in + k + 24)));
+            }
+            _mm256_storeu_ps(output + x, s0);
+            _mm256_storeu_ps(output + x + 8, s1);
+            _mm256_storeu_ps(output + x + 16, s2);
+            _mm256_storeu_ps(output + x + 24, s3);
+        }
+        for (; x + 8 <= n; x += 8) {
+            __m256 s = _mm256_setzero_ps();
+            for (int k = 0; k < nTaps; ++k) {
+                s = _mm256_add_ps(s, _mm256_mul_ps(
+                    _mm256_broadcast_ss(taps + k),
+                    _mm256_loadu_ps(input + x + k)));
+            }
+            _mm256_storeu_ps(output + x, s);
+        }
+        return x;
+    }
+#endif
+
     float _hue;
     float _saturation;
     float _contrast;
@@ -585,6 +834,16 @@ private:
     int _rigor;
     int _length;
     int _outputLength;
+
+    Backend _backend;
+    bool _fir;
+    int _radius;
+    Array<float> _lumaKernel;
+    Array<float> _chromaKernel;
+    Array<float> _lumaTaps;
+    Array<float> _evenTaps;
+    Array<float> _oddTaps;
+    Array<float> _firBuffer;
 };
 
 // A non-resampling decoder optimized to decode a small number of samples at
@@ -14,7 +14,16 @@ public:
     String toString() const { return body()->toString(); }
     Operator parse(CharacterSource* source, Span* span) const
     {
-        if (Space::parseOperator(source, toString(), span))
+        String op = toString();
+        // && and || are parsed by LogicalAndExpression and
+        // LogicalOrExpression, so their first character mustn't be taken as
+        // a bitwise operator.
+        if (op == "&" || op == "|") {
+            CharacterSource s = *source;
+            if (Space::parseOperator(&s, op + op))
+                return Operator();
+        }
+        if (Space::parseOperator(source, op, span))
             return *this;
         return Operator();
     }
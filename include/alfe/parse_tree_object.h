@@ -3,13 +3,16 @@
 #ifndef INCLUDED_PARSE_TREE_OBJECT_H
 #define INCLUDED_PARSE_TREE_OBJECT_H
 
+#include "alfe/small_object_pool.h"
+
 class ParseTreeObject : public Handle
 {
 public:
     Span span() const { return body()->span(); }
     void setSpan(Span span) { body()->setSpan(span); }
 
-    class Body : public Handle::Body
+    // Parsing creates lots of small nodes, so they come from SmallObjectPool.
+    class Body : public Handle::Body, public Pooled
     {
     public:
         Body(const Span& span) : _span(span) { }
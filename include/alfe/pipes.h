@@ -73,6 +73,10 @@
 #define INCLUDED_PIPES_H
 
 //#include "alfe/thread.h"
+#include "alfe/lock_free_circular_buffer.h"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 // Infrastructure
 
@@ -554,9 +558,11 @@ public:
 
 // A filter that converts from one type to another (with static_cast<>).
 template<class ProducedT, class ConsumedT> class CastPipe
-  : public Pipe<ProducedT, ConsumedT, CastPipe<ProducedT, ConsumedT>>
+  : public Pipe<ConsumedT, ProducedT, CastPipe<ProducedT, ConsumedT>>
 {
+    typedef Pipe<ConsumedT, ProducedT, CastPipe<ProducedT, ConsumedT>> Base;
 public:
+    CastPipe(int n = defaultSampleCount) : Base(this, n) { }
     void produce(int n)
     {
         Accessor<ConsumedT> reader = this->_sink.reader(n);
@@ -618,6 +624,175 @@ protected:
 };
 
 
+// Wait policies for ThreadBridge. SpinWait keeps the waiting thread on its
+// core (yielding, then sleeping briefly if the wait goes on), which gives the
+// lowest latency when each side has a core to itself. BlockingWait sleeps on a
+// condition variable, which is kinder when the threads share cores.
+class SpinWait
+{
+public:
+    template<class F> void wait(F ready)
+    {
+        for (int spins = 0; !ready(); ++spins) {
+            if (spins < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    void notify() { }
+};
+
+class BlockingWait
+{
+public:
+    template<class F> void wait(F ready)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, ready);
+    }
+    void notify()
+    {
+        // Taking the lock means that a waiter can't miss the notification
+        // between checking its condition and going to sleep.
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        _condition.notify_all();
+    }
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+};
+
+
+// A filter with one sink and one source which live on different threads. The
+// samples pass between them through a fixed-size lock-free circular buffer,
+// so a filter graph can be split across cores without changing any of the
+// filters in it. Everything connected to sink() must run on one thread (the
+// producer) and everything connected to source() on another (the consumer).
+//
+// On the producer side the bridge works in push mode: the samples are copied
+// into the buffer when they are written to sink(). The producer thread can
+// also pull samples through the bridge by calling sink()->consume(n). On the
+// consumer side it works in pull mode (produce() waits for data to arrive),
+// and the consumer thread can push samples on by calling source()->produce(n).
+// A full buffer makes the producer wait and an empty one makes the consumer
+// wait. After close() neither side waits any more: the producer's samples are
+// discarded and the consumer gets zeroes.
+template<class T, class Wait = SpinWait> class ThreadBridge : public Filter
+{
+public:
+    ThreadBridge(int bufferSize, int n = defaultSampleCount)
+      : _buffer(bufferSize), _closed(false), _sink(this, n), _source(this)
+    { }
+    Sink<T>* sink() { return &_sink; }
+    Source<T>* source() { return &_source; }
+    void close()
+    {
+        _closed = true;
+        _wait.notify();
+    }
+    bool closed() const { return _closed; }
+private:
+    // Called on the producer thread.
+    void consume(int n)
+    {
+        Accessor<T> reader = _sink.reader(n);
+        BufferWriter writer(this);
+        for (int done = 0; done < n && !_closed;) {
+            int w = _buffer.writable();
+            if (w == 0) {
+                _wait.wait([&]{
+                    return _closed || _buffer.writable() != 0;
+                });
+                continue;
+            }
+            w = min(w, n - done);
+            reader.items(writer, w);
+            done += w;
+            _wait.notify();
+        }
+        _sink.read(n);
+    }
+    // Called on the consumer thread.
+    void produce(int n)
+    {
+        Accessor<T> writer = _source.writer(n);
+        BufferReader reader(this);
+        int done = 0;
+        while (done < n) {
+            int r = _buffer.readable();
+            if (r == 0) {
+                _wait.wait([&]{
+                    return _closed || _buffer.readableNow() != 0;
+                });
+                if (_closed && _buffer.readableNow() == 0)
+                    break;
+                continue;
+            }
+            r = min(r, n - done);
+            writer.items(reader, r);
+            done += r;
+            _wait.notify();
+        }
+        if (done < n) {
+            Zero<T> zero;
+            writer.items(zero, n - done);
+        }
+        _source.written(n);
+    }
+
+    class BufferWriter
+    {
+    public:
+        BufferWriter(ThreadBridge* bridge) : _bridge(bridge) { }
+        void operator()(T* source, int n)
+        {
+            if (n == 0)
+                return;
+            _bridge->_buffer.copyIn(source, n);
+            _bridge->_buffer.added(n);
+        }
+    private:
+        ThreadBridge* _bridge;
+    };
+    class BufferReader
+    {
+    public:
+        BufferReader(ThreadBridge* bridge) : _bridge(bridge) { }
+        void operator()(T* destination, int n)
+        {
+            if (n == 0)
+                return;
+            _bridge->_buffer.copyOut(destination, n);
+            _bridge->_buffer.remove(n);
+        }
+    private:
+        ThreadBridge* _bridge;
+    };
+    class BridgeSink : public Sink<T>
+    {
+    public:
+        BridgeSink(ThreadBridge* b, int n) : Sink<T>(n), _b(b) { }
+        void consume(int n) { _b->consume(n); }
+    private:
+        ThreadBridge* _b;
+    };
+    class BridgeSource : public Source<T>
+    {
+    public:
+        BridgeSource(ThreadBridge* b) : _b(b) { }
+        void produce(int n) { _b->produce(n); }
+    private:
+        ThreadBridge* _b;
+    };
+
+    LockFreeCircularBuffer<T> _buffer;
+    std::atomic<bool> _closed;
+    Wait _wait;
+    BridgeSink _sink;
+    BridgeSource _source;
+};
+
 // A pipe that interpolates using the nearest-neighbor algorithm.
 template<class T, class Rate = int> class NearestNeighborInterpolator
   : public Pipe<T, T, NearestNeighborInterpolator<T, Rate>>
@@ -12,7 +12,8 @@
 // Ts are constructed when a block is allocated, not when a T is requested.
 //
 // This is used by the grid tree Fractal programs. When those are replaced by
-// quadtree equivalents, this class will be unused.
+// quadtree equivalents, this class will be unused. For small objects in
+// general, see SmallObjectPool.
 template<class T> class MemoryPool : Uncopyable
 {
 private:
@@ -20,6 +20,7 @@ public:
             ++i;
             return Value(l + i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -42,6 +43,7 @@ public:
             ++i;
             return Value(l + i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -63,6 +65,7 @@ public:
             ++i;
             return Value(l + i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -85,6 +88,7 @@ public:
             ++i;
             return Value(l - i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -108,6 +112,7 @@ public:
             ++i;
             return Value(l - i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -130,6 +135,7 @@ public:
             ++i;
             return Value(l - i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -152,6 +158,7 @@ public:
             ++i;
             return Value(l * i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -175,6 +182,7 @@ public:
             ++i;
             return Value(l * i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -197,6 +205,7 @@ public:
             ++i;
             return Value(l * i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -218,6 +227,7 @@ public:
             ++i;
             return Value(l / i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -240,6 +250,7 @@ public:
             ++i;
             return Value(l / i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -261,6 +272,7 @@ public:
             ++i;
             return Value(l / i->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -282,6 +294,7 @@ public:
             ++i;
             return Value(Rational(l, i->value<int>()));
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorDivide(); }
         FunctionType type() const
         {
@@ -307,6 +320,7 @@ public:
                 return Rational(l.numerator, l.denominator << -r);
             return Rational(l.numerator << r, l.denominator);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftLeft(); }
         FunctionType type() const
         {
@@ -332,6 +346,7 @@ public:
                 return Rational(l.numerator << -r, l.denominator);
             return Rational(l.numerator, l.denominator << r);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorShiftRight(); }
         FunctionType type() const
         {
@@ -354,6 +369,7 @@ public:
             int r = i->value<int>();
             return power(Rational(l), r);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPower(); }
         FunctionType type() const
         {
@@ -376,6 +392,7 @@ public:
             int r = i->value<int>();
             return power(l, r);
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPower(); }
         FunctionType type() const
         {
@@ -394,6 +411,7 @@ public:
         {
             return Value( - arguments.begin()->value<Rational>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorMinus(); }
         FunctionType type() const
         {
@@ -412,6 +430,7 @@ public:
         {
             return Value(arguments.begin()->value<Rational>().floor());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return "floor"; }
         FunctionType type() const
         {
@@ -16,59 +16,108 @@ public:
       : _profile(4), _horizontalProfile(4), _width(1), _bleeding(2),
         _horizontalBleeding(2), _horizontalRollOff(0), _verticalRollOff(0),
         _subPixelSeparation(0), _phosphor(0), _mask(0), _maskSize(0),
-        _needsInit(true)
+        _inputTL(0, 0), _inputBR(0, 0), _needsInit(true)
     { }
-    void init()
+    // Returns true if the input buffer (or its position) has changed, in
+    // which case all of it needs to be filled in again before render().
+    bool init()
     {
         if (!_needsInit)
-            return;
+            return false;
         _needsInit = false;
+        Vector inputTL = _inputTL;
+        Vector inputBR = _inputBR;
         _output.ensure(_size.x*3*sizeof(float), _size.y);
 
-        _vertical.generate(_size, 3,
-            kernelRadius(_profile, _zoom.y, _width, _verticalRollOff,
-                _verticalLobes),
-            kernel(_profile, _zoom.y, _width, _verticalRollOff,
-                _verticalLobes),
-            &_inputTL.y, &_inputBR.y, _zoom.y, _offset.y);
+        FilterKey verticalKey(_profile, _width, _verticalRollOff,
+            _verticalLobes, 0, _zoom.y, _offset.y, _size);
+        if (!_verticalFilters.find(verticalKey, &_vertical, &_inputTL.y,
+            &_inputBR.y)) {
+            ImageFilterVertical vertical;
+            vertical.generate(_size, 3,
+                kernelRadius(_profile, _zoom.y, _width, _verticalRollOff,
+                    _verticalLobes),
+                kernel(_profile, _zoom.y, _width, _verticalRollOff,
+                    _verticalLobes),
+                &_inputTL.y, &_inputBR.y, _zoom.y, _offset.y);
+            _verticalFilters.add(verticalKey, vertical, _inputTL.y,
+                _inputBR.y);
+            _vertical = vertical;
+        }
 
         int inputHeight = _inputBR.y - _inputTL.y;
         _intermediate.ensure(_size.x*3*sizeof(float), inputHeight);
 
         _vertical.setBuffers(_intermediate, _output);
 
-        static const float inputChannelPositions[3] = {0, 0, 0};
-        float outputChannelPositions[3] =
-            {-_subPixelSeparation/3, 0, _subPixelSeparation/3};
+        FilterKey horizontalKey(_horizontalProfile, 1, _horizontalRollOff,
+            _horizontalLobes, _subPixelSeparation, _zoom.x, _offset.x,
+            Vector(_size.x, inputHeight));
+        if (!_horizontalFilters.find(horizontalKey, &_horizontal,
+            &_inputTL.x, &_inputBR.x)) {
+            static const float inputChannelPositions[3] = {0, 0, 0};
+            float outputChannelPositions[3] =
+                {-_subPixelSeparation/3, 0, _subPixelSeparation/3};
 
-        auto channelKernel = kernel(_horizontalProfile, _zoom.x, 1,
-            _horizontalRollOff, _horizontalLobes);
-        _horizontal.generate(Vector(_size.x, inputHeight), 3,
-            inputChannelPositions, 3, outputChannelPositions,
-            kernelRadius(_horizontalProfile, _zoom.x, 1, _horizontalRollOff,
-                _horizontalLobes),
-            [=](float distance, int inputChannel, int outputChannel)
-            {
-                if ((inputChannel - outputChannel) % 3 != 0)
-                    return Tuple<float, float>(0.0f, 0.0f);
-                return channelKernel(distance);
-            },
-            &_inputTL.x, &_inputBR.x, _zoom.x, _offset.x);
+            auto channelKernel = kernel(_horizontalProfile, _zoom.x, 1,
+                _horizontalRollOff, _horizontalLobes);
+            ImageFilterHorizontal horizontal;
+            horizontal.generate(Vector(_size.x, inputHeight), 3,
+                inputChannelPositions, 3, outputChannelPositions,
+                kernelRadius(_horizontalProfile, _zoom.x, 1,
+                    _horizontalRollOff, _horizontalLobes),
+                [=](float distance, int inputChannel, int outputChannel)
+                {
+                    if ((inputChannel - outputChannel) % 3 != 0)
+                        return Tuple<float, float>(0.0f, 0.0f);
+                    return channelKernel(distance);
+                },
+                &_inputTL.x, &_inputBR.x, _zoom.x, _offset.x);
+            _horizontalFilters.add(horizontalKey, horizontal, _inputTL.x,
+                _inputBR.x);
+            _horizontal = horizontal;
+        }
 
         _input.ensure((_inputBR.x - _inputTL.x)*3*sizeof(float), inputHeight);
 
         _horizontal.setBuffers(_input, _intermediate);
+        // The input buffer only moves if its size changes, so if only the
+        // kernels changed the caller doesn't need to fill it in again.
+        return _inputTL != inputTL || _inputBR != inputBR;
     }
     void render()
     {
-        _horizontal.execute();
-        Byte* d = _intermediate.data();
-        for (int y = 0; y < _inputBR.y - _inputTL.y; ++y) {
-            bleed(d, 12, Vector(3, _size.x), _horizontalBleeding);
-            d += _intermediate.stride();
+        bool sse2 = useSSE2();
+        int intermediateStride = _intermediate.stride();
+        _horizontal.execute([&](int top, int bottom)
+        {
+            Byte* d = _intermediate.data() + top*intermediateStride;
+            for (int y = top; y < bottom; ++y) {
+                bleedRow(reinterpret_cast<float*>(d), _size.x, sse2);
+                d += intermediateStride;
+            }
+        });
+        if (_bleeding == 2) {
+            // Bleeding down the columns can't be done a row at a time, but
+            // we can find the rows that need it while they're in the cache.
+            int outputStride = _output.stride();
+            int n = _size.x*3;
+            _clippedRows.ensure(_size.y);
+            _vertical.execute([&](int top, int bottom)
+            {
+                Byte* d = _output.data() + top*outputStride;
+                for (int y = top; y < bottom; ++y) {
+                    _clippedRows[y] =
+                        !inRange(reinterpret_cast<float*>(d), n, sse2);
+                    d += outputStride;
+                }
+            });
+            bleedColumns(sse2);
+            return;
         }
         _vertical.execute();
-        bleed(_output.data(), _output.stride(), _size*Vector(3, 1), _bleeding);
+        if (_bleeding == 1)
+            bleedDown(sse2);
     }
     int getProfile() { return _profile; }
     void setProfile(int profile)
@@ -281,6 +330,234 @@ private:
         }
         return lobes/min(1.0f, zoom);
     }
+    // The key for a generated filter: everything that the kernels depend on.
+    // Horizontal filters have a width of 1 and vertical ones no sub-pixel
+    // separation.
+    struct FilterKey
+    {
+        FilterKey(int profile, float width, float rollOff, float lobes,
+            float separation, float zoom, float offset, Vector size)
+          : _profile(profile), _width(width), _rollOff(rollOff),
+            _lobes(lobes), _separation(separation), _zoom(zoom),
+            _offset(offset), _size(size)
+        { }
+        bool operator==(const FilterKey& other) const
+        {
+            return _profile == other._profile && _width == other._width &&
+                _rollOff == other._rollOff && _lobes == other._lobes &&
+                _separation == other._separation && _zoom == other._zoom &&
+                _offset == other._offset && _size == other._size;
+        }
+        int _profile;
+        float _width;
+        float _rollOff;
+        float _lobes;
+        float _separation;
+        float _zoom;
+        float _offset;
+        Vector _size;
+    };
+    // The most recently used filters, along with the range of input rows or
+    // columns that they read, so that changing one setting (or going back to
+    // one that was used a moment ago) doesn't mean generating all the kernels
+    // again. A filter's buffers are shared with its copies, so a filter must
+    // never be generated again once it's in the cache.
+    template<class Filter> class FilterCache
+    {
+    public:
+        FilterCache() : _count(0) { }
+        bool find(const FilterKey& key, Filter* filter, int* first, int* last)
+        {
+            for (int i = 0; i < _count; ++i) {
+                if (_entries[i]._key == key) {
+                    Entry e = _entries[i];
+                    for (; i > 0; --i)
+                        _entries[i] = _entries[i - 1];
+                    _entries[0] = e;
+                    *filter = e._filter;
+                    *first = e._first;
+                    *last = e._last;
+                    return true;
+                }
+            }
+            return false;
+        }
+        void add(const FilterKey& key, const Filter& filter, int first,
+            int last)
+        {
+            if (_count < size)
+                ++_count;
+            for (int i = _count - 1; i > 0; --i)
+                _entries[i] = _entries[i - 1];
+            _entries[0] = Entry(key, filter, first, last);
+        }
+    private:
+        static const int size = 8;
+        struct Entry
+        {
+            Entry() : _key(0, 0, 0, 0, 0, 0, 0, Vector(0, 0)) { }
+            Entry(const FilterKey& key, const Filter& filter, int first,
+                int last)
+              : _key(key), _filter(filter), _first(first), _last(last) { }
+            FilterKey _key;
+            Filter _filter;
+            int _first;
+            int _last;
+        };
+        Entry _entries[size];
+        int _count;
+    };
+
+    // Clamps bleed + o to [0, 1] and leaves in bleed the amount that was cut
+    // off, for bleeding mode 1.
+    static float clip(float o, float* bleed)
+    {
+        o += *bleed;
+        *bleed = 0;
+        if (o < 0) {
+            *bleed = o;
+            o = 0;
+        }
+        if (o > 1) {
+            *bleed = o - 1;
+            o = 1;
+        }
+        return o;
+    }
+    // The two halves of clip() for four values at once. The operands are in
+    // the order that gives the same results as clip() for NaNs and zeros.
+    static __m128 excess(__m128 o)
+    {
+        __m128 zero = _mm_setzero_ps();
+        return _mm_add_ps(_mm_min_ps(o, zero),
+            _mm_max_ps(_mm_sub_ps(o, _mm_set1_ps(1.0f)), zero));
+    }
+    static __m128 clamp01(__m128 o)
+    {
+        return _mm_min_ps(_mm_set1_ps(1.0f), _mm_max_ps(_mm_setzero_ps(), o));
+    }
+    // Returns true if all n values at p are in [+0, 1]. Bleeding leaves
+    // those alone (as long as there's nothing to bleed into them), so runs of
+    // them can be skipped. Comparing the bits as integers also catches -0
+    // (which clip() turns into +0) and NaNs.
+    static bool inRange(const float* p, int n, bool sse2)
+    {
+        const SInt32* v = reinterpret_cast<const SInt32*>(p);
+        static const SInt32 one = 0x3f800000;
+        int i = 0;
+        if (sse2) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i ones = _mm_set1_epi32(one);
+            __m128i out = zero;
+            for (; i + 4 <= n; i += 4) {
+                __m128i x = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(v + i));
+                out = _mm_or_si128(out, _mm_or_si128(
+                    _mm_cmplt_epi32(x, zero), _mm_cmpgt_epi32(x, ones)));
+            }
+            if (_mm_movemask_epi8(out) != 0)
+                return false;
+        }
+        for (; i < n; ++i)
+            if (v[i] < 0 || v[i] > one)
+                return false;
+        return true;
+    }
+    // Does the horizontal bleeding for a row of n pixels. Mode 1 can't be
+    // vectorized along the row since each pixel depends on the last, but
+    // most groups of pixels don't need anything done.
+    void bleedRow(float* row, int n, bool sse2)
+    {
+        if (_horizontalBleeding == 2) {
+            if (!inRange(row, n*3, sse2))
+                bleed(reinterpret_cast<Byte*>(row), 12, Vector(3, n), 2);
+            return;
+        }
+        if (_horizontalBleeding != 1)
+            return;
+        float bleeds[3] = {0, 0, 0};
+        int end = n*3;
+        for (int i = 0; i < end;) {
+            int groupEnd = min(i + 12, end);
+            if (bleeds[0] == 0 && bleeds[1] == 0 && bleeds[2] == 0 &&
+                inRange(row + i, groupEnd - i, sse2)) {
+                i = groupEnd;
+                continue;
+            }
+            for (; i < groupEnd; i += 3)
+                for (int c = 0; c < 3; ++c)
+                    row[i + c] = clip(row[i + c], &bleeds[c]);
+        }
+    }
+    // Bleeding mode 1 down the columns of the output, done a row at a time
+    // so that the memory is accessed in order.
+    void bleedDown(bool sse2)
+    {
+        int n = _size.x*3;
+        _bleeds.ensure(n);
+        float* bleeds = &_bleeds[0];
+        for (int x = 0; x < n; ++x)
+            bleeds[x] = 0;
+        Byte* d = _output.data();
+        for (int y = 0; y < _size.y; ++y) {
+            float* p = reinterpret_cast<float*>(d);
+            int x = 0;
+            if (sse2) {
+                for (; x + 4 <= n; x += 4) {
+                    __m128 o = _mm_add_ps(_mm_loadu_ps(bleeds + x),
+                        _mm_loadu_ps(p + x));
+                    _mm_storeu_ps(bleeds + x, excess(o));
+                    _mm_storeu_ps(p + x, clamp01(o));
+                }
+            }
+            for (; x < n; ++x)
+                p[x] = clip(p[x], &bleeds[x]);
+            d += _output.stride();
+        }
+    }
+    // Bleeding mode 2 down the columns of the output, for just the columns
+    // that have a value out of range in one of the rows in _clippedRows.
+    // The other columns would be left as they are.
+    void bleedColumns(bool sse2)
+    {
+        int n = _size.x*3;
+        _clippedColumns.ensure(n);
+        SInt32* columns = &_clippedColumns[0];
+        for (int x = 0; x < n; ++x)
+            columns[x] = 0;
+        bool clipped = false;
+        Byte* d = _output.data();
+        for (int y = 0; y < _size.y; ++y, d += _output.stride()) {
+            if (!_clippedRows[y])
+                continue;
+            clipped = true;
+            const SInt32* v = reinterpret_cast<const SInt32*>(d);
+            int x = 0;
+            if (sse2) {
+                __m128i zero = _mm_setzero_si128();
+                __m128i one = _mm_set1_epi32(0x3f800000);
+                for (; x + 4 <= n; x += 4) {
+                    __m128i* c = reinterpret_cast<__m128i*>(columns + x);
+                    __m128i i = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(v + x));
+                    _mm_storeu_si128(c, _mm_or_si128(_mm_loadu_si128(c),
+                        _mm_or_si128(_mm_cmplt_epi32(i, zero),
+                        _mm_cmpgt_epi32(i, one))));
+                }
+            }
+            for (; x < n; ++x)
+                if (v[x] < 0 || v[x] > 0x3f800000)
+                    columns[x] = -1;
+        }
+        if (!clipped)
+            return;
+        for (int x = 0; x < n; ++x) {
+            if (columns[x] != 0) {
+                bleed(_output.data() + x*sizeof(float), _output.stride(),
+                    Vector(1, _size.y), 2);
+            }
+        }
+    }
     void bleed(Byte* data, int s, Vector size, int bleeding)
     {
         if (bleeding == 1) {
@@ -289,17 +566,8 @@ private:
                 Byte* output = outputColumn;
                 float bleed = 0;
                 for (int y = 0; y < size.y; ++y) {
-                    float o = bleed + *reinterpret_cast<float*>(output);
-                    bleed = 0;
-                    if (o < 0) {
-                        bleed = o;
-                        o = 0;
-                    }
-                    if (o > 1) {
-                        bleed = o - 1;
-                        o = 1;
-                    }
-                    *reinterpret_cast<float*>(output) = o;
+                    float* p = reinterpret_cast<float*>(output);
+                    *p = clip(*p, &bleed);
                     output += s;
                 }
                 outputColumn += sizeof(float);
@@ -447,6 +715,11 @@ private:
 
     ImageFilterHorizontal _horizontal;
     ImageFilterVertical _vertical;
+    FilterCache<ImageFilterHorizontal> _horizontalFilters;
+    FilterCache<ImageFilterVertical> _verticalFilters;
+    Array<bool> _clippedRows;
+    Array<SInt32> _clippedColumns;
+    Array<float> _bleeds;
 };
 
 #endif // INCLUDED_SCANLINES_H
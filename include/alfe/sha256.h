@@ -2,153 +2,75 @@
 #define INCLUDED_SHA256_H
 
 #include "alfe/integer_types.h"
+#include "alfe/cpu_features.h"
 
 // Based on Brad Conte's implementation at
 // https://github.com/B-Con/crypto-algorithms
+//
+// Blocks are compressed with the SHA extensions if the CPU has them. When
+// there are several independent messages to hash (see hashMany()) and the
+// CPU has AVX2 but not SHA, eight messages are hashed at once, one in each
+// 32-bit lane.
 
 class SHA256Hash
 {
     Byte _data[32];
+    typedef void (*Compressor)(DWord* state, const Byte* data,
+        size_t blocks);
 public:
     bool bit(int i) { return (_data[i >> 3] & (1 << (i & 7))) != 0; }
     class Hasher
     {
     public:
-        Hasher()
-        {
-            _datalen = 0;
-            _bitlen = 0;
-            _state[0] = 0x6a09e667;
-            _state[1] = 0xbb67ae85;
-            _state[2] = 0x3c6ef372;
-            _state[3] = 0xa54ff53a;
-            _state[4] = 0x510e527f;
-            _state[5] = 0x9b05688c;
-            _state[6] = 0x1f83d9ab;
-            _state[7] = 0x5be0cd19;
-        }
+        Hasher() : Hasher(compressor()) { }
         void update(const Byte* data, size_t len)
         {
-            DWord i;
-
-            for (i = 0; i < len; ++i) {
-                _data[_datalen] = data[i];
-                _datalen++;
-                if (_datalen == 64) {
-                    transform();
-                    _bitlen += 512;
-                    _datalen = 0;
-                }
+            _length += len;
+            if (_datalen != 0) {
+                size_t n = min(len, static_cast<size_t>(64 - _datalen));
+                memcpy(_data + _datalen, data, n);
+                _datalen += static_cast<DWord>(n);
+                data += n;
+                len -= n;
+                if (_datalen < 64)
+                    return;
+                _compressor(_state, _data, 1);
+                _datalen = 0;
+            }
+            // Whole blocks are compressed straight from the caller's data.
+            size_t blocks = len/64;
+            if (blocks != 0) {
+                _compressor(_state, data, blocks);
+                data += blocks*64;
+                len -= blocks*64;
             }
+            memcpy(_data, data, len);
+            _datalen = static_cast<DWord>(len);
         }
         void final(Byte* hash)
         {
-            int i = _datalen;
-
-            // Pad whatever data is left in the buffer.
-            if (_datalen < 56) {
-                _data[i++] = 0x80;
-                while (i < 56)
-                    _data[i++] = 0x00;
-            }
-            else {
-                _data[i++] = 0x80;
-                while (i < 64)
-                    _data[i++] = 0x00;
-                transform();
-                memset(_data, 0, 56);
-            }
-
-            // Append to the padding the total message's length in bits and transform.
-            _bitlen += _datalen * 8;
-            _data[63] = _bitlen & 0xff;
-            _data[62] = (_bitlen >> 8) & 0xff;
-            _data[61] = (_bitlen >> 16) & 0xff;
-            _data[60] = (_bitlen >> 24) & 0xff;
-            _data[59] = (_bitlen >> 32) & 0xff;
-            _data[58] = (_bitlen >> 40) & 0xff;
-            _data[57] = (_bitlen >> 48) & 0xff;
-            _data[56] = (_bitlen >> 56) & 0xff;
-            transform();
-
-            // Since this implementation uses little endian byte ordering and SHA uses big endian,
-            // reverse all the bytes when copying the final state to the output hash.
-            for (i = 0; i < 4; ++i) {
-                hash[i] = (_state[0] >> (24 - i * 8)) & 0xff;
-                hash[i + 4] = (_state[1] >> (24 - i * 8)) & 0xff;
-                hash[i + 8] = (_state[2] >> (24 - i * 8)) & 0xff;
-                hash[i + 12] = (_state[3] >> (24 - i * 8)) & 0xff;
-                hash[i + 16] = (_state[4] >> (24 - i * 8)) & 0xff;
-                hash[i + 20] = (_state[5] >> (24 - i * 8)) & 0xff;
-                hash[i + 24] = (_state[6] >> (24 - i * 8)) & 0xff;
-                hash[i + 28] = (_state[7] >> (24 - i * 8)) & 0xff;
-            }
+            Byte tail[128];
+            _compressor(_state, tail, pad(tail, _data, _datalen, _length));
+            output(_state, 1, hash);
         }
     private:
-        // Right rotation
-        DWord rot(DWord a, int b) { return (a >> b) | (a << (32 - b)); }
-        DWord sig0(DWord x) { return rot(x, 7) ^ rot(x, 18) ^ (x >> 3); }
-        DWord sig1(DWord x) { return rot(x, 17) ^ rot(x, 19) ^ (x >> 10); }
-        void transform()
+        Hasher(Compressor compressor)
+          : _compressor(compressor), _datalen(0), _length(0)
         {
-            static const DWord k[64] = {
-                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-            };
-
-            DWord m[64];
-            int i;
-            int j;
-
-            for (i = 0, j = 0; i < 16; ++i, j += 4)
-                m[i] = (_data[j] << 24) | (_data[j + 1] << 16) | (_data[j + 2] << 8) | (_data[j + 3]);
-            for (; i < 64; ++i)
-                m[i] = sig1(m[i - 2]) + m[i - 7] + sig0(m[i - 15]) + m[i - 16];
-
-            DWord a = _state[0];
-            DWord b = _state[1];
-            DWord c = _state[2];
-            DWord d = _state[3];
-            DWord e = _state[4];
-            DWord f = _state[5];
-            DWord g = _state[6];
-            DWord h = _state[7];
-
-            for (i = 0; i < 64; ++i) {
-                DWord t1 = h + (rot(e, 6) ^ rot(e, 11) ^ rot(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + m[i];
-                DWord t2 = (rot(a, 2) ^ rot(a, 13) ^ rot(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
-                h = g;
-                g = f;
-                f = e;
-                e = d + t1;
-                d = c;
-                c = b;
-                b = a;
-                a = t1 + t2;
-            }
-
-            _state[0] += a;
-            _state[1] += b;
-            _state[2] += c;
-            _state[3] += d;
-            _state[4] += e;
-            _state[5] += f;
-            _state[6] += g;
-            _state[7] += h;
+            initialize(_state, 1);
         }
 
+        Compressor _compressor;
         Byte _data[64];
         DWord _datalen;
-        unsigned long long _bitlen;
+        UInt64 _length;
         DWord _state[8];
+
+        friend class SHA256Hash;
     };
 
+    SHA256Hash() { }
+
     SHA256Hash(const Byte* data, int length)
     {
         Hasher h;
@@ -213,6 +135,417 @@ public:
         return String(s, String());
     }
     const Byte* data() { return &_data[0]; }
+
+    // Hashes count independent messages, putting the hash of the message at
+    // data[i] (of lengths[i] bytes) in hashes[i]. This is quicker than
+    // hashing them one at a time when there are several to do and the CPU
+    // has AVX2 but not SHA.
+    static void hashMany(const Byte* const* data, const int* lengths,
+        int count, SHA256Hash* hashes)
+    {
+        static const Implementation implementation =
+            available(extensions) ? extensions :
+            available(multiBuffer) ? multiBuffer : scalar;
+        hashMany(data, lengths, count, hashes, implementation);
+    }
+
+    // The implementations that are chosen between at run time: the plain C
+    // code, the SHA extensions and AVX2 with eight messages at once. These
+    // can be asked for explicitly so that they can be tested against each
+    // other.
+    enum Implementation { scalar, extensions, multiBuffer };
+    static bool available(Implementation implementation)
+    {
+#ifdef ALFE_X86
+        if (implementation == extensions)
+            return CPUFeatures::hasSHA();
+        if (implementation == multiBuffer)
+            return CPUFeatures::hasAVX2();
+#endif
+        return implementation == scalar;
+    }
+    // As above, but with a particular implementation, which must be
+    // available.
+    static void hashMany(const Byte* const* data, const int* lengths,
+        int count, SHA256Hash* hashes, Implementation implementation)
+    {
+        Compressor c = compressScalar;
+#ifdef ALFE_X86
+        if (implementation == multiBuffer) {
+            hashMany8(data, lengths, count, hashes);
+            return;
+        }
+        if (implementation == extensions)
+            c = compressSHA;
+#endif
+        for (int i = 0; i < count; ++i) {
+            Hasher h(c);
+            h.update(data[i], lengths[i]);
+            h.final(hashes[i]._data);
+        }
+    }
+private:
+    static const DWord* roundConstants()
+    {
+        static const DWord k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+            0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+            0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+            0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+            0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+            0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+            0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+        return k;
+    }
+    // The states of several messages can be interleaved, with word i of a
+    // state at state[i*stride].
+    static void initialize(DWord* state, int stride)
+    {
+        static const DWord h[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        for (int i = 0; i < 8; ++i)
+            state[i*stride] = h[i];
+    }
+    // SHA uses big endian byte ordering.
+    static void output(const DWord* state, int stride, Byte* hash)
+    {
+        for (int i = 0; i < 8; ++i) {
+            DWord s = state[i*stride];
+            hash[i*4] = (s >> 24) & 0xff;
+            hash[i*4 + 1] = (s >> 16) & 0xff;
+            hash[i*4 + 2] = (s >> 8) & 0xff;
+            hash[i*4 + 3] = s & 0xff;
+        }
+    }
+    // Copies the n bytes at the end of a message of length bytes that don't
+    // make up a whole block to tail, and pads them. Returns the number of
+    // blocks in tail, which is 2 if there isn't room for the length after
+    // the data.
+    static int pad(Byte* tail, const Byte* data, int n, UInt64 length)
+    {
+        memcpy(tail, data, n);
+        tail[n] = 0x80;
+        int blocks = n < 56 ? 1 : 2;
+        memset(tail + n + 1, 0, blocks*64 - 9 - n);
+        UInt64 bits = length*8;
+        for (int i = 1; i <= 8; ++i) {
+            tail[blocks*64 - i] = bits & 0xff;
+            bits >>= 8;
+        }
+        return blocks;
+    }
+
+    static Compressor compressor()
+    {
+#ifdef ALFE_X86
+        static const Compressor c =
+            CPUFeatures::hasSHA() ? compressSHA : compressScalar;
+        return c;
+#else
+        return compressScalar;
+#endif
+    }
+
+    // Right rotation
+    static DWord rot(DWord a, int b) { return (a >> b) | (a << (32 - b)); }
+    static DWord sig0(DWord x) { return rot(x, 7) ^ rot(x, 18) ^ (x >> 3); }
+    static DWord sig1(DWord x) { return rot(x, 17) ^ rot(x, 19) ^ (x >> 10); }
+    static void compressScalar(DWord* state, const Byte* data, size_t blocks)
+    {
+        const DWord* k = roundConstants();
+        for (; blocks > 0; --blocks, data += 64) {
+            DWord m[64];
+            int i;
+            int j;
+
+            for (i = 0, j = 0; i < 16; ++i, j += 4) {
+                m[i] = (data[j] << 24) | (data[j + 1] << 16) |
+                    (data[j + 2] << 8) | (data[j + 3]);
+            }
+            for (; i < 64; ++i)
+                m[i] = sig1(m[i - 2]) + m[i - 7] + sig0(m[i - 15]) + m[i - 16];
+
+            DWord a = state[0];
+            DWord b = state[1];
+            DWord c = state[2];
+            DWord d = state[3];
+            DWord e = state[4];
+            DWord f = state[5];
+            DWord g = state[6];
+            DWord h = state[7];
+
+            for (i = 0; i < 64; ++i) {
+                DWord t1 = h + (rot(e, 6) ^ rot(e, 11) ^ rot(e, 25)) +
+                    ((e & f) ^ (~e & g)) + k[i] + m[i];
+                DWord t2 = (rot(a, 2) ^ rot(a, 13) ^ rot(a, 22)) +
+                    ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+    }
+
+#ifdef ALFE_X86
+    // Four rounds, using the message words plus round constants in w.
+    ALFE_TARGET("sha,sse4.1")
+        static void roundsSHA(__m128i* abef, __m128i* cdgh, __m128i w)
+    {
+        *cdgh = _mm_sha256rnds2_epu32(*cdgh, *abef, w);
+        *abef = _mm_sha256rnds2_epu32(*abef, *cdgh,
+            _mm_shuffle_epi32(w, 0x0e));
+    }
+    // Computes the next four words of the message schedule from the
+    // previous sixteen.
+    ALFE_TARGET("sha,sse4.1") static __m128i scheduleSHA(__m128i w0,
+        __m128i w1, __m128i w2, __m128i w3)
+    {
+        return _mm_sha256msg2_epu32(_mm_add_epi32(
+            _mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3);
+    }
+    ALFE_TARGET("sha,sse4.1") static void compressSHA(DWord* state,
+        const Byte* data, size_t blocks)
+    {
+        const DWord* k = roundConstants();
+        const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+            0x0405060700010203ULL);
+        // The SHA instructions want the state as ABEF and CDGH.
+        __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(state)), 0xb1);
+        __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(state + 4)), 0x1b);
+        __m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+        __m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xf0);
+        for (; blocks > 0; --blocks, data += 64) {
+            __m128i abefSave = abef;
+            __m128i cdghSave = cdgh;
+            const __m128i* d = reinterpret_cast<const __m128i*>(data);
+            __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128(d), swap);
+            __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128(d + 1), swap);
+            __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128(d + 2), swap);
+            __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128(d + 3), swap);
+            for (int i = 0; i < 64; i += 16) {
+                const __m128i* kk = reinterpret_cast<const __m128i*>(k + i);
+                roundsSHA(&abef, &cdgh,
+                    _mm_add_epi32(w0, _mm_loadu_si128(kk)));
+                roundsSHA(&abef, &cdgh,
+                    _mm_add_epi32(w1, _mm_loadu_si128(kk + 1)));
+                roundsSHA(&abef, &cdgh,
+                    _mm_add_epi32(w2, _mm_loadu_si128(kk + 2)));
+                roundsSHA(&abef, &cdgh,
+                    _mm_add_epi32(w3, _mm_loadu_si128(kk + 3)));
+                if (i < 48) {
+                    w0 = scheduleSHA(w0, w1, w2, w3);
+                    w1 = scheduleSHA(w1, w2, w3, w0);
+                    w2 = scheduleSHA(w2, w3, w0, w1);
+                    w3 = scheduleSHA(w3, w0, w1, w2);
+                }
+            }
+            abef = _mm_add_epi32(abef, abefSave);
+            cdgh = _mm_add_epi32(cdgh, cdghSave);
+        }
+        __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+        __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+            _mm_blend_epi16(feba, dchg, 0xf0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4),
+            _mm_alignr_epi8(dchg, feba, 8));
+    }
+
+    ALFE_TARGET("avx2") static __m256i rot8(__m256i x, int n)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(x, n),
+            _mm256_slli_epi32(x, 32 - n));
+    }
+    // Transposes eight rows of eight words, so that w[i] holds word i of
+    // each row.
+    ALFE_TARGET("avx2") static void transpose8(const __m256i* r,
+        __m256i* w)
+    {
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+        __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+        __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+        __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+        __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+        __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+        __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+        __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+        __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+        w[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+        w[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+        w[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+        w[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+        w[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+        w[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+        w[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+        w[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+    }
+    // Compresses a block from each of eight messages. Lane j's state is
+    // interleaved in state with a stride of 8, starting at state[j].
+    ALFE_TARGET("avx2") static void compress8(DWord* state,
+        const Byte* const* blocks)
+    {
+        const DWord* k = roundConstants();
+        const __m256i swap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        __m256i w[16];
+        for (int half = 0; half < 2; ++half) {
+            __m256i r[8];
+            for (int j = 0; j < 8; ++j) {
+                r[j] = _mm256_shuffle_epi8(_mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(blocks[j] + half*32)),
+                    swap);
+            }
+            transpose8(r, w + half*8);
+        }
+        __m256i* s = reinterpret_cast<__m256i*>(state);
+        __m256i a = _mm256_loadu_si256(s);
+        __m256i b = _mm256_loadu_si256(s + 1);
+        __m256i c = _mm256_loadu_si256(s + 2);
+        __m256i d = _mm256_loadu_si256(s + 3);
+        __m256i e = _mm256_loadu_si256(s + 4);
+        __m256i f = _mm256_loadu_si256(s + 5);
+        __m256i g = _mm256_loadu_si256(s + 6);
+        __m256i h = _mm256_loadu_si256(s + 7);
+        for (int i = 0; i < 64; ++i) {
+            if (i >= 16) {
+                __m256i w2 = w[(i - 2) & 15];
+                __m256i w15 = w[(i - 15) & 15];
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rot8(w2, 17),
+                    rot8(w2, 19)), _mm256_srli_epi32(w2, 10));
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rot8(w15, 7),
+                    rot8(w15, 18)), _mm256_srli_epi32(w15, 3));
+                w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                    _mm256_add_epi32(w[(i - 7) & 15], s1));
+            }
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h,
+                _mm256_xor_si256(_mm256_xor_si256(rot8(e, 6), rot8(e, 11)),
+                rot8(e, 25))), _mm256_add_epi32(_mm256_xor_si256(
+                _mm256_and_si256(e, f), _mm256_andnot_si256(e, g)),
+                _mm256_add_epi32(_mm256_set1_epi32(k[i]), w[i & 15])));
+            __m256i t2 = _mm256_add_epi32(
+                _mm256_xor_si256(_mm256_xor_si256(rot8(a, 2), rot8(a, 13)),
+                rot8(a, 22)), _mm256_xor_si256(_mm256_xor_si256(
+                _mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+                _mm256_and_si256(b, c)));
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+        _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), a));
+        _mm256_storeu_si256(s + 1,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 1), b));
+        _mm256_storeu_si256(s + 2,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 2), c));
+        _mm256_storeu_si256(s + 3,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 3), d));
+        _mm256_storeu_si256(s + 4,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 4), e));
+        _mm256_storeu_si256(s + 5,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 5), f));
+        _mm256_storeu_si256(s + 6,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 6), g));
+        _mm256_storeu_si256(s + 7,
+            _mm256_add_epi32(_mm256_loadu_si256(s + 7), h));
+    }
+    // Each lane hashes one message at a time and picks up the next message
+    // as soon as it has finished, so messages of different lengths keep all
+    // the lanes busy until there are fewer than eight left.
+    static void hashMany8(const Byte* const* data, const int* lengths,
+        int count, SHA256Hash* hashes)
+    {
+        struct Lane
+        {
+            int _message;
+            int _block;
+            int _whole;    // Blocks read straight from the message.
+            int _blocks;   // Blocks in total, including padding.
+            const Byte* _data;
+            Byte _tail[128];
+        };
+        Lane lanes[8];
+        DWord state[64];
+        static const Byte unused[64] = { 0 };
+        int next = 0;
+        for (int j = 0; j < 8; ++j)
+            lanes[j]._message = -1;
+        do {
+            const Byte* blocks[8];
+            bool busy = false;
+            for (int j = 0; j < 8; ++j) {
+                Lane* lane = &lanes[j];
+                if (lane->_message >= 0 && lane->_block == lane->_blocks) {
+                    output(state + j, 8, hashes[lane->_message]._data);
+                    lane->_message = -1;
+                }
+                if (lane->_message < 0 && next < count) {
+                    int length = lengths[next];
+                    lane->_message = next;
+                    lane->_data = data[next];
+                    lane->_block = 0;
+                    lane->_whole = length/64;
+                    lane->_blocks = lane->_whole + pad(lane->_tail,
+                        lane->_data + lane->_whole*64, length & 63, length);
+                    initialize(state + j, 8);
+                    ++next;
+                }
+                if (lane->_message < 0) {
+                    blocks[j] = unused;
+                    continue;
+                }
+                busy = true;
+                int b = lane->_block;
+                if (b < lane->_whole)
+                    blocks[j] = lane->_data + b*64;
+                else
+                    blocks[j] = lane->_tail + (b - lane->_whole)*64;
+                ++lane->_block;
+            }
+            if (!busy)
+                break;
+            compress8(state, blocks);
+        } while (true);
+    }
+#endif
 };
 
 #endif // INCLUDED_SHA256_H
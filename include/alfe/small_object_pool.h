@@ -0,0 +1,386 @@
+#include "alfe/main.h"
+
+#ifndef INCLUDED_SMALL_OBJECT_POOL_H
+#define INCLUDED_SMALL_OBJECT_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+
+template<class T> class SmallObjectPoolT;
+typedef SmallObjectPoolT<void> SmallObjectPool;
+
+template<class T> class SmallObjectArenaT;
+typedef SmallObjectArenaT<void> SmallObjectArena;
+
+// SmallObjectPool is a general-purpose allocator for small objects, which
+// are rounded up to a multiple of granularity bytes and served from
+// per-thread free lists, one for each size. Requests for more than maxSize
+// bytes just go to operator new.
+//
+// Memory is obtained in chunks which are aligned to their size, so that the
+// chunk header (and hence the thread that owns the object) can be found from
+// an object's address. Each chunk only holds objects of one size, which are
+// carved off as needed.
+//
+// Freeing an object on the thread that allocated it pushes it onto that
+// thread's free list. An object freed on another thread is added to a batch
+// on the freeing thread, and a whole batch is pushed onto a lock-free list
+// belonging to the owning thread with a single compare-exchange. The owning
+// thread takes all of that list at once when its own free list runs out.
+// When a thread ends, its free lists are kept (since objects it allocated
+// may still be alive) and handed to the next thread that needs them.
+//
+// The sizes must match: deallocate() has to be given the size that was
+// passed to allocate().
+template<class T> class SmallObjectPoolT
+{
+public:
+    static const int granularity = 16;
+    static const int maxSize = 256;
+
+    static void* allocate(size_t size)
+    {
+        if (size > maxSize)
+            return ::operator new(size);
+        SmallObjectArenaT<T>* arena = SmallObjectArenaT<T>::current();
+        if (arena != 0)
+            return arena->allocate(size);
+        Heap* heap = Heap::current();
+        if (heap != 0)
+            return heap->allocate(sizeClass(size));
+        // This thread's heap has already been destroyed (we're being called
+        // from a thread_local or static destructor), so share the orphan
+        // heap.
+        std::lock_guard<std::mutex> lock(Heap::orphanMutex());
+        return Heap::orphan()->allocate(sizeClass(size));
+    }
+    static void deallocate(void* p, size_t size)
+    {
+        if (p == 0)
+            return;
+        if (size > maxSize) {
+            ::operator delete(p);
+            return;
+        }
+        Heap* owner = Chunk::of(p)->_heap;
+        if (owner == 0)
+            return;  // Arena memory is freed when the arena is reset.
+        int c = sizeClass(size);
+        Heap* heap = Heap::current();
+        if (heap == owner)
+            heap->free(c, p);
+        else {
+            if (heap != 0)
+                heap->freeRemote(owner, c, p);
+            else
+                owner->pushRemote(c, p, p);
+        }
+    }
+private:
+    static const int sizeClasses = maxSize/granularity;
+    static const int chunkSize = 0x10000;
+    static const int remoteBatch = 64;
+
+    static int sizeClass(size_t size)
+    {
+        return (max(static_cast<int>(size), 1) - 1)/granularity;
+    }
+    // A free object's first word points to the next free object.
+    static void*& next(void* p) { return *static_cast<void**>(p); }
+
+    class Heap;
+
+    class Chunk
+    {
+    public:
+        static Chunk* create(Heap* heap)
+        {
+#ifdef _WIN32
+            void* p = _aligned_malloc(chunkSize, chunkSize);
+#else
+            void* p;
+            if (posix_memalign(&p, chunkSize, chunkSize) != 0)
+                p = 0;
+#endif
+            if (p == 0)
+                throw std::bad_alloc();
+            Chunk* chunk = static_cast<Chunk*>(p);
+            chunk->_heap = heap;
+            chunk->_next = 0;
+            chunk->_free = reinterpret_cast<UInt8*>(p) + headerSize;
+            return chunk;
+        }
+        void destroy()
+        {
+#ifdef _WIN32
+            _aligned_free(this);
+#else
+            ::free(this);
+#endif
+        }
+        static Chunk* of(void* p)
+        {
+            return reinterpret_cast<Chunk*>(reinterpret_cast<uintptr_t>(p) &
+                ~static_cast<uintptr_t>(chunkSize - 1));
+        }
+        // Returns 0 if there isn't room for another size bytes.
+        void* carve(int size)
+        {
+            UInt8* end = reinterpret_cast<UInt8*>(this) + chunkSize;
+            if (end - _free < size)
+                return 0;
+            void* p = _free;
+            _free += size;
+            return p;
+        }
+
+        Heap* _heap;   // 0 for arena chunks.
+        Chunk* _next;  // Only used by arenas.
+        UInt8* _free;
+    };
+    static const int headerSize =
+        (sizeof(Chunk) + granularity - 1) & ~(granularity - 1);
+
+    class Heap : Uncopyable
+    {
+    public:
+        Heap() : _idleNext(0), _pendingOwner(0), _pendingCount(0)
+        {
+            for (int c = 0; c < sizeClasses; ++c) {
+                _free[c] = 0;
+                _remote[c] = 0;
+                _chunks[c] = 0;
+            }
+        }
+        void* allocate(int c)
+        {
+            void* p = _free[c];
+            if (p == 0) {
+                p = _remote[c].exchange(0, std::memory_order_acquire);
+                if (p == 0)
+                    return carve(c);
+            }
+            _free[c] = next(p);
+            return p;
+        }
+        void free(int c, void* p)
+        {
+            next(p) = _free[c];
+            _free[c] = p;
+        }
+        void freeRemote(Heap* owner, int c, void* p)
+        {
+            if (owner != _pendingOwner || c != _pendingClass ||
+                _pendingCount == remoteBatch)
+                flush();
+            if (_pendingCount == 0) {
+                _pendingOwner = owner;
+                _pendingClass = c;
+                _pendingLast = p;
+                next(p) = 0;
+            }
+            else
+                next(p) = _pendingFirst;
+            _pendingFirst = p;
+            ++_pendingCount;
+        }
+        void flush()
+        {
+            if (_pendingCount == 0)
+                return;
+            _pendingOwner->pushRemote(_pendingClass, _pendingFirst,
+                _pendingLast);
+            _pendingOwner = 0;
+            _pendingCount = 0;
+        }
+        // Pushes the list from first to last onto this heap's remote list.
+        // Called from other threads.
+        void pushRemote(int c, void* first, void* last)
+        {
+            void* head = _remote[c].load(std::memory_order_relaxed);
+            do {
+                next(last) = head;
+            } while (!_remote[c].compare_exchange_weak(head, first,
+                std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        // Returns this thread's heap, getting one if necessary. Returns 0 if
+        // the thread is ending and has already given its heap up.
+        static Heap* current()
+        {
+            Owner* owner = &owned();
+            if (owner->_heap == 0 && !owner->_ended)
+                owner->_heap = acquire();
+            return owner->_heap;
+        }
+        // Neither of these are ever destroyed, since objects can be freed
+        // during static destruction.
+        static Heap* orphan()
+        {
+            static Heap* heap = new Heap;
+            return heap;
+        }
+        static std::mutex& orphanMutex()
+        {
+            static std::mutex* mutex = new std::mutex;
+            return *mutex;
+        }
+    private:
+        void* carve(int c)
+        {
+            int size = (c + 1)*granularity;
+            void* p = 0;
+            if (_chunks[c] != 0)
+                p = _chunks[c]->carve(size);
+            if (p == 0) {
+                _chunks[c] = Chunk::create(this);
+                p = _chunks[c]->carve(size);
+            }
+            return p;
+        }
+
+        class Owner : Uncopyable
+        {
+        public:
+            Owner() : _heap(0), _ended(false) { }
+            ~Owner()
+            {
+                if (_heap != 0) {
+                    _heap->flush();
+                    release(_heap);
+                }
+                _heap = 0;
+                _ended = true;
+            }
+            Heap* _heap;
+            bool _ended;
+        };
+        static Owner& owned()
+        {
+            static thread_local Owner owner;
+            return owner;
+        }
+        static Heap* acquire()
+        {
+            std::lock_guard<std::mutex> lock(orphanMutex());
+            Heap* heap = idle();
+            if (heap == 0)
+                return new Heap;
+            idle() = heap->_idleNext;
+            return heap;
+        }
+        static void release(Heap* heap)
+        {
+            std::lock_guard<std::mutex> lock(orphanMutex());
+            heap->_idleNext = idle();
+            idle() = heap;
+        }
+        static Heap*& idle()
+        {
+            static Heap* heap = 0;
+            return heap;
+        }
+
+        void* _free[sizeClasses];
+        std::atomic<void*> _remote[sizeClasses];
+        Chunk* _chunks[sizeClasses];
+        Heap* _idleNext;
+
+        // The batch of objects freed by this thread that belong to another.
+        Heap* _pendingOwner;
+        int _pendingClass;
+        int _pendingCount;
+        void* _pendingFirst;
+        void* _pendingLast;
+    };
+
+    friend class SmallObjectArenaT<T>;
+};
+
+// While an arena exists, small objects allocated from SmallObjectPool by the
+// thread that created it come from the arena instead: they're allocated by
+// just bumping a pointer and freeing them does nothing. All the memory is
+// given back at once by reset() or when the arena is destroyed, so that
+// tearing down something big (like a parse tree) doesn't cost a free per
+// node. Everything allocated from the arena must have been destroyed (or
+// must never be touched again) by then. Arenas nest. Code that runs while an
+// arena exists but creates objects that have to outlive it can use a Pause.
+template<class T> class SmallObjectArenaT : Uncopyable
+{
+    typedef SmallObjectPoolT<T> Pool;
+    typedef typename Pool::Chunk Chunk;
+public:
+    // While a Pause exists, small objects come from SmallObjectPool again
+    // instead of from this thread's arena.
+    class Pause : Uncopyable
+    {
+    public:
+        Pause() : _arena(current()) { current() = 0; }
+        ~Pause() { current() = _arena; }
+    private:
+        SmallObjectArenaT* _arena;
+    };
+
+    SmallObjectArenaT() : _chunks(0), _outer(current())
+    {
+        current() = this;
+    }
+    ~SmallObjectArenaT()
+    {
+        reset();
+        current() = _outer;
+    }
+    void reset()
+    {
+        while (_chunks != 0) {
+            Chunk* chunk = _chunks;
+            _chunks = chunk->_next;
+            chunk->destroy();
+        }
+    }
+private:
+    void* allocate(size_t size)
+    {
+        int s = (max(static_cast<int>(size), 1) + Pool::granularity - 1) &
+            ~(Pool::granularity - 1);
+        void* p = 0;
+        if (_chunks != 0)
+            p = _chunks->carve(s);
+        if (p == 0) {
+            Chunk* chunk = Chunk::create(0);
+            chunk->_next = _chunks;
+            _chunks = chunk;
+            p = chunk->carve(s);
+        }
+        return p;
+    }
+    static SmallObjectArenaT*& current()
+    {
+        static thread_local SmallObjectArenaT* arena = 0;
+        return arena;
+    }
+
+    Chunk* _chunks;
+    SmallObjectArenaT* _outer;
+
+    friend class SmallObjectPoolT<T>;
+};
+
+// Deriving from Pooled makes a class's objects come from SmallObjectPool.
+// They must be deleted through a pointer to their own type or to a base
+// with a virtual destructor, so that operator delete is told the right size.
+class Pooled
+{
+public:
+    static void* operator new(size_t size)
+    {
+        return SmallObjectPool::allocate(size);
+    }
+    static void operator delete(void* p, size_t size)
+    {
+        SmallObjectPool::deallocate(p, size);
+    }
+};
+
+#endif // INCLUDED_SMALL_OBJECT_POOL_H
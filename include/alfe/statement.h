@@ -55,58 +55,7 @@ public:
 template<class T> class StatementT : public ParseTreeObject
 {
 public:
-    static Statement parse(CharacterSource* source)
-    {
-        Statement statement = ExpressionStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = FunctionDefinitionStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = ExpressionStatement::parseAssignment(source);
-        if (statement.valid())
-            return statement;
-        statement = CompoundStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = TycoDefinitionStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = NothingStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = IncrementDecrementStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = ConditionalStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = SwitchStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = ReturnStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = IncludeStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = BreakOrContinueStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = ForeverStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = WhileStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = ForStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        statement = LabelStatement::parse(source);
-        if (statement.valid())
-            return statement;
-        return GotoStatement::parse(source);
-    }
+    static Statement parse(CharacterSource* source);
     static Statement parseOrFail(CharacterSource* source)
     {
         Statement statement = parse(source);
@@ -234,7 +183,7 @@ public:
         TycoSpecifier returnTypeSpecifier = TycoSpecifier::parse(&s);
         if (!returnTypeSpecifier.valid())
             return FunctionDefinitionStatement();
-        Identifier name = Identifier::parse(&s);
+        IdentifierT<T> name = IdentifierT<T>::parse(&s);
         if (!name.valid())
             return FunctionDefinitionStatement();
         Span span;
@@ -284,7 +233,7 @@ private:
             _parameterList(parameterList), _body(body) { }
         TypeT<T> type() const
         {
-            FunctionType t(_returnTypeSpecifier);
+            FunctionTypeT<T> t(_returnTypeSpecifier);
             for (auto p : _parameterList)
                 t.instantiate(p.type());
             return t;
@@ -301,10 +250,10 @@ private:
         }
     private:
         TycoSpecifier _returnTypeSpecifier;
-        Identifier _name;
+        IdentifierT<T> _name;
         List<VariableDefinitionT<T>> _parameterList;
         Statement _body;
-        Scope _scope;
+        ScopeT<T> _scope;
     };
 };
 
@@ -932,7 +881,7 @@ public:
     static LabelStatement parse(CharacterSource* source)
     {
         CharacterSource s2 = *source;
-        Identifier identifier = Identifier::parse(&s2);
+        IdentifierT<T> identifier = IdentifierT<T>::parse(&s2);
         if (!identifier.valid())
             return LabelStatement();
         Span span;
@@ -986,4 +935,59 @@ private:
     };
 };
 
+// This is defined out of line so that all the statement types are complete
+// at the point of definition.
+template<class T> Statement StatementT<T>::parse(CharacterSource* source)
+{
+    Statement statement = ExpressionStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = FunctionDefinitionStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = ExpressionStatement::parseAssignment(source);
+    if (statement.valid())
+        return statement;
+    statement = CompoundStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = TycoDefinitionStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = NothingStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = IncrementDecrementStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = ConditionalStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = SwitchStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = ReturnStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = IncludeStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = BreakOrContinueStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = ForeverStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = WhileStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = ForStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    statement = LabelStatement::parse(source);
+    if (statement.valid())
+        return statement;
+    return GotoStatement::parse(source);
+}
+
 #endif // INCLUDED_STATEMENT_H
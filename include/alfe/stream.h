@@ -8,10 +8,10 @@ class FileDescriptor : public ConstHandle
 {
 public:
     FileDescriptor() : _fileDescriptor(-1) { }
-    WindowsHandle(int fileDescriptor, bool own = true)
-      : _handle(handle),
-        ConstHandle((own && fileDescriptor != -1)
-            ? create<Body>(fileDescriptor) : ConstHandle())
+    FileDescriptor(int fileDescriptor, bool own = true)
+      : ConstHandle((own && fileDescriptor != -1)
+            ? create<Body>(fileDescriptor) : ConstHandle()),
+        _fileDescriptor(fileDescriptor)
     { }
     bool valid() const { return _fileDescriptor != -1; }
     operator int() const { return _fileDescriptor; }
@@ -20,6 +20,7 @@ protected:
       : ConstHandle(other), _fileDescriptor(fileDescriptor) { }
     class Body : public ConstHandle::Body
     {
+    public:
         Body(int fileDescriptor) : _fileDescriptor(fileDescriptor) { }
         ~Body()
         {
@@ -29,7 +30,6 @@ protected:
     private:
         int _fileDescriptor;
     };
-private:
     int _fileDescriptor;
 };
 #endif
@@ -55,10 +55,9 @@ public:
     StreamT() { }
     StreamT(int fileDescriptor, const File& file = File(), bool own = true)
       : FileDescriptor(create<Body>(own &&
-          fileDesciptor != -1 ? fileDescriptor : -1), fileDescriptor),
+          fileDescriptor != -1 ? fileDescriptor : -1), fileDescriptor),
         _file(file)
     { }
-    operator int() const { return operator int(); }
 #endif
     File file() const { return _file; }
     // Be careful using the template read() and write() functions with types
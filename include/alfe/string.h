@@ -4,6 +4,8 @@
 #define INCLUDED_STRING_H
 
 #include <cstdarg>
+#include <ctype.h>
+#include <stdio.h>
 
 template<class T> class ExceptionT;
 typedef ExceptionT<void> Exception;
@@ -14,6 +16,9 @@ typedef StringTemplate<Byte> String;
 template<class T> class CharacterSourceT;
 typedef CharacterSourceT<void> CharacterSource;
 
+template<class T> class StringBuilderTemplate;
+typedef StringBuilderTemplate<Byte> StringBuilder;
+
 template<class T> class StringTemplate
 {
 public:
@@ -81,6 +86,7 @@ public:
         int _digits;
         bool _ox;
         friend class StringTemplate;
+        template<class U> friend class StringBuilderTemplate;
     };
 
     class CodePoint
@@ -135,6 +141,7 @@ public:
         }
         int _c;
         friend class StringTemplate;
+        template<class U> friend class StringBuilderTemplate;
     };
 
     class Byte
@@ -153,6 +160,7 @@ public:
         void write(T* destination) const { *destination = _b; }
         T _b;
         friend class StringTemplate;
+        template<class U> friend class StringBuilderTemplate;
     };
 
     class Decimal
@@ -218,6 +226,7 @@ public:
         int _n;
         int _digits;
         friend class StringTemplate;
+        template<class U> friend class StringBuilderTemplate;
     };
 
     class Boolean
@@ -242,6 +251,7 @@ public:
         }
         bool _b;
         friend class StringTemplate;
+        template<class U> friend class StringBuilderTemplate;
     };
 
     StringTemplate() : StringTemplate(0, 0, 0) { }
@@ -426,13 +436,7 @@ public:
     const T& operator[](int offset) const { return *(data() + offset); }
     UInt32 hash() const
     {
-        Hash h(typeid(String));
-        const T* p = data();
-        for (int i = 0; i < length(); ++i) {
-            h.mixin(*p);
-            ++p;
-        }
-        return h;
+        return Hash(typeid(String)).mixin(data(), length()*sizeof(T));
     }
     bool operator==(const String& other) const
     {
@@ -687,6 +691,7 @@ private:
     template<class U> friend class FileT;
     template<class U> friend class StreamT;
     template<class U> friend class CurrentDirectoryT;
+    template<class U> friend class StringBuilderTemplate;
     friend String format(const char* format, ...);
 };
 
@@ -723,12 +728,167 @@ String format(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
+    // A va_list can't be reused after it has been consumed on all platforms.
+    va_list args2;
+    va_copy(args2, args);
     int c = vsnprintf(0, 0, format, args) + 1;
+    va_end(args);
     String s(c);
-    vsnprintf(reinterpret_cast<char*>(s.data()), c, format, args);
+    vsnprintf(reinterpret_cast<char*>(s.data()), c, format, args2);
+    va_end(args2);
     return s.subString(0, s.length() - 1);  // Discard trailing null byte
 }
 
+// StringBuilder is for building up a String a piece at a time, as the
+// logging and disassembly code does. Unlike String::operator+=, it keeps
+// spare space at the end of its buffer and doubles the buffer when it runs
+// out, and the Hex, Decimal etc. helpers are written straight into the buffer
+// instead of each going through a temporary String. A builder that is
+// cleared and reused keeps its capacity.
+//
+// string() doesn't copy (unless the result fits in a small string): the
+// String shares the builder's buffer. The builder never writes to the part of
+// the buffer that a String might be looking at - it takes a new buffer if it
+// is cleared or modified in place while such a String still exists. Once the
+// String has gone, the builder goes back to using its own buffer, so a caller
+// that builds a line, uses the String and then clears the builder doesn't
+// allocate.
+template<class T> class StringBuilderTemplate
+{
+public:
+    StringBuilderTemplate() : _length(0), _shared(false) { }
+    explicit StringBuilderTemplate(int n) : StringBuilderTemplate()
+    {
+        reserve(n);
+    }
+    void reserve(int n)
+    {
+        if (n > _array.allocated())
+            reallocate(n);
+    }
+    int length() const { return _length; }
+    bool empty() const { return _length == 0; }
+    void clear()
+    {
+        if (shared())
+            _array = AppendableArray<T>(_array.allocated());
+        else
+            _array.clear();
+        _length = 0;
+        _shared = false;
+    }
+    String string() const
+    {
+        if (_length == 0)
+            return String();
+        String s(reinterpret_cast<const char*>(&_array[0]), _length);
+        if (!s.small()) {
+            // s is currently a view of our buffer. Make it share ownership.
+            s._array = _array;
+            _shared = true;
+        }
+        return s;
+    }
+    operator String() const { return string(); }
+
+    StringBuilderTemplate& operator+=(const String& s)
+    {
+        append(s.data(), s.length());
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const char* s)
+    {
+        append(reinterpret_cast<const T*>(s), static_cast<int>(strlen(s)));
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const typename String::Hex& hex)
+    {
+        hex.write(extend(hex.bytes()));
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const typename String::Decimal& d)
+    {
+        d.write(extend(d.bytes()));
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const typename String::CodePoint& c)
+    {
+        c.write(extend(c.bytes()));
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const typename String::Byte& b)
+    {
+        b.write(extend(1));
+        return *this;
+    }
+    StringBuilderTemplate& operator+=(const typename String::Boolean& b)
+    {
+        b.write(extend(b.bytes()));
+        return *this;
+    }
+    // Appends n copies of c.
+    void pad(int n, T c = ' ')
+    {
+        if (n > 0)
+            memset(extend(n), c, n);
+    }
+    // Pads with c until the length is at least n, like String::alignLeft().
+    void padTo(int n, T c = ' ') { pad(n - _length, c); }
+    // Pads the text appended since the length was start on the left with c
+    // so that it is at least n characters long, like String::alignRight().
+    void alignRight(int start, int n, T c = ' ')
+    {
+        int p = n - (_length - start);
+        if (p <= 0)
+            return;
+        if (shared())
+            reallocate(_array.allocated());
+        T* d = extend(p) - (_length - p - start);
+        memmove(d + p, d, _length - p - start);
+        memset(d, c, p);
+    }
+private:
+    // True if a String returned by string() is still using our buffer.
+    bool shared() const
+    {
+        if (_shared && _array.unique())
+            _shared = false;
+        return _shared;
+    }
+    void append(const T* data, int n)
+    {
+        if (n > 0)
+            memcpy(extend(n), data, n);
+    }
+    // Makes room for n more characters and returns a pointer to them.
+    T* extend(int n)
+    {
+        int l = _length + n;
+        // If a String that we shared our buffer with has appended to it,
+        // the rest of the buffer isn't ours to write to any more.
+        if (l > _array.allocated())
+            reallocate(max(l, 2*_array.allocated()));
+        else
+            if (_array.count() != _length)
+                reallocate(_array.allocated());
+        _array.expand(n);
+        _length = l;
+        return &_array[_length - n];
+    }
+    void reallocate(int n)
+    {
+        AppendableArray<T> a(n);
+        if (_length > 0)
+            a.append(&_array[0], _length);
+        _array = a;
+        _shared = false;
+    }
+
+    AppendableArray<T> _array;
+    int _length;
+    mutable bool _shared;
+};
+
 template<class T> class StreamT;
 typedef StreamT<void> Stream;
 
@@ -18,6 +18,7 @@ public:
             ++i;
             return Value(l + i->value<String>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorPlus(); }
         FunctionType type() const
         {
@@ -39,6 +40,7 @@ public:
             ++i;
             return Value(l*i->value<String>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
@@ -60,6 +62,7 @@ public:
             ++i;
             return Value(l*i->value<int>());
         }
+        bool pure() const { return true; }
         Identifier identifier() const { return OperatorStar(); }
         FunctionType type() const
         {
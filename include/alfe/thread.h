@@ -3,9 +3,21 @@
 #ifndef INCLUDED_THREAD_H
 #define INCLUDED_THREAD_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include "alfe/windows_handle.h"
 #include "alfe/linked_list.h"
 
+#ifdef _WIN32
+
+// On Windows, Event and Thread are kernel objects so that they can be used
+// with the Win32 wait functions.
+
 class Event : public WindowsHandle
 {
 public:
@@ -88,16 +100,110 @@ private:
     WindowsHandle _handle;
 };
 
+#else
+
+class Event : public Handle
+{
+public:
+    Event(bool manualReset = false) : Handle(create<Body>(manualReset)) { }
+    void signal()
+    {
+        Body* b = body();
+        std::lock_guard<std::mutex> lock(b->_mutex);
+        b->_signalled = true;
+        if (b->_manualReset)
+            b->_condition.notify_all();
+        else
+            b->_condition.notify_one();
+    }
+    // Waits for up to time milliseconds (or forever if time is negative).
+    // Returns false on timeout.
+    bool wait(int time = -1)
+    {
+        Body* b = body();
+        std::unique_lock<std::mutex> lock(b->_mutex);
+        auto signalled = [b] { return b->_signalled; };
+        if (time < 0)
+            b->_condition.wait(lock, signalled);
+        else {
+            if (!b->_condition.wait_for(lock, std::chrono::milliseconds(time),
+                signalled))
+                return false;
+        }
+        if (!b->_manualReset)
+            b->_signalled = false;
+        return true;
+    }
+    void reset()
+    {
+        Body* b = body();
+        std::lock_guard<std::mutex> lock(b->_mutex);
+        b->_signalled = false;
+    }
+private:
+    class Body : public Handle::Body
+    {
+    public:
+        Body(bool manualReset)
+          : _manualReset(manualReset), _signalled(false) { }
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        bool _manualReset;
+        bool _signalled;
+    };
+    Body* body() { return as<Body>(); }
+};
+
+class Thread : Uncopyable
+{
+public:
+    Thread() : _error(false) { }
+    ~Thread() { noFailJoin(); }
+    // Thread priorities are only supported on Windows.
+    void setPriority(int nPriority) { }
+    void noFailJoin()
+    {
+        if (_thread.joinable())
+            _thread.join();
+    }
+    void join()
+    {
+        noFailJoin();
+        if (_error) {
+            _error = false;
+            throw _exception;
+        }
+    }
+    void start() { _thread = std::thread([this] { process(); }); }
+
+private:
+    void process()
+    {
+        BEGIN_CHECKED {
+            threadProc();
+        } END_CHECKED(Exception& e) {
+            _exception = e;
+            _error = true;
+        }
+    }
+
+    virtual void threadProc() = 0;
+
+    bool _error;
+    Exception _exception;
+    std::thread _thread;
+};
+
+#endif // _WIN32
+
 class Mutex : Uncopyable
 {
 public:
-    Mutex() { InitializeCriticalSection(&_cs); }
-    ~Mutex() { DeleteCriticalSection(&_cs); }
-    void lock() { EnterCriticalSection(&_cs); }
-    void unlock() { LeaveCriticalSection(&_cs); }
-    bool tryLock() { return TryEnterCriticalSection(&_cs) != 0; }
+    void lock() { _mutex.lock(); }
+    void unlock() { _mutex.unlock(); }
+    bool tryLock() { return _mutex.try_lock(); }
 private:
-    CRITICAL_SECTION _cs;
+    std::mutex _mutex;
 };
 
 class Lock : Uncopyable
@@ -130,47 +236,50 @@ class ThreadPool;
 template<class T> class TaskT;
 typedef TaskT<void> Task;
 
-template<class T> class TaskThreadT;
-typedef TaskThreadT<void> TaskThread;
-
 template<class T> class TaskT : public LinkedListMember<Task>
 {
 public:
-    TaskT() : _state(completed), _threadPool(0) { }
-    ~TaskT() { join(); }
-    void setPool(ThreadPool* threadPool)
-    {
-        _threadPool = threadPool;
-        _threadPool->addCompleted(this);
-    }
+    TaskT()
+      : _state(completed), _threadPool(0), _queue(0), _inQueue(false),
+        _internal(false), _error(false) { }
+    // Waits for the task to finish if it is running. By the time this runs
+    // the derived class has been destroyed, so a task that hasn't started yet
+    // is dropped rather than run: a derived class that needs its queued work
+    // done should call join() from its own destructor.
+    ~TaskT();
+    void setPool(ThreadPool* threadPool);
 
     void removeFromPool() { _threadPool = 0; }
 
     // Cancel task and remove from pool as quickly as possible.
-    void cancel() { _threadPool->cancel(this); }
+    void cancel();
 
-    // Wait for task to complete.
-    void join()
-    {
-        if (_threadPool != 0)
-            _threadPool->join(this);
-    }
+    // Wait for task to complete. If run() threw an exception, it is rethrown
+    // here. If the task is still queued (no pool thread has picked it up
+    // yet), join() takes it off the queue and calls run() on the calling
+    // thread instead of waiting, so run() must not assume that it is on one
+    // of the pool's threads. This means that a task which joins tasks it
+    // started can't deadlock the pool by having every pool thread waiting.
+    void join();
 
     // If task is not running, start it. If task is running, cancel it and then
     // start it again.
-    void restart() { _threadPool->restart(this); }
+    void restart();
 
     // Same as restart(), but waits for previous instance of the task to stop
     // running before continuing.
-    void restartSynchronous() { _threadPool->restartSynchronous(this); }
+    void restartSynchronous();
 
 protected:
-    bool cancelling() { return _threadPool->cancelling(this); }
+    // This is polled frequently by long-running tasks, so doesn't take a lock.
+    bool cancelling()
+    {
+        State state = _state.load(std::memory_order_relaxed);
+        return state == cancelPending || state == restartPending;
+    }
 private:
     virtual void run() = 0;
 
-    ThreadPool* _threadPool;
-    TaskThread* _thread;
     enum State {
         waiting,
         running,
@@ -178,96 +287,89 @@ private:
         restartPending,
         completed
     };
-    State _state;
-
-    template<class U> friend class TaskThreadT;
-    friend class ThreadPool;
-};
-
-template<class T> class TaskThreadT : public Thread
-{
-public:
-    TaskThreadT() : _next(0) { }
-private:
-    void go() { _go.signal(); }
-    void threadProc()
-    {
-        do {
-            _go.wait();
-            if (_task == 0)
-                return;
-            _task->run();
-            _threadPool->taskCompleted(this);
-        } while (true);
-    }
-
-    TaskThread* _next;
+    // Changed with compare-and-swap so that the pool doesn't need a lock for
+    // it. Only the thread that took the task off its queue can start it or
+    // complete it.
+    std::atomic<State> _state;
     ThreadPool* _threadPool;
-    Task* _task;
-    Event _go;
+    std::atomic<int> _queue;      // Index of the worker whose queue we use.
+    std::atomic<bool> _inQueue;   // Changed with that queue's lock held.
+    bool _internal;               // Not reported by getCompletedTask().
+    bool _error;
+    Exception _exception;
+
     friend class ThreadPool;
 };
 
+// Each thread in the pool has a queue of its own. Tasks started from one of
+// the pool's threads go on that thread's queue, other tasks are spread between
+// the queues. A thread runs the most recently queued task from its own queue
+// and when that's empty it takes the oldest task from another thread's queue,
+// so that idle threads pick up work without all threads contending for a
+// single queue. Each queue has its own lock, task states are changed with
+// atomic operations and the number of queued tasks is an atomic counter, so
+// starting and finishing a task doesn't take a pool-wide lock. The pool's
+// lock is only taken by threads going to sleep (idle workers and threads
+// waiting for tasks) and, when there are any such sleepers, by threads waking
+// them up. Tasks reported by getCompletedTask() also take the lock of the
+// completed list when they finish.
 class ThreadPool : Uncopyable
 {
 public:
     ThreadPool(int threads = 0)
+      : _queued(0), _running(0), _next(0), _sleeping(0), _waiting(0),
+        _ending(false)
     {
-        if (threads == 0) {
-            // Count available threads
-            DWORD_PTR pam, sam;
-            IF_ZERO_THROW(
-                GetProcessAffinityMask(GetCurrentProcess(), &pam, &sam));
-            for (DWORD_PTR p = 1; p != 0; p <<= 1)
-                if ((pam&p) != 0)
-                    ++threads;
-        }
-        _threads.allocate(threads);
-        for (int i = 0; i < threads; ++i) {
-            _threads[i]._threadPool = this;
-            startTask(&_threads[i], 0);
-            _threads[i].start();
-        }
+        if (threads == 0)
+            threads = max(1, static_cast<int>(
+                std::thread::hardware_concurrency()));
+        _workers.allocate(threads);
+        for (int i = 0; i < threads; ++i)
+            _workers[i]._thread = std::thread([this, i] { workerProc(i); });
     }
     ~ThreadPool()
     {
-        // Wait until queue is empty and all threads are idle.
-        do {
-            {
-                Lock lock(&_mutex);
-                int i;
-                for (i = 0; i < _threads.count(); ++i) {
-                    if (_threads[i]._task != 0)
-                        break;
-                }
-                if (i == _threads.count())
-                    break;
-            }
-            _done.wait();
-        } while (true);
-        // End all the threads
-        for (int i = 0; i < _threads.count(); ++i) {
-            _threads[i].go();
-            _threads[i].join();
+        // Wait until queues are empty and all threads are idle.
+        waitFor([this] { return _queued == 0 && _running == 0; });
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _ending = true;
+            _wake.notify_all();
         }
+        // End all the threads
+        for (int i = 0; i < _workers.count(); ++i)
+            _workers[i]._thread.join();
+    }
+
+    int threads() const { return _workers.count(); }
+
+    // A pool with a thread per core, for code that wants to do some work in
+    // parallel but isn't given a pool to use.
+    static ThreadPool* shared()
+    {
+        static ThreadPool pool;
+        return &pool;
     }
 
     // Removes all queued tasks and cancels all running tasks,
     void abandon()
     {
-        Lock lock(&_mutex);
-        // Can't use a range-based for loop here because we're
-        // removing items and continuing.
-        auto t = _waiting.next();
-        while (t != &_waiting) {
-            auto next = t->next();
-            t->remove();
-            t = next;
-        }
-        for (int i = 0; i < _threads.count(); ++i) {
-            Task* task = _threads[i]._task;
+        for (int i = 0; i < _workers.count(); ++i) {
+            Worker* w = &_workers[i];
+            std::deque<Task*> tasks;
+            {
+                std::lock_guard<std::mutex> lock(w->_mutex);
+                tasks.swap(w->_tasks);
+                _queued -= static_cast<int>(tasks.size());
+            }
+            for (auto task : tasks) {
+                task->_inQueue = false;
+                requestCancel(task);
+                finished(task);
+            }
+            Task* task = w->_task;
             if (task != 0)
-                task->_state = Task::cancelPending;
+                requestCancel(task);
         }
     }
 
@@ -275,77 +377,93 @@ public:
     void join(Task* task)
     {
         do {
-            {
-                Lock lock(&_mutex);
-                if (task->_state == Task::completed)
-                    return;
+            Task::State state = task->_state;
+            if (state == Task::completed)
+                break;
+            if (unqueue(task)) {
+                // Nobody has picked it up yet. Rather than wait, do it here.
+                execute(task);
+                continue;
             }
-            _done.wait();
+            waitFor([task, state]
+            {
+                return task->_state != state || task->_inQueue;
+            });
         } while (true);
+        if (task->_error) {
+            task->_error = false;
+            throw task->_exception;
+        }
     }
 
-    void restart(Task* task)
+    // Waits for task to stop running, without rethrowing its exception.
+    // Called when a task is destroyed: see ~TaskT().
+    void noFailJoin(Task* task)
     {
-        Lock lock(&_mutex);
-        if (task->_state == Task::completed) {
+        do {
+            Task::State state = task->_state;
+            if (state == Task::completed)
+                break;
+            if (unqueue(task)) {
+                requestCancel(task);
+                finished(task);
+                continue;
+            }
+            waitFor([task, state]
+            {
+                return task->_state != state || task->_inQueue;
+            });
+        } while (true);
+        if (!task->_internal) {
+            std::lock_guard<std::mutex> lock(_completedMutex);
             task->remove();
-            addNoLock(task);
-        }
-        else {
-            if (task->_state != Task::waiting)
-                task->_state = Task::restartPending;
         }
     }
 
-    void restartSynchronous(Task* task)
+    void restart(Task* task)
     {
-        restart(task);
         do {
-            {
-                Lock lock(&_mutex);
-                if (task->_state != Task::restartPending)
-                    return;
+            Task::State state = task->_state;
+            if (state == Task::completed) {
+                {
+                    std::unique_lock<std::mutex> lock(_completedMutex,
+                        std::defer_lock);
+                    if (!task->_internal)
+                        lock.lock();
+                    if (!task->_state.compare_exchange_strong(state,
+                        Task::waiting))
+                        continue;
+                    task->remove();
+                }
+                enqueue(task);
+                return;
             }
-            _done.wait();
+            if (state == Task::waiting || state == Task::restartPending)
+                return;
+            if (task->_state.compare_exchange_strong(state,
+                Task::restartPending))
+                return;
         } while (true);
     }
 
-    void cancel(Task* task)
+    void restartSynchronous(Task* task)
     {
-        Lock lock(&_mutex);
-        if (task->_state == Task::waiting)
-            task->remove();
-        else {
-            if (task->_state != Task::completed)
-                task->_state = Task::cancelPending;
-        }
+        restart(task);
+        waitFor([task] { return task->_state != Task::restartPending; });
     }
 
-    bool cancelling(Task* task)
+    void cancel(Task* task)
     {
-        Lock lock(&_mutex);
-        return task->_state == Task::cancelPending ||
-            task->_state == Task::restartPending;
+        requestCancel(task);
+        if (unqueue(task))
+            finished(task);
     }
 
-    // Called by thread when it has completed its task
-    void taskCompleted(TaskThread* thread)
-    {
-        Lock lock(&_mutex);
-        Task* task = thread->_task;
-        if (task->_state != task->Task::restartPending) {
-            task->_state = Task::completed;
-            _completed.add(task);
-            task = _waiting.getNext();
-            if (task != 0)
-                task->remove();
-        }
-        startTask(thread, task);
-    }
+    bool cancelling(Task* task) { return task->cancelling(); }
 
     Task* getCompletedTask()
     {
-        Lock lock(&_mutex);
+        std::lock_guard<std::mutex> lock(_completedMutex);
         Task* task = _completed.getNext();
         if (task != 0)
             task->remove();
@@ -354,44 +472,327 @@ public:
 
     void setPriority(int nPriority)
     {
-        for (int i = 0; i < _threads.count(); ++i)
-            _threads[i].setPriority(nPriority);
+#ifdef _WIN32
+        for (int i = 0; i < _workers.count(); ++i) {
+            IF_ZERO_THROW(SetThreadPriority(
+                _workers[i]._thread.native_handle(), nPriority));
+        }
+#endif
+    }
+
+    void addCompleted(Task* task)
+    {
+        std::lock_guard<std::mutex> lock(_completedMutex);
+        _completed.add(task);
+    }
+
+    // Calls f(i) for each i from begin to end-1, on the pool's threads and the
+    // calling thread, and returns when all the calls have returned. Indices
+    // are handed out grain at a time, so a thread that finishes its share
+    // early takes over some of the remaining work. If f throws, no more
+    // indices are handed out and the first exception is rethrown here once
+    // all the other threads have stopped.
+    template<class F> void parallelFor(int begin, int end, F f, int grain = 1)
+    {
+        if (end <= begin)
+            return;
+        std::atomic<int> next(begin);
+        auto work = [&]
+        {
+            try {
+                do {
+                    int i = next.fetch_add(grain);
+                    if (i >= end)
+                        return;
+                    for (int e = min(i + grain, end); i < e; ++i)
+                        f(i);
+                } while (true);
+            }
+            catch (...) {
+                next = end;
+                throw;
+            }
+        };
+        int helpers = min(_workers.count(), (end - begin - 1)/grain);
+        Array<WorkTask<decltype(work)>> tasks(helpers);
+        for (int i = 0; i < helpers; ++i) {
+            Task* task = &tasks[i];
+            tasks[i]._work = &work;
+            task->_threadPool = this;
+            task->_internal = true;
+            restart(task);
+        }
+        // Every helper has to be joined before tasks goes out of scope, even
+        // if an earlier one failed.
+        std::exception_ptr error;
+        try {
+            work();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        for (int i = 0; i < helpers; ++i) {
+            try {
+                join(&tasks[i]);
+            }
+            catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
     }
 
-    void addCompleted(Task* task) { _completed.add(task); }
 private:
-    void addNoLock(Task* task)
+    template<class W> class WorkTask : public Task
+    {
+    public:
+        void run() { (*_work)(); }
+        W* _work;
+    };
+
+    class Worker : Uncopyable
+    {
+    public:
+        Worker() : _task(0) { }
+        std::mutex _mutex;
+        std::deque<Task*> _tasks;
+        std::thread _thread;
+        std::atomic<Task*> _task;  // Running on this thread.
+    };
+
+    // The index of the current thread in the pool it belongs to, if any.
+    static ThreadPool*& currentPool()
+    {
+        thread_local ThreadPool* pool = 0;
+        return pool;
+    }
+    static int& currentWorker()
+    {
+        thread_local int worker = 0;
+        return worker;
+    }
+
+    void workerProc(int i)
     {
-        TaskThread* thread = _idle;
-        if (thread == 0) {
-            _waiting.add(task);
+        currentPool() = this;
+        currentWorker() = i;
+        do {
+            Task* task = take(i);
+            if (task != 0) {
+                _workers[i]._task = task;
+                execute(task);
+                _workers[i]._task = 0;
+                continue;
+            }
+            // A thread queueing a task increments _queued before it looks at
+            // _sleeping, and we increment _sleeping before looking at
+            // _queued, so one of us sees the other and the wakeup can't be
+            // lost.
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_queued == 0 && _ending)
+                return;
+            ++_sleeping;
+            _wake.wait(lock, [this] { return _queued != 0 || _ending; });
+            --_sleeping;
+        } while (true);
+    }
+    Task* take(int i)
+    {
+        int n = _workers.count();
+        {
+            Worker* w = &_workers[i];
+            std::lock_guard<std::mutex> lock(w->_mutex);
+            if (!w->_tasks.empty()) {
+                Task* task = w->_tasks.back();
+                w->_tasks.pop_back();
+                task->_inQueue = false;
+                --_queued;
+                return task;
+            }
+        }
+        for (int j = 1; j < n; ++j) {
+            Worker* w = &_workers[(i + j) % n];
+            std::lock_guard<std::mutex> lock(w->_mutex);
+            if (!w->_tasks.empty()) {
+                Task* task = w->_tasks.front();
+                w->_tasks.pop_front();
+                task->_inQueue = false;
+                --_queued;
+                return task;
+            }
+        }
+        return 0;
+    }
+    // Runs a task that the calling thread has taken off its queue.
+    void execute(Task* task)
+    {
+        Task::State state = Task::waiting;
+        if (!task->_state.compare_exchange_strong(state, Task::running)) {
+            // Cancelled after it was taken from the queue.
+            finished(task);
             return;
         }
-        _idle = thread->_next;
-        startTask(thread, task);
+        ++_running;
+        BEGIN_CHECKED {
+            task->run();
+        } END_CHECKED(Exception& e) {
+            task->_exception = e;
+            task->_error = true;
+        }
+        --_running;
+        finished(task);
+    }
+    // Called by the thread that took task off its queue (and ran it, if it
+    // wasn't cancelled first). Marks the task completed, or queues it again
+    // if it was restarted in the meantime.
+    void finished(Task* task)
+    {
+        // Once the task is marked completed its owner may destroy it, so
+        // don't look at it after that (except to add it to the completed
+        // list, which its destructor takes the lock of).
+        bool internal = task->_internal;
+        {
+            std::unique_lock<std::mutex> lock(_completedMutex,
+                std::defer_lock);
+            if (!internal)
+                lock.lock();
+            do {
+                Task::State state = task->_state;
+                if (state == Task::restartPending) {
+                    if (task->_state.compare_exchange_strong(state,
+                        Task::waiting))
+                        break;
+                }
+                else {
+                    if (task->_state.compare_exchange_strong(state,
+                        Task::completed)) {
+                        if (!internal)
+                            _completed.add(task);
+                        notifyWaiting();
+                        return;
+                    }
+                }
+            } while (true);
+        }
+        enqueue(task);
     }
-    void startTask(TaskThread* thread, Task* task)
+    // Called with task's state already set to waiting.
+    void enqueue(Task* task)
     {
-        thread->_task = task;
-        if (task == 0) {
-            thread->_next = _idle;
-            _idle = thread;
+        int i;
+        if (currentPool() == this)
+            i = currentWorker();
+        else
+            i = _next.fetch_add(1, std::memory_order_relaxed) %
+                _workers.count();
+        task->_queue = i;
+        {
+            Worker* w = &_workers[i];
+            std::lock_guard<std::mutex> lock(w->_mutex);
+            w->_tasks.push_back(task);
+            task->_inQueue = true;
+            ++_queued;
         }
-        else {
-            task->_state = Task::running;
-            thread->go();
+        if (_sleeping != 0) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _wake.notify_one();
         }
-        _done.signal();
+        notifyWaiting();
+    }
+    // Takes task off its queue if it is in one, after which the caller is
+    // responsible for it.
+    bool unqueue(Task* task)
+    {
+        if (!task->_inQueue)
+            return false;
+        Worker* w = &_workers[task->_queue];
+        std::lock_guard<std::mutex> lock(w->_mutex);
+        if (!task->_inQueue)
+            return false;
+        for (auto i = w->_tasks.begin(); i != w->_tasks.end(); ++i) {
+            if (*i == task) {
+                w->_tasks.erase(i);
+                task->_inQueue = false;
+                --_queued;
+                return true;
+            }
+        }
+        return false;
+    }
+    void requestCancel(Task* task)
+    {
+        do {
+            Task::State state = task->_state;
+            if (state == Task::completed || state == Task::cancelPending)
+                return;
+            if (task->_state.compare_exchange_strong(state,
+                Task::cancelPending))
+                return;
+        } while (true);
+    }
+    // Sleeps until done() returns true. We're only woken when a task is
+    // completed or queued, so done() must become true through one of those.
+    // A task that is on its way into or out of a queue is neither, but then
+    // it is about to be queued or started (and so eventually completed).
+    template<class F> void waitFor(F done)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        ++_waiting;
+        _done.wait(lock, done);
+        --_waiting;
+    }
+    // Same handshake as with _sleeping in workerProc().
+    void notifyWaiting()
+    {
+        if (_waiting == 0)
+            return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done.notify_all();
     }
 
-    TaskThread* _idle;
-    Mutex _mutex;
-    Event _done;
-    LinkedList<Task> _waiting;
+    std::mutex _mutex;
+    std::condition_variable _done;
+    std::condition_variable _wake;
+    std::atomic<int> _queued;
+    std::atomic<int> _running;
+    std::atomic<int> _next;
+    std::atomic<int> _sleeping;
+    std::atomic<int> _waiting;
+    bool _ending;
+    std::mutex _completedMutex;
     LinkedList<Task> _completed;
-    Array<TaskThread> _threads;
+    Array<Worker> _workers;
 };
 
+template<class T> TaskT<T>::~TaskT()
+{
+    if (_threadPool != 0)
+        _threadPool->noFailJoin(this);
+}
+
+template<class T> void TaskT<T>::setPool(ThreadPool* threadPool)
+{
+    _threadPool = threadPool;
+    _threadPool->addCompleted(this);
+}
+
+template<class T> void TaskT<T>::cancel() { _threadPool->cancel(this); }
+
+template<class T> void TaskT<T>::join()
+{
+    if (_threadPool != 0)
+        _threadPool->join(this);
+}
+
+template<class T> void TaskT<T>::restart() { _threadPool->restart(this); }
+
+template<class T> void TaskT<T>::restartSynchronous()
+{
+    _threadPool->restartSynchronous(this);
+}
+
 // A ThreadTask has a single thread all to itself.
 class ThreadTask : public Task
 {
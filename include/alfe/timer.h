@@ -3,29 +3,50 @@
 #ifndef INCLUDED_TIMER_H
 #define INCLUDED_TIMER_H
 
+#ifdef _WIN32
 #include <MMSystem.h>
+#else
+#include <chrono>
+#endif
 
 class Timer
 {
 public:
-    Timer()
+    Timer() { reset(); }
+    void reset()
     {
+#ifdef _WIN32
         QueryPerformanceCounter(&_startTime);
+#else
+        _startTime = std::chrono::steady_clock::now();
+#endif
     }
-    void output(String caption)
+    // Returns the number of seconds since the timer was created or reset.
+    double elapsed()
     {
+#ifdef _WIN32
         LARGE_INTEGER time;
         QueryPerformanceCounter(&time);
         time.QuadPart -= _startTime.QuadPart;
         LARGE_INTEGER frequency;
         QueryPerformanceFrequency(&frequency);
-        console.write(caption + ": " + decimal(static_cast<int>(
-            (time.QuadPart*1000000)/frequency.QuadPart)) +
-            " microseconds\n");
-        //printf("%lf us\n",time.QuadPart*1000000.0/frequency.QuadPart);
+        return static_cast<double>(time.QuadPart)/frequency.QuadPart;
+#else
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - _startTime).count();
+#endif
+    }
+    void output(String caption)
+    {
+        console.write(caption + ": " +
+            decimal(static_cast<int>(elapsed()*1000000)) + " microseconds\n");
     }
 private:
+#ifdef _WIN32
     LARGE_INTEGER _startTime;
+#else
+    std::chrono::steady_clock::time_point _startTime;
+#endif
 };
 
 //class Timer
@@ -102,8 +102,8 @@ template<class T> class StructureT
 public:
     template<class U> U get(Identifier identifier) const
     {
-        Value v = getValue(identifier);
-        StructuredType t(v.type().rValue());
+        ValueT<T> v = getValue(identifier);
+        StructuredTypeT<T> t(v.type().rValue());
         if (t.valid())
             return t.rValueFromLValue(v).template value<U>();
         return v.template value<U>();
@@ -197,7 +197,7 @@ public:
     {
         if (_objects.hasKey(identifier)) {
             VariableDefinition s = _objects[identifier];
-            *path = ResolutionPath::local();
+            *path = ResolutionPathT<T>::local();
             return s;
         }
         if (_parent == 0) {
@@ -260,7 +260,7 @@ public:
     void setFunctionScope(Scope* scope) { _functionScope = scope; }
     Scope* functionScope() { return _functionScope; }
 private:
-    String argumentTypesString(List<Type> argumentTypes) const
+    String argumentTypesString(List<TypeT<T>> argumentTypes) const
     {
         String s;
         bool needComma = false;
@@ -372,7 +372,8 @@ public:
     }
     LValueT member(Identifier identifier)
     {
-        return LValueT(_structure->getValue(_identifier).value<Structure*>(),
+        return LValueT(
+            _structure->getValue(_identifier).template value<Structure*>(),
             identifier);
     }
 private:
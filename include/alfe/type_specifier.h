@@ -270,7 +270,7 @@ private:
         TycoT<T> resolve(const ScopeT<T>* scope) const
         {
             Type ret = scope->resolveType(_returnType);
-            FunctionType f = FunctionTemplateT<T>().instantiate(ret);
+            FunctionTypeT<T> f = FunctionTemplateT<T>().instantiate(ret);
             for (auto a : _argumentTypes) {
                 Type t = scope->resolveType(a);
                 f = f.instantiate(t);
@@ -365,7 +365,7 @@ protected:
         {
             return TycoSpecifier::Body::hash().mixin(_name.hash());
         }
-        bool equals(const ConstHandle::Body* other) const
+        bool equals(const ::ConstHandle::Body* other) const
         {
             auto o = other->to<Body>();
             return o != 0 && _name == o->_name;
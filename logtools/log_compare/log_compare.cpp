@@ -125,11 +125,15 @@ class Program : public ProgramBase
         _states[10] = "ERROR";      _testStates[10] = error;
         for (int i = 0; i < 11; ++i)
             _states[i] += ": ";
-        String l1 = File(_arguments[1], true).contents();
-        String l2 = File(_arguments[2], true).contents();
+        // The results refer to the mapped logs rather than copying from them,
+        // so they stay mapped until we're done.
+        File f1(_arguments[1], true);
+        File f2(_arguments[2], true);
+        FileMapping l1 = f1.map();
+        FileMapping l2 = f2.map();
         _eol = String(codePoint(10));
-        parseTestLog(l1, false);
-        parseTestLog(l2, true);
+        parseTestLog(CharacterSource(l1, f1), false);
+        parseTestLog(CharacterSource(l2, f2), true);
 
         double cyclesBefore = 0;
         double cyclesAfter = 0;
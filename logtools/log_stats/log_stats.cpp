@@ -105,9 +105,12 @@ class Program : public ProgramBase
         _states[10] = "ERROR";      _testStates[10] = error;
         for (int i = 0; i < 11; ++i)
             _states[i] += ": ";
-        String l1 = File(_arguments[1], true).contents();
+        // The results refer to the mapped log rather than copying from it, so
+        // it stays mapped until we're done.
+        File f1(_arguments[1], true);
+        FileMapping l1 = f1.map();
         _eol = String(codePoint(10));
-        parseTestLog(l1);
+        parseTestLog(CharacterSource(l1, f1));
 
         double cycles = 0;
         double bytes = 0;
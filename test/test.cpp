@@ -1,5 +1,461 @@
 #include "alfe/string.h"
 #include "alfe/main.h"
+#include "alfe/thread.h"
+#include "alfe/sha256.h"
+#include "alfe/timer.h"
+#include "alfe/hash_table.h"
+#include "alfe/bound_signal.h"
+#include "alfe/config_file.h"
+#include "alfe/small_object_pool.h"
+#include "alfe/ntsc_decode.h"
+#include "alfe/bitmap_png.h"
+#include "alfe/convolution_pipe.h"
+#include "alfe/cga.h"
+#include <algorithm>
+
+// A key whose hash only has four values, so that a HashTable of them is one
+// long cluster of colliding entries.
+class CollidingKey
+{
+public:
+    CollidingKey() : _k(0) { }
+    CollidingKey(int k) : _k(k) { }
+    UInt32 hash() const { return _k & 3; }
+    bool operator==(const CollidingKey& other) const { return _k == other._k; }
+private:
+    int _k;
+};
+
+// The receiving end of a signal, which remembers what it was last sent.
+class SignalRecorder : public BoundSignal<int, int>
+{
+public:
+    SignalRecorder() : _v(0), _count(0) { }
+    void setData(int t, int v) { _v = v; ++_count; }
+    int _v;
+    int _count;
+};
+
+// A SignalRecorder that can be sent to without going through the vtable.
+class DirectSignalRecorder : public SignalRecorder
+{
+public:
+    Sender sender(bool inverted)
+    {
+        return directSender<DirectSignalRecorder>(inverted);
+    }
+};
+
+// Inverts a signal and passes it on. If it's connected, ends bound to it send
+// straight to whatever it's connected to instead.
+class SignalInverter : public BoundSignal<int, int>
+{
+public:
+    SignalInverter() : _next(0), _count(0) { }
+    void connect(BoundSignal* next)
+    {
+        _next = next;
+        _output.bind(next);
+    }
+    void setData(int t, int v)
+    {
+        ++_count;
+        if (_next != 0)
+            _output.send(t, ~v);
+    }
+    BoundSignal* forward(bool* inverted)
+    {
+        *inverted = true;
+        return _next;
+    }
+    BoundSignal* _next;
+    SignalRecorder _output;
+    int _count;
+};
+
+// Pieces of the signal wiring of berapa's IBM 5150/5160 machines (see
+// berapa/ibmpcxt.config), for a fixed-cycle benchmark of signal delivery with
+// and without binding. A Wire's output either calls setData() on the end it's
+// connected to, as berapa's connectors did before binding, or is bound.
+typedef BoundSignal<bool, int> Wire;
+
+class WireOutput : public Wire
+{
+public:
+    WireOutput() : _other(0), _bound(false) { }
+    void connect(Wire* other) { _other = other; }
+    void bind(bool bound)
+    {
+        _bound = bound;
+        if (bound)
+            Wire::bind(_other);
+    }
+    void set(int t, bool v)
+    {
+        if (_bound)
+            send(t, v);
+        else
+            _other->setData(t, v);
+    }
+    void setData(int t, bool v) { }
+    Wire* _other;
+    bool _bound;
+};
+
+// A chip's input line, which counts the changes it sees.
+class WireInput : public Wire
+{
+public:
+    WireInput() : _v(false), _count(0) { }
+    void setData(int t, bool v)
+    {
+        if (v != _v) {
+            _v = v;
+            ++_count;
+        }
+    }
+    Sender sender(bool inverted)
+    {
+        return directSender<WireInput>(inverted);
+    }
+    bool _v;
+    int _count;
+};
+
+class NotGate : public Wire
+{
+public:
+    void setData(int t, bool v) { _output.set(t, !v); }
+    Wire* forward(bool* inverted)
+    {
+        *inverted = true;
+        return _output._other;
+    }
+    WireOutput _output;
+};
+
+// Sends its output only when it changes, like berapa's BooleanComponents.
+class AndGate
+{
+public:
+    class Input : public Wire
+    {
+    public:
+        Input(AndGate* gate) : _gate(gate), _v(false) { }
+        void setData(int t, bool v)
+        {
+            _v = v;
+            _gate->update(t);
+        }
+        Sender sender(bool inverted) { return directSender<Input>(inverted); }
+        AndGate* _gate;
+        bool _v;
+    };
+    AndGate() : _a(this), _b(this), _v(false) { }
+    void update(int t)
+    {
+        bool v = _a._v && _b._v;
+        if (v != _v) {
+            _v = v;
+            _output.set(t, v);
+        }
+    }
+    void bind(bool bound) { _output.bind(bound); }
+    Input _a;
+    Input _b;
+    WireOutput _output;
+    bool _v;
+};
+
+class SRLatch
+{
+public:
+    class Input : public Wire
+    {
+    public:
+        Input(SRLatch* latch, bool set) : _latch(latch), _set(set) { }
+        void setData(int t, bool v)
+        {
+            if (v)
+                _latch->update(t, _set);
+        }
+        Sender sender(bool inverted) { return directSender<Input>(inverted); }
+        SRLatch* _latch;
+        bool _set;
+    };
+    SRLatch() : _set(this, true), _reset(this, false), _v(false) { }
+    void update(int t, bool v)
+    {
+        if (v != _v) {
+            _v = v;
+            _lastSet.set(t, v);
+        }
+    }
+    void bind(bool bound) { _lastSet.bind(bound); }
+    Input _set;
+    Input _reset;
+    WireOutput _lastSet;
+    bool _v;
+};
+
+// The signals that change while a 5150 runs: PIT timer 0 into IRQ0 and the
+// PIC into the CPU, timer 1 and the DMAC refreshing DRAM through the refresh
+// latch, ~dmac.eop into the bus's terminal count, and timer 2 beeping the
+// speaker. berapa connects each output to one input, so the DMAC's dack0 and
+// timer 2's output are each modelled as two outputs.
+class PCXTWiring
+{
+public:
+    PCXTWiring(bool bound)
+    {
+        _timer0.connect(&_irq0);
+        _int.connect(&_cpuIrq);
+        _timer1.connect(&_refreshSet._a);
+        _dack0.connect(&_refreshSet._b);
+        _notDack0.connect(&_notDack);
+        _refreshSet._output.connect(&_refreshLatch._set);
+        _notDack._output.connect(&_refreshLatch._reset);
+        _refreshLatch._lastSet.connect(&_dreq0);
+        _eop.connect(&_notEop);
+        _notEop._output.connect(&_terminalCount);
+        _timer2.connect(&_c5);
+        _timer2Speaker.connect(&_speakerGate._a);
+        _b1.connect(&_speakerGate._b);
+        _speakerGate._output.connect(&_speaker);
+        WireOutput* outputs[] = {&_timer0, &_int, &_timer1, &_dack0,
+            &_notDack0, &_notDack._output, &_eop, &_notEop._output, &_timer2,
+            &_timer2Speaker, &_b1};
+        for (auto o : outputs)
+            o->bind(bound);
+        _refreshSet.bind(bound);
+        _refreshLatch.bind(bound);
+        _speakerGate.bind(bound);
+        _b1.set(0, true);
+    }
+    // Runs for n cycles of the 1.193MHz PIT clock, a refresh period of 18
+    // cycles at a time.
+    void run(int n)
+    {
+        bool timer0 = false;
+        bool timer2 = false;
+        bool interrupt = false;
+        int next0 = 0;
+        int next2 = 0;
+        for (int t = 0; t < n; t += 18) {
+            // Timer 1 is a rate generator whose pulse starts a DMA refresh
+            // cycle.
+            _timer1.set(t, true);
+            _dack0.set(t + 2, true);
+            _notDack0.set(t + 2, true);
+            _eop.set(t + 3, true);
+            _eop.set(t + 4, false);
+            _dack0.set(t + 4, false);
+            _notDack0.set(t + 4, false);
+            _timer1.set(t + 17, false);
+            // Timer 0 is a square wave at 18.2Hz, and the PIC interrupts the
+            // CPU until the next refresh period after each rising edge.
+            if (interrupt) {
+                interrupt = false;
+                _int.set(t, false);
+            }
+            if (t >= next0) {
+                timer0 = !timer0;
+                _timer0.set(t, timer0);
+                if (timer0) {
+                    interrupt = true;
+                    _int.set(t, true);
+                }
+                next0 += 0x8000;
+            }
+            // Timer 2 is a 1kHz square wave.
+            if (t >= next2) {
+                timer2 = !timer2;
+                _timer2.set(t, timer2);
+                _timer2Speaker.set(t, timer2);
+                next2 += 596;
+            }
+        }
+    }
+    int count()
+    {
+        return _irq0._count + _cpuIrq._count + _dreq0._count +
+            _terminalCount._count + _c5._count + _speaker._count;
+    }
+private:
+    WireOutput _timer0;
+    WireOutput _int;
+    WireOutput _timer1;
+    WireOutput _dack0;
+    WireOutput _notDack0;
+    WireOutput _eop;
+    WireOutput _timer2;
+    WireOutput _timer2Speaker;
+    WireOutput _b1;
+    NotGate _notDack;
+    NotGate _notEop;
+    AndGate _refreshSet;
+    AndGate _speakerGate;
+    SRLatch _refreshLatch;
+    WireInput _irq0;
+    WireInput _cpuIrq;
+    WireInput _dreq0;
+    WireInput _terminalCount;
+    WireInput _c5;
+    WireInput _speaker;
+};
+
+// A task that counts how many times it has been run.
+class CountingTask : public Task
+{
+public:
+    CountingTask() : _count(0) { }
+    ~CountingTask() { join(); }
+    void run() { ++_count; }
+    std::atomic<int> _count;
+};
+
+// Spreads out consecutive integers, so that a benchmark using them as keys
+// doesn't just measure how well the hash keeps neighbouring keys together.
+int scramble(int i)
+{
+    return static_cast<int>(static_cast<UInt32>(i)*0x9e3779b1);
+}
+
+// A Source of noise, which can be asked for any sample it produces so that
+// the output of a filter can be checked. If a length is given, the Source
+// says that it will end after that many samples.
+class NoiseSource : public Source<float>
+{
+public:
+    NoiseSource(int length = -1) : _length(length), _produced(0) { }
+    void produce(int n)
+    {
+        Accessor<float> writer = this->writer(n);
+        for (int i = 0; i < n; ++i) {
+            writer.item() = (*this)[_produced];
+            ++_produced;
+        }
+        this->written(n);
+        if (_length != -1)
+            this->remaining(_length - _produced);
+    }
+    float operator[](int i) const
+    {
+        return static_cast<float>(scramble(i)/2147483648.0);
+    }
+    int produced() const { return _produced; }
+private:
+    int _length;
+    int _produced;
+};
+
+// A Sink that is pulled from directly rather than pushed to.
+template<class T> class PulledSink : public Sink<T>
+{
+public:
+    void consume(int n) { }
+};
+
+// Pulls n samples through a resampling convolution pipe and returns how many
+// differ by more than tolerance from convolving the input with the kernel
+// directly. Output sample i is centred on input sample i*consumerRate/
+// producerRate - firstTap.
+template<class P> int convolutionErrors(P* pipe, int producerRate,
+    int consumerRate, ConvolutionKernel kernel, int n, double tolerance)
+{
+    NoiseSource source;
+    PulledSink<float> sink;
+    source.connect(pipe->sink());
+    pipe->source()->connect(&sink);
+    double scale = static_cast<double>(producerRate)/consumerRate;
+    int firstTap = PolyphaseKernel<float>(kernel, scale, 1, 0).firstTap();
+    double le = kernel.leftExtent();
+    double re = kernel.rightExtent();
+    Accessor<float> reader = sink.reader(n);
+    int errors = 0;
+    for (int i = 0; i < n; ++i) {
+        double t = static_cast<double>(i)*consumerRate/producerRate -
+            firstTap;
+        double expected = 0;
+        for (int m = static_cast<int>(ceil(t + le/scale));
+            m <= static_cast<int>(floor(t + re/scale)); ++m) {
+            if (m >= 0)
+                expected += source[m]*kernel((m - t)*scale);
+        }
+        if (abs(reader.item() - expected) > tolerance)
+            ++errors;
+    }
+    sink.read(n);
+    return errors;
+}
+
+// A Source of consecutive integers, for checking that samples arrive in
+// order.
+class CountingSource : public Source<int>
+{
+public:
+    CountingSource() : _produced(0) { }
+    void produce(int n)
+    {
+        Accessor<int> writer = this->writer(n);
+        for (int i = 0; i < n; ++i) {
+            writer.item() = _produced;
+            ++_produced;
+        }
+        this->written(n);
+    }
+    int produced() const { return _produced; }
+private:
+    int _produced;
+};
+
+// Pushes samples into a ThreadBridge on one thread and pulls them out on
+// this one, and returns the number that were wrong. The buffer is much
+// smaller than the data, so each side has to wait for the other. At the end
+// the producer is left waiting for space that never comes, and close() has
+// to release it. The consumer then gets what was left in the buffer
+// followed by zeroes.
+template<class Wait> int threadBridgeErrors()
+{
+    static const int total = 100000;
+    ThreadBridge<int, Wait> bridge(256, 64);
+    CountingSource source;
+    PulledSink<int> sink;
+    source.connect(bridge.sink());
+    bridge.source()->connect(&sink);
+    std::thread producer([&]()
+    {
+        while (source.produced() < total + 1000)
+            source.produce(100);
+    });
+    int errors = 0;
+    int expected = 0;
+    while (expected < total) {
+        int n = min(37, total - expected);
+        Accessor<int> reader = sink.reader(n);
+        for (int i = 0; i < n; ++i) {
+            if (reader.item() != expected)
+                ++errors;
+            ++expected;
+        }
+        sink.read(n);
+    }
+    bridge.close();
+    producer.join();
+    Accessor<int> reader = sink.reader(1000);
+    for (int i = 0; i < 1000; ++i) {
+        int v = reader.item();
+        if (v == expected)
+            ++expected;
+        else
+            if (v != 0)
+                ++errors;
+        if (v == 0)
+            expected = -1;
+    }
+    sink.read(1000);
+    return errors;
+}
 
 class Program : public ProgramBase
 {
@@ -23,7 +479,782 @@ public:
             s.get();
             s.get();
             int b = s.offset();
-            console.write(s.subString(a, b));  // Should print "oob"
+            console.write(s.subString(a, b) + "\n");  // Should print "oob"
+        }
+
+        {
+            // A StringBuilder that is cleared once the String it returned has
+            // gone reuses its buffer, while one that is cleared with that
+            // String still around leaves the String alone.
+            StringBuilder builder;
+            builder += "The quick brown fox jumps over the lazy dog";
+            const Byte* first;
+            {
+                String s = builder.string();
+                first = &s[0];
+            }
+            builder.clear();
+            builder += "Pack my box with five dozen liquor jugs";
+            String kept = builder.string();
+            bool reused = &kept[0] == first;
+            builder.clear();
+            builder += "Sphinx of black quartz, judge my vow";
+            bool preserved = kept == "Pack my box with five dozen liquor jugs";
+            console.write(decimal(reused ? 1 : 0) + " " +
+                decimal(preserved ? 1 : 0) + "\n");  // Should print "1 1"
+        }
+
+        {
+            // An exception thrown on one of the pool's threads is rethrown
+            // by parallelFor() after all the helper tasks have finished.
+            ThreadPool pool(2);
+            int caught = 0;
+            for (int i = 0; i < 100; ++i) {
+                try {
+                    pool.parallelFor(0, 3, [](int j)
+                    {
+                        if (j == 1)
+                            throw Exception("parallelFor");
+                    });
+                }
+                catch (Exception&) {
+                    ++caught;
+                }
+            }
+            console.write(decimal(caught) + "\n");  // Should print "100"
+        }
+
+        {
+            // Tasks restarted, cancelled and joined from several threads at
+            // once, and parallelFor() called from the pool's own threads
+            // (whose helpers are joined by running them inline if no thread
+            // is free).
+            ThreadPool pool(4);
+            Array<CountingTask> tasks(64);
+            for (int i = 0; i < tasks.count(); ++i)
+                tasks[i].setPool(&pool);
+            pool.parallelFor(0, 100, [&](int round)
+            {
+                for (int i = 0; i < tasks.count(); ++i) {
+                    tasks[(i + round) % tasks.count()].restart();
+                    if (i % 7 == 0)
+                        tasks[(i*3) % tasks.count()].cancel();
+                    tasks[i].join();
+                }
+            });
+            for (int i = 0; i < tasks.count(); ++i)
+                tasks[i].join();
+            bool ran = true;
+            for (int i = 0; i < tasks.count(); ++i)
+                ran = ran && tasks[i]._count > 0;
+            int completed = 0;
+            while (pool.getCompletedTask() != 0)
+                ++completed;
+            std::atomic<int> sum(0);
+            pool.parallelFor(0, 8, [&](int i)
+            {
+                pool.parallelFor(0, 100, [&](int j) { ++sum; });
+            });
+            // Should print "1 64 800"
+            console.write(decimal(ran ? 1 : 0) + " " + decimal(completed) +
+                " " + decimal(sum) + "\n");
+        }
+
+        {
+            // Expressions give the same values compiled as when their trees
+            // are walked, and constant ones are folded. The || cases check
+            // that LogicalOr isn't evaluated as &&.
+            ConfigFile config;
+            config.addDefaultOption("a", 5);
+            config.addDefaultOption("b", false);
+            config.loadFromString("a = 2 + 3*4; b = a > 20 || a < 0;");
+            static const char* texts[] = { "2 + 3*4", "a*a - 1",
+                "false || true", "true || false", "false || false",
+                "b || a > 10", "a > 20 || a < 0", "b && true",
+                "false && b", "a > 10 ? a : 0", "7/2 + 1/2", "1 << 4",
+                "\"x\" + \"y\"*3" };
+            static const bool constant[] = { true, false, true, true, true,
+                false, false, false, true, false, true, true, true };
+            int mismatches = 0;
+            for (int i = 0; i < 13; ++i) {
+                Expression e = config.parse(texts[i]);
+                CompiledExpression c(e);
+                Value tree = e.evaluate(&config).rValue().simplify();
+                Value compiled = c.evaluate(&config).simplify();
+                if (tree != compiled || c.constant() != constant[i])
+                    ++mismatches;
+            }
+            bool t = config.evaluate<bool>("a < 0 || a > 10", false);
+            // Should print "0 14 0 1"
+            console.write(decimal(mismatches) + " " +
+                decimal(config.get<int>("a")) + " " +
+                decimal(config.get<bool>("b") ? 1 : 0) + " " +
+                decimal(t ? 1 : 0) + "\n");
+        }
+
+        {
+            // The test vectors from FIPS 180-2, with every implementation
+            // that this CPU can run.
+            static const char* messages[3] = { "abc", "",
+                "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq" };
+            static const char* expected[3] = {
+                "ba7816bf8f01cfea414140de5dae2223"
+                    "b00361a396177a9cb410ff61f20015ad",
+                "e3b0c44298fc1c149afbf4c8996fb924"
+                    "27ae41e4649b934ca495991b7852b855",
+                "248d6a61d20638b8e5c026930c3e6039"
+                    "a33ce45964ff2167f6ecedd419db06c1" };
+            const Byte* data[3];
+            int lengths[3];
+            for (int i = 0; i < 3; ++i) {
+                data[i] = reinterpret_cast<const Byte*>(messages[i]);
+                lengths[i] = static_cast<int>(strlen(messages[i]));
+            }
+            int failed = 0;
+            for (int j = 0; j < 3; ++j) {
+                auto implementation =
+                    static_cast<SHA256Hash::Implementation>(j);
+                if (!SHA256Hash::available(implementation))
+                    continue;
+                SHA256Hash hashes[3];
+                SHA256Hash::hashMany(data, lengths, 3, hashes,
+                    implementation);
+                for (int i = 0; i < 3; ++i)
+                    if (hashes[i].toString() != expected[i])
+                        ++failed;
+            }
+            // A million "a"s, fed to the Hasher in uneven pieces.
+            Array<Byte> a(1000000);
+            memset(&a[0], 'a', 1000000);
+            SHA256Hash::Hasher hasher;
+            for (int i = 0, n = 1; i < 1000000; n = n*3 % 1000) {
+                int length = min(n, 1000000 - i);
+                hasher.update(&a[i], length);
+                i += length;
+            }
+            if (SHA256Hash(hasher).toString() !=
+                "cdc76e5c9914fb9281a1c7e284d73e67"
+                "f1809a48a497200e046d39ccc7112cd0")
+                ++failed;
+            console.write(decimal(failed) + "\n");  // Should print "0"
+        }
+
+        {
+            // The implementations agree with each other on messages of
+            // every length up to a few blocks, including where the padding
+            // spills into a second block.
+            static const int count = 300;
+            Array<Byte> buffer(count*(count - 1)/2 + 1);
+            UInt32 seed = 1;
+            for (int i = 0; i < buffer.count(); ++i) {
+                seed = seed*1103515245 + 12345;
+                buffer[i] = static_cast<Byte>(seed >> 16);
+            }
+            const Byte* data[count];
+            int lengths[count];
+            for (int i = 0, offset = 0; i < count; offset += i, ++i) {
+                data[i] = &buffer[offset];
+                lengths[i] = i;
+            }
+            SHA256Hash reference[count];
+            SHA256Hash::hashMany(data, lengths, count, reference,
+                SHA256Hash::scalar);
+            int differences = 0;
+            for (int j = 1; j < 3; ++j) {
+                auto implementation =
+                    static_cast<SHA256Hash::Implementation>(j);
+                if (!SHA256Hash::available(implementation))
+                    continue;
+                SHA256Hash hashes[count];
+                SHA256Hash::hashMany(data, lengths, count, hashes,
+                    implementation);
+                for (int i = 0; i < count; ++i)
+                    if (!(hashes[i] == reference[i]))
+                        ++differences;
+            }
+            console.write(decimal(differences) + "\n");  // Should print "0"
+        }
+
+        {
+            // SHA-256 throughput of each implementation that this CPU can
+            // run, hashing 64 messages of 1MB each.
+            static const int size = 0x4000000;
+            static const int count = 64;
+            Array<Byte> buffer(size);
+            memset(&buffer[0], 0x5a, size);
+            const Byte* data[count];
+            int lengths[count];
+            for (int i = 0; i < count; ++i) {
+                data[i] = &buffer[i*(size/count)];
+                lengths[i] = size/count;
+            }
+            static const char* names[3] =
+                { "scalar", "extensions", "multiBuffer" };
+            for (int j = 0; j < 3; ++j) {
+                auto implementation =
+                    static_cast<SHA256Hash::Implementation>(j);
+                if (!SHA256Hash::available(implementation))
+                    continue;
+                SHA256Hash hashes[count];
+                Timer timer;
+                SHA256Hash::hashMany(data, lengths, count, hashes,
+                    implementation);
+                console.write(String("SHA-256 ") + names[j] + ": " +
+                    format("%.2f", size/timer.elapsed()/1e9) + " GB/s\n");
+            }
+        }
+
+        {
+            // Random adds and erases, checked against a plain array. The
+            // keys are few enough that the table keeps filling up and
+            // emptying out again.
+            static const int keys = 4096;
+            HashTable<int, int> table;
+            int values[keys];
+            for (int i = 0; i < keys; ++i)
+                values[i] = -1;
+            int errors = 0;
+            UInt32 seed = 1;
+            for (int i = 0; i < 1000000; ++i) {
+                seed = seed*1103515245 + 12345;
+                int key = (seed >> 8) % keys;
+                if ((seed >> 30) == 0) {
+                    table.erase(key);
+                    values[key] = -1;
+                }
+                else {
+                    table[key] = i;
+                    values[key] = i;
+                }
+                if (i % 1000 != 0)
+                    continue;
+                int n = 0;
+                for (int k = 0; k < keys; ++k) {
+                    if (values[k] < 0) {
+                        if (table.hasKey(k))
+                            ++errors;
+                        continue;
+                    }
+                    ++n;
+                    if (!table.hasKey(k) || table[k] != values[k])
+                        ++errors;
+                }
+                if (n != table.count())
+                    ++errors;
+            }
+            console.write(decimal(errors) + "\n");  // Should print "0"
+        }
+
+        {
+            // Erasing from the middle of a long cluster of colliding entries
+            // keeps the rest of the cluster reachable.
+            HashTable<CollidingKey, int> table;
+            for (int i = 0; i < 200; ++i)
+                table[i] = i;
+            for (int i = 0; i < 200; i += 3)
+                table.erase(i);
+            table.erase(1000);
+            int errors = 0;
+            for (int i = 0; i < 200; ++i) {
+                if (table.hasKey(i) != (i % 3 != 0))
+                    ++errors;
+                else
+                    if (i % 3 != 0 && table[i] != i)
+                        ++errors;
+            }
+            int n = 0;
+            for (auto e : table) {
+                if (e.key() == CollidingKey(e.value()))
+                    ++n;
+            }
+            console.write(decimal(errors) + " " + decimal(n) + " " +
+                decimal(table.count()) + "\n");  // Should print "0 133 133"
+        }
+
+        {
+            // After reserve(n), adding n entries doesn't reallocate, so a
+            // copy made beforehand still shares them.
+            HashTable<int, int> table;
+            table.reserve(10000);
+            HashTable<int, int> copy = table;
+            for (int i = 0; i < 10000; ++i)
+                table[i] = i;
+            int n = copy.count();
+            console.write(decimal(n) + "\n");  // Should print "10000"
+        }
+
+        {
+            // Binding a signal skips the inverters on the way to its
+            // destination and inverts the data once for each of them.
+            SignalRecorder source;
+            SignalRecorder recorder;
+            source.bind(&recorder);
+            source.send(0, 5);
+            int a = recorder._v;
+            SignalInverter inverters[3];
+            DirectSignalRecorder direct;
+            inverters[0].connect(&inverters[1]);
+            inverters[1].connect(&inverters[2]);
+            inverters[2].connect(&direct);
+            source.bind(&inverters[1]);
+            source.send(1, 5);
+            int b = direct._v;
+            source.bind(&inverters[0]);
+            source.send(2, 5);
+            int c = direct._v;
+            int n = inverters[0]._count + inverters[1]._count +
+                inverters[2]._count;
+            // An inverter that isn't connected to anything can't be skipped.
+            SignalInverter unconnected;
+            source.bind(&unconnected);
+            source.send(3, 5);
+            console.write(decimal(a) + " " + decimal(b) + " " + decimal(c) +
+                " " + decimal(n) + " " + decimal(unconnected._count) + "\n");
+            // Should print "5 5 -6 0 1"
+        }
+
+        {
+            // NTSCDecoder's FIR backend gives the same output as its FFT
+            // backend, give or take 1 for rounding, over a range of filter
+            // settings.
+            static const float settings[][4] = {
+                // chromaBandwidth, lumaBandwidth, rollOff, lobes
+                {1, 1, 0, 4},
+                {1, 1, 0, 1.5f},
+                {0.5f, 2, 0.5f, 3},
+                {2, 0.5f, 1, 2}};
+            FFTWWisdom<float> wisdom(File("wisdom"));
+            NTSCDecoder fft;
+            NTSCDecoder fir;
+            fft.setBackend(NTSCDecoder::fftBackend);
+            fir.setBackend(NTSCDecoder::firBackend);
+            NTSCDecoder* decoders[2] = {&fft, &fir};
+            Byte burst[4] = {100, 150, 140, 90};
+            Byte ntsc[512];
+            SRGB fftOutput[448];
+            SRGB firOutput[448];
+            int usedFIR = 0;
+            int maximum = 0;
+            int r = 1;
+            for (auto& s : settings) {
+                for (auto d : decoders) {
+                    d->setHue(4);
+                    d->setSaturation(1.45);
+                    d->setContrast(1.4);
+                    d->setBrightness(-0.3);
+                    d->setChromaBandwidth(s[0]);
+                    d->setLumaBandwidth(s[1]);
+                    d->setRollOff(s[2]);
+                    d->setLobes(s[3]);
+                    d->setPadding(32);
+                    d->init();
+                    d->calculateBurst(burst);
+                }
+                if (fir.usingFIR() && !fft.usingFIR())
+                    ++usedFIR;
+                for (int block = 0; block < 16; ++block) {
+                    for (int t = 0; t < 512; ++t) {
+                        r = r*1103515245 + 12345;
+                        ntsc[t] = 48 + ((r >> 16) & 0x7f);
+                    }
+                    fft.decodeNTSC(ntsc, fftOutput);
+                    fir.decodeNTSC(ntsc, firOutput);
+                    for (int x = 0; x < 448; ++x) {
+                        SRGB a = fftOutput[x];
+                        SRGB b = firOutput[x];
+                        maximum = max(maximum, abs(a.x - b.x));
+                        maximum = max(maximum, abs(a.y - b.y));
+                        maximum = max(maximum, abs(a.z - b.z));
+                    }
+                }
+            }
+            console.write(decimal(usedFIR) + " " +
+                decimal(maximum <= 1 ? 1 : 0) + "\n");  // Should print "4 1"
+        }
+
+        {
+            // NTSCCaptureDecoder decodes the lines of a field in parallel,
+            // and gives the same output whichever threads decode which
+            // lines. The input is a synthetic field: lines of 1820 samples
+            // (8 per colour carrier cycle) with a sync pulse, a colour burst
+            // and a picture whose luma and hue change across each line.
+            static const int samplesPerLine = 1820;
+            static const int margin = 2*samplesPerLine;
+            Array<Byte> field(262*samplesPerLine + 2*margin);
+            for (int n = 0; n < field.count(); ++n) {
+                int m = (n - margin + 40) % samplesPerLine;
+                if (m < 0)
+                    m += samplesPerLine;
+                int line = (n - margin)/samplesPerLine;
+                float carrier = static_cast<float>(tau*n/8);
+                float v = 40;
+                if (m >= samplesPerLine - 134)
+                    v = 4;
+                else
+                    if (m >= 20 && m < 110)
+                        v = 40 + 20*sin(carrier);
+                    else
+                        if (m >= 150 && m < 1650) {
+                            float hue = static_cast<float>(tau*m/1500 +
+                                line*0.01);
+                            v = 60 + m/30.0f + 30*sin(carrier + hue);
+                        }
+                field[n] = static_cast<Byte>(v);
+            }
+            Bitmap<SRGB> outputs[3];
+            ThreadPool one(1);
+            ThreadPool four(4);
+            ThreadPool* pools[3] = {&one, &four, 0};
+            for (int i = 0; i < 3; ++i) {
+                NTSCCaptureDecoder<SRGB> decoder;
+                outputs[i] = Bitmap<SRGB>(Vector(640, 240));
+                decoder.setInputBuffer(&field[margin]);
+                decoder.setOutputBuffer(outputs[i]);
+                decoder.setThreadPool(pools[i]);
+                decoder.decode();
+            }
+            int differences[2] = {0, 0};
+            for (int i = 0; i < 2; ++i) {
+                for (int y = 0; y < 240; ++y) {
+                    const SRGB* a = reinterpret_cast<const SRGB*>(
+                        outputs[0].data() + y*outputs[0].stride());
+                    const SRGB* b = reinterpret_cast<const SRGB*>(
+                        outputs[i + 1].data() + y*outputs[i + 1].stride());
+                    for (int x = 0; x < 640; ++x) {
+                        if (a[x] != b[x])
+                            ++differences[i];
+                    }
+                }
+            }
+            console.write(decimal(differences[0]) + " " +
+                decimal(differences[1]) + "\n");  // Should print "0 0"
+        }
+
+        {
+            // The striped PNG encoder's output reads back through libpng
+            // (which checks the zlib stream's Adler-32 trailer) as the
+            // image that was saved, whether the image fits in one stripe or
+            // needs several batches of them. Half of each image is smooth
+            // and half is noise, so that every row filter gets used.
+            Vector sizes[2] = {Vector(64, 48), Vector(600, 1600)};
+            int idats[2];
+            int differences = 0;
+            ThreadPool four(4);
+            UInt32 seed = 1;
+            for (int i = 0; i < 2; ++i) {
+                Vector size = sizes[i];
+                Bitmap<DWORD> image(size);
+                for (int y = 0; y < size.y; ++y) {
+                    DWORD* row = image.row(y);
+                    for (int x = 0; x < size.x; ++x) {
+                        seed = seed*1103515245 + 12345;
+                        if (x < size.x/2)
+                            row[x] = (x << 16) + (y << 8) + ((x + y) & 0xff);
+                        else
+                            row[x] = seed >> 8;
+                        row[x] &= 0xffffff;
+                    }
+                }
+                File file("png_test.png");
+                image.save(PNGFileFormat<DWORD>(false, &four), file);
+                Array<Byte> data;
+                file.readIntoArray(&data);
+                idats[i] = 0;
+                for (int j = 0; j + 4 <= data.count(); ++j) {
+                    if (memcmp(&data[j], "IDAT", 4) == 0)
+                        ++idats[i];
+                }
+                Bitmap<DWORD> loaded;
+                loaded.load(PNGFileFormat<DWORD>(), file);
+                file.remove();
+                if (loaded.size() != size) {
+                    ++differences;
+                    continue;
+                }
+                for (int y = 0; y < size.y; ++y) {
+                    for (int x = 0; x < size.x; ++x) {
+                        if ((loaded.row(y)[x] & 0xffffff) != image.row(y)[x])
+                            ++differences;
+                    }
+                }
+            }
+            console.write(decimal(idats[0]) + " " + decimal(idats[1]) + " " +
+                decimal(differences) + "\n");  // Should print "1 12 0"
+
+            // adler32_combine() of the checksums of two pieces is the
+            // checksum of the whole, for each place the whole can be split,
+            // including at the ends.
+            Array<Byte> bytes(1000);
+            for (int j = 0; j < bytes.count(); ++j) {
+                seed = seed*1103515245 + 12345;
+                bytes[j] = static_cast<Byte>(seed >> 24);
+            }
+            UInt32 whole = adler32(adler32(0, 0, 0), &bytes[0], 1000);
+            int errors = 0;
+            for (int j = 0; j <= 1000; ++j) {
+                UInt32 a = adler32(adler32(0, 0, 0), &bytes[0], j);
+                UInt32 b = adler32(adler32(0, 0, 0), &bytes[0] + j, 1000 - j);
+                if (adler32_combine(a, b, 1000 - j) != whole)
+                    ++errors;
+            }
+            console.write(decimal(errors) + "\n");  // Should print "0"
+        }
+
+        {
+            // Each of the convolution pipes gives the same output as direct
+            // convolution with its kernel, to within the error that its
+            // coefficient table allows, both downsampling by 7/3 and
+            // upsampling by 7/3. For upsampling the kernel is measured in
+            // input samples.
+            ConvolutionKernel kernel = SincFilter()*RectangleWindow(4);
+            int errors[4] = {0, 0, 0, 0};
+            for (int i = 0; i < 2; ++i) {
+                int producerRate = i == 0 ? 3 : 7;
+                int consumerRate = 10 - producerRate;
+                ConvolutionKernel k = kernel;
+                if (i == 1)
+                    k = ScaledFilter(kernel, 7.0/3);
+                SmallConvolutionPipe<float> small(producerRate,
+                    consumerRate, k);
+                errors[0] += convolutionErrors(&small, producerRate,
+                    consumerRate, k, 1000, 1e-5);
+                LCMConvolutionPipe<float> lcm(producerRate, consumerRate, k);
+                errors[1] += convolutionErrors(&lcm, producerRate,
+                    consumerRate, k, 1000, 1e-5);
+                NearestNeighborConvolutionPipe<float> nearest(producerRate,
+                    consumerRate, k);
+                errors[2] += convolutionErrors(&nearest, producerRate,
+                    consumerRate, k, 1000, 1e-2);
+                LinearConvolutionPipe<float> linear(producerRate,
+                    consumerRate, k);
+                errors[3] += convolutionErrors(&linear, producerRate,
+                    consumerRate, k, 1000, 1e-3);
+            }
+            console.write(decimal(errors[0]) + " " + decimal(errors[1]) +
+                " " + decimal(errors[2]) + " " + decimal(errors[3]) +
+                "\n");  // Should print "0 0 0 0"
+
+            // With a finite input, the pipe says how many samples it will
+            // produce, and producing them doesn't need more input than
+            // there is.
+            NoiseSource finite(1000);
+            LCMConvolutionPipe<float> lcm(3, 7, kernel);
+            PulledSink<float> sink;
+            finite.connect(lcm.sink());
+            lcm.source()->connect(&sink);
+            int pulled = 0;
+            do {
+                int n = 64;
+                if (sink.finite())
+                    n = min(n, sink.remaining());
+                sink.reader(n);
+                sink.read(n);
+                pulled += n;
+            } while ((!sink.finite() || sink.remaining() > 0) &&
+                pulled < 1000);
+            console.write(decimal(pulled) + " " + decimal(finite.produced()) +
+                "\n");  // Should print "417 994"
+        }
+
+        {
+            // Samples pass through a ThreadBridge from one thread to another
+            // in order with either wait policy, and close() stops both sides
+            // waiting.
+            console.write(decimal(threadBridgeErrors<SpinWait>()) + " " +
+                decimal(threadBridgeErrors<BlockingWait>()) +
+                "\n");  // Should print "0 0"
+        }
+
+        {
+            // CGAComposite::simulateLine() (which is vectorized where the
+            // CPU allows) gives the same composite samples as simulateCGA()
+            // one sample at a time, for each set of tables and each phase.
+            // The line has runs of active samples and of blanking and sync,
+            // so both of simulateLine()'s paths are used.
+            static const int length = 1000;
+            static const Byte blanking[6] = {0x50, 0x55, 0x58, 0x60, 0x66,
+                0x70};
+            Array<Byte> rgbi(length + 1);
+            UInt32 seed = 1;
+            for (int i = 0; i <= length; ++i) {
+                seed = seed*1103515245 + 12345;
+                if ((i & 0x100) != 0 && (i & 0xc0) == 0)
+                    rgbi[i] = blanking[(seed >> 16) % 6];
+                else
+                    rgbi[i] = (seed >> 16) & 15;
+            }
+            Array<Byte> ntsc(length);
+            CGAComposite composite;
+            int errors = 0;
+            for (int tables = 0; tables < 4; ++tables) {
+                composite.setNewCGA((tables & 2) != 0);
+                composite.setBW((tables & 1) != 0);
+                composite.initChroma();
+                for (int phase = 0; phase < 4; ++phase) {
+                    composite.simulateLine(&rgbi[0], &ntsc[0], length, phase);
+                    for (int i = 0; i < length; ++i) {
+                        if (ntsc[i] != composite.simulateCGA(rgbi[i],
+                            rgbi[i + 1], (phase + 1 + i) & 3))
+                            ++errors;
+                    }
+                }
+            }
+            console.write(decimal(errors) + "\n");  // Should print "0"
+        }
+
+        {
+            // Signal delivery through an inverter: without binding, there's a
+            // virtual call to the inverter and another to the destination.
+            // Bound, the inverter is skipped and the destination's setData()
+            // is called directly.
+            static const int n = 100000000;
+            SignalInverter inverter;
+            DirectSignalRecorder recorder;
+            inverter.connect(&recorder);
+            BoundSignal<int, int>* volatile first = &inverter;
+            Timer timer;
+            for (int i = 0; i < n; ++i)
+                first->setData(i, i);
+            double unbound = timer.elapsed();
+            SignalRecorder source;
+            source.bind(&inverter);
+            timer.reset();
+            for (int i = 0; i < n; ++i)
+                source.send(i, i);
+            double bound = timer.elapsed();
+            console.write("Signal through an inverter: unbound " +
+                format("%.2f", unbound*1e9/n) + "ns, bound " +
+                format("%.2f", bound*1e9/n) + "ns" +
+                (recorder._count == 2*n ? "" : " (wrong count)") + "\n");
+        }
+
+        {
+            // HashTable throughput with 10^7 entries.
+            static const int n = 10000000;
+            HashTable<int, int> table;
+            Timer timer;
+            for (int i = 0; i < n; ++i)
+                table[scramble(i)] = i;
+            double insert = timer.elapsed();
+            timer.reset();
+            int found = 0;
+            for (int i = 0; i < n; ++i)
+                found += table.hasKey(scramble(i)) ? 1 : 0;
+            double hit = timer.elapsed();
+            timer.reset();
+            for (int i = n; i < 2*n; ++i)
+                found += table.hasKey(scramble(i)) ? 1 : 0;
+            double miss = timer.elapsed();
+            console.write("HashTable insert " + format("%.1f", insert*1e9/n) +
+                "ns, lookup hit " + format("%.1f", hit*1e9/n) +
+                "ns, lookup miss " + format("%.1f", miss*1e9/n) + "ns" +
+                (found == n ? "" : " (wrong count)") + "\n");
+        }
+
+        {
+            // Objects freed on a thread other than the one that allocated
+            // them go back to their owner in batches, and the owner reuses
+            // them once its own free list is empty. An unusual size is used
+            // so that the owner starts out with nothing on that free list.
+            static const int n = 1000;
+            static const int size = 208;
+            int reused = 0;
+            std::thread owner([&]()
+            {
+                void* objects[n];
+                for (int i = 0; i < n; ++i)
+                    objects[i] = SmallObjectPool::allocate(size);
+                std::thread freer([&]()
+                {
+                    for (int i = 0; i < n; ++i)
+                        SmallObjectPool::deallocate(objects[i], size);
+                });
+                freer.join();
+                std::sort(objects, objects + n);
+                void* again[n];
+                for (int i = 0; i < n; ++i) {
+                    again[i] = SmallObjectPool::allocate(size);
+                    if (std::binary_search(objects, objects + n, again[i]))
+                        ++reused;
+                }
+                for (int i = 0; i < n; ++i)
+                    SmallObjectPool::deallocate(again[i], size);
+            });
+            owner.join();
+            console.write(decimal(reused) + "\n");  // Should print "1000"
+        }
+
+        {
+            // Small object allocation throughput: 10^7 frees and allocations
+            // of 16 to 256 bytes with 1024 objects alive, compared to
+            // malloc(). The arena just allocates, and is reset every 1024
+            // allocations.
+            static const int n = 10000000;
+            static const int live = 1024;
+            void* objects[live];
+            size_t sizes[live];
+            for (int i = 0; i < live; ++i) {
+                sizes[i] = 16;
+                objects[i] = malloc(16);
+            }
+            Timer timer;
+            for (int i = 0; i < n; ++i) {
+                int j = i & (live - 1);
+                free(objects[j]);
+                sizes[j] = 16 + (scramble(i) & 0xf0);
+                objects[j] = malloc(sizes[j]);
+            }
+            double mallocTime = timer.elapsed();
+            for (int i = 0; i < live; ++i) {
+                free(objects[i]);
+                objects[i] = SmallObjectPool::allocate(sizes[i]);
+            }
+            timer.reset();
+            for (int i = 0; i < n; ++i) {
+                int j = i & (live - 1);
+                SmallObjectPool::deallocate(objects[j], sizes[j]);
+                sizes[j] = 16 + (scramble(i) & 0xf0);
+                objects[j] = SmallObjectPool::allocate(sizes[j]);
+            }
+            double poolTime = timer.elapsed();
+            for (int i = 0; i < live; ++i)
+                SmallObjectPool::deallocate(objects[i], sizes[i]);
+            timer.reset();
+            for (int i = 0; i < n; i += live) {
+                SmallObjectArena arena;
+                for (int j = 0; j < live; ++j) {
+                    objects[j] = SmallObjectPool::allocate(
+                        16 + (scramble(i + j) & 0xf0));
+                }
+            }
+            double arenaTime = timer.elapsed();
+            console.write("Small objects: malloc " +
+                format("%.1f", mallocTime*1e9/n) + "ns, SmallObjectPool " +
+                format("%.1f", poolTime*1e9/n) + "ns, SmallObjectArena " +
+                format("%.1f", arenaTime*1e9/n) + "ns\n");
+        }
+
+        {
+            // The signals of a 5150/5160 for 100 emulated seconds, unbound
+            // and bound. The difference is an upper bound on what binding
+            // saves a whole machine, since everything else it does is the
+            // same either way.
+            static const int seconds = 100;
+            static const int n = 1193182*seconds;
+            PCXTWiring unbound(false);
+            Timer timer;
+            unbound.run(n);
+            double unboundTime = timer.elapsed();
+            PCXTWiring bound(true);
+            timer.reset();
+            bound.run(n);
+            double boundTime = timer.elapsed();
+            console.write("5150 signals per emulated second: unbound " +
+                format("%.2f", unboundTime*1e3/seconds) + "ms, bound " +
+                format("%.2f", boundTime*1e3/seconds) + "ms, " +
+                decimal(bound.count()/seconds) + " changes" +
+                (unbound.count() == bound.count() ? "" : " (wrong count)") +
+                "\n");
         }
     }
 };